@@ -0,0 +1,365 @@
+/*
+ * archive_query.c
+ *
+ * Description:
+ * Retrieves one child's output from an archive written by the parent's -a
+ * option (see output_archive.h). The archive is mapped read-only; the sorted
+ * index at its end is binary searched for the child's first block (at or
+ * before the requested start time), and only that child's blocks are
+ * decompressed and printed. An archive without an index (the parent did not
+ * exit normally) is handled by scanning its block headers first.
+ *
+ * Usage: archive_query [-s since_epoch_seconds] <archive> <child_NN | NN>
+ *        archive_query -l <archive>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "output_archive.h"
+#include "lz_codec.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct archive_view_s {
+    const char *data;
+    size_t size;
+    const archive_index_entry_t *index;
+    size_t entry_count;
+    archive_index_entry_t *scanned;     // Index rebuilt by scanning (NULL if the file has one)
+} archive_view_t;
+
+/*
+ * Purpose:
+ *   qsort() comparison for index entries: child id, time, offset.
+ * Receives:
+ *   a, b: Pointers to archive_index_entry_t.
+ * Returns:
+ *   <0, 0 or >0.
+ */
+static int compare_entries(const void *a, const void *b) {
+    const archive_index_entry_t *x = a;
+    const archive_index_entry_t *y = b;
+    if (x->child_id != y->child_id) return x->child_id < y->child_id ? -1 : 1;
+    if (x->time_ns != y->time_ns) return x->time_ns < y->time_ns ? -1 : 1;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reads and validates the block header at 'offset'. Blocks are not aligned
+ *   in the file, so the header is copied out of the mapping.
+ * Receives:
+ *   view:   The mapped archive.
+ *   offset: File offset of a block header.
+ *   header: Receives the header.
+ * Returns:
+ *   true if a valid block starts at 'offset', false otherwise.
+ */
+static bool block_at(const archive_view_t *view, uint64_t offset, archive_block_header_t *header) {
+    if (offset > view->size || view->size - offset < sizeof(*header)) {
+        return false;
+    }
+    memcpy(header, view->data + offset, sizeof(*header));
+    return header->magic == OUTPUT_ARCHIVE_BLOCK_MAGIC && header->raw_len <= OUTPUT_ARCHIVE_BLOCK_SIZE &&
+           header->stored_len <= view->size - offset - sizeof(*header);
+}
+
+/*
+ * Purpose:
+ *   Rebuilds the index of an archive that has no trailer by walking its blocks.
+ * Receives:
+ *   view: The mapped archive; 'index' and 'entry_count' are filled in.
+ * Returns:
+ *   0 on success, -1 on allocation failure.
+ */
+static int scan_blocks(archive_view_t *view) {
+    size_t capacity = 0;
+    uint64_t offset = sizeof(archive_file_header_t);
+    archive_block_header_t block;
+    while (block_at(view, offset, &block)) {
+        if (view->entry_count == capacity) {
+            capacity = capacity == 0 ? 256 : capacity * 2;
+            archive_index_entry_t *grown = realloc(view->scanned, capacity * sizeof(*grown));
+            if (grown == NULL) {
+                return -1;
+            }
+            view->scanned = grown;
+        }
+        archive_index_entry_t *entry = &view->scanned[view->entry_count++];
+        entry->child_id = block.child_id;
+        entry->reserved = 0;
+        entry->time_ns = block.time_ns;
+        entry->offset = offset;
+        offset += sizeof(block) + block.stored_len;
+    }
+    if (view->entry_count > 0) {
+        qsort(view->scanned, view->entry_count, sizeof(*view->scanned), compare_entries);
+    }
+    view->index = view->scanned;
+    fprintf(stderr, "archive_query: archive has no index, scanned %zu blocks\n", view->entry_count);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Maps an archive and locates its index.
+ * Receives:
+ *   path: Archive path.
+ *   view: Receives the mapping and index.
+ * Returns:
+ *   0 on success, -1 on failure (message printed).
+ */
+static int open_archive(const char *path, archive_view_t *view) {
+    memset(view, 0, sizeof(*view));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "archive_query: cannot open '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(archive_file_header_t)) {
+        fprintf(stderr, "archive_query: '%s' is not an archive\n", path);
+        close(fd);
+        return -1;
+    }
+    view->size = (size_t)st.st_size;
+    void *map = mmap(NULL, view->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "archive_query: cannot map '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    view->data = map;
+
+    archive_file_header_t header;
+    memcpy(&header, view->data, sizeof(header));
+    if (header.magic != OUTPUT_ARCHIVE_MAGIC || header.version != OUTPUT_ARCHIVE_VERSION) {
+        fprintf(stderr, "archive_query: '%s' is not an archive\n", path);
+        munmap(map, view->size);
+        return -1;
+    }
+
+    if (view->size >= sizeof(header) + sizeof(archive_trailer_t)) {
+        archive_trailer_t trailer;
+        memcpy(&trailer, view->data + view->size - sizeof(trailer), sizeof(trailer));
+        uint64_t index_end = view->size - sizeof(trailer);
+        if (trailer.magic == OUTPUT_ARCHIVE_INDEX_MAGIC && trailer.version == OUTPUT_ARCHIVE_VERSION &&
+            trailer.index_offset <= index_end &&
+            trailer.entry_count == (index_end - trailer.index_offset) / sizeof(archive_index_entry_t) &&
+            (index_end - trailer.index_offset) % sizeof(archive_index_entry_t) == 0 &&
+            trailer.index_offset % sizeof(uint64_t) == 0) {
+            view->index = (const archive_index_entry_t *)(view->data + trailer.index_offset);
+            view->entry_count = (size_t)trailer.entry_count;
+            return 0;
+        }
+    }
+    if (scan_blocks(view) != 0) {
+        fprintf(stderr, "archive_query: out of memory while scanning '%s'\n", path);
+        munmap(map, view->size);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Binary search for the first index entry not less than (child_id, time_ns).
+ * Receives:
+ *   view:     The archive.
+ *   child_id: Child to look for.
+ *   time_ns:  Earliest block time.
+ * Returns:
+ *   Index of the first matching entry (entry_count if none).
+ */
+static size_t lower_bound(const archive_view_t *view, uint32_t child_id, uint64_t time_ns) {
+    size_t low = 0;
+    size_t high = view->entry_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const archive_index_entry_t *entry = &view->index[mid];
+        if (entry->child_id < child_id || (entry->child_id == child_id && entry->time_ns < time_ns)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Purpose:
+ *   Decompresses one block and writes it to stdout.
+ * Receives:
+ *   view:   The archive.
+ *   entry:  Index entry of the block.
+ *   buffer: Scratch buffer of OUTPUT_ARCHIVE_BLOCK_SIZE bytes.
+ * Returns:
+ *   0 on success, -1 if the block is corrupt or stdout fails.
+ */
+static int print_block(const archive_view_t *view, const archive_index_entry_t *entry, char *buffer) {
+    archive_block_header_t block;
+    if (!block_at(view, entry->offset, &block)) {
+        fprintf(stderr, "archive_query: corrupt block at offset %llu\n", (unsigned long long)entry->offset);
+        return -1;
+    }
+    const char *stored = view->data + entry->offset + sizeof(block);
+    const char *raw = stored;
+    if ((block.flags & OUTPUT_ARCHIVE_COMPRESSED) != 0) {
+        if (lz_decompress(stored, block.stored_len, buffer, block.raw_len) != 0) {
+            fprintf(stderr, "archive_query: cannot decompress block at offset %llu\n",
+                    (unsigned long long)entry->offset);
+            return -1;
+        }
+        raw = buffer;
+    } else if (block.stored_len != block.raw_len) {
+        fprintf(stderr, "archive_query: corrupt block at offset %llu\n", (unsigned long long)entry->offset);
+        return -1;
+    }
+    if (fwrite(raw, 1, block.raw_len, stdout) != block.raw_len) {
+        perror("archive_query: write failed");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Prints one line per child: id, block count, raw bytes and stored bytes.
+ * Receives:
+ *   view: The archive.
+ * Returns:
+ *   None (void).
+ */
+static void list_children(const archive_view_t *view) {
+    size_t i = 0;
+    while (i < view->entry_count) {
+        uint32_t child_id = view->index[i].child_id;
+        size_t blocks = 0;
+        unsigned long long raw = 0;
+        unsigned long long stored = 0;
+        for (; i < view->entry_count && view->index[i].child_id == child_id; ++i) {
+            archive_block_header_t block;
+            if (block_at(view, view->index[i].offset, &block)) {
+                raw += block.raw_len;
+                stored += block.stored_len;
+            }
+            blocks++;
+        }
+        printf("child_%.2u: %zu blocks, %llu bytes (%llu stored)\n", (unsigned)child_id, blocks, raw, stored);
+    }
+}
+
+/*
+ * Purpose:
+ *   Parses "child_NN" or "NN" into a child id.
+ * Receives:
+ *   text: The argument.
+ *   id:   Receives the id.
+ * Returns:
+ *   0 on success, -1 if the argument is not a child id.
+ */
+static int parse_child_id(const char *text, uint32_t *id) {
+    if (strncmp(text, "child_", 6) == 0) {
+        text += 6;
+    }
+    char *end = NULL;
+    unsigned long value = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || value > UINT32_MAX) {
+        return -1;
+    }
+    *id = (uint32_t)value;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Parses the -s argument, whole seconds since the epoch, into nanoseconds.
+ * Receives:
+ *   text:     The argument.
+ *   since_ns: Receives the time in nanoseconds.
+ * Returns:
+ *   0 on success, -1 if the argument is not a number of seconds that fits.
+ */
+static int parse_since(const char *text, uint64_t *since_ns) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long seconds = strtoull(text, &end, 10);
+    if (end == text || *end != '\0' || text[0] == '-' || errno != 0 || seconds > UINT64_MAX / 1000000000u) {
+        return -1;
+    }
+    *since_ns = (uint64_t)seconds * 1000000000u;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Entry point; see the usage in the file header.
+ * Receives:
+ *   argc, argv: Command-line arguments.
+ * Returns:
+ *   EXIT_SUCCESS, or EXIT_FAILURE on invalid arguments or a corrupt archive.
+ */
+int main(int argc, char *argv[]) {
+    bool list = false;
+    uint64_t since_ns = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "ls:")) != -1) {
+        if (opt == 'l') {
+            list = true;
+        } else if (opt == 's' && parse_since(optarg, &since_ns) != 0) {
+            fprintf(stderr, "archive_query: Invalid start time '%s'.\n", optarg);
+            optind = argc + 1;
+            break;
+        } else if (opt != 's') {
+            optind = argc + 1;
+            break;
+        }
+    }
+    uint32_t child_id = 0;
+    if (optind >= argc || (list && optind != argc - 1) ||
+        (!list && (optind != argc - 2 || parse_child_id(argv[optind + 1], &child_id) != 0))) {
+        fprintf(stderr, "Usage: %s [-s since_epoch_seconds] <archive> <child_NN | NN>\n"
+                        "       %s -l <archive>\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    archive_view_t view;
+    if (open_archive(argv[optind], &view) != 0) {
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+    if (list) {
+        list_children(&view);
+    } else {
+        size_t first = lower_bound(&view, child_id, since_ns);
+        // The block before the first match may still hold output from after 'since'.
+        if (since_ns > 0 && first > 0 && view.index[first - 1].child_id == child_id) {
+            first--;
+        }
+        char *buffer = malloc(OUTPUT_ARCHIVE_BLOCK_SIZE);
+        if (buffer == NULL) {
+            perror("archive_query: malloc failed");
+            status = EXIT_FAILURE;
+        }
+        for (size_t i = first; buffer != NULL && i < view.entry_count && view.index[i].child_id == child_id; ++i) {
+            if (print_block(&view, &view.index[i], buffer) != 0) {
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+        free(buffer);
+    }
+    if (fflush(stdout) != 0) {
+        status = EXIT_FAILURE;
+    }
+    free(view.scanned);
+    munmap((void *)view.data, view.size);
+    return status;
+}
@@ -0,0 +1,36 @@
+/*
+ * barrier_protocol.h
+ *
+ * Description:
+ * Protocol between the parent and children launched behind a barrier ('b').
+ * The parent passes two inherited descriptors in the child's environment as
+ * "CHILD_BARRIER=<gate_fd>,<report_fd>":
+ *
+ *   gate_fd:   An eventfd in semaphore mode (EFD_SEMAPHORE). Each read takes
+ *              one token and blocks while there is none.
+ *   report_fd: The write end of a pipe to the parent.
+ *
+ * First thing in main(), a child writes a BARRIER_PARKED record to
+ * report_fd, then reads gate_fd. Once every child of the batch has parked,
+ * the parent releases them all with one write of the batch size to gate_fd.
+ * Each child then takes its start time, writes a BARRIER_STARTED record and
+ * closes both descriptors before doing its actual work. Records are smaller
+ * than PIPE_BUF, so concurrent writes never interleave.
+ */
+#ifndef BARRIER_PROTOCOL_H
+#define BARRIER_PROTOCOL_H
+
+#include <stdint.h>
+
+#define ENV_VAR_BARRIER_NAME "CHILD_BARRIER"
+
+#define BARRIER_PARKED 1u
+#define BARRIER_STARTED 2u
+
+typedef struct barrier_record_s {
+    uint32_t kind;      /* BARRIER_PARKED or BARRIER_STARTED */
+    int32_t pid;
+    uint64_t ns;        /* CLOCK_MONOTONIC, comparable across processes */
+} barrier_record_t;
+
+#endif /* BARRIER_PROTOCOL_H */
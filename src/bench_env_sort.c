@@ -0,0 +1,289 @@
+/*
+ * bench_env_sort.c
+ *
+ * Description:
+ * Benchmark for the parent's startup environment sort. It generates synthetic
+ * environments of 10k-100k "NAME=VALUE" entries (generated job variables with
+ * long shared prefixes mixed with ordinary short names), sorts each one with the
+ * original qsort()+strcoll() path under LC_COLLATE=C and with env_sort_c_locale(),
+ * checks that both produce byte-identical orderings and prints the best time of
+ * several runs for each. A second table compares the serial radix sort with the
+ * parallel merge sort (one thread per online CPU, at least two) over a range of
+ * sizes, to find where (if anywhere) the parallel sort starts to pay off on a
+ * given machine and check ENV_SORT_PARALLEL_THRESHOLD against it.
+ *
+ * Usage: bench_env_sort [entries ...]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "env_sort.h"
+
+#define BENCH_RUNS 5
+
+static const char *const name_prefixes[] = {
+    "JOB_GENERATED_PARAMETER_", "LC_", "XDG_", "PATH_", "CI_PIPELINE_STEP_", "X", "BUILD_"
+};
+
+static unsigned long long g_rng_state = 0x9E3779B97F4A7C15ull;
+
+/*
+ * Purpose:
+ *   Deterministic xorshift64 pseudo-random generator, so every run sorts the same data.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The next pseudo-random value.
+ */
+static unsigned long long next_random(void) {
+    g_rng_state ^= g_rng_state << 13;
+    g_rng_state ^= g_rng_state >> 7;
+    g_rng_state ^= g_rng_state << 17;
+    return g_rng_state;
+}
+
+/*
+ * Purpose:
+ *   Returns the current CLOCK_MONOTONIC time in seconds.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The time as a double.
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Purpose:
+ *   qsort() comparator identical to the parent's compare_env_vars().
+ * Receives:
+ *   a, b: Pointers to the two char * elements.
+ * Returns:
+ *   The strcoll() result.
+ */
+static int compare_env_vars(const void *a, const void *b) {
+    return strcoll(*(const char **)a, *(const char **)b);
+}
+
+/*
+ * Purpose:
+ *   Generates a synthetic environment of 'count' entries.
+ * Receives:
+ *   count: Number of entries to generate.
+ * Returns:
+ *   A malloc'ed array of malloc'ed strings, or NULL on allocation failure.
+ */
+static char **generate_env(size_t count) {
+    char **env = malloc(count * sizeof(char *));
+    if (env == NULL) {
+        return NULL;
+    }
+    size_t prefix_count = sizeof(name_prefixes) / sizeof(name_prefixes[0]);
+    for (size_t i = 0; i < count; ++i) {
+        char entry[160];
+        const char *prefix = name_prefixes[next_random() % prefix_count];
+        snprintf(entry, sizeof(entry), "%s%llu=value_%llx",
+                 prefix, next_random() % (count * 4), next_random());
+        env[i] = strdup(entry);
+        if (env[i] == NULL) {
+            for (size_t j = 0; j < i; ++j) {
+                free(env[j]);
+            }
+            free(env);
+            return NULL;
+        }
+    }
+    return env;
+}
+
+/*
+ * Purpose:
+ *   Runs both sorts on one environment size and prints the timings.
+ * Receives:
+ *   count: Number of environment entries.
+ * Returns:
+ *   0 if both orderings were identical, 1 otherwise (or on allocation failure).
+ */
+static int bench_size(size_t count) {
+    char **env = generate_env(count);
+    char **by_qsort = malloc(count * sizeof(char *));
+    char **by_radix = malloc(count * sizeof(char *));
+    if (env == NULL || by_qsort == NULL || by_radix == NULL) {
+        fprintf(stderr, "bench_env_sort: allocation failed for %zu entries\n", count);
+        free(by_qsort);
+        free(by_radix);
+        free(env);
+        return 1;
+    }
+
+    double best_qsort = 0.0;
+    double best_radix = 0.0;
+    int status = 0;
+    for (int run = 0; run < BENCH_RUNS; ++run) {
+        memcpy(by_qsort, env, count * sizeof(char *));
+        memcpy(by_radix, env, count * sizeof(char *));
+
+        double start = now_seconds();
+        qsort(by_qsort, count, sizeof(char *), compare_env_vars);
+        double qsort_time = now_seconds() - start;
+
+        start = now_seconds();
+        if (env_sort_c_locale(by_radix, count) != 0) {
+            fprintf(stderr, "bench_env_sort: env_sort_c_locale failed\n");
+            status = 1;
+            break;
+        }
+        double radix_time = now_seconds() - start;
+
+        if (run == 0 || qsort_time < best_qsort) best_qsort = qsort_time;
+        if (run == 0 || radix_time < best_radix) best_radix = radix_time;
+
+        for (size_t i = 0; i < count; ++i) {
+            if (strcmp(by_qsort[i], by_radix[i]) != 0) {
+                fprintf(stderr, "bench_env_sort: ordering mismatch at index %zu\n", i);
+                status = 1;
+                break;
+            }
+        }
+        if (status != 0) {
+            break;
+        }
+    }
+
+    if (status == 0) {
+        printf("%8zu entries: qsort+strcoll %8.3f ms, radix %8.3f ms, speedup %.2fx\n",
+               count, best_qsort * 1e3, best_radix * 1e3,
+               best_radix > 0.0 ? best_qsort / best_radix : 0.0);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(env[i]);
+    }
+    free(env);
+    free(by_qsort);
+    free(by_radix);
+    return status;
+}
+
+/*
+ * Purpose:
+ *   Times the serial radix sort against the parallel merge sort on one size and
+ *   prints which of the two is faster.
+ * Receives:
+ *   count:        Number of environment entries.
+ *   thread_count: Number of threads for the parallel sort.
+ * Returns:
+ *   0 if both orderings were identical, 1 otherwise (or on allocation failure).
+ */
+static int bench_crossover(size_t count, unsigned thread_count) {
+    char **env = generate_env(count);
+    char **by_serial = malloc(count * sizeof(char *));
+    char **by_parallel = malloc(count * sizeof(char *));
+    if (env == NULL || by_serial == NULL || by_parallel == NULL) {
+        fprintf(stderr, "bench_env_sort: allocation failed for %zu entries\n", count);
+        free(by_serial);
+        free(by_parallel);
+        free(env);
+        return 1;
+    }
+
+    double best_serial = 0.0;
+    double best_parallel = 0.0;
+    int status = 0;
+    for (int run = 0; run < BENCH_RUNS && status == 0; ++run) {
+        memcpy(by_serial, env, count * sizeof(char *));
+        memcpy(by_parallel, env, count * sizeof(char *));
+
+        double start = now_seconds();
+        int serial_result = env_sort_c_locale_serial(by_serial, count);
+        double serial_time = now_seconds() - start;
+
+        start = now_seconds();
+        int parallel_result = env_sort_c_locale_parallel(by_parallel, count, thread_count);
+        double parallel_time = now_seconds() - start;
+
+        if (serial_result != 0 || parallel_result != 0) {
+            fprintf(stderr, "bench_env_sort: sort failed for %zu entries\n", count);
+            status = 1;
+            break;
+        }
+        if (run == 0 || serial_time < best_serial) best_serial = serial_time;
+        if (run == 0 || parallel_time < best_parallel) best_parallel = parallel_time;
+
+        for (size_t i = 0; i < count; ++i) {
+            if (strcmp(by_serial[i], by_parallel[i]) != 0) {
+                fprintf(stderr, "bench_env_sort: parallel ordering mismatch at index %zu\n", i);
+                status = 1;
+                break;
+            }
+        }
+    }
+
+    if (status == 0) {
+        printf("%8zu entries: serial %8.3f ms, parallel(%u) %8.3f ms -> %s\n",
+               count, best_serial * 1e3, thread_count, best_parallel * 1e3,
+               best_parallel < best_serial ? "parallel" : "serial");
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(env[i]);
+    }
+    free(env);
+    free(by_serial);
+    free(by_parallel);
+    return status;
+}
+
+/*
+ * Purpose:
+ *   Benchmarks the default sizes, or the sizes given on the command line.
+ * Receives:
+ *   argc, argv: Optional list of environment sizes.
+ * Returns:
+ *   EXIT_SUCCESS if every ordering matched, EXIT_FAILURE otherwise.
+ */
+int main(int argc, char *argv[]) {
+    static const size_t default_sizes[] = { 10000, 25000, 50000, 100000 };
+    static const size_t crossover_sizes[] = { 4096, 16384, 32768, 65536, 131072, 262144, 524288 };
+
+    if (setlocale(LC_COLLATE, "C") == NULL) {
+        fprintf(stderr, "bench_env_sort: failed to set LC_COLLATE to C\n");
+        return EXIT_FAILURE;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned thread_count = cpus > 2 ? (unsigned)cpus : 2;
+
+    int status = 0;
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            long count = strtol(argv[i], NULL, 10);
+            if (count <= 0) {
+                fprintf(stderr, "Usage: %s [entries ...]\n", argv[0]);
+                return EXIT_FAILURE;
+            }
+            status |= bench_size((size_t)count);
+            status |= bench_crossover((size_t)count, thread_count);
+        }
+    } else {
+        printf("qsort+strcoll vs. radix sort:\n");
+        for (size_t i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]); ++i) {
+            status |= bench_size(default_sizes[i]);
+        }
+        printf("Serial vs. parallel sort (%ld online CPUs, threshold %d):\n",
+               cpus, ENV_SORT_PARALLEL_THRESHOLD);
+        for (size_t i = 0; i < sizeof(crossover_sizes) / sizeof(crossover_sizes[0]); ++i) {
+            status |= bench_crossover(crossover_sizes[i], thread_count);
+        }
+    }
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -8,6 +8,17 @@
  * it received via execve (passed in 'envp'). It reads variable names listed
  * in that filter file and prints the corresponding values found within its
  * received environment.
+ *
+ * If the parent passes the path of a shared append log (see shared_log.h),
+ * the report is assembled in memory and appended to that log as a single
+ * record instead of being written to stdout. Errors still go to stderr.
+ *
+ * With CHILD_REPORT_FORMAT=binary the report is encoded as binary TLV fields
+ * (see child_report.h) and emitted with a single write() instead of text lines.
+ *
+ * When launched behind a barrier (see barrier_protocol.h), the child parks
+ * before anything else and starts its work only when the parent releases the
+ * whole batch.
  */
 #define _POSIX_C_SOURCE 200809L
 
@@ -16,14 +27,23 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
-
+#include "barrier_protocol.h"
+#include "child_report.h"
+#include "shared_log.h"
 
 #define ENV_VAR_FILTER_FILE_NAME "CHILD_ENV_FILTER_FILE"
 
 /* --- Function Prototypes --- */
 
 static char *find_env_var_value_in_array(const char *var_name, char **env_array);
+static FILE *open_report(const char *log_path, bool binary, shared_log_t *log, char **report_buf, size_t *report_size);
+static int finish_report(FILE *out, shared_log_t *log, char **report_buf, size_t *report_size);
+static int finish_binary_report(child_report_builder_t *builder, shared_log_t *log,
+                                const struct timespec *start_real, const struct timespec *start_mono);
+static int write_all(int fd, const char *data, size_t length);
+static int wait_for_barrier(const char *barrier);
 
 /*
  * Purpose:
@@ -48,15 +68,45 @@ static char *find_env_var_value_in_array(const char *var_name, char **env_array)
  */
 int main(int argc, char *argv[], char **envp) {
     const char *program_name = (argc > 0 && argv[0] != NULL) ? argv[0] : "child (unknown name)";
+    if (wait_for_barrier(find_env_var_value_in_array(ENV_VAR_BARRIER_NAME, envp)) != 0) {
+        fprintf(stderr, "Child (%s): Error - Failed to wait at the launch barrier.\n", program_name);
+        return EXIT_FAILURE;
+    }
     pid_t pid = getpid();
     pid_t ppid = getppid();
+    struct timespec start_real;
+    struct timespec start_mono;
+    clock_gettime(CLOCK_REALTIME, &start_real);
+    clock_gettime(CLOCK_MONOTONIC, &start_mono);
+
+    const char *report_format = find_env_var_value_in_array(ENV_VAR_REPORT_FORMAT_NAME, envp);
+    child_report_builder_t report_builder;
+    child_report_builder_t *binary = NULL;
+    if (report_format != NULL && strcmp(report_format, "binary") == 0) {
+        if (child_report_begin(&report_builder) != 0) {
+            perror("Child: Failed to allocate binary report");
+            return EXIT_FAILURE;
+        }
+        binary = &report_builder;
+    }
 
-
-    if (printf("Child: Name='%s', PID=%d, PPID=%d\n", program_name, pid, ppid) < 0) {
+    shared_log_t log = {-1, NULL, 0};
+    char *report_buf = NULL;
+    size_t report_size = 0;
+    FILE *out = open_report(find_env_var_value_in_array(ENV_VAR_SHARED_LOG_NAME, envp), binary != NULL,
+                            &log, &report_buf, &report_size);
+
+    if (binary != NULL) {
+        int32_t pid_value = (int32_t)pid;
+        int32_t ppid_value = (int32_t)ppid;
+        child_report_add(binary, CHILD_REPORT_TAG_NAME, 0, program_name, strlen(program_name));
+        child_report_add(binary, CHILD_REPORT_TAG_PID, 0, &pid_value, sizeof(pid_value));
+        child_report_add(binary, CHILD_REPORT_TAG_PPID, 0, &ppid_value, sizeof(ppid_value));
+    } else if (fprintf(out, "Child: Name='%s', PID=%d, PPID=%d\n", program_name, pid, ppid) < 0) {
         perror("Child: Failed to print identity");
         return EXIT_FAILURE;
     }
-    fflush(stdout);
+    fflush(out);
 
 
 
@@ -69,11 +119,13 @@ int main(int argc, char *argv[], char **envp) {
         return EXIT_FAILURE;
     }
 
-    if (printf("Child: Using environment filter file: %s\n", filter_filename) < 0) {
+    if (binary != NULL) {
+        child_report_add(binary, CHILD_REPORT_TAG_FILTER_FILE, 0, filter_filename, strlen(filter_filename));
+    } else if (fprintf(out, "Child: Using environment filter file: %s\n", filter_filename) < 0) {
         perror("Child: Failed to print filter filename");
 
     }
-    fflush(stdout);
+    fflush(out);
 
 
     FILE *file = fopen(filter_filename, "r");
@@ -83,7 +135,9 @@ int main(int argc, char *argv[], char **envp) {
         return EXIT_FAILURE;
     }
 
-    printf("Child: Received Environment Variables (from filter list):\n");
+    if (binary == NULL) {
+        fprintf(out, "Child: Received Environment Variables (from filter list):\n");
+    }
 
     char *line_buf = NULL;
     size_t line_buf_size = 0;
@@ -107,11 +161,13 @@ int main(int argc, char *argv[], char **envp) {
         char *var_value = find_env_var_value_in_array(var_name, envp);
 
 
-        if (printf("  %s=%s\n", var_name, var_value ? var_value : "(Not found in received env)") < 0) {
+        if (binary != NULL) {
+            child_report_add_var(binary, var_name, var_value);
+        } else if (fprintf(out, "  %s=%s\n", var_name, var_value ? var_value : "(Not found in received env)") < 0) {
             perror("Child: Failed to print environment variable");
 
         }
-        fflush(stdout);
+        fflush(out);
     }
 
 
@@ -128,13 +184,101 @@ int main(int argc, char *argv[], char **envp) {
 
     }
 
-    printf("Child: (%s, %d) exiting.\n", program_name, pid);
-    fflush(stdout);
+    if (binary != NULL) {
+        if (finish_binary_report(binary, &log, &start_real, &start_mono) != 0) {
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    fprintf(out, "Child: (%s, %d) exiting.\n", program_name, pid);
+    if (finish_report(out, &log, &report_buf, &report_size) != 0) {
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
 
 
+/*
+ * Purpose:
+ *   Chooses where the report goes. If a shared log path was passed and the log
+ *   can be mapped, the report is collected in a memory stream so it can be
+ *   appended as one record; otherwise it goes to stdout. A binary report is
+ *   built separately, so only the log is opened for it.
+ * Receives:
+ *   log_path:    Value of ENV_VAR_SHARED_LOG_NAME, or NULL if not set.
+ *   binary:      true if the report is built by child_report_add() instead.
+ *   log:         Handle opened here when the shared log is used.
+ *   report_buf:  Receives the memory stream's buffer.
+ *   report_size: Receives the memory stream's size.
+ * Returns:
+ *   The stream to print the report to (never NULL).
+ */
+static FILE *open_report(const char *log_path, bool binary, shared_log_t *log, char **report_buf, size_t *report_size) {
+    if (log_path == NULL || log_path[0] == '\0') {
+        return stdout;
+    }
+    if (shared_log_open(log, log_path, true) != 0) {
+        fprintf(stderr, "Child: Cannot use shared log '%s' (%s), writing to stdout\n", log_path, strerror(errno));
+        return stdout;
+    }
+    if (binary) {
+        return stdout;
+    }
+    FILE *out = open_memstream(report_buf, report_size);
+    if (out == NULL) {
+        perror("Child: Failed to create report buffer, writing to stdout");
+        shared_log_close(log);
+        return stdout;
+    }
+    return out;
+}
+
+
+/*
+ * Purpose:
+ *   Completes the report. A report collected in memory is appended to the
+ *   shared log as a single record; if the log is full, the report is written to
+ *   stdout instead so it is not lost.
+ * Receives:
+ *   out:         Stream returned by open_report().
+ *   log:         Shared log handle (unused when 'out' is stdout).
+ *   report_buf:  Memory stream buffer.
+ *   report_size: Memory stream size.
+ * Returns:
+ *   0 on success, -1 if the report could not be written anywhere.
+ */
+static int finish_report(FILE *out, shared_log_t *log, char **report_buf, size_t *report_size) {
+    if (out == stdout) {
+        if (fflush(stdout) != 0) {
+            perror("Child: Failed to flush output");
+            return -1;
+        }
+        return 0;
+    }
+    if (fclose(out) != 0) {
+        perror("Child: Failed to finish report");
+        shared_log_close(log);
+        free(*report_buf);
+        return -1;
+    }
+
+    int rc = 0;
+    if (shared_log_append(log, (int32_t)getpid(), *report_buf, *report_size) != 0) {
+        fprintf(stderr, "Child: Shared log append failed (%s), writing report to stdout\n", strerror(errno));
+        if (fwrite(*report_buf, 1, *report_size, stdout) != *report_size || fflush(stdout) != 0) {
+            perror("Child: Failed to write report");
+            rc = -1;
+        }
+    }
+    shared_log_close(log);
+    free(*report_buf);
+    *report_buf = NULL;
+    return rc;
+}
+
+
 /*
  * Purpose:
  *   Searches for a specific environment variable within a given environment
@@ -173,3 +317,122 @@ static char *find_env_var_value_in_array(const char *var_name, char **env_array)
 
     return NULL;
 }
+
+
+/*
+ * Purpose:
+ *   Completes a binary report with its timing field and emits it: appended to
+ *   the shared log if one is open, otherwise with a single write() to stdout
+ *   (repeated only after a short write), so a reader never sees it interleaved
+ *   with text lines.
+ * Receives:
+ *   builder:    The report built so far.
+ *   log:        Shared log handle (fd -1 if not used).
+ *   start_real: CLOCK_REALTIME at startup.
+ *   start_mono: CLOCK_MONOTONIC at startup.
+ * Returns:
+ *   0 on success, -1 if the report could not be built or written.
+ */
+static int finish_binary_report(child_report_builder_t *builder, shared_log_t *log,
+                                const struct timespec *start_real, const struct timespec *start_mono) {
+    struct timespec end_mono;
+    clock_gettime(CLOCK_MONOTONIC, &end_mono);
+    uint64_t timing[2];
+    timing[0] = (uint64_t)start_real->tv_sec * 1000000000u + (uint64_t)start_real->tv_nsec;
+    timing[1] = (uint64_t)(end_mono.tv_sec - start_mono->tv_sec) * 1000000000u +
+                (uint64_t)end_mono.tv_nsec - (uint64_t)start_mono->tv_nsec;
+    child_report_add(builder, CHILD_REPORT_TAG_TIMING, 0, timing, sizeof(timing));
+
+    int rc = 0;
+    if (child_report_finish(builder) != 0) {
+        perror("Child: Failed to build binary report");
+        rc = -1;
+    } else if (log->header == NULL || shared_log_append(log, (int32_t)getpid(), builder->data, builder->length) != 0) {
+        if (log->header != NULL) {
+            fprintf(stderr, "Child: Shared log append failed (%s), writing report to stdout\n", strerror(errno));
+        }
+        if (write_all(STDOUT_FILENO, builder->data, builder->length) != 0) {
+            perror("Child: Failed to write binary report");
+            rc = -1;
+        }
+    }
+    shared_log_close(log);
+    child_report_free(builder);
+    return rc;
+}
+
+
+/*
+ * Purpose:
+ *   Writes a whole buffer to a file descriptor, continuing after short writes
+ *   and EINTR.
+ * Receives:
+ *   fd:     Destination descriptor.
+ *   data:   Bytes to write.
+ *   length: Number of bytes.
+ * Returns:
+ *   0 on success, -1 on a write error (errno is set).
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Parks the child at the launch barrier until the parent releases it, then
+ *   reports the start time (see barrier_protocol.h).
+ * Receives:
+ *   barrier: Value of ENV_VAR_BARRIER_NAME ("<gate_fd>,<report_fd>"), or NULL
+ *            when the child was not launched behind a barrier.
+ * Returns:
+ *   0 on success (or without a barrier), -1 on a malformed value or an I/O
+ *   error.
+ */
+static int wait_for_barrier(const char *barrier) {
+    if (barrier == NULL) {
+        return 0;
+    }
+    char *end = NULL;
+    long gate_fd = strtol(barrier, &end, 10);
+    if (end == barrier || *end != ',') {
+        return -1;
+    }
+    const char *report = end + 1;
+    long report_fd = strtol(report, &end, 10);
+    if (end == report || *end != '\0' || gate_fd < 0 || report_fd < 0) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    barrier_record_t record = { BARRIER_PARKED, (int32_t)getpid(),
+                                (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec };
+    if (write_all((int)report_fd, (const char *)&record, sizeof(record)) != 0) {
+        return -1;
+    }
+    uint64_t token;
+    ssize_t got;
+    while ((got = read((int)gate_fd, &token, sizeof(token))) < 0 && errno == EINTR) {
+    }
+    if (got != (ssize_t)sizeof(token)) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record.kind = BARRIER_STARTED;
+    record.ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    int result = write_all((int)report_fd, (const char *)&record, sizeof(record));
+    close((int)gate_fd);
+    close((int)report_fd);
+    return result;
+}
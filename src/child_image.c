@@ -0,0 +1,275 @@
+/*
+ * child_image.c
+ *
+ * Description:
+ * Implements the sealed in-memory child executable (see child_image.h).
+ */
+#define _GNU_SOURCE     // memfd_create(), F_ADD_SEALS, AT_EMPTY_PATH, syscall()
+
+#include "child_image.h"
+#include "parent_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define CHILD_IMAGE_COPY_ATTEMPTS 3
+
+static pthread_mutex_t g_child_image_lock = PTHREAD_MUTEX_INITIALIZER;  // Guards g_child_image
+static child_image_t *g_child_image;            // Published image, or NULL
+static char g_child_image_path[PATH_MAX];       // Written once by child_image_load()
+static atomic_ulong g_child_image_launches;     // Images handed to launches
+static unsigned long g_child_image_refreshes;   // Command-loop thread only
+
+/*
+ * Purpose:
+ *   Tells whether a file's identity differs from the one an image was copied from.
+ * Receives:
+ *   image: The image.
+ *   info:  The file's current status.
+ * Returns:
+ *   true if the device, inode, size or modification time differ.
+ */
+static bool file_changed(const child_image_t *image, const struct stat *info) {
+    return image->dev != info->st_dev || image->ino != info->st_ino || image->size != (size_t)info->st_size ||
+           image->mtime.tv_sec != info->st_mtim.tv_sec || image->mtime.tv_nsec != info->st_mtim.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Copies the file into a new memfd and seals it. A file that is rewritten
+ *   in place while it is copied is copied again.
+ * Receives:
+ *   generation: The new image's generation.
+ * Returns:
+ *   The image (one reference, for the publication), or NULL on failure
+ *   (error logged).
+ */
+static child_image_t *copy_image(unsigned generation) {
+    child_image_t *image = calloc(1, sizeof(*image));
+    if (image == NULL) {
+        plog_perror("Parent: Failed to allocate child image");
+        return NULL;
+    }
+    image->fd = -1;
+    for (int attempt = 0; attempt < CHILD_IMAGE_COPY_ATTEMPTS; ++attempt) {
+        int file_fd = open(g_child_image_path, O_RDONLY | O_CLOEXEC);
+        struct stat before;
+        if (file_fd < 0 || fstat(file_fd, &before) != 0) {
+            plog_perror("Parent: Failed to open child executable for the in-memory image");
+            if (file_fd >= 0) close(file_fd);
+            break;
+        }
+        char magic[2] = { 0, 0 };
+        if (!S_ISREG(before.st_mode) || pread(file_fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) ||
+            (magic[0] == '#' && magic[1] == '!')) {
+            plog_err("Parent: '%s' is not an executable binary; scripts cannot run from an in-memory image.\n",
+                     g_child_image_path);
+            close(file_fd);
+            break;
+        }
+
+        int memfd = memfd_create("child_image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memfd < 0) {
+            plog_perror("Parent: memfd_create() failed");
+            close(file_fd);
+            break;
+        }
+        off_t offset = 0;
+        while (offset < before.st_size) {
+            ssize_t copied = sendfile(memfd, file_fd, &offset, (size_t)(before.st_size - offset));
+            if (copied <= 0) {
+                if (copied < 0 && errno == EINTR) continue;
+                break;
+            }
+        }
+        struct stat after;
+        bool stable = offset == before.st_size && fstat(file_fd, &after) == 0 && after.st_size == before.st_size &&
+                      after.st_mtim.tv_sec == before.st_mtim.tv_sec && after.st_mtim.tv_nsec == before.st_mtim.tv_nsec;
+        close(file_fd);
+        if (!stable) {
+            close(memfd);
+            continue;   // Rewritten while copied
+        }
+        if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+            plog_perror("Parent: Failed to seal child image");
+            close(memfd);
+            break;
+        }
+        image->fd = memfd;
+        image->size = (size_t)before.st_size;
+        image->dev = before.st_dev;
+        image->ino = before.st_ino;
+        image->mtime = before.st_mtim;
+        image->generation = generation;
+        atomic_init(&image->refs, 1);
+        return image;
+    }
+    if (image->fd < 0) {
+        plog_err("Parent: Failed to copy '%s' into memory.\n", g_child_image_path);
+    }
+    free(image);
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Copies the child executable into the first in-memory image.
+ * Receives:
+ *   exec_path: The child executable.
+ * Returns:
+ *   0 on success, -1 on failure (error logged; launches use the path).
+ */
+int child_image_load(const char *exec_path) {
+    if (strlen(exec_path) >= sizeof(g_child_image_path)) {
+        plog_err("Parent: Child executable path too long for the in-memory image.\n");
+        return -1;
+    }
+    strcpy(g_child_image_path, exec_path);
+    child_image_t *image = copy_image(1);
+    if (image == NULL) {
+        g_child_image_path[0] = '\0';
+        return -1;
+    }
+    pthread_mutex_lock(&g_child_image_lock);
+    g_child_image = image;
+    pthread_mutex_unlock(&g_child_image_lock);
+    plog_out("Parent: Loaded '%s' into a sealed in-memory image (%zu bytes).\n", exec_path, image->size);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reloads the image if the file changed since it was copied ('i').
+ *   Launches already holding the old image keep it; the next ones get the
+ *   new one. Command-loop thread only.
+ * Receives:
+ *   None.
+ * Returns:
+ *   1 if a new image was published, 0 if the file is unchanged, -1 on
+ *   failure (error logged; the current image stays).
+ */
+int child_image_refresh(void) {
+    child_image_t *current = g_child_image;     // Only this thread replaces it
+    if (current == NULL) {
+        plog_out("Parent: No in-memory child image (start with -I).\n");
+        return -1;
+    }
+    struct stat info;
+    if (stat(g_child_image_path, &info) != 0) {
+        plog_perror("Parent: Failed to check child executable");
+        return -1;
+    }
+    if (!file_changed(current, &info)) {
+        plog_out("Parent: Child image generation %u is up to date.\n", current->generation);
+        return 0;
+    }
+    child_image_t *image = copy_image(current->generation + 1);
+    if (image == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_child_image_lock);
+    g_child_image = image;
+    pthread_mutex_unlock(&g_child_image_lock);
+    child_image_release(current);
+    g_child_image_refreshes++;
+    plog_out("Parent: Child image refreshed to generation %u (%zu bytes).\n", image->generation, image->size);
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Takes a reference to the current image for one launch. Any thread.
+ * Receives:
+ *   exec_path: The launch's resolved executable.
+ * Returns:
+ *   The image, or NULL if there is none or it was copied from another path
+ *   (the launch then executes the path).
+ */
+child_image_t *child_image_acquire(const char *exec_path) {
+    if (g_child_image_path[0] == '\0' || strcmp(exec_path, g_child_image_path) != 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&g_child_image_lock);
+    child_image_t *image = g_child_image;
+    if (image != NULL) {
+        atomic_fetch_add_explicit(&image->refs, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&g_child_image_lock);
+    if (image != NULL) {
+        atomic_fetch_add_explicit(&g_child_image_launches, 1, memory_order_relaxed);
+    }
+    return image;
+}
+
+/*
+ * Purpose:
+ *   Drops a reference; the last one closes the memfd.
+ * Receives:
+ *   image: The image, or NULL.
+ * Returns:
+ *   None (void).
+ */
+void child_image_release(child_image_t *image) {
+    if (image != NULL && atomic_fetch_sub_explicit(&image->refs, 1, memory_order_acq_rel) == 1) {
+        close(image->fd);
+        free(image);
+    }
+}
+
+/*
+ * Purpose:
+ *   Replaces the calling (forked) process with the image. Async-signal-safe.
+ * Receives:
+ *   image: The image.
+ *   argv:  Arguments.
+ *   envp:  Environment.
+ * Returns:
+ *   -1 with errno set (only if execveat() fails).
+ */
+int child_image_exec(const child_image_t *image, char *const argv[], char *const envp[]) {
+    return (int)syscall(SYS_execveat, image->fd, "", argv, envp, AT_EMPTY_PATH);
+}
+
+/*
+ * Purpose:
+ *   Prints the current image and how often images were used and refreshed.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Prints nothing without an image.
+ */
+void child_image_print_stats(void) {
+    child_image_t *image = g_child_image;   // Command-loop thread, which alone replaces it
+    if (image == NULL) {
+        return;
+    }
+    plog_out("Parent: Child image: generation %u, %zu bytes from '%s'; %lu launch(es) from memory, "
+             "%lu refresh(es).\n", image->generation, image->size, g_child_image_path,
+             atomic_load(&g_child_image_launches), g_child_image_refreshes);
+}
+
+/*
+ * Purpose:
+ *   Drops the published image. Launcher threads must have stopped.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void child_image_shutdown(void) {
+    pthread_mutex_lock(&g_child_image_lock);
+    child_image_t *image = g_child_image;
+    g_child_image = NULL;
+    pthread_mutex_unlock(&g_child_image_lock);
+    child_image_release(image);
+}
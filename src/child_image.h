@@ -0,0 +1,48 @@
+/*
+ * child_image.h
+ *
+ * Description:
+ * Optional in-memory child executable (-I). At startup the child executable
+ * is copied into a memfd that is then sealed against any change, and
+ * children are started from it with execveat(fd, "", AT_EMPTY_PATH): a
+ * launch neither looks up the path nor reads the file, so a build that
+ * replaces the file during a deploy cannot disturb it. The 'i' command
+ * checks the file and, if it changed (device, inode, size or modification
+ * time), loads the new build and publishes it in one pointer swap.
+ *
+ * Images are reference counted like environment versions (env_rcu.h): a
+ * launch holds the image it started with until fork() has returned, so a
+ * refresh never closes a memfd that a launch is about to execute. Only
+ * launches whose resolved executable path is the image's path use it.
+ *
+ * The memfd is close-on-exec, which the kernel allows for ELF executables
+ * only; a script cannot be executed this way and is refused.
+ */
+#ifndef CHILD_IMAGE_H
+#define CHILD_IMAGE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef struct child_image_s {
+    int fd;                     /* Sealed memfd holding the executable */
+    atomic_int refs;            /* Publication + launches in progress */
+    unsigned generation;        /* 1 for the first image, +1 per refresh */
+    size_t size;
+    dev_t dev;                  /* Identity of the file it was copied from */
+    ino_t ino;
+    struct timespec mtime;
+} child_image_t;
+
+int child_image_load(const char *exec_path);
+int child_image_refresh(void);
+child_image_t *child_image_acquire(const char *exec_path);
+void child_image_release(child_image_t *image);
+int child_image_exec(const child_image_t *image, char *const argv[], char *const envp[]);
+void child_image_print_stats(void);
+void child_image_shutdown(void);
+
+#endif /* CHILD_IMAGE_H */
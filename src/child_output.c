@@ -0,0 +1,1802 @@
+/*
+ * child_output.c
+ *
+ * Description:
+ * Implements child output capture (see child_output.h). The launching thread
+ * creates one pipe per child before fork() and registers the read end with an
+ * output reactor afterwards. There are one or more reactor shards; each has its
+ * own thread, epoll instance, wake-up eventfd, copy buffers and stream list, and
+ * a child belongs to shard (child id % shard count) for its whole life. Next to
+ * the child's pipe the shard also watches a pidfd of the child and reaps it with
+ * waitid() when it exits, so finished children do not stay zombies. Shards share
+ * nothing on the forwarding path: every shard counts into its own cache-line
+ * aligned statistics slot, and output_print_stats() adds the slots up.
+ *
+ * Forwarding prefers splice(), which moves pages from the pipe to the destination
+ * inside the kernel. Destinations that splice() cannot write to (terminals on
+ * recent kernels, O_APPEND files) make it fail with EINVAL; the reactor then
+ * switches to read()/write() for the rest of the run. splice() does not block,
+ * so when it cannot go on the reactor checks whether the destination is full
+ * (a slow reader such as a pager) and then waits for it, as write() would.
+ * When the destination is a terminal and tagging is enabled, data is always
+ * copied so every line can be prefixed with the child's name.
+ *
+ * With report decoding enabled, children send binary reports (child_report.h).
+ * Each stream then buffers its bytes until a whole report has arrived, decodes
+ * it and forwards the rendered text; anything else on the stream (e.g. error
+ * messages on stderr) is forwarded unchanged.
+ *
+ * When an output archive is open (output_archive.h), everything forwarded is
+ * also added to the child's archive block. The data then has to pass through
+ * user space anyway, so splice() is not used.
+ *
+ * In ordered mode (reorder_window > 0) each child's output is emitted as one
+ * block in launch (registration) order. Only the oldest unfinished child, the
+ * head, is forwarded as it arrives (including with splice()); later children
+ * are held in memory until every earlier child has finished. If the held bytes
+ * would exceed the window, the oldest held output is emitted early behind an
+ * out-of-order marker, so memory stays bounded.
+ *
+ * Ordered mode and the output archive need one global order of all output, so
+ * they run with a single shard.
+ *
+ * In subreaper mode (subreaper.h) the single shard also waits on the SIGCHLD
+ * signalfd and reaps exited descendants of the children; children it reaps
+ * itself are reaped with the raw waitid() system call to get their usage.
+ *
+ * A child registered with a result callback gets a record shared by its stream
+ * and its exit watch: the stream appends what it forwards (so it is not
+ * spliced), the watch adds the exit status, and whichever of the two finishes
+ * last hands the record to the callback.
+ *
+ * Reactor threads report their errors through the parent log and write them
+ * out right away (plog_write_pending()), so the messages are not held back
+ * until the command loop flushes the log.
+ */
+#define _GNU_SOURCE
+
+#include "child_output.h"
+#include "child_report.h"
+#include "launch_journal.h"
+#include "output_archive.h"
+#include "parent_log.h"
+#include "parent_memory.h"
+#include "subreaper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OUTPUT_CHUNK_SIZE 65536
+#define OUTPUT_TAGGED_SIZE (2 * OUTPUT_CHUNK_SIZE)
+#define OUTPUT_FORWARD_BUDGET (16 * OUTPUT_CHUNK_SIZE)
+#define OUTPUT_MAX_EVENTS 64
+#define OUTPUT_SHUTDOWN_TIMEOUT_MS 2000
+#define OUTPUT_PREFIX_SIZE 40
+#define OUTPUT_MARKER_SIZE 128
+
+#ifndef P_PIDFD
+#define P_PIDFD 3   /* waitid() id type for pidfds (Linux 5.4), missing from older headers */
+#endif
+
+typedef enum output_source_kind_e {
+    OUTPUT_SOURCE_STREAM,                   // Child output pipe
+    OUTPUT_SOURCE_EXIT,                     // Child pidfd
+    OUTPUT_SOURCE_SIGNAL                    // SIGCHLD signalfd (subreaper mode)
+} output_source_kind_t;
+
+struct output_stream_s;
+
+/* Output and exit status of one child, for its result callback. */
+typedef struct output_record_s {
+    atomic_int users;                       // Stream and exit watch still attached
+    output_result_fn on_result;
+    void *context;
+    char *data;
+    size_t used;
+    size_t capacity;
+    bool overflow;                          // Output exceeded OUTPUT_RESULT_MAX_SIZE
+    bool exited;
+    int exit_code;
+    int exit_status;
+} output_record_t;
+
+/* Counters of one shard; written only by the shard's thread. */
+typedef struct output_shard_stats_s {
+    atomic_ulong streams_finished;
+    atomic_ulong bytes_forwarded;
+    atomic_ulong children_reaped;
+    atomic_ulong abnormal_exits;
+} output_shard_stats_t;
+
+typedef struct output_shard_s {
+    _Alignas(64) output_shard_stats_t stats;
+    _Alignas(64) int index;
+    int epoll_fd;
+    int wake_fd;
+    pthread_t thread;
+    bool thread_started;
+    char *buffer;                           // Copy buffer, shard thread only
+    char *tagged;                           // Tagged output buffer, shard thread only
+    size_t tagged_used;
+    pthread_mutex_t lock;                   // Guards the two lists and next_seq
+    struct output_stream_s *streams;        // Registered streams
+    struct output_exit_watch_s *exits;      // Children not reaped yet
+    uint64_t next_seq;                      // Next registration number
+    uint64_t head_seq;                      // Stream currently forwarded directly (ordered mode)
+    size_t held_total;                      // Bytes held across all streams (ordered mode)
+} output_shard_t;
+
+/* A child whose exit the shard is waiting for. */
+typedef struct output_exit_watch_s {
+    output_source_kind_t kind;              // OUTPUT_SOURCE_EXIT
+    int pidfd;
+    int child_id;
+    pid_t pid;
+    char name[OUTPUT_NAME_SIZE];
+    output_record_t *record;                // Shared with the child's stream, or NULL
+    struct output_exit_watch_s *prev;
+    struct output_exit_watch_s *next;
+} output_exit_watch_t;
+
+typedef struct output_stream_s {
+    output_source_kind_t kind;              // OUTPUT_SOURCE_STREAM
+    output_shard_t *shard;                  // Shard servicing the stream
+    int fd;                                 // Read end of the child's pipe
+    int child_id;
+    pid_t pid;
+    bool at_line_start;                     // Next byte starts a new line (tagging)
+    size_t prefix_len;
+    char prefix[OUTPUT_PREFIX_SIZE];        // "[child_NN] "
+    char *pending;                          // Undecoded bytes (report decoding only)
+    size_t pending_used;
+    size_t pending_capacity;
+    archive_stream_t archive;               // Block being filled for the output archive
+    uint64_t seq;                           // Registration order (ordered mode)
+    bool closed;                            // Pipe closed, held output not yet emitted (ordered mode)
+    char *held;                             // Output waiting for earlier children (ordered mode)
+    size_t held_used;
+    size_t held_capacity;
+    char name[OUTPUT_NAME_SIZE];            // "child_NN"
+    output_record_t *record;                // Shared with the child's exit watch, or NULL
+    struct output_stream_s *prev;
+    struct output_stream_s *next;
+} output_stream_t;
+
+static output_config_t g_output_config;
+static bool g_output_running;
+static bool g_output_tagging;
+static atomic_bool g_output_splice_ok;
+static atomic_bool g_output_stopping;
+static atomic_bool g_output_detaching;      // Hot restart: stop without draining
+static output_shard_t *g_output_shards;
+static int g_output_shard_count;
+static output_source_kind_t g_output_signal_source = OUTPUT_SOURCE_SIGNAL;
+
+/*
+ * Purpose:
+ *   Writes a whole byte range to a file descriptor, retrying after short writes
+ *   and EINTR.
+ * Receives:
+ *   fd, data, length: Destination, bytes and their count.
+ * Returns:
+ *   0 on success, -1 on a write error (errno is set).
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reports a failed system call from the reactor thread.
+ * Receives:
+ *   what: Description of the failed operation.
+ * Returns:
+ *   None (void). errno is preserved.
+ */
+static void report_reactor_error(const char *what) {
+    int saved_errno = errno;
+    char message[128];
+    snprintf(message, sizeof(message), "Parent: Output reactor: %s", what);
+    errno = saved_errno;
+    plog_perror(message);       // strerror() is not safe with several reactor threads
+    plog_write_pending();
+    errno = saved_errno;
+}
+
+/*
+ * Purpose:
+ *   Appends bytes to a shard's tagged output buffer, writing the buffer to the
+ *   destination whenever it would overflow.
+ * Receives:
+ *   shard:        The shard.
+ *   data, length: Bytes to append.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int tagged_append(output_shard_t *shard, const char *data, size_t length) {
+    if (shard->tagged_used + length > OUTPUT_TAGGED_SIZE) {
+        if (write_all(g_output_config.dest_fd, shard->tagged, shard->tagged_used) != 0) {
+            return -1;
+        }
+        shard->tagged_used = 0;
+        if (length > OUTPUT_TAGGED_SIZE) {
+            return write_all(g_output_config.dest_fd, data, length);
+        }
+    }
+    memcpy(shard->tagged + shard->tagged_used, data, length);
+    shard->tagged_used += length;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Writes a chunk of a child's output to the destination, inserting the
+ *   stream's "[name] " prefix at the start of every line.
+ * Receives:
+ *   stream: The stream the data was read from (tracks line starts across reads).
+ *   data, length: The bytes read.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int write_tagged(output_stream_t *stream, const char *data, size_t length) {
+    output_shard_t *shard = stream->shard;
+    shard->tagged_used = 0;
+    while (length > 0) {
+        if (stream->at_line_start) {
+            if (tagged_append(shard, stream->prefix, stream->prefix_len) != 0) {
+                return -1;
+            }
+            stream->at_line_start = false;
+        }
+        const char *newline = memchr(data, '\n', length);
+        size_t piece = newline != NULL ? (size_t)(newline - data) + 1 : length;
+        if (tagged_append(shard, data, piece) != 0) {
+            return -1;
+        }
+        if (newline != NULL) {
+            stream->at_line_start = true;
+        }
+        data += piece;
+        length -= piece;
+    }
+    return write_all(g_output_config.dest_fd, shard->tagged, shard->tagged_used);
+}
+
+/*
+ * Purpose:
+ *   Writes a child's output to the destination, tagged if tagging is active.
+ * Receives:
+ *   stream: Source stream.
+ *   data, length: The bytes.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int emit_output(output_stream_t *stream, const char *data, size_t length) {
+    atomic_fetch_add_explicit(&stream->shard->stats.bytes_forwarded, length, memory_order_relaxed);
+    return g_output_tagging ? write_tagged(stream, data, length)
+                            : write_all(g_output_config.dest_fd, data, length);
+}
+
+/*
+ * Purpose:
+ *   Adds forwarded bytes to a child's record; once the output exceeds
+ *   OUTPUT_RESULT_MAX_SIZE the record only remembers that it overflowed.
+ * Receives:
+ *   record: The record (NULL is ignored).
+ *   data, length: The bytes.
+ * Returns:
+ *   None (void).
+ */
+static void record_append(output_record_t *record, const char *data, size_t length) {
+    if (record == NULL || record->overflow) {
+        return;
+    }
+    if (record->used + length > OUTPUT_RESULT_MAX_SIZE) {
+        record->overflow = true;
+        pmem_free(PMEM_BUFFER, record->data, record->capacity);
+        record->data = NULL;
+        return;
+    }
+    if (record->used + length > record->capacity) {
+        size_t capacity = record->capacity == 0 ? 4096 : record->capacity;
+        while (capacity < record->used + length) {
+            capacity *= 2;
+        }
+        char *data_grown = pmem_realloc(PMEM_BUFFER, record->data, record->capacity, capacity);
+        if (data_grown == NULL) {
+            record->overflow = true;
+            pmem_free(PMEM_BUFFER, record->data, record->capacity);
+            record->data = NULL;
+            return;
+        }
+        record->data = data_grown;
+        record->capacity = capacity;
+    }
+    memcpy(record->data + record->used, data, length);
+    record->used += length;
+}
+
+/*
+ * Purpose:
+ *   Detaches the stream or the exit watch from a record. The last one to
+ *   detach passes the record to its callback and frees it.
+ * Receives:
+ *   record: The record (NULL is ignored).
+ * Returns:
+ *   None (void).
+ */
+static void record_release(output_record_t *record) {
+    if (record == NULL || atomic_fetch_sub(&record->users, 1) != 1) {
+        return;
+    }
+    record->on_result(record->context, record->data, record->used, !record->overflow && record->exited,
+                      record->exit_code, record->exit_status);
+    pmem_free(PMEM_BUFFER, record->data, record->capacity);
+    free(record);
+}
+
+/*
+ * Purpose:
+ *   Finds a registered stream of a shard by registration number.
+ * Receives:
+ *   shard: The shard.
+ *   seq:   The registration number.
+ * Returns:
+ *   The stream, or NULL if it is not (or no longer) registered.
+ */
+static output_stream_t *find_stream(output_shard_t *shard, uint64_t seq) {
+    pthread_mutex_lock(&shard->lock);
+    output_stream_t *stream = shard->streams;
+    while (stream != NULL && stream->seq != seq) {
+        stream = stream->next;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return stream;
+}
+
+/*
+ * Purpose:
+ *   Finds the oldest stream of a shard that holds output.
+ * Receives:
+ *   shard: The shard.
+ * Returns:
+ *   The stream with the lowest registration number and held bytes, or NULL.
+ */
+static output_stream_t *oldest_holder(output_shard_t *shard) {
+    output_stream_t *oldest = NULL;
+    pthread_mutex_lock(&shard->lock);
+    for (output_stream_t *stream = shard->streams; stream != NULL; stream = stream->next) {
+        if (stream->held_used > 0 && (oldest == NULL || stream->seq < oldest->seq)) {
+            oldest = stream;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return oldest;
+}
+
+/*
+ * Purpose:
+ *   Writes the marker that announces output emitted ahead of earlier children.
+ * Receives:
+ *   stream: The stream whose output follows.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int write_reorder_marker(const output_stream_t *stream) {
+    char marker[OUTPUT_MARKER_SIZE];
+    int marker_len = snprintf(marker, sizeof(marker),
+                              "--- reorder window full: %s output out of launch order ---\n", stream->name);
+    if (marker_len < 0) {
+        return -1;
+    }
+    if ((size_t)marker_len >= sizeof(marker)) {
+        marker_len = (int)sizeof(marker) - 1;
+    }
+    return write_all(g_output_config.dest_fd, marker, (size_t)marker_len);
+}
+
+/*
+ * Purpose:
+ *   Emits and releases everything a stream holds.
+ * Receives:
+ *   stream:       The stream.
+ *   out_of_order: true if earlier children have not finished yet (a marker is
+ *                 written first).
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int release_held(output_stream_t *stream, bool out_of_order) {
+    if (stream->held_used == 0) {
+        return 0;
+    }
+    int result = 0;
+    if (out_of_order) {
+        result = write_reorder_marker(stream);
+    }
+    if (result == 0) {
+        result = emit_output(stream, stream->held, stream->held_used);
+    }
+    stream->shard->held_total -= stream->held_used;
+    pmem_free(PMEM_BUFFER, stream->held, stream->held_capacity);
+    stream->held = NULL;
+    stream->held_used = 0;
+    stream->held_capacity = 0;
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Holds output of a stream that is not the head yet. When the reorder window
+ *   would overflow, the oldest held output is emitted early (behind a marker);
+ *   data larger than the whole window is emitted at once.
+ * Receives:
+ *   stream: Source stream.
+ *   data, length: The bytes.
+ * Returns:
+ *   0 on success, -1 on a write error. Allocation failures also emit the data
+ *   out of order rather than losing it.
+ */
+static int hold_output(output_stream_t *stream, const char *data, size_t length) {
+    output_shard_t *shard = stream->shard;
+    size_t window = g_output_config.reorder_window;
+    while (shard->held_total + length > window) {
+        output_stream_t *oldest = oldest_holder(shard);
+        if (oldest == NULL) {
+            break;
+        }
+        if (release_held(oldest, true) != 0) {
+            return -1;
+        }
+    }
+    if (shard->held_total + length > window) {
+        return write_reorder_marker(stream) == 0 ? emit_output(stream, data, length) : -1;
+    }
+
+    if (stream->held_capacity - stream->held_used < length) {
+        size_t new_capacity = stream->held_capacity == 0 ? OUTPUT_CHUNK_SIZE : stream->held_capacity;
+        while (new_capacity - stream->held_used < length) {
+            new_capacity *= 2;
+        }
+        char *new_held = pmem_realloc(PMEM_BUFFER, stream->held, stream->held_capacity, new_capacity);
+        if (new_held == NULL) {
+            report_reactor_error("holding child output failed");
+            if (release_held(stream, true) != 0) {
+                return -1;
+            }
+            return write_reorder_marker(stream) == 0 ? emit_output(stream, data, length) : -1;
+        }
+        stream->held = new_held;
+        stream->held_capacity = new_capacity;
+    }
+    memcpy(stream->held + stream->held_used, data, length);
+    stream->held_used += length;
+    shard->held_total += length;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Handles bytes that are not part of a report: adds them to the child's
+ *   record and archive block, then emits them, or holds them in ordered mode while
+ *   earlier children are still running.
+ * Receives:
+ *   stream: Source stream.
+ *   data, length: The bytes.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int forward_plain(output_stream_t *stream, const char *data, size_t length) {
+    record_append(stream->record, data, length);
+    if (archive_append(&stream->archive, data, length) != 0) {
+        report_reactor_error("archiving child output failed");
+    }
+    if (g_output_config.reorder_window > 0 && stream->seq != stream->shard->head_seq) {
+        return hold_output(stream, data, length);
+    }
+    return emit_output(stream, data, length);
+}
+
+/*
+ * Purpose:
+ *   Decodes one complete binary report and forwards its rendered text. The
+ *   report is rendered into memory first so it reaches the destination in one
+ *   piece.
+ * Receives:
+ *   stream: Source stream.
+ *   data, length: The encoded report.
+ * Returns:
+ *   0 on success (a malformed report is reported and dropped), -1 on a write
+ *   error.
+ */
+static int forward_report(output_stream_t *stream, const char *data, size_t length) {
+    child_report_t report;
+    if (child_report_decode(data, length, &report) != 0) {
+        plog_err("Parent: Output reactor: malformed report from PID %d dropped\n", (int)stream->pid);
+        plog_write_pending();
+        return 0;
+    }
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = open_memstream(&text, &text_len);
+    if (out == NULL) {
+        report_reactor_error("open_memstream() failed");
+        return 0;
+    }
+    int rendered = child_report_render(out, &report);
+    if (fclose(out) != 0 || rendered != 0) {
+        report_reactor_error("rendering a child report failed");
+        free(text);
+        return 0;
+    }
+    int result = forward_plain(stream, text, text_len);
+    free(text);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Processes the bytes buffered for a stream in report decoding mode: whole
+ *   reports are decoded and forwarded, bytes outside reports are forwarded as
+ *   they are, and an incomplete report stays buffered until more data arrives.
+ * Receives:
+ *   stream: The stream.
+ *   eof:    true if the child closed the pipe; whatever is left is forwarded.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int process_pending(output_stream_t *stream, bool eof) {
+    static const uint32_t magic = CHILD_REPORT_MAGIC;
+    size_t pos = 0;
+
+    while (pos < stream->pending_used) {
+        const char *data = stream->pending + pos;
+        size_t available = stream->pending_used - pos;
+        long frame = child_report_frame_length(data, available);
+        if (frame > 0 && (size_t)frame <= available) {
+            if (forward_report(stream, data, (size_t)frame) != 0) {
+                return -1;
+            }
+            pos += (size_t)frame;
+            continue;
+        }
+        if (frame >= 0 && !eof) {
+            break;    // Start of a report; wait for the rest.
+        }
+        // Plain bytes: forward up to the next possible start of a report.
+        const char *next = NULL;
+        for (size_t i = 1; i < available && next == NULL; ++i) {
+            if (memcmp(data + i, &magic, available - i < 4 ? available - i : 4) == 0) {
+                next = data + i;
+            }
+        }
+        size_t plain = next != NULL ? (size_t)(next - data) : available;
+        if (eof && frame >= 0) {
+            plain = available;    // Truncated report at end of file.
+        }
+        if (forward_plain(stream, data, plain) != 0) {
+            return -1;
+        }
+        pos += plain;
+    }
+
+    memmove(stream->pending, stream->pending + pos, stream->pending_used - pos);
+    stream->pending_used -= pos;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reads what is currently readable from a stream in report decoding mode
+ *   into its pending buffer and processes it.
+ * Receives:
+ *   stream: The stream to service.
+ * Returns:
+ *   0 if the stream stays open, 1 on end of file or an unrecoverable error.
+ */
+static int forward_stream_decoded(output_stream_t *stream) {
+    size_t moved = 0;
+    int status = 0;
+
+    while (moved < OUTPUT_FORWARD_BUDGET) {
+        if (stream->pending_capacity - stream->pending_used < OUTPUT_CHUNK_SIZE) {
+            if (stream->pending_capacity >= CHILD_REPORT_MAX_SIZE + OUTPUT_CHUNK_SIZE) {
+                // No valid report is this large; flush what is buffered as plain bytes.
+                if (process_pending(stream, true) != 0) {
+                    report_reactor_error("write() of child output failed");
+                    return 1;
+                }
+                continue;
+            }
+            size_t new_capacity = stream->pending_capacity == 0 ? OUTPUT_CHUNK_SIZE * 2 : stream->pending_capacity * 2;
+            char *new_pending = realloc(stream->pending, new_capacity);
+            if (new_pending == NULL) {
+                report_reactor_error("growing a report buffer failed");
+                return 1;
+            }
+            stream->pending = new_pending;
+            stream->pending_capacity = new_capacity;
+        }
+        ssize_t received = read(stream->fd, stream->pending + stream->pending_used,
+                                stream->pending_capacity - stream->pending_used);
+        if (received == 0) {
+            status = 1;
+            break;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            report_reactor_error("read() from child pipe failed");
+            status = 1;
+            break;
+        }
+        stream->pending_used += (size_t)received;
+        moved += (size_t)received;
+    }
+
+    if (process_pending(stream, status != 0) != 0) {
+        report_reactor_error("write() of child output failed");
+        return 1;
+    }
+    return status;
+}
+
+/*
+ * Purpose:
+ *   Tells apart the two reasons for splice() failing with EAGAIN: an empty
+ *   child pipe or a full destination. A full destination is waited for, as
+ *   the copy path's blocking write() would; returning instead would make the
+ *   reactor spin, since the child pipe stays readable.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true if the destination was full and can now take data (splice again),
+ *   false if the child pipe is empty.
+ */
+static bool wait_for_destination(void) {
+    struct pollfd pfd = { .fd = g_output_config.dest_fd, .events = POLLOUT };
+    int ready;
+    while ((ready = poll(&pfd, 1, 0)) < 0 && errno == EINTR) {
+    }
+    if (ready != 0) {
+        return false;
+    }
+    while ((ready = poll(&pfd, 1, -1)) < 0 && errno == EINTR) {
+    }
+    return ready > 0;
+}
+
+/*
+ * Purpose:
+ *   Forwards what is currently readable from one stream, up to a per-wakeup
+ *   budget so that one busy child cannot starve the others.
+ * Receives:
+ *   stream: The stream to service.
+ * Returns:
+ *   0 if the stream stays open, 1 on end of file or an unrecoverable error.
+ */
+static int forward_stream(output_stream_t *stream) {
+    size_t moved = 0;
+
+    if (g_output_config.decode_reports) {
+        return forward_stream_decoded(stream);
+    }
+
+    bool direct = g_output_config.reorder_window == 0 || stream->seq == stream->shard->head_seq;
+    if (direct && stream->record == NULL && !g_output_tagging && !archive_enabled() &&
+        atomic_load(&g_output_splice_ok)) {
+        while (moved < OUTPUT_FORWARD_BUDGET) {
+            ssize_t spliced = splice(stream->fd, NULL, g_output_config.dest_fd, NULL,
+                                     OUTPUT_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (spliced > 0) {
+                moved += (size_t)spliced;
+                atomic_fetch_add_explicit(&stream->shard->stats.bytes_forwarded, (unsigned long)spliced,
+                                          memory_order_relaxed);
+                continue;
+            }
+            if (spliced == 0) {
+                return 1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                if (wait_for_destination()) {
+                    continue;
+                }
+                return 0;
+            }
+            if (errno == EINVAL) {
+                // The destination does not support splice(); copy from now on.
+                atomic_store(&g_output_splice_ok, false);
+                break;
+            }
+            report_reactor_error("splice() failed");
+            return 1;
+        }
+        if (atomic_load(&g_output_splice_ok)) {
+            return 0;
+        }
+    }
+
+    while (moved < OUTPUT_FORWARD_BUDGET) {
+        ssize_t received = read(stream->fd, stream->shard->buffer, OUTPUT_CHUNK_SIZE);
+        if (received == 0) {
+            return 1;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return 0;
+            }
+            report_reactor_error("read() from child pipe failed");
+            return 1;
+        }
+        if (forward_plain(stream, stream->shard->buffer, (size_t)received) != 0) {
+            report_reactor_error("write() of child output failed");
+            return 1;
+        }
+        moved += (size_t)received;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Closes a stream's pipe and completes its archive block, but keeps the
+ *   stream registered (ordered mode keeps it until its held output is emitted).
+ *   Does nothing if the pipe is already closed.
+ * Receives:
+ *   stream: The stream.
+ * Returns:
+ *   None (void).
+ */
+static void detach_stream(output_stream_t *stream) {
+    if (stream->closed) {
+        return;
+    }
+    epoll_ctl(stream->shard->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+    close(stream->fd);
+    stream->fd = -1;
+    stream->closed = true;
+    if (archive_stream_close(&stream->archive) != 0) {
+        report_reactor_error("archiving child output failed");
+    }
+}
+
+/*
+ * Purpose:
+ *   Unregisters a stream, closes its pipe and frees it. Shard thread only
+ *   (or after the shard has stopped).
+ * Receives:
+ *   stream: The stream to close.
+ * Returns:
+ *   None (void).
+ */
+static void close_stream(output_stream_t *stream) {
+    output_shard_t *shard = stream->shard;
+    detach_stream(stream);
+
+    pthread_mutex_lock(&shard->lock);
+    if (stream->prev != NULL) {
+        stream->prev->next = stream->next;
+    } else {
+        shard->streams = stream->next;
+    }
+    if (stream->next != NULL) {
+        stream->next->prev = stream->prev;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    atomic_fetch_add_explicit(&shard->stats.streams_finished, 1, memory_order_relaxed);
+    shard->held_total -= stream->held_used;
+    record_release(stream->record);
+    pmem_free(PMEM_BUFFER, stream->held, stream->held_capacity);
+    free(stream->pending);
+    free(stream);
+}
+
+/*
+ * Purpose:
+ *   Moves the head to the next child in launch order: emits what it held and
+ *   keeps going past children that have already finished.
+ * Receives:
+ *   shard: The shard (ordered mode runs a single one).
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int advance_head(output_shard_t *shard) {
+    int result = 0;
+    for (;;) {
+        output_stream_t *head = find_stream(shard, shard->head_seq);
+        if (head == NULL) {
+            return result;  // Not registered yet; it streams directly once it is.
+        }
+        if (release_held(head, false) != 0) {
+            result = -1;
+        }
+        if (!head->closed) {
+            return result;
+        }
+        close_stream(head);
+        shard->head_seq++;
+    }
+}
+
+/*
+ * Purpose:
+ *   Handles the end of a child's output. Outside ordered mode the stream is
+ *   closed right away; in ordered mode a finished head lets the next child
+ *   take over, while a finished later child waits with its held output.
+ * Receives:
+ *   stream: The stream that reached end of file.
+ * Returns:
+ *   None (void).
+ */
+static void finish_stream(output_stream_t *stream) {
+    if (g_output_config.reorder_window == 0) {
+        close_stream(stream);
+        return;
+    }
+    detach_stream(stream);
+    if (stream->seq == stream->shard->head_seq && advance_head(stream->shard) != 0) {
+        report_reactor_error("write() of child output failed");
+    }
+}
+
+/*
+ * Purpose:
+ *   Tells whether any stream of a shard still has an open pipe.
+ * Receives:
+ *   shard: The shard.
+ * Returns:
+ *   true if no pipe is open (streams that only hold output do not count).
+ */
+static bool streams_idle(output_shard_t *shard) {
+    bool idle = true;
+    pthread_mutex_lock(&shard->lock);
+    for (output_stream_t *stream = shard->streams; stream != NULL && idle; stream = stream->next) {
+        idle = stream->closed;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return idle;
+}
+
+/*
+ * Purpose:
+ *   Returns the number of milliseconds from 'now' until 'deadline'.
+ * Receives:
+ *   deadline: Absolute CLOCK_MONOTONIC time.
+ * Returns:
+ *   The remaining time in milliseconds (0 if the deadline has passed).
+ */
+static int milliseconds_until(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long remaining = (long long)(deadline->tv_sec - now.tv_sec) * 1000 +
+                          (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+/*
+ * Purpose:
+ *   Tells whether a shard watches a child's exit (subreaper_watched_fn).
+ * Receives:
+ *   context: The shard.
+ *   pid:     The PID.
+ * Returns:
+ *   true if one of the shard's exit watches is for pid.
+ */
+static bool is_watched(void *context, pid_t pid) {
+    output_shard_t *shard = context;
+    pthread_mutex_lock(&shard->lock);
+    output_exit_watch_t *watch = shard->exits;
+    while (watch != NULL && watch->pid != pid) {
+        watch = watch->next;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return watch != NULL;
+}
+
+/*
+ * Purpose:
+ *   Reaps a child whose pidfd became readable, counts and journals its exit
+ *   and reports an abnormal one (non-zero status or a signal) on stderr. In
+ *   subreaper mode its usage is recorded and exited descendants are collected.
+ * Receives:
+ *   shard: The shard watching the child.
+ *   watch: The child's exit watch; unregistered and freed unless the child is
+ *          still running.
+ * Returns:
+ *   true if the watch was released, false if the child has not exited yet.
+ */
+static bool reap_child(output_shard_t *shard, output_exit_watch_t *watch) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    int rc;
+    do {
+        // The system call, unlike the libc wrapper, also returns the usage.
+        rc = (int)syscall(SYS_waitid, P_PIDFD, watch->pidfd, &info, WEXITED | WNOHANG,
+                          subreaper_enabled() ? &usage : NULL);
+    } while (rc != 0 && errno == EINTR);
+    if (rc != 0 && errno == ECHILD) {
+        // A child of an earlier run, recovered from the journal: it was
+        // re-parented, so only the exit itself is known.
+        atomic_fetch_add_explicit(&shard->stats.children_reaped, 1, memory_order_relaxed);
+        plog_err("Parent: Child '%s' (PID %d) of an earlier run exited (status unknown).\n",
+                 watch->name, (int)watch->pid);
+        plog_write_pending();
+        journal_exit(watch->child_id, watch->pid, 0, 0);
+    } else if (rc != 0) {
+        report_reactor_error("waitid() on a child pidfd failed");
+    } else if (info.si_pid == 0) {
+        return false;   // Not exited yet (spurious wake-up); keep watching.
+    } else {
+        atomic_fetch_add_explicit(&shard->stats.children_reaped, 1, memory_order_relaxed);
+        journal_exit(watch->child_id, watch->pid, info.si_code, info.si_status);
+        if (subreaper_enabled()) {
+            subreaper_child_exited(watch->pid, &usage);
+        }
+        if (watch->record != NULL) {
+            watch->record->exited = true;
+            watch->record->exit_code = info.si_code;
+            watch->record->exit_status = info.si_status;
+        }
+        if (info.si_code != CLD_EXITED || info.si_status != 0) {
+            atomic_fetch_add_explicit(&shard->stats.abnormal_exits, 1, memory_order_relaxed);
+            plog_err("Parent: Child '%s' (PID %d) %s %d.\n", watch->name, (int)watch->pid,
+                     info.si_code == CLD_EXITED ? "exited with status" : "was terminated by signal",
+                     info.si_status);
+            plog_write_pending();
+        }
+    }
+
+    epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, watch->pidfd, NULL);
+    close(watch->pidfd);
+    pthread_mutex_lock(&shard->lock);
+    if (watch->prev != NULL) {
+        watch->prev->next = watch->next;
+    } else {
+        shard->exits = watch->next;
+    }
+    if (watch->next != NULL) {
+        watch->next->prev = watch->prev;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    record_release(watch->record);
+    free(watch);
+    if (subreaper_enabled()) {
+        subreaper_collect(is_watched, shard);  // Descendants held back behind this child
+    }
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Reactor shard thread. Services the shard's pipes and pidfds until shutdown
+ *   is requested, then keeps forwarding until all of its pipes reach end of
+ *   file or OUTPUT_SHUTDOWN_TIMEOUT_MS passes.
+ * Receives:
+ *   arg: The shard's output_shard_t.
+ * Returns:
+ *   NULL.
+ */
+static void *output_reactor_main(void *arg) {
+    output_shard_t *shard = arg;
+    struct epoll_event events[OUTPUT_MAX_EVENTS];
+    struct timespec deadline = { 0, 0 };
+    bool deadline_set = false;
+
+    for (;;) {
+        int timeout = -1;
+        if (atomic_load(&g_output_detaching)) {
+            break;
+        }
+        if (atomic_load(&g_output_stopping)) {
+            if (streams_idle(shard)) {
+                break;
+            }
+            if (!deadline_set) {
+                clock_gettime(CLOCK_MONOTONIC, &deadline);
+                deadline.tv_sec += OUTPUT_SHUTDOWN_TIMEOUT_MS / 1000;
+                deadline_set = true;
+            }
+            timeout = milliseconds_until(&deadline);
+            if (timeout == 0) {
+                break;
+            }
+        }
+
+        int ready = epoll_wait(shard->epoll_fd, events, OUTPUT_MAX_EVENTS, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            report_reactor_error("epoll_wait() failed");
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            output_source_kind_t *kind = events[i].data.ptr;
+            if (kind == NULL) {
+                uint64_t counter;
+                while (read(shard->wake_fd, &counter, sizeof(counter)) > 0) {
+                }
+            } else if (*kind == OUTPUT_SOURCE_EXIT) {
+                reap_child(shard, (output_exit_watch_t *)kind);
+            } else if (*kind == OUTPUT_SOURCE_SIGNAL) {
+                subreaper_collect(is_watched, shard);
+            } else {
+                output_stream_t *stream = (output_stream_t *)kind;
+                if (forward_stream(stream) != 0) {
+                    finish_stream(stream);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Releases a shard's descriptors and buffers. Its thread must not be
+ *   running and its lists must be empty.
+ * Receives:
+ *   shard: The shard.
+ * Returns:
+ *   None (void).
+ */
+static void shard_destroy(output_shard_t *shard) {
+    if (shard->wake_fd >= 0) close(shard->wake_fd);
+    if (shard->epoll_fd >= 0) close(shard->epoll_fd);
+    shard->wake_fd = -1;
+    shard->epoll_fd = -1;
+    pmem_free(PMEM_BUFFER, shard->buffer, OUTPUT_CHUNK_SIZE);
+    pmem_free(PMEM_BUFFER, shard->tagged, OUTPUT_TAGGED_SIZE);
+    shard->buffer = NULL;
+    shard->tagged = NULL;
+    pthread_mutex_destroy(&shard->lock);
+}
+
+/*
+ * Purpose:
+ *   Creates a shard's epoll instance, wake-up eventfd and buffers.
+ * Receives:
+ *   shard: Zeroed shard to set up.
+ *   index: The shard's number.
+ * Returns:
+ *   0 on success, -1 on failure (error logged; the shard is destroyed).
+ */
+static int shard_init(output_shard_t *shard, int index) {
+    shard->index = index;
+    shard->epoll_fd = -1;
+    shard->wake_fd = -1;
+    pthread_mutex_init(&shard->lock, NULL);
+
+    shard->buffer = pmem_alloc(PMEM_BUFFER, OUTPUT_CHUNK_SIZE);
+    shard->tagged = pmem_alloc(PMEM_BUFFER, OUTPUT_TAGGED_SIZE);
+    if (shard->buffer == NULL || shard->tagged == NULL) {
+        plog_perror("Parent: Failed to allocate output buffers");
+        shard_destroy(shard);
+        return -1;
+    }
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epoll_fd < 0) {
+        plog_perror("Parent: Failed to create output epoll instance");
+        shard_destroy(shard);
+        return -1;
+    }
+    shard->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shard->wake_fd < 0) {
+        plog_perror("Parent: Failed to create output wake-up eventfd");
+        shard_destroy(shard);
+        return -1;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->wake_fd, &event) != 0) {
+        plog_perror("Parent: Failed to register output wake-up eventfd");
+        shard_destroy(shard);
+        return -1;
+    }
+    if (index == 0 && subreaper_enabled()) {
+        event.data.ptr = &g_output_signal_source;
+        if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, subreaper_signal_fd(), &event) != 0) {
+            plog_perror("Parent: Failed to register SIGCHLD signalfd");
+            shard_destroy(shard);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Enables output capture and starts the reactor shard threads (with all
+ *   signals blocked, so SIGINT/SIGTERM reach the command loop).
+ * Receives:
+ *   config: Destination, pipe and shard settings (copied). Ordered mode, the
+ *           output archive and subreaper mode force a single shard.
+ * Returns:
+ *   0 on success.
+ *   -1 if a shard's epoll instance, wake-up descriptor, buffers or thread could
+ *      not be created; capture stays disabled and an error message is logged.
+ */
+int output_start(const output_config_t *config) {
+    g_output_config = *config;
+    g_output_tagging = config->tag_terminal && isatty(config->dest_fd);
+    atomic_store(&g_output_splice_ok, true);
+    atomic_store(&g_output_stopping, false);
+
+    int shard_count = config->shard_count > 0 ? config->shard_count : 1;
+    if (shard_count > 1 && (config->reorder_window > 0 || archive_enabled() || subreaper_enabled())) {
+        plog_err("Parent: Warning - Ordered output, the output archive and subreaper mode use a single reactor.\n");
+        shard_count = 1;
+    }
+    size_t shards_size = (size_t)shard_count * sizeof(output_shard_t);
+    g_output_shards = aligned_alloc(_Alignof(output_shard_t), shards_size);
+    if (g_output_shards == NULL) {
+        plog_perror("Parent: Failed to allocate output reactors");
+        return -1;
+    }
+    memset(g_output_shards, 0, shards_size);
+
+    int initialized = 0;
+    for (; initialized < shard_count; ++initialized) {
+        if (shard_init(&g_output_shards[initialized], initialized) != 0) {
+            break;
+        }
+    }
+
+    sigset_t all_signals;
+    sigset_t previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+    int started = 0;
+    if (initialized == shard_count) {
+        for (; started < shard_count; ++started) {
+            output_shard_t *shard = &g_output_shards[started];
+            int error_number = pthread_create(&shard->thread, NULL, output_reactor_main, shard);
+            if (error_number != 0) {
+                errno = error_number;
+                plog_perror("Parent: Failed to start output reactor thread");
+                break;
+            }
+            shard->thread_started = true;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    g_output_shard_count = initialized;
+    if (started < shard_count) {
+        // Nothing is registered yet, so the started threads stop right away.
+        atomic_store(&g_output_stopping, true);
+        for (int i = 0; i < started; ++i) {
+            uint64_t one = 1;
+            if (write(g_output_shards[i].wake_fd, &one, sizeof(one)) < 0) {
+                plog_perror("Parent: Failed to wake output reactor");
+            }
+            pthread_join(g_output_shards[i].thread, NULL);
+        }
+        for (int i = 0; i < initialized; ++i) {
+            shard_destroy(&g_output_shards[i]);
+        }
+        free(g_output_shards);
+        g_output_shards = NULL;
+        g_output_shard_count = 0;
+        return -1;
+    }
+    g_output_running = true;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Tells whether child output capture is active.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true if output_start() succeeded and output_shutdown() has not been called.
+ */
+bool output_enabled(void) {
+    return g_output_running;
+}
+
+/*
+ * Purpose:
+ *   Creates the capture pipe for one child before fork(). Both ends are
+ *   close-on-exec; the read end is non-blocking and, if configured, resized
+ *   with F_SETPIPE_SZ (a failed resize is logged but not fatal).
+ * Receives:
+ *   pipe_fds: Receives the two descriptors.
+ * Returns:
+ *   0 on success, -1 if the pipe could not be created (error logged).
+ */
+int output_pipe_open(output_pipe_t *pipe_fds) {
+    int fds[2];
+    pipe_fds->read_fd = -1;
+    pipe_fds->write_fd = -1;
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        plog_perror("Parent: Failed to create child output pipe");
+        return -1;
+    }
+    if (fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0) {
+        plog_perror("Parent: Failed to make child output pipe non-blocking");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (g_output_config.pipe_size > 0 && fcntl(fds[0], F_SETPIPE_SZ, g_output_config.pipe_size) < 0) {
+        plog_perror("Parent: Warning - F_SETPIPE_SZ failed for child output pipe");
+    }
+    pipe_fds->read_fd = fds[0];
+    pipe_fds->write_fd = fds[1];
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   In the forked child, points stdout and stderr at the capture pipe. Only
+ *   async-signal-safe calls are used. The original pipe descriptors are
+ *   close-on-exec and disappear at execve().
+ * Receives:
+ *   pipe_fds: The pipe created by output_pipe_open().
+ * Returns:
+ *   0 on success, -1 if dup2() failed.
+ */
+int output_child_redirect(const output_pipe_t *pipe_fds) {
+    if (dup2(pipe_fds->write_fd, STDOUT_FILENO) < 0 || dup2(pipe_fds->write_fd, STDERR_FILENO) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Adds a child to the shard's exit watches, so the shard reaps the child
+ *   when it exits. Opens a pidfd for it unless one is given.
+ * Receives:
+ *   shard:      The child's shard.
+ *   child_name: Name used in exit messages.
+ *   child_id:   The child's number.
+ *   pid:        The child's PID.
+ *   pidfd:      The child's pidfd (consumed, even on failure), or -1 to open one.
+ *   record:     The child's record, or NULL; the watch holds one of its users
+ *               (on failure the caller still does).
+ * Returns:
+ *   0 on success, -1 on failure (error logged; the child is not reaped).
+ */
+static int watch_exit(output_shard_t *shard, const char *child_name, int child_id, pid_t pid, int pidfd,
+                      output_record_t *record) {
+    output_exit_watch_t *watch = calloc(1, sizeof(*watch));
+    if (watch == NULL) {
+        plog_perror("Parent: Failed to allocate child exit watch");
+        if (pidfd >= 0) close(pidfd);
+        return -1;
+    }
+    watch->kind = OUTPUT_SOURCE_EXIT;
+    watch->child_id = child_id;
+    watch->pid = pid;
+    watch->record = record;
+    snprintf(watch->name, sizeof(watch->name), "%s", child_name);
+    watch->pidfd = pidfd >= 0 ? pidfd : (int)syscall(SYS_pidfd_open, pid, 0);
+    if (watch->pidfd < 0) {
+        plog_perror("Parent: pidfd_open() failed; child will not be reaped");
+        free(watch);
+        return -1;
+    }
+    if (fcntl(watch->pidfd, F_SETFD, FD_CLOEXEC) != 0) {
+        plog_perror("Parent: Failed to make child pidfd close-on-exec");
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = watch;
+    pthread_mutex_lock(&shard->lock);
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, watch->pidfd, &event) != 0) {
+        pthread_mutex_unlock(&shard->lock);
+        plog_perror("Parent: Failed to register child pidfd");
+        close(watch->pidfd);
+        free(watch);
+        return -1;
+    }
+    watch->next = shard->exits;
+    if (shard->exits != NULL) {
+        shard->exits->prev = watch;
+    }
+    shard->exits = watch;
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Allocates a stream for a child's pipe (not registered yet).
+ * Receives:
+ *   shard:      The child's shard.
+ *   fd:         Read end of the child's pipe.
+ *   child_name: Name used for line tagging (e.g., "child_00").
+ *   child_id:   The child's number.
+ *   pid:        The child's PID.
+ *   record:     The child's record, or NULL.
+ * Returns:
+ *   The stream, or NULL on allocation failure (error logged; nothing is
+ *   consumed).
+ */
+static output_stream_t *new_stream(output_shard_t *shard, int fd, const char *child_name, int child_id,
+                                   pid_t pid, output_record_t *record) {
+    output_stream_t *stream = calloc(1, sizeof(*stream));
+    if (stream == NULL) {
+        plog_perror("Parent: Failed to allocate child output stream");
+        return NULL;
+    }
+    stream->kind = OUTPUT_SOURCE_STREAM;
+    stream->shard = shard;
+    stream->fd = fd;
+    stream->child_id = child_id;
+    stream->pid = pid;
+    stream->at_line_start = true;
+    stream->record = record;
+    archive_stream_init(&stream->archive, (uint32_t)child_id);
+    snprintf(stream->name, sizeof(stream->name), "%s", child_name);
+    int prefix_len = snprintf(stream->prefix, sizeof(stream->prefix), "[%s] ", child_name);
+    stream->prefix_len = prefix_len > 0 && (size_t)prefix_len < sizeof(stream->prefix)
+                             ? (size_t)prefix_len : strlen(stream->prefix);
+    return stream;
+}
+
+/*
+ * Purpose:
+ *   Registers a stream with its shard's epoll instance and stream list.
+ * Receives:
+ *   stream: A stream from new_stream().
+ * Returns:
+ *   0 on success, -1 on failure (the pipe is closed, the record released and
+ *   the stream freed; error logged).
+ */
+static int link_stream(output_stream_t *stream) {
+    output_shard_t *shard = stream->shard;
+
+    // The stream is added to epoll and numbered under one lock hold: launcher
+    // threads register concurrently, and a failed registration must not consume
+    // a number, or ordered mode would wait for it forever. The shard cannot
+    // close the stream before it is linked, since closing takes the same lock.
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = stream;
+    pthread_mutex_lock(&shard->lock);
+    stream->seq = shard->next_seq;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, stream->fd, &event) != 0) {
+        pthread_mutex_unlock(&shard->lock);
+        plog_perror("Parent: Failed to register child output pipe");
+        record_release(stream->record);
+        close(stream->fd);
+        free(stream->pending);
+        free(stream);
+        return -1;
+    }
+    shard->next_seq++;
+    stream->next = shard->streams;
+    if (shard->streams != NULL) {
+        shard->streams->prev = stream;
+    }
+    shard->streams = stream;
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   In the parent after a successful fork(), closes the pipe's write end and
+ *   hands the read end and the child's exit to the child's reactor shard.
+ * Receives:
+ *   pipe_fds:   The child's pipe; both descriptors are consumed (set to -1).
+ *   child_name: Name used for line tagging (e.g., "child_00").
+ *   child_id:   The child's number (archive key, selects the shard).
+ *   pid:        The child's PID.
+ *   on_result:  Callback for the child's output and exit status, or NULL.
+ *   context:    Passed to on_result.
+ * Returns:
+ *   0 on success, -1 on failure (the read end is closed and the child's output
+ *   is lost; error logged). on_result is called in either case, with
+ *   'complete' false if the output or the exit could not be watched.
+ */
+int output_register(output_pipe_t *pipe_fds, const char *child_name, int child_id, pid_t pid,
+                    output_result_fn on_result, void *context) {
+    close(pipe_fds->write_fd);
+    pipe_fds->write_fd = -1;
+
+    output_record_t *record = NULL;
+    if (on_result != NULL) {
+        record = calloc(1, sizeof(*record));
+        if (record == NULL) {
+            plog_perror("Parent: Failed to allocate child result record");
+            on_result(context, NULL, 0, false, 0, 0);
+        } else {
+            atomic_init(&record->users, 2);
+            record->on_result = on_result;
+            record->context = context;
+        }
+    }
+
+    output_shard_t *shard = &g_output_shards[(unsigned)child_id % (unsigned)g_output_shard_count];
+    // Watched even if the output cannot be: the child is reaped either way.
+    if (watch_exit(shard, child_name, child_id, pid, -1, record) != 0) {
+        record_release(record);
+        subreaper_unwatched(pid);
+    }
+
+    int read_fd = pipe_fds->read_fd;
+    pipe_fds->read_fd = -1;
+    output_stream_t *stream = new_stream(shard, read_fd, child_name, child_id, pid, record);
+    if (stream == NULL) {
+        record_release(record);
+        close(read_fd);
+        return -1;
+    }
+    return link_stream(stream);
+}
+
+/*
+ * Purpose:
+ *   Takes over a child captured by a previous instance of the parent (hot
+ *   restart): its pipe and pidfd are registered with the child's shard as if
+ *   it had been launched here. Output capture must be running.
+ * Receives:
+ *   child: The child's state as saved by output_detach(); its descriptors are
+ *          consumed, its pending bytes copied.
+ * Returns:
+ *   0 on success, -1 on failure (error logged; whatever could not be adopted
+ *   is closed).
+ */
+int output_adopt(const output_child_state_t *child) {
+    output_shard_t *shard = &g_output_shards[(unsigned)child->child_id % (unsigned)g_output_shard_count];
+    int result = 0;
+    if (child->pidfd >= 0 && watch_exit(shard, child->name, child->child_id, child->pid, child->pidfd, NULL) != 0) {
+        result = -1;
+    }
+    if (child->read_fd < 0) {
+        return result;
+    }
+    output_stream_t *stream = new_stream(shard, child->read_fd, child->name, child->child_id, child->pid, NULL);
+    if (stream == NULL) {
+        close(child->read_fd);
+        return -1;
+    }
+    stream->at_line_start = child->at_line_start;
+    if (child->pending_length > 0) {
+        stream->pending = malloc(child->pending_length);
+        if (stream->pending == NULL) {
+            plog_perror("Parent: Failed to allocate adopted report buffer");
+            close(stream->fd);
+            free(stream);
+            return -1;
+        }
+        memcpy(stream->pending, child->pending, child->pending_length);
+        stream->pending_used = child->pending_length;
+        stream->pending_capacity = child->pending_length;
+    }
+    return link_stream(stream) == 0 ? result : -1;
+}
+
+/*
+ * Purpose:
+ *   Stops output capture for a hot restart: the reactor threads stop right
+ *   away, without draining the pipes, and every captured child (pipe, pidfd
+ *   or both) is handed to 'save' before its structures are freed. The
+ *   descriptors are left open (still close-on-exec) for the caller to pass
+ *   on; output still in the pipes is forwarded by the adopting instance.
+ *   Recordings for the result cache are dropped. Not available in ordered
+ *   mode or with an archive, whose held output and open blocks cannot be
+ *   handed over.
+ * Receives:
+ *   save:    Called once per child; the state is only valid during the call.
+ *   context: Passed to save.
+ * Returns:
+ *   0 on success (including when capture is not running).
+ *   -1 if capture cannot be detached (ordered mode or archive; nothing is
+ *      changed) or 'save' failed for a child (capture is stopped anyway and
+ *      that child's descriptors are closed). Errors are logged.
+ */
+int output_detach(output_child_fn save, void *context) {
+    if (!g_output_running) {
+        return 0;
+    }
+    if (g_output_config.reorder_window > 0 || archive_enabled()) {
+        plog_err("Parent: Child output cannot be handed over with ordered output (-O) or an archive (-a).\n");
+        return -1;
+    }
+    atomic_store(&g_output_detaching, true);
+    for (int i = 0; i < g_output_shard_count; ++i) {
+        uint64_t one = 1;
+        if (write(g_output_shards[i].wake_fd, &one, sizeof(one)) < 0) {
+            plog_perror("Parent: Failed to wake output reactor");
+        }
+    }
+    for (int i = 0; i < g_output_shard_count; ++i) {
+        pthread_join(g_output_shards[i].thread, NULL);
+    }
+    g_output_running = false;
+    atomic_store(&g_output_detaching, false);
+
+    int result = 0;
+    for (int i = 0; i < g_output_shard_count; ++i) {
+        output_shard_t *shard = &g_output_shards[i];
+        while (shard->streams != NULL || shard->exits != NULL) {
+            output_child_state_t child;
+            memset(&child, 0, sizeof(child));
+            output_stream_t *stream = shard->streams;
+            output_exit_watch_t *watch = shard->exits;
+            if (stream != NULL) {
+                // The child's exit watch, if any, goes with its stream.
+                while (watch != NULL && watch->pid != stream->pid) {
+                    watch = watch->next;
+                }
+            }
+            child.pid = stream != NULL ? stream->pid : watch->pid;
+            child.child_id = stream != NULL ? stream->child_id : watch->child_id;
+            snprintf(child.name, sizeof(child.name), "%s", stream != NULL ? stream->name : watch->name);
+            child.read_fd = stream != NULL ? stream->fd : -1;
+            child.pidfd = watch != NULL ? watch->pidfd : -1;
+            child.at_line_start = stream != NULL ? stream->at_line_start : true;
+            child.pending = stream != NULL ? stream->pending : NULL;
+            child.pending_length = stream != NULL ? stream->pending_used : 0;
+            if (save(context, &child) != 0) {
+                result = -1;
+                if (child.read_fd >= 0) close(child.read_fd);
+                if (child.pidfd >= 0) close(child.pidfd);
+            }
+
+            if (stream != NULL) {
+                shard->streams = stream->next;
+                if (shard->streams != NULL) shard->streams->prev = NULL;
+                record_release(stream->record);
+                free(stream->pending);
+                free(stream);
+            }
+            if (watch != NULL) {
+                if (watch->prev != NULL) watch->prev->next = watch->next; else shard->exits = watch->next;
+                if (watch->next != NULL) watch->next->prev = watch->prev;
+                record_release(watch->record);
+                free(watch);
+            }
+        }
+        shard_destroy(shard);
+    }
+    free(g_output_shards);
+    g_output_shards = NULL;
+    g_output_shard_count = 0;
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Writes a recorded child output to the destination in place of a launch
+ *   (result cache hit), tagged like live output if tagging is active. A
+ *   marker line first names the child that was recorded, since the replayed
+ *   text carries its name and PID. Called from a launching thread; the output
+ *   is written in one piece (in pieces of at most OUTPUT_TAGGED_SIZE when
+ *   tagged).
+ * Receives:
+ *   child_name:   Name for the line prefix (e.g., "child_05").
+ *   source_name:  The child whose output was recorded.
+ *   source_pid:   Its PID.
+ *   data, length: The recorded output.
+ * Returns:
+ *   0 on success, -1 on a write error (error logged).
+ */
+int output_replay(const char *child_name, const char *source_name, pid_t source_pid, const char *data,
+                  size_t length) {
+    char marker[OUTPUT_MARKER_SIZE];
+    int marker_len = snprintf(marker, sizeof(marker), "--- %s: replay of the cached output of %s (PID %d) ---\n",
+                              child_name, source_name, (int)source_pid);
+    if (marker_len > 0 && write_all(g_output_config.dest_fd, marker,
+                                    (size_t)marker_len < sizeof(marker) ? (size_t)marker_len
+                                                                        : sizeof(marker) - 1) != 0) {
+        plog_perror("Parent: Failed to replay child output");
+        return -1;
+    }
+    int result = 0;
+    if (!g_output_tagging) {
+        result = write_all(g_output_config.dest_fd, data, length);
+    } else {
+        char prefix[OUTPUT_PREFIX_SIZE];
+        int prefix_len = snprintf(prefix, sizeof(prefix), "[%s] ", child_name);
+        size_t prefix_size = prefix_len > 0 && (size_t)prefix_len < sizeof(prefix)
+                                 ? (size_t)prefix_len : strlen(prefix);
+        char *tagged = pmem_alloc(PMEM_BUFFER, OUTPUT_TAGGED_SIZE);
+        if (tagged == NULL) {
+            plog_perror("Parent: Failed to allocate replay buffer");
+            return -1;
+        }
+        size_t used = 0;
+        while (length > 0 && result == 0) {
+            const char *newline = memchr(data, '\n', length);
+            size_t piece = newline != NULL ? (size_t)(newline - data) + 1 : length;
+            if (piece > OUTPUT_TAGGED_SIZE - prefix_size) {
+                piece = OUTPUT_TAGGED_SIZE - prefix_size;
+            }
+            if (used + prefix_size + piece > OUTPUT_TAGGED_SIZE) {
+                result = write_all(g_output_config.dest_fd, tagged, used);
+                used = 0;
+            }
+            memcpy(tagged + used, prefix, prefix_size);
+            memcpy(tagged + used + prefix_size, data, piece);
+            used += prefix_size + piece;
+            data += piece;
+            length -= piece;
+        }
+        if (result == 0 && used > 0) {
+            result = write_all(g_output_config.dest_fd, tagged, used);
+        }
+        pmem_free(PMEM_BUFFER, tagged, OUTPUT_TAGGED_SIZE);
+    }
+    if (result != 0) {
+        plog_perror("Parent: Failed to replay child output");
+    }
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Closes whatever is still open of a capture pipe (used when fork() failed).
+ * Receives:
+ *   pipe_fds: The pipe; descriptors are set to -1.
+ * Returns:
+ *   None (void).
+ */
+void output_pipe_close(output_pipe_t *pipe_fds) {
+    if (pipe_fds->read_fd >= 0) {
+        close(pipe_fds->read_fd);
+    }
+    if (pipe_fds->write_fd >= 0) {
+        close(pipe_fds->write_fd);
+    }
+    pipe_fds->read_fd = -1;
+    pipe_fds->write_fd = -1;
+}
+
+/*
+ * Purpose:
+ *   Stops output capture: every shard forwards what its running children still
+ *   write (for up to OUTPUT_SHUTDOWN_TIMEOUT_MS), then the threads are joined,
+ *   children that have already exited are reaped and all remaining pipes,
+ *   pidfds and resources are released.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void output_shutdown(void) {
+    if (!g_output_running) {
+        return;
+    }
+    atomic_store(&g_output_stopping, true);
+    for (int i = 0; i < g_output_shard_count; ++i) {
+        uint64_t one = 1;
+        if (write(g_output_shards[i].wake_fd, &one, sizeof(one)) < 0) {
+            plog_perror("Parent: Failed to wake output reactor");
+        }
+    }
+    for (int i = 0; i < g_output_shard_count; ++i) {
+        pthread_join(g_output_shards[i].thread, NULL);
+    }
+    g_output_running = false;
+
+    for (int i = 0; i < g_output_shard_count; ++i) {
+        output_shard_t *shard = &g_output_shards[i];
+        // Ordered mode: emit whatever is still held, oldest child first.
+        output_stream_t *oldest;
+        while ((oldest = oldest_holder(shard)) != NULL) {
+            if (release_held(oldest, false) != 0) {
+                plog_perror("Parent: Failed to write held child output");
+                break;
+            }
+        }
+        while (shard->streams != NULL) {
+            close_stream(shard->streams);
+        }
+        // Children still running are left to be reaped by init after the parent exits.
+        while (shard->exits != NULL) {
+            output_exit_watch_t *watch = shard->exits;
+            if (!reap_child(shard, watch)) {
+                shard->exits = watch->next;
+                close(watch->pidfd);
+                record_release(watch->record);
+                free(watch);
+            }
+        }
+        shard_destroy(shard);
+    }
+    free(g_output_shards);
+    g_output_shards = NULL;
+    g_output_shard_count = 0;
+}
+
+/*
+ * Purpose:
+ *   Logs the reactor counters: totals over all shards, then one line per
+ *   shard. Each shard only ever writes its own slot, so the totals are a
+ *   snapshot that may be slightly behind a running shard.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void output_print_stats(void) {
+    if (!g_output_running) {
+        return;
+    }
+    unsigned long totals[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < g_output_shard_count; ++i) {
+        const output_shard_stats_t *stats = &g_output_shards[i].stats;
+        totals[0] += atomic_load_explicit(&stats->streams_finished, memory_order_relaxed);
+        totals[1] += atomic_load_explicit(&stats->bytes_forwarded, memory_order_relaxed);
+        totals[2] += atomic_load_explicit(&stats->children_reaped, memory_order_relaxed);
+        totals[3] += atomic_load_explicit(&stats->abnormal_exits, memory_order_relaxed);
+    }
+    plog_out("Parent: Output (%d reactor(s)): %lu streams finished, %lu bytes forwarded, "
+             "%lu children reaped (%lu abnormal).\n",
+             g_output_shard_count, totals[0], totals[1], totals[2], totals[3]);
+    for (int i = 0; i < g_output_shard_count && g_output_shard_count > 1; ++i) {
+        const output_shard_stats_t *stats = &g_output_shards[i].stats;
+        plog_out("Parent:   reactor %d: %lu streams, %lu bytes, %lu reaped.\n", i,
+                 atomic_load_explicit(&stats->streams_finished, memory_order_relaxed),
+                 atomic_load_explicit(&stats->bytes_forwarded, memory_order_relaxed),
+                 atomic_load_explicit(&stats->children_reaped, memory_order_relaxed));
+    }
+}
+
+/*
+ * Purpose:
+ *   Counts the captured children that have not been reaped yet.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The number of children whose exit the reactors still wait for (0 when
+ *   capture is off).
+ */
+size_t output_running_children(void) {
+    size_t running = 0;
+    for (int i = 0; g_output_running && i < g_output_shard_count; ++i) {
+        output_shard_t *shard = &g_output_shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (const output_exit_watch_t *watch = shard->exits; watch != NULL; watch = watch->next) {
+            running++;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return running;
+}
@@ -0,0 +1,83 @@
+/*
+ * child_output.h
+ *
+ * Description:
+ * Optional capture of child output. Each child's stdout and stderr are
+ * redirected into a pipe whose read end is serviced by an output reactor thread
+ * (epoll). The reactor forwards the data to a destination descriptor: with
+ * splice() when possible, so the bytes move from the pipe to the destination
+ * without being copied through user space, or with read()/write() plus a
+ * "[child_NN] " line prefix when the destination is a terminal and tagging is
+ * enabled. Binary child reports (child_report.h) can be decoded on the way.
+ *
+ * The pipes are spread over one or more reactor shards, each with its own
+ * thread and epoll instance; a shard also reaps its children through pidfds.
+ * A child can be registered with a result callback, which receives all of its
+ * forwarded output and its exit status once both are known (result cache).
+ * For a hot restart, capture can be detached and its children handed to the
+ * next instance, which adopts them.
+ */
+#ifndef CHILD_OUTPUT_H
+#define CHILD_OUTPUT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define OUTPUT_MAX_SHARDS 64
+
+typedef struct output_config_s {
+    int dest_fd;        /* Destination for forwarded output (not closed by the reactor). */
+    bool tag_terminal;  /* Prefix lines with the child's name if dest_fd is a terminal. */
+    int pipe_size;      /* F_SETPIPE_SZ applied to every child pipe (0 = kernel default). */
+    bool decode_reports; /* Children send binary reports: decode them and forward the text. */
+    size_t reorder_window; /* >0: emit each child's output as one block in launch order,
+                              holding at most this many bytes of later children's output. */
+    int shard_count;    /* Number of reactor threads (0 or 1: one); forced to 1 in ordered
+                           mode and with an output archive. */
+} output_config_t;
+
+typedef struct output_pipe_s {
+    int read_fd;
+    int write_fd;
+} output_pipe_t;
+
+/* Receives a child's output and exit status from an output reactor. 'complete'
+ * is false if the output exceeded OUTPUT_RESULT_MAX_SIZE or the child was not
+ * reaped; it is called exactly once per registration that asked for it. */
+typedef void (*output_result_fn)(void *context, const char *output, size_t length, bool complete,
+                                  int exit_code, int exit_status);
+
+#define OUTPUT_RESULT_MAX_SIZE 65536
+
+#define OUTPUT_NAME_SIZE 40
+
+/* A captured child handed from one parent instance to the next (hot restart). */
+typedef struct output_child_state_s {
+    int child_id;
+    pid_t pid;
+    int read_fd;                /* Read end of the capture pipe, or -1 if closed */
+    int pidfd;                  /* Exit watch, or -1 if the child is not watched */
+    bool at_line_start;         /* Line tagging state */
+    char name[OUTPUT_NAME_SIZE];    /* "child_NN" */
+    const char *pending;        /* Undecoded report bytes (report decoding only) */
+    size_t pending_length;
+} output_child_state_t;
+
+typedef int (*output_child_fn)(void *context, const output_child_state_t *child);
+
+int output_start(const output_config_t *config);
+bool output_enabled(void);
+int output_pipe_open(output_pipe_t *pipe_fds);
+int output_child_redirect(const output_pipe_t *pipe_fds);
+int output_register(output_pipe_t *pipe_fds, const char *child_name, int child_id, pid_t pid,
+                    output_result_fn on_result, void *context);
+int output_replay(const char *child_name, const char *source_name, pid_t source_pid, const char *data,
+                  size_t length);
+int output_detach(output_child_fn save, void *context);
+int output_adopt(const output_child_state_t *child);
+void output_pipe_close(output_pipe_t *pipe_fds);
+void output_shutdown(void);
+void output_print_stats(void);
+size_t output_running_children(void);
+
+#endif /* CHILD_OUTPUT_H */
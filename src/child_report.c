@@ -0,0 +1,392 @@
+/*
+ * child_report.c
+ *
+ * Description:
+ * Encoder and decoder for the binary child report described in child_report.h.
+ * The encoder appends fields to a growing buffer; the decoder validates every
+ * field once, fills in the fixed fields of a child_report_t and leaves the
+ * variables in place so they can be walked without copying.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "child_report.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHILD_REPORT_INITIAL_CAPACITY 1024u
+
+/*
+ * Purpose:
+ *   Reads a native-endian unsigned integer of 'size' bytes from an unaligned
+ *   position.
+ * Receives:
+ *   src:  Source bytes.
+ *   size: 2, 4 or 8.
+ * Returns:
+ *   The value.
+ */
+static uint64_t read_uint(const char *src, size_t size) {
+    if (size == 2) {
+        uint16_t value;
+        memcpy(&value, src, sizeof(value));
+        return value;
+    }
+    if (size == 4) {
+        uint32_t value;
+        memcpy(&value, src, sizeof(value));
+        return value;
+    }
+    uint64_t value;
+    memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+/*
+ * Purpose:
+ *   Makes room for 'extra' more bytes in the builder.
+ * Receives:
+ *   builder: The report being built.
+ *   extra:   Bytes about to be appended.
+ * Returns:
+ *   0 on success, -1 if the report would exceed CHILD_REPORT_MAX_SIZE or the
+ *   allocation failed (the builder is marked failed).
+ */
+static int builder_reserve(child_report_builder_t *builder, size_t extra) {
+    if (builder->failed) {
+        return -1;
+    }
+    if (extra > CHILD_REPORT_MAX_SIZE - builder->length) {
+        builder->failed = true;
+        return -1;
+    }
+    size_t needed = builder->length + extra;
+    if (needed <= builder->capacity) {
+        return 0;
+    }
+    size_t new_capacity = builder->capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    char *new_data = realloc(builder->data, new_capacity);
+    if (new_data == NULL) {
+        builder->failed = true;
+        return -1;
+    }
+    builder->data = new_data;
+    builder->capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Starts a new report: allocates the buffer and writes the header (its
+ *   length is filled in by child_report_finish()).
+ * Receives:
+ *   builder: Builder to initialize.
+ * Returns:
+ *   0 on success, -1 on allocation failure.
+ */
+int child_report_begin(child_report_builder_t *builder) {
+    builder->data = malloc(CHILD_REPORT_INITIAL_CAPACITY);
+    builder->length = 0;
+    builder->capacity = CHILD_REPORT_INITIAL_CAPACITY;
+    builder->failed = builder->data == NULL;
+    if (builder->failed) {
+        return -1;
+    }
+    uint32_t magic = CHILD_REPORT_MAGIC;
+    uint16_t version = CHILD_REPORT_VERSION;
+    uint16_t reserved = 0;
+    uint32_t length = 0;
+    memcpy(builder->data, &magic, 4);
+    memcpy(builder->data + 4, &version, 2);
+    memcpy(builder->data + 6, &reserved, 2);
+    memcpy(builder->data + 8, &length, 4);
+    builder->length = CHILD_REPORT_HEADER_SIZE;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Appends one field. Errors are sticky and reported by child_report_finish().
+ * Receives:
+ *   builder:   The report being built.
+ *   tag:       CHILD_REPORT_TAG_* value.
+ *   flags:     Field flags.
+ *   value:     Value bytes (may be NULL if value_len is 0).
+ *   value_len: Number of value bytes.
+ * Returns:
+ *   None (void).
+ */
+void child_report_add(child_report_builder_t *builder, uint16_t tag, uint16_t flags, const void *value,
+                      size_t value_len) {
+    if (value_len > UINT32_MAX || builder_reserve(builder, CHILD_REPORT_FIELD_HEADER_SIZE + value_len) != 0) {
+        builder->failed = true;
+        return;
+    }
+    uint32_t length = (uint32_t)value_len;
+    char *dst = builder->data + builder->length;
+    memcpy(dst, &tag, 2);
+    memcpy(dst + 2, &flags, 2);
+    memcpy(dst + 4, &length, 4);
+    if (value_len > 0) {
+        memcpy(dst + CHILD_REPORT_FIELD_HEADER_SIZE, value, value_len);
+    }
+    builder->length += CHILD_REPORT_FIELD_HEADER_SIZE + value_len;
+}
+
+/*
+ * Purpose:
+ *   Appends a CHILD_REPORT_TAG_VAR field for one filtered variable.
+ * Receives:
+ *   builder: The report being built.
+ *   name:    Variable name.
+ *   value:   Variable value, or NULL if it was not in the environment.
+ * Returns:
+ *   None (void).
+ */
+void child_report_add_var(child_report_builder_t *builder, const char *name, const char *value) {
+    size_t name_len = strlen(name);
+    size_t value_len = value != NULL ? strlen(value) : 0;
+    size_t field_len = 4 + name_len + value_len;
+    if (name_len > UINT32_MAX || field_len > UINT32_MAX ||
+        builder_reserve(builder, CHILD_REPORT_FIELD_HEADER_SIZE + field_len) != 0) {
+        builder->failed = true;
+        return;
+    }
+    uint16_t tag = CHILD_REPORT_TAG_VAR;
+    uint16_t flags = value != NULL ? CHILD_REPORT_VAR_FOUND : 0;
+    uint32_t length = (uint32_t)field_len;
+    uint32_t name_length = (uint32_t)name_len;
+    char *dst = builder->data + builder->length;
+    memcpy(dst, &tag, 2);
+    memcpy(dst + 2, &flags, 2);
+    memcpy(dst + 4, &length, 4);
+    memcpy(dst + 8, &name_length, 4);
+    memcpy(dst + 12, name, name_len);
+    if (value_len > 0) {
+        memcpy(dst + 12 + name_len, value, value_len);
+    }
+    builder->length += CHILD_REPORT_FIELD_HEADER_SIZE + field_len;
+}
+
+/*
+ * Purpose:
+ *   Completes the report by storing its total length in the header.
+ * Receives:
+ *   builder: The report being built.
+ * Returns:
+ *   0 if the report is complete in builder->data / builder->length,
+ *   -1 if any earlier step failed (errno = ENOMEM).
+ */
+int child_report_finish(child_report_builder_t *builder) {
+    if (builder->failed) {
+        errno = ENOMEM;
+        return -1;
+    }
+    uint32_t length = (uint32_t)builder->length;
+    memcpy(builder->data + 8, &length, 4);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Releases the builder's buffer.
+ * Receives:
+ *   builder: Builder to release.
+ * Returns:
+ *   None (void).
+ */
+void child_report_free(child_report_builder_t *builder) {
+    free(builder->data);
+    builder->data = NULL;
+    builder->length = 0;
+    builder->capacity = 0;
+}
+
+/*
+ * Purpose:
+ *   Checks whether a buffer starts with a report and, if so, how long it is.
+ *   Used by stream readers to find report boundaries.
+ * Receives:
+ *   data:      Buffered bytes.
+ *   available: Number of buffered bytes.
+ * Returns:
+ *   The report's total length once the header is available, 0 if more bytes
+ *   are needed to tell, -1 if the bytes do not start a valid report.
+ */
+long child_report_frame_length(const void *data, size_t available) {
+    const char *bytes = data;
+    size_t check = available < 4 ? available : 4;
+    uint32_t magic = CHILD_REPORT_MAGIC;
+    if (memcmp(bytes, &magic, check) != 0) {
+        return -1;
+    }
+    if (available < CHILD_REPORT_HEADER_SIZE) {
+        return 0;
+    }
+    uint64_t version = read_uint(bytes + 4, 2);
+    uint64_t length = read_uint(bytes + 8, 4);
+    if (version != CHILD_REPORT_VERSION || length < CHILD_REPORT_HEADER_SIZE || length > CHILD_REPORT_MAX_SIZE) {
+        return -1;
+    }
+    return (long)length;
+}
+
+/*
+ * Purpose:
+ *   Decodes a complete report. Every field is bounds-checked; unknown tags are
+ *   skipped so newer children can add fields.
+ * Receives:
+ *   data:   Encoded report.
+ *   length: Its total length (as returned by child_report_frame_length()).
+ *   report: Receives the decoded fields; pointers refer into 'data'.
+ * Returns:
+ *   0 on success, -1 if the report is malformed.
+ */
+int child_report_decode(const void *data, size_t length, child_report_t *report) {
+    const char *bytes = data;
+    // A short buffer is "need more" (0) to the framer; 0 must not pass as its length.
+    if (length < CHILD_REPORT_HEADER_SIZE || child_report_frame_length(data, length) != (long)length) {
+        return -1;
+    }
+    memset(report, 0, sizeof(*report));
+    report->pid = -1;
+    report->ppid = -1;
+    report->fields = bytes + CHILD_REPORT_HEADER_SIZE;
+    report->fields_size = length - CHILD_REPORT_HEADER_SIZE;
+
+    size_t pos = CHILD_REPORT_HEADER_SIZE;
+    while (pos < length) {
+        if (length - pos < CHILD_REPORT_FIELD_HEADER_SIZE) {
+            return -1;
+        }
+        uint16_t tag = (uint16_t)read_uint(bytes + pos, 2);
+        uint16_t flags = (uint16_t)read_uint(bytes + pos + 2, 2);
+        uint32_t value_len = (uint32_t)read_uint(bytes + pos + 4, 4);
+        const char *value = bytes + pos + CHILD_REPORT_FIELD_HEADER_SIZE;
+        if (value_len > length - pos - CHILD_REPORT_FIELD_HEADER_SIZE) {
+            return -1;
+        }
+
+        switch (tag) {
+            case CHILD_REPORT_TAG_NAME:
+                report->name = value;
+                report->name_len = value_len;
+                break;
+            case CHILD_REPORT_TAG_PID:
+            case CHILD_REPORT_TAG_PPID:
+                if (value_len != 4) {
+                    return -1;
+                }
+                if (tag == CHILD_REPORT_TAG_PID) {
+                    report->pid = (int32_t)read_uint(value, 4);
+                } else {
+                    report->ppid = (int32_t)read_uint(value, 4);
+                }
+                break;
+            case CHILD_REPORT_TAG_FILTER_FILE:
+                report->filter_file = value;
+                report->filter_file_len = value_len;
+                break;
+            case CHILD_REPORT_TAG_VAR:
+                if (value_len < 4 || read_uint(value, 4) > value_len - 4) {
+                    return -1;
+                }
+                report->var_count++;
+                if ((flags & CHILD_REPORT_VAR_FOUND) == 0) {
+                    report->missing_count++;
+                }
+                break;
+            case CHILD_REPORT_TAG_TIMING:
+                if (value_len != 16) {
+                    return -1;
+                }
+                report->start_ns = read_uint(value, 8);
+                report->elapsed_ns = read_uint(value + 8, 8);
+                break;
+            default:
+                break;
+        }
+        pos += CHILD_REPORT_FIELD_HEADER_SIZE + value_len;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Iterates over the variables of a decoded report.
+ * Receives:
+ *   report: Report returned by child_report_decode().
+ *   cursor: Iteration state; set to 0 before the first call.
+ *   var:    Receives the next variable.
+ * Returns:
+ *   true if 'var' was filled in, false when there are no more variables.
+ */
+bool child_report_next_var(const child_report_t *report, size_t *cursor, child_report_var_t *var) {
+    while (*cursor < report->fields_size) {
+        const char *field = report->fields + *cursor;
+        uint16_t tag = (uint16_t)read_uint(field, 2);
+        uint16_t flags = (uint16_t)read_uint(field + 2, 2);
+        uint32_t value_len = (uint32_t)read_uint(field + 4, 4);
+        *cursor += CHILD_REPORT_FIELD_HEADER_SIZE + value_len;
+        if (tag != CHILD_REPORT_TAG_VAR) {
+            continue;
+        }
+        const char *value = field + CHILD_REPORT_FIELD_HEADER_SIZE;
+        var->name_len = (uint32_t)read_uint(value, 4);
+        var->name = value + 4;
+        if ((flags & CHILD_REPORT_VAR_FOUND) != 0) {
+            var->value = var->name + var->name_len;
+            var->value_len = value_len - 4 - var->name_len;
+        } else {
+            var->value = NULL;
+            var->value_len = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Purpose:
+ *   Prints a decoded report in the same shape as the child's text mode.
+ * Receives:
+ *   out:    Destination stream.
+ *   report: Report returned by child_report_decode().
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+int child_report_render(FILE *out, const child_report_t *report) {
+    int name_len = (int)report->name_len;
+    if (fprintf(out, "Child: Name='%.*s', PID=%d, PPID=%d\n", name_len, report->name ? report->name : "",
+                (int)report->pid, (int)report->ppid) < 0) {
+        return -1;
+    }
+    if (report->filter_file != NULL &&
+        fprintf(out, "Child: Using environment filter file: %.*s\n",
+                (int)report->filter_file_len, report->filter_file) < 0) {
+        return -1;
+    }
+    if (fprintf(out, "Child: Received Environment Variables (from filter list):\n") < 0) {
+        return -1;
+    }
+    size_t cursor = 0;
+    child_report_var_t var;
+    while (child_report_next_var(report, &cursor, &var)) {
+        int rc = var.value != NULL
+                 ? fprintf(out, "  %.*s=%.*s\n", (int)var.name_len, var.name, (int)var.value_len, var.value)
+                 : fprintf(out, "  %.*s=(Not found in received env)\n", (int)var.name_len, var.name);
+        if (rc < 0) {
+            return -1;
+        }
+    }
+    if (fprintf(out, "Child: (%.*s, %d) exiting after %llu us (%zu variables, %zu missing).\n",
+                name_len, report->name ? report->name : "", (int)report->pid,
+                (unsigned long long)(report->elapsed_ns / 1000u), report->var_count, report->missing_count) < 0) {
+        return -1;
+    }
+    return 0;
+}
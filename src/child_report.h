@@ -0,0 +1,86 @@
+/*
+ * child_report.h
+ *
+ * Description:
+ * Binary TLV form of the child's report, selected by passing
+ * CHILD_REPORT_FORMAT=binary to the child. The child assembles the whole
+ * report in memory and emits it with one write(); the parent (and the shared
+ * log reader) decode it without any string parsing.
+ *
+ * Layout (native byte order, no padding):
+ *   header: magic u32, version u16, reserved u16, total length u32
+ *   fields: tag u16, flags u16, value length u32, value bytes
+ * A CHILD_REPORT_TAG_VAR value is: name length u32, name bytes, value bytes;
+ * its flags carry CHILD_REPORT_VAR_FOUND when the variable was present.
+ */
+#ifndef CHILD_REPORT_H
+#define CHILD_REPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CHILD_REPORT_MAGIC 0x54505243u     /* "CRPT" */
+#define CHILD_REPORT_VERSION 1u
+#define CHILD_REPORT_HEADER_SIZE 12u
+#define CHILD_REPORT_FIELD_HEADER_SIZE 8u
+#define CHILD_REPORT_MAX_SIZE (16u * 1024u * 1024u)
+
+/* Name of the environment variable that selects the child's report format. */
+#define ENV_VAR_REPORT_FORMAT_NAME "CHILD_REPORT_FORMAT"
+
+#define CHILD_REPORT_VAR_FOUND 0x1u
+
+typedef enum child_report_tag_e {
+    CHILD_REPORT_TAG_NAME = 1,          /* argv[0] */
+    CHILD_REPORT_TAG_PID = 2,           /* int32 */
+    CHILD_REPORT_TAG_PPID = 3,          /* int32 */
+    CHILD_REPORT_TAG_FILTER_FILE = 4,   /* Path of the filter file */
+    CHILD_REPORT_TAG_VAR = 5,           /* One filtered variable */
+    CHILD_REPORT_TAG_TIMING = 6         /* Start (CLOCK_REALTIME ns) u64, elapsed ns u64 */
+} child_report_tag_t;
+
+typedef struct child_report_builder_s {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;        /* Set once an allocation failed; later calls are no-ops. */
+} child_report_builder_t;
+
+typedef struct child_report_var_s {
+    const char *name;
+    uint32_t name_len;
+    const char *value;  /* NULL if the variable was missing */
+    uint32_t value_len;
+} child_report_var_t;
+
+/* Decoded report; all pointers point into the encoded buffer. */
+typedef struct child_report_s {
+    const char *name;
+    uint32_t name_len;
+    int32_t pid;
+    int32_t ppid;
+    const char *filter_file;
+    uint32_t filter_file_len;
+    uint64_t start_ns;
+    uint64_t elapsed_ns;
+    size_t var_count;
+    size_t missing_count;
+    const char *fields;     /* Start of the field area, for child_report_next_var(). */
+    size_t fields_size;
+} child_report_t;
+
+int child_report_begin(child_report_builder_t *builder);
+void child_report_add(child_report_builder_t *builder, uint16_t tag, uint16_t flags, const void *value,
+                      size_t value_len);
+void child_report_add_var(child_report_builder_t *builder, const char *name, const char *value);
+int child_report_finish(child_report_builder_t *builder);
+void child_report_free(child_report_builder_t *builder);
+
+long child_report_frame_length(const void *data, size_t available);
+int child_report_decode(const void *data, size_t length, child_report_t *report);
+bool child_report_next_var(const child_report_t *report, size_t *cursor, child_report_var_t *var);
+int child_report_render(FILE *out, const child_report_t *report);
+
+#endif /* CHILD_REPORT_H */
@@ -0,0 +1,92 @@
+/*
+ * env_dump.c
+ *
+ * Description:
+ * Implements env_dump_writev(): every entry contributes two iovecs (the string
+ * and a shared "\n"), and the array is flushed whenever IOV_MAX entries are
+ * queued. Short writes and EINTR are handled by advancing through the iovecs.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "env_dump.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/*
+ * Purpose:
+ *   Writes all given iovecs to a file descriptor, retrying after short writes
+ *   and EINTR. The iovec array is modified in place as data is consumed.
+ * Receives:
+ *   fd:        Destination file descriptor.
+ *   iov:       Array of iovecs to write.
+ *   iov_count: Number of entries in 'iov'.
+ * Returns:
+ *   0 on success, -1 on a write error (errno is set).
+ */
+static int writev_all(int fd, struct iovec *iov, int iov_count) {
+    while (iov_count > 0) {
+        ssize_t written = writev(fd, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        size_t remaining = (size_t)written;
+        while (iov_count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *)iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Writes each string of an array followed by a newline to a file descriptor,
+ *   batching up to IOV_MAX iovecs per writev() call. Any stdio buffering of the
+ *   same descriptor must be flushed by the caller beforehand to keep ordering.
+ * Receives:
+ *   fd:    Destination file descriptor (e.g., STDOUT_FILENO).
+ *   vars:  Array of NUL-terminated strings.
+ *   count: Number of strings in 'vars'.
+ * Returns:
+ *   0 on success, -1 on a write error (errno is set).
+ */
+int env_dump_writev(int fd, char **vars, size_t count) {
+    static char newline[] = "\n";
+    struct iovec iov[IOV_MAX];
+    int iov_count = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        iov[iov_count].iov_base = vars[i];
+        iov[iov_count].iov_len = strlen(vars[i]);
+        iov[iov_count + 1].iov_base = newline;
+        iov[iov_count + 1].iov_len = 1;
+        iov_count += 2;
+
+        if (iov_count > IOV_MAX - 2) {
+            if (writev_all(fd, iov, iov_count) != 0) {
+                return -1;
+            }
+            iov_count = 0;
+        }
+    }
+    if (iov_count > 0 && writev_all(fd, iov, iov_count) != 0) {
+        return -1;
+    }
+    return 0;
+}
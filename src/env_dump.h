@@ -0,0 +1,16 @@
+/*
+ * env_dump.h
+ *
+ * Description:
+ * Bulk output of an array of environment strings. The entries are gathered into
+ * an iovec array and written with as few writev() calls as IOV_MAX allows,
+ * instead of one formatted (and possibly line-buffered) printf() per entry.
+ */
+#ifndef ENV_DUMP_H
+#define ENV_DUMP_H
+
+#include <stddef.h>
+
+int env_dump_writev(int fd, char **vars, size_t count);
+
+#endif /* ENV_DUMP_H */
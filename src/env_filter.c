@@ -0,0 +1,191 @@
+/*
+ * env_filter.c
+ *
+ * Description:
+ * Loads the environment filter file declared in env_filter.h. The file is read
+ * once per change instead of once per launched child; env_rcu.c keeps, for
+ * every filter name, the index of the matching environment entry.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "env_filter.h"
+#include "env_snapshot.h"
+#include "parent_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+ * Purpose:
+ *   Tells whether a file status matches the identity recorded in a filter.
+ * Receives:
+ *   filter: The filter.
+ *   st:     Status of the file.
+ * Returns:
+ *   true if the file looks unchanged.
+ */
+static bool same_file(const env_filter_t *filter, const struct stat *st) {
+    return filter->dev == st->st_dev && filter->ino == st->st_ino && filter->size == st->st_size &&
+           filter->mtime.tv_sec == st->st_mtim.tv_sec && filter->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Reads a filter file. Empty lines and lines starting with '#' are skipped;
+ *   the trailing newline of each line is removed.
+ * Receives:
+ *   path: Path of the filter file.
+ * Returns:
+ *   The new filter (free with env_filter_free(); 'users' is 0), or NULL on
+ *   failure (an error message is logged).
+ */
+env_filter_t *env_filter_load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        plog_perror("Parent: Failed to open environment filter file");
+        return NULL;
+    }
+
+    env_filter_t *filter = calloc(1, sizeof(*filter));
+    size_t capacity = 16;
+    size_t names_capacity = 256;
+    size_t names_used = 0;
+    if (filter != NULL) {
+        filter->name_hashes = malloc(capacity * sizeof(uint32_t));
+        filter->name_lens = malloc(capacity * sizeof(uint32_t));
+        filter->offsets = malloc(capacity * sizeof(uint32_t));
+        filter->names = malloc(names_capacity);
+    }
+    if (filter == NULL || filter->name_hashes == NULL || filter->name_lens == NULL ||
+        filter->offsets == NULL || filter->names == NULL) {
+        plog_perror("Parent: Failed to allocate memory for environment filter");
+        env_filter_free(filter);
+        fclose(file);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        plog_perror("Parent: Failed to stat environment filter file");
+        env_filter_free(filter);
+        fclose(file);
+        return NULL;
+    }
+    filter->dev = st.st_dev;
+    filter->ino = st.st_ino;
+    filter->size = st.st_size;
+    filter->mtime = st.st_mtim;
+
+    char *line_buf = NULL;
+    size_t line_buf_size = 0;
+    ssize_t line_len;
+    bool failed = false;
+
+    while (!failed && (line_len = getline(&line_buf, &line_buf_size, file)) != -1) {
+        if (line_len > 0 && line_buf[line_len - 1] == '\n') {
+            line_buf[--line_len] = '\0';
+        }
+        if (line_len == 0 || line_buf[0] == '#') {
+            continue;
+        }
+
+        if (filter->count == capacity) {
+            capacity *= 2;
+            uint32_t *hashes = realloc(filter->name_hashes, capacity * sizeof(uint32_t));
+            if (hashes != NULL) filter->name_hashes = hashes;
+            uint32_t *lens = realloc(filter->name_lens, capacity * sizeof(uint32_t));
+            if (lens != NULL) filter->name_lens = lens;
+            uint32_t *offsets = realloc(filter->offsets, capacity * sizeof(uint32_t));
+            if (offsets != NULL) filter->offsets = offsets;
+            failed = hashes == NULL || lens == NULL || offsets == NULL;
+        }
+        while (!failed && names_used + (size_t)line_len + 1 > names_capacity) {
+            char *names = names_capacity <= UINT32_MAX / 2 ? realloc(filter->names, names_capacity * 2) : NULL;
+            if (names == NULL) {
+                failed = true;
+            } else {
+                filter->names = names;
+                names_capacity *= 2;
+            }
+        }
+        if (failed) {
+            plog_perror("Parent: Failed to grow environment filter");
+            break;
+        }
+
+        memcpy(filter->names + names_used, line_buf, (size_t)line_len + 1);
+        filter->offsets[filter->count] = (uint32_t)names_used;
+        filter->name_lens[filter->count] = (uint32_t)line_len;
+        filter->name_hashes[filter->count] = env_name_hash(line_buf, (size_t)line_len);
+        filter->count++;
+        names_used += (size_t)line_len + 1;
+    }
+    free(line_buf);
+
+    if (!failed && ferror(file)) {
+        plog_perror("Parent: Error reading from filter file");
+        failed = true;
+    }
+    if (fclose(file) != 0) {
+        plog_perror("Parent: fclose failed for filter file");
+    }
+    if (failed) {
+        env_filter_free(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+/*
+ * Purpose:
+ *   Checks whether a filter still reflects the file at 'path'.
+ * Receives:
+ *   filter: The loaded filter, or NULL.
+ *   path:   Path of the filter file.
+ * Returns:
+ *   true if the file has the same identity, size and modification time as when
+ *   the filter was loaded; false otherwise (including when it cannot be stat'ed).
+ */
+bool env_filter_is_current(const env_filter_t *filter, const char *path) {
+    struct stat st;
+    return filter != NULL && stat(path, &st) == 0 && same_file(filter, &st);
+}
+
+/*
+ * Purpose:
+ *   Tells whether filter name 'index' is the given variable name.
+ * Receives:
+ *   filter:   The filter.
+ *   index:    Index of the filter name.
+ *   name:     The variable name (need not be NUL-terminated).
+ *   name_len: Length of the name.
+ *   hash:     env_name_hash() of the name.
+ * Returns:
+ *   true on a match.
+ */
+bool env_filter_matches(const env_filter_t *filter, size_t index, const char *name, size_t name_len,
+                        uint32_t hash) {
+    return filter->name_hashes[index] == hash && filter->name_lens[index] == name_len &&
+           memcmp(env_filter_name(filter, index), name, name_len) == 0;
+}
+
+/*
+ * Purpose:
+ *   Frees a filter.
+ * Receives:
+ *   filter: The filter (NULL is ignored).
+ * Returns:
+ *   None (void).
+ */
+void env_filter_free(env_filter_t *filter) {
+    if (filter == NULL) {
+        return;
+    }
+    free(filter->name_hashes);
+    free(filter->name_lens);
+    free(filter->offsets);
+    free(filter->names);
+    free(filter);
+}
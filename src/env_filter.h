@@ -0,0 +1,44 @@
+/*
+ * env_filter.h
+ *
+ * Description:
+ * Parsed environment filter file: the variable names a child may inherit, one
+ * per line ('#' starts a comment line). Names are kept packed with their
+ * hashes and lengths (as in env_snapshot.h), so the entries that refer to one
+ * variable are found without touching the name strings. The file identity
+ * (device, inode, size, modification time) is remembered to notice edits.
+ */
+#ifndef ENV_FILTER_H
+#define ENV_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef struct env_filter_s {
+    size_t count;           /* Number of names (duplicates are kept, in file order). */
+    uint32_t *name_hashes;  /* FNV-1a hash of each name. */
+    uint32_t *name_lens;    /* Length of each name. */
+    uint32_t *offsets;      /* Offset of each NUL-terminated name in 'names'. */
+    char *names;
+    dev_t dev;              /* Identity of the file the names were read from. */
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned users;         /* Environment versions sharing the filter (writer only). */
+} env_filter_t;
+
+env_filter_t *env_filter_load(const char *path);
+bool env_filter_is_current(const env_filter_t *filter, const char *path);
+bool env_filter_matches(const env_filter_t *filter, size_t index, const char *name, size_t name_len,
+                        uint32_t hash);
+void env_filter_free(env_filter_t *filter);
+
+/* Returns the NUL-terminated name 'index'. */
+static inline const char *env_filter_name(const env_filter_t *filter, size_t index) {
+    return filter->names + filter->offsets[index];
+}
+
+#endif /* ENV_FILTER_H */
@@ -0,0 +1,388 @@
+/*
+ * env_rcu.c
+ *
+ * Description:
+ * Implements the published environment (see env_rcu.h).
+ *
+ * A reader must not increment the reference count of a version that the
+ * writer may already be freeing. Between loading the current pointer and
+ * incrementing that version's count, a reader is therefore counted in
+ * 'g_env_rcu_acquiring'. The writer frees a retired version only if:
+ * - its count is zero, and
+ * - 'acquiring' reads zero after the version was replaced.
+ * A reader that enters later loads the new pointer. A reader that was
+ * already inside has finished its increment once 'acquiring' drops back.
+ * All these accesses are sequentially consistent, so no reader can
+ * resurrect a freed version.
+ *
+ * Releasing never frees anything: a reader that dropped the last reference
+ * cannot know whether another reader is just about to take one. Freeing is
+ * left to env_rcu_reclaim(), which the writer runs once per command-loop
+ * iteration and after every publish.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "env_rcu.h"
+#include "parent_log.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static _Atomic(env_version_t *) g_env_rcu_current;
+static atomic_uint g_env_rcu_acquiring;         // Readers between pointer load and reference increment
+static env_version_t *g_env_rcu_retired;        // Replaced versions not freed yet (writer only)
+static size_t g_env_rcu_retired_count;
+static uint64_t g_env_rcu_next_generation = 1;  // Writer only
+
+/*
+ * Purpose:
+ *   Frees a version, the snapshot and filter slots it owns, and its filter
+ *   once no other version shares it.
+ * Receives:
+ *   version: The version (no reader may hold it).
+ * Returns:
+ *   None (void).
+ */
+static void free_version(env_version_t *version) {
+    env_snapshot_free(&version->snap);
+    free(version->filter_slots);
+    if (version->filter != NULL && --version->filter->users == 0) {
+        env_filter_free(version->filter);
+    }
+    free(version);
+}
+
+/*
+ * Purpose:
+ *   Publishes a new current version and retires the previous one. Writer only.
+ * Receives:
+ *   snap:  The snapshot; ownership moves to the version (it is reset to empty
+ *          on success).
+ *   filter: The filter the slots refer to, or NULL.
+ *   slots: Filter slots (one per filter name, NULL without a filter);
+ *          ownership moves to the version on success.
+ * Returns:
+ *   0 on success, -1 on allocation failure (snapshot and slots are left to the
+ *   caller; an error message is logged).
+ */
+static int publish_version(env_snapshot_t *snap, env_filter_t *filter, long *slots) {
+    env_version_t *version = malloc(sizeof(*version));
+    if (version == NULL) {
+        plog_perror("Parent: Failed to allocate environment version");
+        return -1;
+    }
+    version->snap = *snap;
+    version->filter = filter;
+    version->filter_slots = slots;
+    version->generation = g_env_rcu_next_generation++;
+    atomic_init(&version->refs, 0);
+    version->next_retired = NULL;
+    memset(snap, 0, sizeof(*snap));
+    if (filter != NULL) {
+        filter->users++;
+    }
+
+    env_version_t *previous = atomic_exchange(&g_env_rcu_current, version);
+    if (previous != NULL) {
+        previous->next_retired = g_env_rcu_retired;
+        g_env_rcu_retired = previous;
+        g_env_rcu_retired_count++;
+    }
+    env_rcu_reclaim();
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Copies the filter slots of the current version. Writer only.
+ * Receives:
+ *   current: The current version.
+ *   slots:   Receives the copy (NULL if the version has no filter).
+ * Returns:
+ *   0 on success, -1 on allocation failure (an error message is logged).
+ */
+static int copy_slots(const env_version_t *current, long **slots) {
+    *slots = NULL;
+    if (current->filter == NULL) {
+        return 0;
+    }
+    *slots = malloc((current->filter->count > 0 ? current->filter->count : 1) * sizeof(long));
+    if (*slots == NULL) {
+        plog_perror("Parent: Failed to allocate filtered environment");
+        return -1;
+    }
+    memcpy(*slots, current->filter_slots, current->filter->count * sizeof(long));
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Builds a snapshot of an environment array and publishes it, resolving
+ *   every filter name against it. Writer only.
+ * Receives:
+ *   source_env: The environment to copy (e.g., 'environ').
+ *   filter:     A newly loaded filter to use from now on, or NULL to keep the
+ *               current version's filter. On success the versions own it.
+ * Returns:
+ *   0 on success, -1 on failure (the current version stays published and a
+ *   new 'filter' is left to the caller).
+ */
+int env_rcu_publish(char **source_env, env_filter_t *filter) {
+    if (filter == NULL) {
+        env_version_t *current = atomic_load(&g_env_rcu_current);
+        filter = current != NULL ? current->filter : NULL;
+    }
+
+    env_snapshot_t snap;
+    if (env_snapshot_build(&snap, source_env) != 0) {
+        return -1;
+    }
+    long *slots = NULL;
+    if (filter != NULL) {
+        slots = malloc((filter->count > 0 ? filter->count : 1) * sizeof(long));
+        if (slots == NULL) {
+            plog_perror("Parent: Failed to allocate filtered environment");
+            env_snapshot_free(&snap);
+            return -1;
+        }
+        for (size_t i = 0; i < filter->count; ++i) {
+            long index = env_snapshot_find(&snap, env_filter_name(filter, i), filter->name_lens[i]);
+            bool has_value = index >= 0 && env_snapshot_entry(&snap, (size_t)index)[filter->name_lens[i]] == '=';
+            slots[i] = has_value ? index : -1;
+        }
+    }
+    if (publish_version(&snap, filter, slots) != 0) {
+        free(slots);
+        env_snapshot_free(&snap);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Publishes a version in which one variable is set, derived from the current
+ *   version: only the variable's entry and the filter slots naming it change.
+ *   The caller updates 'environ' itself (setenv()). Writer only.
+ * Receives:
+ *   name:  The variable name (non-empty, without '=').
+ *   value: The new value.
+ * Returns:
+ *   0 on success, -1 on failure (the current version stays published; an error
+ *   message is logged).
+ */
+int env_rcu_setenv(const char *name, const char *value) {
+    env_version_t *current = atomic_load(&g_env_rcu_current);
+    if (current == NULL) {
+        plog_err("Parent: No environment snapshot published.\n");
+        return -1;
+    }
+    long *slots = NULL;
+    if (copy_slots(current, &slots) != 0) {
+        return -1;
+    }
+    env_snapshot_t snap;
+    size_t index = 0;
+    if (env_snapshot_set(&snap, &current->snap, name, value, &index) != 0) {
+        free(slots);
+        return -1;
+    }
+    if (current->filter != NULL) {
+        size_t name_len = strlen(name);
+        uint32_t hash = env_name_hash(name, name_len);
+        for (size_t i = 0; i < current->filter->count; ++i) {
+            if (env_filter_matches(current->filter, i, name, name_len, hash)) {
+                slots[i] = (long)index;
+            }
+        }
+    }
+    if (publish_version(&snap, current->filter, slots) != 0) {
+        free(slots);
+        env_snapshot_free(&snap);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Publishes a version without one variable, derived from the current
+ *   version; filter slots are remapped while the entries are copied. Nothing
+ *   is published if the variable is not set. The caller updates 'environ'
+ *   itself (unsetenv()). Writer only.
+ * Receives:
+ *   name: The variable name (non-empty, without '=').
+ * Returns:
+ *   0 on success (including when the variable was not set), -1 on failure
+ *   (the current version stays published; an error message is logged).
+ */
+int env_rcu_unsetenv(const char *name) {
+    env_version_t *current = atomic_load(&g_env_rcu_current);
+    if (current == NULL) {
+        plog_err("Parent: No environment snapshot published.\n");
+        return -1;
+    }
+    long *slots = NULL;
+    if (copy_slots(current, &slots) != 0) {
+        return -1;
+    }
+    env_snapshot_t snap;
+    size_t slot_count = current->filter != NULL ? current->filter->count : 0;
+    long removed = env_snapshot_unset(&snap, &current->snap, name, slots, slot_count);
+    if (removed <= 0) {
+        free(slots);
+        return removed == 0 ? 0 : -1;
+    }
+    if (publish_version(&snap, current->filter, slots) != 0) {
+        free(slots);
+        env_snapshot_free(&snap);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Returns the filter of the current version. Writer only (the filter may
+ *   be freed once a later version replaces it).
+ * Receives:
+ *   None.
+ * Returns:
+ *   The filter, or NULL if none is loaded.
+ */
+env_filter_t *env_rcu_filter(void) {
+    env_version_t *current = atomic_load(&g_env_rcu_current);
+    return current != NULL ? current->filter : NULL;
+}
+
+/*
+ * Purpose:
+ *   Fills an environment array with the cached filtered entries of a version,
+ *   in filter file order. The strings point into the version's snapshot, so
+ *   they are valid while the version is held.
+ * Receives:
+ *   version: A version held by the caller.
+ *   vars:    Array with room for one pointer per filter name.
+ * Returns:
+ *   The number of entries written (not NULL-terminated).
+ */
+size_t env_version_filtered(const env_version_t *version, char **vars) {
+    size_t count = 0;
+    if (version->filter == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < version->filter->count; ++i) {
+        if (version->filter_slots[i] >= 0) {
+            vars[count++] = (char *)env_snapshot_entry(&version->snap, (size_t)version->filter_slots[i]);
+        }
+    }
+    return count;
+}
+
+/*
+ * Purpose:
+ *   Takes a reference to the current version without locking. Any thread.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The current version (to be passed to env_rcu_release()), or NULL if
+ *   nothing has been published yet.
+ */
+env_version_t *env_rcu_acquire(void) {
+    atomic_fetch_add(&g_env_rcu_acquiring, 1);
+    env_version_t *version = atomic_load(&g_env_rcu_current);
+    if (version != NULL) {
+        atomic_fetch_add(&version->refs, 1);
+    }
+    atomic_fetch_sub(&g_env_rcu_acquiring, 1);
+    return version;
+}
+
+/*
+ * Purpose:
+ *   Drops a reference taken with env_rcu_acquire(). Any thread.
+ * Receives:
+ *   version: The version (NULL is ignored).
+ * Returns:
+ *   None (void).
+ */
+void env_rcu_release(env_version_t *version) {
+    if (version != NULL) {
+        atomic_fetch_sub_explicit(&version->refs, 1, memory_order_release);
+    }
+}
+
+/*
+ * Purpose:
+ *   Frees every retired version that no reader holds any more. Writer only.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void env_rcu_reclaim(void) {
+    if (g_env_rcu_retired == NULL || atomic_load(&g_env_rcu_acquiring) != 0) {
+        return;     // A reader may still be about to take a reference; try again later.
+    }
+    env_version_t **link = &g_env_rcu_retired;
+    while (*link != NULL) {
+        env_version_t *version = *link;
+        if (atomic_load(&version->refs) == 0) {
+            *link = version->next_retired;
+            g_env_rcu_retired_count--;
+            free_version(version);
+        } else {
+            link = &version->next_retired;
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Returns the generation of the current version.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The generation, or 0 if nothing has been published.
+ */
+uint64_t env_rcu_generation(void) {
+    env_version_t *version = env_rcu_acquire();
+    uint64_t generation = version != NULL ? version->generation : 0;
+    env_rcu_release(version);
+    return generation;
+}
+
+/*
+ * Purpose:
+ *   Returns the number of retired versions still waiting for readers. Writer only.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The count.
+ */
+size_t env_rcu_retired_count(void) {
+    return g_env_rcu_retired_count;
+}
+
+/*
+ * Purpose:
+ *   Frees the current and all retired versions. Only called when no reader
+ *   can exist any more (launcher threads stopped).
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void env_rcu_shutdown(void) {
+    env_version_t *version = atomic_exchange(&g_env_rcu_current, NULL);
+    if (version != NULL) {
+        free_version(version);
+    }
+    while (g_env_rcu_retired != NULL) {
+        version = g_env_rcu_retired;
+        g_env_rcu_retired = version->next_retired;
+        free_version(version);
+    }
+    g_env_rcu_retired_count = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * env_rcu.h
+ *
+ * Description:
+ * Publication of the parent's environment snapshot (env_snapshot.h) to
+ * concurrent launcher threads, in the style of read-copy-update. A published
+ * version is immutable and carries a generation number. Readers take the
+ * current version with env_rcu_acquire() without any lock, use it for as long
+ * as they like and drop it with env_rcu_release(). The single writer (the
+ * command-loop thread) builds a new version and swaps it in with
+ * env_rcu_publish(); the old version is retired and freed by
+ * env_rcu_reclaim() once no reader holds it any more.
+ *
+ * Each version also caches the filtered environment for children: for every
+ * name of the filter file (env_filter.h), the index of its entry in the
+ * snapshot. env_rcu_setenv()/env_rcu_unsetenv() derive the next version from
+ * the current one by patching only the changed variable's entry and the
+ * filter slots that name it, instead of rebuilding from 'environ'.
+ */
+#ifndef ENV_RCU_H
+#define ENV_RCU_H
+
+#include "env_snapshot.h"
+#include "env_filter.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct env_version_s {
+    env_snapshot_t snap;                /* Immutable once published. */
+    env_filter_t *filter;               /* Filter names, shared between versions; or NULL. */
+    long *filter_slots;                 /* Per filter name: index of its entry in 'snap', or -1. */
+    uint64_t generation;                /* 1 for the first published version. */
+    atomic_uint refs;                   /* Readers holding this version. */
+    struct env_version_s *next_retired; /* Writer only. */
+} env_version_t;
+
+int env_rcu_publish(char **source_env, env_filter_t *filter);
+int env_rcu_setenv(const char *name, const char *value);
+int env_rcu_unsetenv(const char *name);
+env_filter_t *env_rcu_filter(void);
+size_t env_version_filtered(const env_version_t *version, char **vars);
+env_version_t *env_rcu_acquire(void);
+void env_rcu_release(env_version_t *version);
+void env_rcu_reclaim(void);
+uint64_t env_rcu_generation(void);
+size_t env_rcu_retired_count(void);
+void env_rcu_shutdown(void);
+
+#endif /* ENV_RCU_H */
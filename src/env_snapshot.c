@@ -0,0 +1,342 @@
+/*
+ * env_snapshot.c
+ *
+ * Description:
+ * Builds and queries the struct-of-arrays environment snapshot declared in
+ * env_snapshot.h. A lookup hashes the requested name once and then streams
+ * through the contiguous hash and length arrays; the packed string buffer is
+ * only touched for candidates whose hash and length both match.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "env_snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+/*
+ * Purpose:
+ *   Computes the 32-bit FNV-1a hash of an environment variable name.
+ * Receives:
+ *   name:     Pointer to the first character of the name (need not be NUL-terminated).
+ *   name_len: Number of characters of the name to hash.
+ * Returns:
+ *   The hash value.
+ */
+uint32_t env_name_hash(const char *name, size_t name_len) {
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < name_len; ++i) {
+        hash ^= (unsigned char)name[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * Purpose:
+ *   Builds a snapshot of a NULL-terminated "NAME=VALUE" environment array. All
+ *   strings are copied into one packed buffer, so the snapshot stays valid even
+ *   if the source array is modified afterwards. Entries without '=' are kept with
+ *   the whole string as their name.
+ * Receives:
+ *   snap:       Pointer to the snapshot to fill. Its previous contents are not freed.
+ *   source_env: The environment array to copy (e.g., 'environ'). May be NULL,
+ *               which yields an empty snapshot.
+ * Returns:
+ *   0 on success.
+ *   -1 on memory allocation failure or if the environment is too large for
+ *      32-bit offsets; 'snap' is left empty and an error message is printed.
+ */
+int env_snapshot_build(env_snapshot_t *snap, char **source_env) {
+    memset(snap, 0, sizeof(*snap));
+
+    size_t count = 0;
+    size_t total = 0;
+    if (source_env != NULL) {
+        for (char **env = source_env; *env != NULL; ++env) {
+            total += strlen(*env) + 1;
+            count++;
+        }
+    }
+    if (total > UINT32_MAX) {
+        fprintf(stderr, "Parent: Environment too large for snapshot (%zu bytes).\n", total);
+        return -1;
+    }
+
+    snap->name_hashes = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    snap->name_lens = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    snap->offsets = malloc((count + 1) * sizeof(uint32_t));
+    snap->strings = malloc(total > 0 ? total : 1);
+    if (snap->name_hashes == NULL || snap->name_lens == NULL ||
+        snap->offsets == NULL || snap->strings == NULL) {
+        perror("Parent: Failed to allocate memory for environment snapshot");
+        env_snapshot_free(snap);
+        return -1;
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const char *entry = source_env[i];
+        size_t entry_len = strlen(entry);
+        const char *eq = memchr(entry, '=', entry_len);
+        size_t name_len = eq != NULL ? (size_t)(eq - entry) : entry_len;
+
+        memcpy(snap->strings + pos, entry, entry_len + 1);
+        snap->offsets[i] = (uint32_t)pos;
+        snap->name_lens[i] = (uint32_t)name_len;
+        snap->name_hashes[i] = env_name_hash(entry, name_len);
+        pos += entry_len + 1;
+    }
+    snap->offsets[count] = (uint32_t)pos;
+    snap->count = count;
+    snap->strings_size = pos;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Frees all memory owned by a snapshot and resets it to the empty state.
+ * Receives:
+ *   snap: Pointer to the snapshot. Handles NULL gracefully.
+ * Returns:
+ *   None (void).
+ */
+void env_snapshot_free(env_snapshot_t *snap) {
+    if (snap == NULL) {
+        return;
+    }
+    free(snap->name_hashes);
+    free(snap->name_lens);
+    free(snap->offsets);
+    free(snap->strings);
+    memset(snap, 0, sizeof(*snap));
+}
+
+/*
+ * Purpose:
+ *   Finds the index of a variable in the snapshot.
+ * Receives:
+ *   snap:     The snapshot to search.
+ *   name:     The variable name (need not be NUL-terminated).
+ *   name_len: Length of the name.
+ * Returns:
+ *   The index of the first "NAME=value" entry with that name, or -1 if it is
+ *   not present. Entries without '=' are skipped, so a malformed "NAME" does
+ *   not hide a later valid definition.
+ */
+long env_snapshot_find(const env_snapshot_t *snap, const char *name, size_t name_len) {
+    if (snap == NULL || name == NULL || name_len == 0) {
+        return -1;
+    }
+    uint32_t hash = env_name_hash(name, name_len);
+    for (size_t i = 0; i < snap->count; ++i) {
+        if (snap->name_hashes[i] == hash && snap->name_lens[i] == name_len &&
+            snap->strings[snap->offsets[i] + name_len] == '=' &&
+            memcmp(snap->strings + snap->offsets[i], name, name_len) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Purpose:
+ *   Looks up the value of a variable in the snapshot, like getenv().
+ * Receives:
+ *   snap: The snapshot to search.
+ *   name: The NUL-terminated variable name.
+ * Returns:
+ *   A pointer to the VALUE part inside the snapshot's packed buffer, or NULL if
+ *   the variable is not present (or is stored without '='). The pointer stays
+ *   valid until the snapshot is freed.
+ */
+const char *env_snapshot_lookup(const env_snapshot_t *snap, const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+    size_t name_len = strlen(name);
+    long index = env_snapshot_find(snap, name, name_len);
+    if (index < 0) {
+        return NULL;
+    }
+    const char *entry = env_snapshot_entry(snap, (size_t)index);
+    if (entry[name_len] != '=') {
+        return NULL;
+    }
+    return entry + name_len + 1;
+}
+
+/*
+ * Purpose:
+ *   Allocates the arrays of an empty snapshot sized for 'count' entries and
+ *   'total' bytes of packed strings.
+ * Receives:
+ *   snap:  Pointer to the snapshot to fill (cleared first).
+ *   count: Number of entries.
+ *   total: Size of the packed string buffer.
+ * Returns:
+ *   0 on success, -1 on allocation failure ('snap' left empty, error printed).
+ */
+static int snapshot_alloc(env_snapshot_t *snap, size_t count, size_t total) {
+    memset(snap, 0, sizeof(*snap));
+    snap->name_hashes = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    snap->name_lens = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    snap->offsets = malloc((count + 1) * sizeof(uint32_t));
+    snap->strings = malloc(total > 0 ? total : 1);
+    if (snap->name_hashes == NULL || snap->name_lens == NULL ||
+        snap->offsets == NULL || snap->strings == NULL) {
+        perror("Parent: Failed to allocate memory for environment snapshot");
+        env_snapshot_free(snap);
+        return -1;
+    }
+    snap->count = count;
+    snap->strings_size = total;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Builds a copy of a snapshot in which one variable is set, like setenv()
+ *   with overwrite: the first entry with that name gets the new value in place,
+ *   or a new entry is appended. Only the changed entry is hashed and formatted;
+ *   every other entry is carried over with block copies, so entry indices do
+ *   not change.
+ * Receives:
+ *   dst:   Pointer to the snapshot to fill. Its previous contents are not freed.
+ *   src:   The snapshot to start from (not modified).
+ *   name:  The variable name (non-empty, without '=').
+ *   value: The new value.
+ *   index: Receives the index of the changed or appended entry.
+ * Returns:
+ *   0 on success.
+ *   -1 on memory allocation failure or if the result is too large for 32-bit
+ *      offsets; 'dst' is left empty and an error message is printed.
+ */
+int env_snapshot_set(env_snapshot_t *dst, const env_snapshot_t *src, const char *name, const char *value,
+                     size_t *index) {
+    size_t name_len = strlen(name);
+    size_t entry_size = name_len + 1 + strlen(value) + 1;
+    long found = env_snapshot_find(src, name, name_len);
+    size_t at = found >= 0 ? (size_t)found : src->count;
+    size_t old_size = found >= 0 ? (size_t)(src->offsets[at + 1] - src->offsets[at]) : 0;
+    size_t count = found >= 0 ? src->count : src->count + 1;
+    size_t total = src->strings_size - old_size + entry_size;
+    if (total > UINT32_MAX) {
+        memset(dst, 0, sizeof(*dst));
+        fprintf(stderr, "Parent: Environment too large for snapshot (%zu bytes).\n", total);
+        return -1;
+    }
+    if (snapshot_alloc(dst, count, total) != 0) {
+        return -1;
+    }
+
+    size_t head = src->offsets != NULL ? src->offsets[at] : 0;
+    size_t tail = src->strings_size - head - old_size;
+    memcpy(dst->name_hashes, src->name_hashes, src->count * sizeof(uint32_t));
+    memcpy(dst->name_lens, src->name_lens, src->count * sizeof(uint32_t));
+    memcpy(dst->offsets, src->offsets, (at + 1) * sizeof(uint32_t));
+    memcpy(dst->strings, src->strings, head);
+
+    char *entry = dst->strings + head;
+    memcpy(entry, name, name_len);
+    entry[name_len] = '=';
+    memcpy(entry + name_len + 1, value, entry_size - name_len - 1);
+    dst->name_hashes[at] = env_name_hash(name, name_len);
+    dst->name_lens[at] = (uint32_t)name_len;
+
+    // Entries after the changed one move by the size difference.
+    memcpy(entry + entry_size, src->strings + head + old_size, tail);
+    for (size_t i = at + 1; i <= count; ++i) {
+        dst->offsets[i] = (uint32_t)(found >= 0 ? src->offsets[i] - old_size + entry_size
+                                                : head + entry_size);
+    }
+    *index = at;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Builds a copy of a snapshot without any entry of one variable, like
+ *   unsetenv(). Entry indices held by the caller (e.g., a cached filtered
+ *   environment) are remapped to the copy in the same pass.
+ * Receives:
+ *   dst:         Pointer to the snapshot to fill. Its previous contents are not
+ *                freed; it is left empty if nothing was removed.
+ *   src:         The snapshot to start from (not modified).
+ *   name:        The variable name (non-empty, without '=').
+ *   indices:     Entry indices into 'src' to remap (-1 entries are kept);
+ *                removed entries become -1. May be NULL if 'index_count' is 0.
+ *   index_count: Number of indices.
+ * Returns:
+ *   The number of entries removed (0 if the variable was not present), or -1
+ *   on memory allocation failure ('dst' left empty, error printed).
+ */
+long env_snapshot_unset(env_snapshot_t *dst, const env_snapshot_t *src, const char *name,
+                        long *indices, size_t index_count) {
+    size_t name_len = strlen(name);
+    uint32_t hash = env_name_hash(name, name_len);
+    size_t removed = 0;
+    size_t removed_bytes = 0;
+    size_t first_removed = 0;
+    for (size_t i = 0; i < src->count; ++i) {
+        if (src->name_hashes[i] == hash && src->name_lens[i] == name_len &&
+            memcmp(env_snapshot_entry(src, i), name, name_len) == 0) {
+            if (removed == 0) {
+                first_removed = i;
+            }
+            removed++;
+            removed_bytes += src->offsets[i + 1] - src->offsets[i];
+        }
+    }
+    memset(dst, 0, sizeof(*dst));
+    if (removed == 0) {
+        return 0;
+    }
+    if (snapshot_alloc(dst, src->count - removed, src->strings_size - removed_bytes) != 0) {
+        return -1;
+    }
+
+    size_t out = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < src->count; ++i) {
+        size_t entry_size = src->offsets[i + 1] - src->offsets[i];
+        if (src->name_hashes[i] == hash && src->name_lens[i] == name_len &&
+            memcmp(env_snapshot_entry(src, i), name, name_len) == 0) {
+            continue;
+        }
+        memcpy(dst->strings + pos, env_snapshot_entry(src, i), entry_size);
+        dst->name_hashes[out] = src->name_hashes[i];
+        dst->name_lens[out] = src->name_lens[i];
+        dst->offsets[out] = (uint32_t)pos;
+        pos += entry_size;
+        out++;
+    }
+    dst->offsets[out] = (uint32_t)pos;
+
+    // Entries keep their order, so an index moves down by the number of
+    // removed entries before it (usually one: the variable appears once).
+    for (size_t k = 0; k < index_count; ++k) {
+        if (indices[k] < 0 || (size_t)indices[k] < first_removed) {
+            continue;
+        }
+        size_t old_index = (size_t)indices[k];
+        if (src->name_hashes[old_index] == hash && src->name_lens[old_index] == name_len &&
+            memcmp(env_snapshot_entry(src, old_index), name, name_len) == 0) {
+            indices[k] = -1;
+            continue;
+        }
+        size_t before = removed == 1 ? 1 : 0;
+        for (size_t i = first_removed; i < old_index && before < removed; ++i) {
+            if (src->name_hashes[i] == hash && src->name_lens[i] == name_len &&
+                memcmp(env_snapshot_entry(src, i), name, name_len) == 0) {
+                before++;
+            }
+        }
+        indices[k] = (long)(old_index - before);
+    }
+    return (long)removed;
+}
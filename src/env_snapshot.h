@@ -0,0 +1,45 @@
+/*
+ * env_snapshot.h
+ *
+ * Description:
+ * Struct-of-arrays snapshot of an environment block. Instead of a 'char **'
+ * array whose strings live at scattered heap/stack addresses, the snapshot keeps
+ * contiguous arrays of name hashes, name lengths and offsets into one packed
+ * buffer of "NAME=VALUE\0" strings, so scans walk memory linearly.
+ */
+#ifndef ENV_SNAPSHOT_H
+#define ENV_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct env_snapshot_s {
+    size_t count;           /* Number of entries. */
+    uint32_t *name_hashes;  /* FNV-1a hash of each NAME. */
+    uint32_t *name_lens;    /* Length of each NAME (without '='). */
+    uint32_t *offsets;      /* count + 1 offsets into 'strings'; the last one is the end. */
+    char *strings;          /* Packed "NAME=VALUE\0" entries. */
+    size_t strings_size;    /* Bytes used in 'strings'. */
+} env_snapshot_t;
+
+uint32_t env_name_hash(const char *name, size_t name_len);
+int env_snapshot_build(env_snapshot_t *snap, char **source_env);
+void env_snapshot_free(env_snapshot_t *snap);
+long env_snapshot_find(const env_snapshot_t *snap, const char *name, size_t name_len);
+const char *env_snapshot_lookup(const env_snapshot_t *snap, const char *name);
+int env_snapshot_set(env_snapshot_t *dst, const env_snapshot_t *src, const char *name, const char *value,
+                     size_t *index);
+long env_snapshot_unset(env_snapshot_t *dst, const env_snapshot_t *src, const char *name,
+                        long *indices, size_t index_count);
+
+/* Returns the packed "NAME=VALUE" string of entry 'index'. */
+static inline const char *env_snapshot_entry(const env_snapshot_t *snap, size_t index) {
+    return snap->strings + snap->offsets[index];
+}
+
+/* Returns the length of entry 'index' (excluding the terminating NUL). */
+static inline size_t env_snapshot_entry_len(const env_snapshot_t *snap, size_t index) {
+    return (size_t)(snap->offsets[index + 1] - snap->offsets[index]) - 1;
+}
+
+#endif /* ENV_SNAPSHOT_H */
@@ -0,0 +1,379 @@
+/*
+ * env_sort.c
+ *
+ * Description:
+ * MSD (most significant digit first) radix sort for environment strings. Each
+ * pass distributes a range of strings into 256 buckets by the byte at the current
+ * depth, then the non-trivial buckets are processed one byte deeper. Small ranges
+ * are finished with an insertion sort that compares only the unsorted suffixes.
+ * Pending ranges are kept on an explicit heap stack, so long common prefixes
+ * cannot overflow the call stack. The result is byte-identical to sorting with
+ * strcoll() under LC_COLLATE=C.
+ *
+ * From ENV_SORT_PARALLEL_THRESHOLD entries (an unmeasured default, see
+ * env_sort.h) and with more than one online CPU the array is split into one
+ * chunk per worker thread, every chunk is radix sorted concurrently and the
+ * sorted runs are combined by rounds of pairwise merges, each round also
+ * running its merges in parallel.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "env_sort.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ENV_SORT_INSERTION_THRESHOLD 32
+#define ENV_SORT_BUCKETS 256
+#define ENV_SORT_MAX_THREADS 16
+
+typedef struct sort_range_s {
+    size_t start;
+    size_t count;
+    size_t depth;
+} sort_range_t;
+
+typedef struct sort_stack_s {
+    sort_range_t *ranges;
+    size_t count;
+    size_t capacity;
+} sort_stack_t;
+
+typedef struct sort_task_s {
+    pthread_t thread;
+    bool thread_started;
+    char **src;       // Run(s) to read
+    char **dst;       // Merge destination (unused for the chunk sort phase)
+    size_t start;     // Range [start, end) of the array; [start, mid) and [mid, end) for merges
+    size_t mid;
+    size_t end;
+    int result;
+} sort_task_t;
+
+/*
+ * Purpose:
+ *   Pushes a pending range onto the sort stack, growing it as needed.
+ * Receives:
+ *   stack: The stack to push onto.
+ *   start, count, depth: The range of the array and the byte depth at which it
+ *          still has to be sorted.
+ * Returns:
+ *   0 on success, -1 on memory allocation failure.
+ */
+static int push_range(sort_stack_t *stack, size_t start, size_t count, size_t depth) {
+    if (stack->count == stack->capacity) {
+        size_t new_capacity = stack->capacity == 0 ? 64 : stack->capacity * 2;
+        sort_range_t *new_ranges = realloc(stack->ranges, new_capacity * sizeof(sort_range_t));
+        if (new_ranges == NULL) {
+            return -1;
+        }
+        stack->ranges = new_ranges;
+        stack->capacity = new_capacity;
+    }
+    stack->ranges[stack->count].start = start;
+    stack->ranges[stack->count].count = count;
+    stack->ranges[stack->count].depth = depth;
+    stack->count++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Sorts a small range of strings that are known to share their first 'depth'
+ *   bytes, comparing only the remaining suffixes.
+ * Receives:
+ *   vars:  The range to sort.
+ *   count: Number of strings in the range.
+ *   depth: Length of the common prefix already established by the radix passes.
+ * Returns:
+ *   None (void).
+ */
+static void insertion_sort_suffixes(char **vars, size_t count, size_t depth) {
+    for (size_t i = 1; i < count; ++i) {
+        char *current = vars[i];
+        size_t j = i;
+        while (j > 0 && strcmp(vars[j - 1] + depth, current + depth) > 0) {
+            vars[j] = vars[j - 1];
+            j--;
+        }
+        vars[j] = current;
+    }
+}
+
+/*
+ * Purpose:
+ *   Sorts an array of C strings into the byte order produced by strcoll() in the
+ *   "C" locale (equivalently strcmp()), using a single-threaded MSD radix sort. The key byte of
+ *   every string is read once per pass into a contiguous cache, so the bucket
+ *   scatter does not chase the string pointers a second time.
+ * Receives:
+ *   vars:  The array of string pointers to sort in place.
+ *   count: Number of strings in the array.
+ * Returns:
+ *   0 on success.
+ *   -1 on memory allocation failure. The array then still contains every original
+ *      pointer, but possibly only partially sorted; the caller should fall back
+ *      to another sort.
+ */
+int env_sort_c_locale_serial(char **vars, size_t count) {
+    if (count < 2) {
+        return 0;
+    }
+    if (count <= ENV_SORT_INSERTION_THRESHOLD) {
+        insertion_sort_suffixes(vars, count, 0);
+        return 0;
+    }
+
+    char **scratch = malloc(count * sizeof(char *));
+    unsigned char *key_cache = malloc(count);
+    sort_stack_t stack = { .ranges = NULL, .count = 0, .capacity = 0 };
+    int result = 0;
+
+    if (scratch == NULL || key_cache == NULL || push_range(&stack, 0, count, 0) != 0) {
+        result = -1;
+        goto cleanup;
+    }
+
+    while (stack.count > 0) {
+        sort_range_t range = stack.ranges[--stack.count];
+        char **base = vars + range.start;
+        size_t n = range.count;
+        size_t depth = range.depth;
+
+        if (n <= ENV_SORT_INSERTION_THRESHOLD) {
+            insertion_sort_suffixes(base, n, depth);
+            continue;
+        }
+
+        size_t bucket_sizes[ENV_SORT_BUCKETS];
+        size_t bucket_starts[ENV_SORT_BUCKETS];
+        for (;;) {
+            memset(bucket_sizes, 0, sizeof(bucket_sizes));
+            for (size_t i = 0; i < n; ++i) {
+                unsigned char key = (unsigned char)base[i][depth];
+                key_cache[i] = key;
+                bucket_sizes[key]++;
+            }
+            // A shared non-terminating byte splits nothing: step deeper without scattering.
+            if (bucket_sizes[key_cache[0]] != n || key_cache[0] == '\0') {
+                break;
+            }
+            depth++;
+        }
+
+        size_t position = 0;
+        for (size_t b = 0; b < ENV_SORT_BUCKETS; ++b) {
+            bucket_starts[b] = position;
+            position += bucket_sizes[b];
+        }
+        for (size_t i = 0; i < n; ++i) {
+            scratch[bucket_starts[key_cache[i]]++] = base[i];
+        }
+        memcpy(base, scratch, n * sizeof(char *));
+
+        // Bucket 0 holds strings that end at this depth: they are all equal.
+        size_t offset = bucket_sizes[0];
+        for (size_t b = 1; b < ENV_SORT_BUCKETS; ++b) {
+            if (bucket_sizes[b] > 1 &&
+                push_range(&stack, range.start + offset, bucket_sizes[b], depth + 1) != 0) {
+                result = -1;
+                goto cleanup;
+            }
+            offset += bucket_sizes[b];
+        }
+    }
+
+cleanup:
+    free(stack.ranges);
+    free(key_cache);
+    free(scratch);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Thread entry point that radix sorts one chunk of the array.
+ * Receives:
+ *   arg: Pointer to the sort_task_t describing the chunk [start, end) of 'src'.
+ * Returns:
+ *   NULL. The outcome is stored in the task's 'result' field.
+ */
+static void *sort_chunk_task(void *arg) {
+    sort_task_t *task = arg;
+    task->result = env_sort_c_locale_serial(task->src + task->start, task->end - task->start);
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Thread entry point that merges two adjacent sorted runs of 'src' into the
+ *   same positions of 'dst'.
+ * Receives:
+ *   arg: Pointer to the sort_task_t with runs [start, mid) and [mid, end).
+ * Returns:
+ *   NULL. Merging cannot fail, so 'result' is always 0.
+ */
+static void *merge_runs_task(void *arg) {
+    sort_task_t *task = arg;
+    char **left = task->src + task->start;
+    char **left_end = task->src + task->mid;
+    char **right = left_end;
+    char **right_end = task->src + task->end;
+    char **out = task->dst + task->start;
+
+    while (left < left_end && right < right_end) {
+        *out++ = strcmp(*left, *right) <= 0 ? *left++ : *right++;
+    }
+    while (left < left_end) {
+        *out++ = *left++;
+    }
+    while (right < right_end) {
+        *out++ = *right++;
+    }
+    task->result = 0;
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Runs 'routine' for every task, using one worker thread per task except the
+ *   first, which runs on the calling thread. If a thread cannot be created, its
+ *   task is run on the calling thread instead.
+ * Receives:
+ *   tasks:      Array of tasks.
+ *   task_count: Number of tasks.
+ *   routine:    Task body (sort_chunk_task or merge_runs_task).
+ * Returns:
+ *   0 if every task succeeded, -1 otherwise.
+ */
+static int run_tasks(sort_task_t *tasks, size_t task_count, void *(*routine)(void *)) {
+    for (size_t i = 1; i < task_count; ++i) {
+        tasks[i].thread_started = pthread_create(&tasks[i].thread, NULL, routine, &tasks[i]) == 0;
+        if (!tasks[i].thread_started) {
+            routine(&tasks[i]);
+        }
+    }
+    if (task_count > 0) {
+        routine(&tasks[0]);
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < task_count; ++i) {
+        if (i > 0 && tasks[i].thread_started) {
+            pthread_join(tasks[i].thread, NULL);
+        }
+        if (tasks[i].result != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Sorts an array of C strings into "C" locale byte order with a parallel merge
+ *   sort: 'thread_count' chunks are radix sorted concurrently, then merged in
+ *   log2(thread_count) rounds of concurrent pairwise merges that alternate
+ *   between the array and a scratch buffer.
+ * Receives:
+ *   vars:         The array of string pointers to sort in place.
+ *   count:        Number of strings in the array.
+ *   thread_count: Number of chunks/threads to use (clamped to 1..ENV_SORT_MAX_THREADS).
+ * Returns:
+ *   0 on success.
+ *   -1 on memory allocation failure; the array still holds every original
+ *      pointer and the caller should fall back to another sort.
+ */
+int env_sort_c_locale_parallel(char **vars, size_t count, unsigned thread_count) {
+    if (thread_count > ENV_SORT_MAX_THREADS) {
+        thread_count = ENV_SORT_MAX_THREADS;
+    }
+    if (thread_count < 2 || count < (size_t)thread_count * ENV_SORT_INSERTION_THRESHOLD) {
+        return env_sort_c_locale_serial(vars, count);
+    }
+
+    char **scratch = malloc(count * sizeof(char *));
+    if (scratch == NULL) {
+        return -1;
+    }
+
+    sort_task_t tasks[ENV_SORT_MAX_THREADS];
+    size_t bounds[ENV_SORT_MAX_THREADS + 1];
+    size_t run_count = thread_count;
+    for (size_t i = 0; i <= run_count; ++i) {
+        bounds[i] = count * i / run_count;
+    }
+
+    memset(tasks, 0, sizeof(tasks));
+    for (size_t i = 0; i < run_count; ++i) {
+        tasks[i].src = vars;
+        tasks[i].start = bounds[i];
+        tasks[i].end = bounds[i + 1];
+    }
+    if (run_tasks(tasks, run_count, sort_chunk_task) != 0) {
+        free(scratch);
+        return -1;
+    }
+
+    char **src = vars;
+    char **dst = scratch;
+    while (run_count > 1) {
+        size_t pair_count = run_count / 2;
+        memset(tasks, 0, sizeof(tasks));
+        for (size_t i = 0; i < pair_count; ++i) {
+            tasks[i].src = src;
+            tasks[i].dst = dst;
+            tasks[i].start = bounds[2 * i];
+            tasks[i].mid = bounds[2 * i + 1];
+            tasks[i].end = bounds[2 * i + 2];
+        }
+        run_tasks(tasks, pair_count, merge_runs_task);
+
+        // An odd run out has no partner this round; carry it over unchanged.
+        if (run_count % 2 != 0) {
+            size_t last = bounds[run_count - 1];
+            memcpy(dst + last, src + last, (count - last) * sizeof(char *));
+        }
+
+        size_t new_run_count = 0;
+        for (size_t i = 0; i < run_count; i += 2) {
+            bounds[new_run_count++] = bounds[i];
+        }
+        bounds[new_run_count] = count;
+        run_count = new_run_count;
+
+        char **swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != vars) {
+        memcpy(vars, src, count * sizeof(char *));
+    }
+    free(scratch);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Sorts an array of C strings into "C" locale byte order, choosing the
+ *   parallel merge sort for arrays of at least ENV_SORT_PARALLEL_THRESHOLD
+ *   entries when more than one CPU is online, and the serial radix sort otherwise.
+ * Receives:
+ *   vars:  The array of string pointers to sort in place.
+ *   count: Number of strings in the array.
+ * Returns:
+ *   0 on success, -1 on memory allocation failure (see env_sort_c_locale_serial()).
+ */
+int env_sort_c_locale(char **vars, size_t count) {
+    if (count >= ENV_SORT_PARALLEL_THRESHOLD) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 1) {
+            return env_sort_c_locale_parallel(vars, count, (unsigned)cpus);
+        }
+    }
+    return env_sort_c_locale_serial(vars, count);
+}
@@ -0,0 +1,498 @@
+/*
+ * exec_warmup.c
+ *
+ * Description:
+ * Implements the child executable warmup (see exec_warmup.h). Each file is
+ * mapped read-only to walk its program and dynamic headers; only 64-bit ELF
+ * files of the parent's own byte order are parsed, anything else is warmed
+ * as a plain file.
+ */
+#define _GNU_SOURCE     // readahead(), pipe2()
+
+#include "exec_warmup.h"
+#include "parent_log.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WARMUP_SEARCH_SIZE 1024
+
+/* A file exec needs, and its locked mapping (lock mode). */
+typedef struct warmup_file_s {
+    char path[PATH_MAX];
+    size_t size;
+    void *locked;               // Locked mapping, or NULL
+} warmup_file_t;
+
+static const char *const g_warmup_default_dirs[] = {
+    "/lib64", "/usr/lib64", "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+    "/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu", "/lib", "/usr/lib", "/usr/local/lib"
+};
+
+static warmup_mode_t g_warmup_mode = WARMUP_OFF;
+static warmup_file_t *g_warmup_files;           // WARMUP_MAX_FILES entries
+static size_t g_warmup_file_count;
+static size_t g_warmup_unresolved;              // DT_NEEDED entries not found
+static uint64_t g_warmup_bytes;
+static uint64_t g_warmup_locked_bytes;
+static uint64_t g_warmup_elapsed_ns;
+static atomic_int g_warmup_next_sample;
+static _Atomic uint64_t g_warmup_samples[WARMUP_SAMPLES];  // Exec latency in ns, 0 = not measured
+
+/*
+ * Purpose:
+ *   Returns the current CLOCK_MONOTONIC time.
+ * Receives:
+ *   None.
+ * Returns:
+ *   Nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Parses the -w argument.
+ * Receives:
+ *   text: "cold", "measure", "warm" or "lock".
+ *   mode: Receives the mode.
+ * Returns:
+ *   0 on success, -1 if the text names no mode.
+ */
+int warmup_parse_mode(const char *text, warmup_mode_t *mode) {
+    static const char *const names[] = { "cold", "measure", "warm", "lock" };
+    static const warmup_mode_t modes[] = { WARMUP_COLD, WARMUP_MEASURE, WARMUP_WARM, WARMUP_LOCK };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcmp(text, names[i]) == 0) {
+            *mode = modes[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Purpose:
+ *   Adds a file to the list unless it is there already.
+ * Receives:
+ *   path: The file's path.
+ * Returns:
+ *   None (void). Files beyond WARMUP_MAX_FILES are ignored.
+ */
+static void add_file(const char *path) {
+    for (size_t i = 0; i < g_warmup_file_count; ++i) {
+        if (strcmp(g_warmup_files[i].path, path) == 0) {
+            return;
+        }
+    }
+    if (g_warmup_file_count < WARMUP_MAX_FILES && strlen(path) < PATH_MAX) {
+        strcpy(g_warmup_files[g_warmup_file_count++].path, path);
+    }
+}
+
+/*
+ * Purpose:
+ *   Translates a virtual address of a mapped ELF file into a file offset
+ *   through its PT_LOAD segments.
+ * Receives:
+ *   phdrs:  The program headers.
+ *   count:  Their number.
+ *   vaddr:  The address.
+ * Returns:
+ *   The offset, or SIZE_MAX if no segment contains the address.
+ */
+static size_t vaddr_offset(const Elf64_Phdr *phdrs, size_t count, Elf64_Addr vaddr) {
+    for (size_t i = 0; i < count; ++i) {
+        if (phdrs[i].p_type == PT_LOAD && vaddr >= phdrs[i].p_vaddr &&
+            vaddr - phdrs[i].p_vaddr < phdrs[i].p_filesz) {
+            return (size_t)(phdrs[i].p_offset + (vaddr - phdrs[i].p_vaddr));
+        }
+    }
+    return SIZE_MAX;
+}
+
+/*
+ * Purpose:
+ *   Looks for a library in a colon-separated list of directories, with
+ *   $ORIGIN replaced by the directory of the object that needs it.
+ * Receives:
+ *   name:   The DT_NEEDED name.
+ *   dirs:   The directory list, or NULL.
+ *   origin: Directory of the object that needs the library.
+ *   found:  Receives the path (PATH_MAX bytes).
+ * Returns:
+ *   true if the library was found.
+ */
+static bool search_dirs(const char *name, const char *dirs, const char *origin, char *found) {
+    while (dirs != NULL && *dirs != '\0') {
+        size_t length = strcspn(dirs, ":");
+        char dir[PATH_MAX];
+        if (length > 0 && length < sizeof(dir)) {
+            memcpy(dir, dirs, length);
+            dir[length] = '\0';
+            const char *rest = dir;
+            const char *prefix = "";
+            if (strncmp(dir, "$ORIGIN", 7) == 0) {
+                prefix = origin;
+                rest = dir + 7;
+            } else if (strncmp(dir, "${ORIGIN}", 9) == 0) {
+                prefix = origin;
+                rest = dir + 9;
+            }
+            int written = snprintf(found, PATH_MAX, "%s%s/%s", prefix, rest, name);
+            if (written > 0 && written < PATH_MAX && access(found, R_OK) == 0) {
+                return true;
+            }
+        }
+        dirs += length;
+        if (*dirs == ':') {
+            dirs++;
+        }
+    }
+    return false;
+}
+
+/*
+ * Purpose:
+ *   Resolves a DT_NEEDED name like the dynamic loader would, except that
+ *   ld.so.cache is replaced by the usual library directories.
+ * Receives:
+ *   name:    The DT_NEEDED name.
+ *   rpath:   The object's DT_RPATH, or NULL.
+ *   runpath: The object's DT_RUNPATH, or NULL.
+ *   origin:  Directory of the object.
+ *   found:   Receives the path (PATH_MAX bytes).
+ * Returns:
+ *   true if the library was found.
+ */
+static bool resolve_library(const char *name, const char *rpath, const char *runpath, const char *origin,
+                            char *found) {
+    if (strchr(name, '/') != NULL) {
+        snprintf(found, PATH_MAX, "%s", name);
+        return access(found, R_OK) == 0;
+    }
+    if ((runpath == NULL && search_dirs(name, rpath, origin, found)) ||
+        search_dirs(name, getenv("LD_LIBRARY_PATH"), origin, found) ||
+        search_dirs(name, runpath, origin, found)) {
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(g_warmup_default_dirs) / sizeof(g_warmup_default_dirs[0]); ++i) {
+        if (search_dirs(name, g_warmup_default_dirs[i], origin, found)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Purpose:
+ *   Adds the interpreter and the libraries a mapped ELF file needs.
+ * Receives:
+ *   path: The file's path (for $ORIGIN).
+ *   data: The mapped file.
+ *   size: Its size.
+ * Returns:
+ *   None (void). Files that are not 64-bit native ELF add nothing.
+ */
+static void add_dependencies(const char *path, const unsigned char *data, size_t size) {
+    if (size < sizeof(Elf64_Ehdr) || memcmp(data, ELFMAG, SELFMAG) != 0 || data[EI_CLASS] != ELFCLASS64) {
+        return;
+    }
+    const Elf64_Ehdr *header = (const Elf64_Ehdr *)data;
+    if (header->e_phentsize != sizeof(Elf64_Phdr) || header->e_phoff > size ||
+        (size - header->e_phoff) / sizeof(Elf64_Phdr) < header->e_phnum) {
+        return;
+    }
+    const Elf64_Phdr *phdrs = (const Elf64_Phdr *)(data + header->e_phoff);
+    size_t phnum = header->e_phnum;
+
+    char origin[PATH_MAX];
+    snprintf(origin, sizeof(origin), "%s", path);
+    char *slash = strrchr(origin, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+    } else {
+        strcpy(origin, ".");
+    }
+
+    const Elf64_Dyn *dynamic = NULL;
+    size_t dynamic_count = 0;
+    for (size_t i = 0; i < phnum; ++i) {
+        if (phdrs[i].p_type == PT_INTERP && phdrs[i].p_offset < size && phdrs[i].p_filesz <= size - phdrs[i].p_offset &&
+            phdrs[i].p_filesz > 0 && data[phdrs[i].p_offset + phdrs[i].p_filesz - 1] == '\0') {
+            add_file((const char *)data + phdrs[i].p_offset);
+        } else if (phdrs[i].p_type == PT_DYNAMIC && phdrs[i].p_offset < size &&
+                   phdrs[i].p_filesz <= size - phdrs[i].p_offset) {
+            dynamic = (const Elf64_Dyn *)(data + phdrs[i].p_offset);
+            dynamic_count = phdrs[i].p_filesz / sizeof(Elf64_Dyn);
+        }
+    }
+    if (dynamic == NULL) {
+        return;     // Statically linked
+    }
+
+    Elf64_Addr strtab_addr = 0;
+    Elf64_Xword strtab_size = 0;
+    for (size_t i = 0; i < dynamic_count && dynamic[i].d_tag != DT_NULL; ++i) {
+        if (dynamic[i].d_tag == DT_STRTAB) strtab_addr = dynamic[i].d_un.d_ptr;
+        if (dynamic[i].d_tag == DT_STRSZ) strtab_size = dynamic[i].d_un.d_val;
+    }
+    size_t strtab = vaddr_offset(phdrs, phnum, strtab_addr);
+    if (strtab_addr == 0 || strtab >= size || strtab_size > size - strtab) {
+        return;
+    }
+    const char *strings = (const char *)data + strtab;
+
+    const char *rpath = NULL;
+    const char *runpath = NULL;
+    for (size_t i = 0; i < dynamic_count && dynamic[i].d_tag != DT_NULL; ++i) {
+        Elf64_Xword index = dynamic[i].d_un.d_val;
+        if (index >= strtab_size || memchr(strings + index, '\0', strtab_size - index) == NULL) {
+            continue;
+        }
+        if (dynamic[i].d_tag == DT_RPATH) rpath = strings + index;
+        if (dynamic[i].d_tag == DT_RUNPATH) runpath = strings + index;
+    }
+    for (size_t i = 0; i < dynamic_count && dynamic[i].d_tag != DT_NULL; ++i) {
+        Elf64_Xword index = dynamic[i].d_un.d_val;
+        if (dynamic[i].d_tag != DT_NEEDED || index >= strtab_size ||
+            memchr(strings + index, '\0', strtab_size - index) == NULL) {
+            continue;
+        }
+        char found[PATH_MAX];
+        if (resolve_library(strings + index, rpath, runpath, origin, found)) {
+            add_file(found);
+        } else {
+            g_warmup_unresolved++;
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Applies the mode to one file and adds the files it depends on.
+ * Receives:
+ *   file: The file.
+ * Returns:
+ *   0 on success, -1 if the file could not be opened or mapped (error logged).
+ */
+static int process_file(warmup_file_t *file) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        plog_perror("Parent: Failed to open file for warmup");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    file->size = (size_t)info.st_size;
+    if (file->size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    if (g_warmup_mode == WARMUP_COLD) {
+        // Only clean pages no process maps are dropped (the parent's own libc stays).
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    } else if (g_warmup_mode >= WARMUP_WARM) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        if (readahead(fd, 0, file->size) != 0) {
+            plog_perror("Parent: readahead() failed");
+        }
+    }
+
+    void *data = mmap(NULL, file->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        plog_perror("Parent: Failed to map file for warmup");
+        return -1;
+    }
+    add_dependencies(file->path, data, file->size);
+    if (g_warmup_mode == WARMUP_COLD) {
+        munmap(data, file->size);
+        int again = open(file->path, O_RDONLY | O_CLOEXEC);    // Drop what reading the headers loaded
+        if (again >= 0) {
+            posix_fadvise(again, 0, 0, POSIX_FADV_DONTNEED);
+            close(again);
+        }
+    } else if (g_warmup_mode == WARMUP_LOCK && mlock(data, file->size) == 0) {
+        file->locked = data;
+        g_warmup_locked_bytes += file->size;
+    } else {
+        if (g_warmup_mode == WARMUP_LOCK) {
+            plog_perror("Parent: Failed to lock file in memory (RLIMIT_MEMLOCK?)");
+        }
+        munmap(data, file->size);
+    }
+    g_warmup_bytes += file->size;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Collects the files the child executable needs and applies the mode to
+ *   them (see exec_warmup.h); prints a summary.
+ * Receives:
+ *   exec_path: The child executable.
+ *   mode:      The warmup mode; WARMUP_OFF does nothing.
+ * Returns:
+ *   0 on success, -1 if the executable itself could not be processed or
+ *   memory ran out (error logged; launches are not timed).
+ */
+int warmup_start(const char *exec_path, warmup_mode_t mode) {
+    if (mode == WARMUP_OFF) {
+        return 0;
+    }
+    g_warmup_files = calloc(WARMUP_MAX_FILES, sizeof(*g_warmup_files));
+    if (g_warmup_files == NULL) {
+        plog_perror("Parent: Failed to allocate warmup file list");
+        return -1;
+    }
+    g_warmup_mode = mode;
+    uint64_t start = now_ns();
+    add_file(exec_path);
+    // The list grows while it is walked: every file appends what it needs.
+    for (size_t i = 0; i < g_warmup_file_count; ++i) {
+        if (process_file(&g_warmup_files[i]) != 0 && i == 0) {
+            warmup_shutdown();
+            return -1;
+        }
+    }
+    g_warmup_elapsed_ns = now_ns() - start;
+
+    static const char *const verbs[] = { "", "Evicted", "Found", "Warmed", "Warmed and locked" };
+    plog_out("Parent: %s %zu file(s) (%.1f MiB) for '%s' in %.3f ms", verbs[mode], g_warmup_file_count,
+             (double)g_warmup_bytes / (1024.0 * 1024.0), exec_path, (double)g_warmup_elapsed_ns / 1e6);
+    if (g_warmup_unresolved > 0) {
+        plog_out("; %zu needed librar(y/ies) not found", g_warmup_unresolved);
+    }
+    plog_out(".\n");
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Starts timing a launch if it is one of the first WARMUP_SAMPLES. Call
+ *   just before fork(); the probe's pipe is close-on-exec from its creation,
+ *   so children forked concurrently by other threads do not keep it open.
+ * Receives:
+ *   probe: Probe to set up.
+ * Returns:
+ *   None (void). probe->read_fd is -1 when the launch is not timed.
+ */
+void warmup_probe_begin(warmup_probe_t *probe) {
+    probe->read_fd = -1;
+    probe->write_fd = -1;
+    probe->sample = -1;
+    if (g_warmup_files == NULL || atomic_load_explicit(&g_warmup_next_sample, memory_order_relaxed) >= WARMUP_SAMPLES) {
+        return;
+    }
+    int sample = atomic_fetch_add(&g_warmup_next_sample, 1);
+    int fds[2];
+    if (sample >= WARMUP_SAMPLES || pipe2(fds, O_CLOEXEC) != 0) {
+        return;
+    }
+    probe->read_fd = fds[0];
+    probe->write_fd = fds[1];
+    probe->sample = sample;
+    probe->start_ns = now_ns();
+}
+
+/*
+ * Purpose:
+ *   Completes a timed launch: waits until the child's execve() has closed
+ *   the pipe and records the time. Call in the parent right after fork().
+ * Receives:
+ *   probe:  The probe from warmup_probe_begin().
+ *   forked: false if fork() failed; nothing is recorded then.
+ * Returns:
+ *   None (void).
+ */
+void warmup_probe_finish(warmup_probe_t *probe, bool forked) {
+    if (probe->read_fd < 0) {
+        return;
+    }
+    close(probe->write_fd);
+    if (forked) {
+        char byte;
+        while (read(probe->read_fd, &byte, 1) < 0 && errno == EINTR) {
+        }
+        uint64_t elapsed = now_ns() - probe->start_ns;
+        atomic_store(&g_warmup_samples[probe->sample], elapsed > 0 ? elapsed : 1);
+    }
+    close(probe->read_fd);
+    probe->read_fd = -1;
+}
+
+/*
+ * Purpose:
+ *   Prints the warmup summary and the exec latency of the timed launches:
+ *   the first one, and the range and average of the others.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Prints nothing when warmup is off.
+ */
+void warmup_print_stats(void) {
+    if (g_warmup_files == NULL) {
+        return;
+    }
+    static const char *const names[] = { "off", "cold", "measure", "warm", "lock" };
+    uint64_t first = atomic_load(&g_warmup_samples[0]);
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    uint64_t sum = 0;
+    unsigned count = 0;
+    for (int i = 1; i < WARMUP_SAMPLES; ++i) {
+        uint64_t sample = atomic_load(&g_warmup_samples[i]);
+        if (sample == 0) continue;
+        min = sample < min ? sample : min;
+        max = sample > max ? sample : max;
+        sum += sample;
+        count++;
+    }
+    plog_out("Parent: Exec warmup (%s): %zu file(s), %.1f MiB, %.1f MiB locked; ", names[g_warmup_mode],
+             g_warmup_file_count, (double)g_warmup_bytes / (1024.0 * 1024.0),
+             (double)g_warmup_locked_bytes / (1024.0 * 1024.0));
+    if (first == 0) {
+        plog_out("no launch timed yet.\n");
+    } else if (count == 0) {
+        plog_out("first launch exec'd in %.1f us.\n", (double)first / 1e3);
+    } else {
+        plog_out("first launch exec'd in %.1f us, next %u in %.1f/%.1f/%.1f us (min/avg/max).\n",
+                 (double)first / 1e3, count, (double)min / 1e3, (double)sum / count / 1e3, (double)max / 1e3);
+    }
+}
+
+/*
+ * Purpose:
+ *   Unlocks and unmaps locked files and frees the file list.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void warmup_shutdown(void) {
+    for (size_t i = 0; g_warmup_files != NULL && i < g_warmup_file_count; ++i) {
+        if (g_warmup_files[i].locked != NULL) {
+            munlock(g_warmup_files[i].locked, g_warmup_files[i].size);
+            munmap(g_warmup_files[i].locked, g_warmup_files[i].size);
+        }
+    }
+    free(g_warmup_files);
+    g_warmup_files = NULL;
+    g_warmup_file_count = 0;
+}
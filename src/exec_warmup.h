@@ -0,0 +1,56 @@
+/*
+ * exec_warmup.h
+ *
+ * Description:
+ * Page-cache warmup of the child executable (-w). At startup the parent
+ * reads the child's ELF headers and collects the files exec needs: the
+ * executable, its program interpreter (PT_INTERP) and its DT_NEEDED
+ * libraries, transitively, resolved through DT_RPATH, LD_LIBRARY_PATH,
+ * DT_RUNPATH and the default library directories (ld.so.cache is not read).
+ * Depending on the mode, the files are then
+ *
+ *   cold:    evicted (POSIX_FADV_DONTNEED), to measure a cold first launch;
+ *   measure: left alone;
+ *   warm:    read into the page cache (POSIX_FADV_WILLNEED, readahead());
+ *   lock:    warmed and kept resident with a locked read-only mapping.
+ *
+ * In every mode the first WARMUP_SAMPLES launches are timed: a close-on-exec
+ * pipe is created before fork() and the launching thread waits for its end
+ * of file, which comes when execve() has replaced the child's image. The
+ * time covers the kernel's part of exec (reading the executable and the
+ * interpreter); the libraries are loaded by the interpreter afterwards.
+ * Later launches are not slowed down.
+ */
+#ifndef EXEC_WARMUP_H
+#define EXEC_WARMUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WARMUP_MAX_FILES 64
+#define WARMUP_SAMPLES 16
+
+typedef enum warmup_mode_e {
+    WARMUP_OFF,
+    WARMUP_COLD,
+    WARMUP_MEASURE,
+    WARMUP_WARM,
+    WARMUP_LOCK
+} warmup_mode_t;
+
+/* One timed launch, from before fork() until execve() has completed. */
+typedef struct warmup_probe_s {
+    int read_fd;                /* -1 when the launch is not timed */
+    int write_fd;
+    int sample;                 /* Index of the launch among the timed ones */
+    uint64_t start_ns;
+} warmup_probe_t;
+
+int warmup_parse_mode(const char *text, warmup_mode_t *mode);
+int warmup_start(const char *exec_path, warmup_mode_t mode);
+void warmup_probe_begin(warmup_probe_t *probe);
+void warmup_probe_finish(warmup_probe_t *probe, bool forked);
+void warmup_print_stats(void);
+void warmup_shutdown(void);
+
+#endif /* EXEC_WARMUP_H */
@@ -0,0 +1,471 @@
+/*
+ * hot_restart.c
+ *
+ * Description:
+ * Implements the hot restart (see hot_restart.h). The state is laid out as
+ * a header, one record per child followed by its pending report bytes, then
+ * one record per cached result (oldest first) followed by its output. It is
+ * built in memory while capture is detached and written to the memfd in one
+ * go; if execve() fails, the same buffer is used to adopt the children back
+ * into the running instance.
+ */
+#define _GNU_SOURCE     // memfd_create()
+
+#include "hot_restart.h"
+#include "launcher.h"
+#include "parent_log.h"
+#include "result_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HOT_RESTART_MAGIC 0x52485250u  // "PRHR"
+#define HOT_RESTART_VERSION 2u
+
+extern char **environ;
+
+typedef struct restart_header_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t child_size;        // sizeof(restart_child_t)
+    uint32_t result_size;       // sizeof(restart_result_t)
+    uint32_t child_count;
+    uint32_t result_count;
+    int32_t next_child_id;
+    int32_t output_fd;          // -1: stdout
+} restart_header_t;
+
+typedef struct restart_child_s {
+    int32_t child_id;
+    int32_t pid;
+    int32_t read_fd;
+    int32_t pidfd;
+    uint32_t at_line_start;
+    uint32_t pending_length;    // Bytes following the record
+    char name[OUTPUT_NAME_SIZE];
+} restart_child_t;
+
+typedef struct restart_result_s {
+    result_key_t key;
+    int32_t exit_code;
+    int32_t exit_status;
+    int32_t source_pid;
+    char source_name[RESULT_SOURCE_NAME_SIZE];
+    uint64_t length;            // Bytes following the record
+} restart_result_t;
+
+typedef struct restart_buffer_s {
+    char *data;
+    size_t used;
+    size_t capacity;
+    restart_header_t header;    // Counts, copied to the front once complete
+} restart_buffer_t;
+
+/*
+ * Purpose:
+ *   Appends bytes to the state buffer, growing it as needed.
+ * Receives:
+ *   buffer: The buffer.
+ *   data, length: The bytes.
+ * Returns:
+ *   0 on success, -1 on allocation failure (error logged; nothing appended).
+ */
+static int buffer_append(restart_buffer_t *buffer, const void *data, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    if (length > buffer->capacity - buffer->used) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+        while (capacity - buffer->used < length) {
+            capacity *= 2;
+        }
+        char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            plog_perror("Parent: Failed to allocate hot restart state");
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->used, data, length);
+    buffer->used += length;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Copies the next bytes of a state out of it.
+ * Receives:
+ *   data, length: The state.
+ *   offset:       Position to read from; advanced past the bytes.
+ *   dst:          Receives the bytes.
+ *   size:         Number of bytes.
+ * Returns:
+ *   true on success, false if the state is too short.
+ */
+static bool take(const char *data, size_t length, size_t *offset, void *dst, size_t size) {
+    if (size > length - *offset) {
+        return false;
+    }
+    memcpy(dst, data + *offset, size);
+    *offset += size;
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Sets or clears FD_CLOEXEC on a descriptor.
+ * Receives:
+ *   fd:      The descriptor (negative values are ignored).
+ *   cloexec: true to set the flag.
+ * Returns:
+ *   None (void). Failures are logged.
+ */
+static void set_cloexec(int fd, bool cloexec) {
+    if (fd < 0) {
+        return;
+    }
+    int flags = fcntl(fd, F_GETFD);
+    if (flags < 0 || fcntl(fd, F_SETFD, cloexec ? (flags | FD_CLOEXEC) : (flags & ~FD_CLOEXEC)) != 0) {
+        plog_perror("Parent: Failed to change close-on-exec flag for hot restart");
+    }
+}
+
+/*
+ * Purpose:
+ *   output_detach() callback: appends one child to the state.
+ * Receives:
+ *   context: The restart_buffer_t.
+ *   child:   The child.
+ * Returns:
+ *   0 on success, -1 on allocation failure.
+ */
+static int save_child(void *context, const output_child_state_t *child) {
+    restart_buffer_t *buffer = context;
+    restart_child_t record;
+    memset(&record, 0, sizeof(record));
+    record.child_id = child->child_id;
+    record.pid = child->pid;
+    record.read_fd = child->read_fd;
+    record.pidfd = child->pidfd;
+    record.at_line_start = child->at_line_start;
+    record.pending_length = (uint32_t)child->pending_length;
+    memcpy(record.name, child->name, sizeof(record.name));
+    size_t used = buffer->used;
+    if (buffer_append(buffer, &record, sizeof(record)) != 0 ||
+        buffer_append(buffer, child->pending, child->pending_length) != 0) {
+        buffer->used = used;
+        return -1;
+    }
+    buffer->header.child_count++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   result_cache_export() callback: appends one cached result to the state.
+ * Receives:
+ *   context: The restart_buffer_t.
+ *   key:     The result's key.
+ *   result:  The result.
+ * Returns:
+ *   0 on success, -1 on allocation failure (the rest of the cache is dropped).
+ */
+static int save_result(void *context, const result_key_t *key, const result_cache_hit_t *result) {
+    restart_buffer_t *buffer = context;
+    restart_result_t record;
+    memset(&record, 0, sizeof(record));
+    record.key = *key;
+    record.exit_code = result->exit_code;
+    record.exit_status = result->exit_status;
+    record.source_pid = (int32_t)result->source_pid;
+    memcpy(record.source_name, result->source_name, sizeof(record.source_name));
+    record.length = result->length;
+    size_t used = buffer->used;
+    if (buffer_append(buffer, &record, sizeof(record)) != 0 ||
+        buffer_append(buffer, result->output, result->length) != 0) {
+        buffer->used = used;
+        return -1;
+    }
+    buffer->header.result_count++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Adopts the children of a state into output capture, or closes their
+ *   descriptors if capture is not running. Their descriptors get FD_CLOEXEC
+ *   back, so later children do not inherit them.
+ * Receives:
+ *   data, length: The state (after its header).
+ *   offset:       Position of the first child; advanced past the children.
+ *   count:        Number of children.
+ * Returns:
+ *   The number of children adopted.
+ */
+static size_t adopt_children(const char *data, size_t length, size_t *offset, uint32_t count) {
+    size_t adopted = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        restart_child_t record;
+        if (!take(data, length, offset, &record, sizeof(record)) || record.pending_length > length - *offset) {
+            plog_err("Parent: Hot restart state is truncated.\n");
+            break;
+        }
+        output_child_state_t child;
+        memset(&child, 0, sizeof(child));
+        child.child_id = record.child_id;
+        child.pid = (pid_t)record.pid;
+        child.read_fd = record.read_fd;
+        child.pidfd = record.pidfd;
+        child.at_line_start = record.at_line_start != 0;
+        memcpy(child.name, record.name, sizeof(child.name));
+        child.name[sizeof(child.name) - 1] = '\0';
+        child.pending = data + *offset;
+        child.pending_length = record.pending_length;
+        *offset += record.pending_length;
+
+        set_cloexec(child.read_fd, true);
+        set_cloexec(child.pidfd, true);
+        if (!output_enabled()) {
+            if (child.read_fd >= 0) close(child.read_fd);
+            if (child.pidfd >= 0) close(child.pidfd);
+            continue;
+        }
+        if (output_adopt(&child) == 0) {
+            adopted++;
+        }
+    }
+    return adopted;
+}
+
+/*
+ * Purpose:
+ *   Performs a hot restart: detaches output capture, saves the captured
+ *   children, the result cache and the next child id to a memfd and
+ *   re-executes the parent with '-H <fd>' in front of its original options.
+ *   Must be called from the command-loop thread between launches. Refused
+ *   with ordered output (-O) and the output archive (-a).
+ * Receives:
+ *   binary_path:   Parent binary to execute, or NULL for the running one.
+ *   argv:          The instance's own main() arguments; a leading '-H <fd>'
+ *                  from an earlier restart is replaced.
+ *   output_config: Capture settings, used to restart capture in this
+ *                  instance if execve() fails.
+ * Returns:
+ *   Does not return on success. -1 on failure (error logged); the children
+ *   are then adopted back and the instance carries on.
+ */
+int hot_restart_exec(const char *binary_path, char *const argv[], const output_config_t *output_config) {
+    const char *path = binary_path != NULL ? binary_path : "/proc/self/exe";
+    if (access(path, X_OK) != 0) {
+        plog_perror("Parent: Hot restart binary is not executable");
+        return -1;
+    }
+
+    size_t argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    size_t skip = argc >= 3 && strcmp(argv[1], "-H") == 0 ? 2 : 0;
+    char **new_argv = malloc((argc - skip + 3) * sizeof(char *));
+    int state_fd = memfd_create("parent-hot-restart", MFD_CLOEXEC);
+    if (new_argv == NULL || state_fd < 0) {
+        plog_perror(new_argv == NULL ? "Parent: Failed to allocate hot restart arguments"
+                                     : "Parent: Failed to create hot restart state");
+        free(new_argv);
+        if (state_fd >= 0) close(state_fd);
+        return -1;
+    }
+    char fd_text[16];
+    snprintf(fd_text, sizeof(fd_text), "%d", state_fd);
+    new_argv[0] = argv[0];
+    new_argv[1] = "-H";
+    new_argv[2] = fd_text;
+    memcpy(new_argv + 3, argv + 1 + skip, (argc - 1 - skip) * sizeof(char *));
+    new_argv[argc - skip + 2] = NULL;
+
+    restart_buffer_t buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    bool capturing = output_enabled();
+    if (buffer_append(&buffer, &buffer.header, sizeof(buffer.header)) != 0 ||
+        (output_detach(save_child, &buffer) != 0 && output_enabled())) {
+        free(buffer.data);
+        free(new_argv);
+        close(state_fd);
+        return -1;      // Nothing was detached
+    }
+    result_cache_export(save_result, &buffer);
+
+    buffer.header.magic = HOT_RESTART_MAGIC;
+    buffer.header.version = HOT_RESTART_VERSION;
+    buffer.header.child_size = sizeof(restart_child_t);
+    buffer.header.result_size = sizeof(restart_result_t);
+    buffer.header.next_child_id = launcher_next_child_id();
+    buffer.header.output_fd = capturing && output_config->dest_fd != STDOUT_FILENO ? output_config->dest_fd : -1;
+    memcpy(buffer.data, &buffer.header, sizeof(buffer.header));
+
+    size_t written = 0;
+    while (written < buffer.used) {
+        ssize_t rc = write(state_fd, buffer.data + written, buffer.used - written);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc < 0) {
+            plog_perror("Parent: Failed to write hot restart state");
+            break;
+        }
+        written += (size_t)rc;
+    }
+
+    size_t offset = sizeof(restart_header_t);
+    if (written == buffer.used && lseek(state_fd, 0, SEEK_SET) == 0) {
+        // The descriptors named in the state must survive execve().
+        for (uint32_t i = 0; i < buffer.header.child_count; ++i) {
+            restart_child_t record;
+            take(buffer.data, buffer.used, &offset, &record, sizeof(record));
+            offset += record.pending_length;
+            set_cloexec(record.read_fd, false);
+            set_cloexec(record.pidfd, false);
+        }
+        set_cloexec(buffer.header.output_fd, false);
+        set_cloexec(state_fd, false);
+
+        plog_out("Parent: Hot restart: handing %u child(ren) and %u cached result(s) to '%s'.\n",
+                 buffer.header.child_count, buffer.header.result_count, path);
+        plog_flush();
+        execve(path, new_argv, environ);
+        plog_perror("Parent: Hot restart execve() failed");
+    }
+
+    // The new instance did not start: take the children back.
+    set_cloexec(buffer.header.output_fd, true);
+    close(state_fd);
+    free(new_argv);
+    if (capturing && output_start(output_config) != 0) {
+        plog_err("Parent: Warning - Child output capture disabled.\n");
+    }
+    offset = sizeof(restart_header_t);
+    size_t adopted = adopt_children(buffer.data, buffer.used, &offset, buffer.header.child_count);
+    plog_out("Parent: Hot restart abandoned; resumed %zu of %u child(ren).\n", adopted, buffer.header.child_count);
+    free(buffer.data);
+    return -1;
+}
+
+/*
+ * Purpose:
+ *   Reads the state passed by the previous instance and closes its memfd.
+ *   The output destination it names gets FD_CLOEXEC back.
+ * Receives:
+ *   state_fd: The memfd ('-H' option).
+ *   state:    Receives the state.
+ * Returns:
+ *   0 on success, -1 if the state cannot be read or was written by an
+ *   incompatible parent (error logged; the children it names are then neither
+ *   forwarded nor reaped by this instance).
+ */
+int hot_restart_load(int state_fd, hot_restart_t *state) {
+    memset(state, 0, sizeof(*state));
+    state->output_fd = -1;
+    struct stat st;
+    if (fstat(state_fd, &st) != 0) {
+        plog_perror("Parent: Failed to read hot restart state");
+        close(state_fd);
+        return -1;
+    }
+    state->length = (size_t)st.st_size;
+    state->data = malloc(state->length > 0 ? state->length : 1);
+    if (state->data == NULL) {
+        plog_perror("Parent: Failed to allocate hot restart state");
+        close(state_fd);
+        return -1;
+    }
+    size_t loaded = 0;
+    while (loaded < state->length) {
+        ssize_t rc = pread(state_fd, state->data + loaded, state->length - loaded, (off_t)loaded);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            plog_perror("Parent: Failed to read hot restart state");
+            break;
+        }
+        loaded += (size_t)rc;
+    }
+    close(state_fd);
+
+    restart_header_t header;
+    size_t offset = 0;
+    if (loaded < state->length || !take(state->data, state->length, &offset, &header, sizeof(header)) ||
+        header.magic != HOT_RESTART_MAGIC || header.version != HOT_RESTART_VERSION ||
+        header.child_size != sizeof(restart_child_t) || header.result_size != sizeof(restart_result_t)) {
+        plog_err("Parent: Hot restart state is missing or from an incompatible parent.\n");
+        hot_restart_free(state);
+        return -1;
+    }
+    state->output_fd = header.output_fd;
+    state->next_child_id = header.next_child_id;
+    set_cloexec(state->output_fd, true);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Continues where the previous instance stopped: adopts its children into
+ *   output capture, restores its cached results and its child numbering.
+ *   Call after output_start() and result_cache_init(), before
+ *   launcher_start().
+ * Receives:
+ *   state: A state from hot_restart_load().
+ * Returns:
+ *   None (void). What cannot be restored is logged and dropped.
+ */
+void hot_restart_resume(hot_restart_t *state) {
+    restart_header_t header;
+    size_t offset = 0;
+    take(state->data, state->length, &offset, &header, sizeof(header));
+    size_t adopted = adopt_children(state->data, state->length, &offset, header.child_count);
+
+    size_t restored = 0;
+    for (uint32_t i = 0; i < header.result_count; ++i) {
+        restart_result_t record;
+        if (!take(state->data, state->length, &offset, &record, sizeof(record)) ||
+            record.length > state->length - offset) {
+            plog_err("Parent: Hot restart state is truncated.\n");
+            break;
+        }
+        result_cache_hit_t result = { state->data + offset, (size_t)record.length, record.exit_code,
+                                      record.exit_status, { 0 }, (pid_t)record.source_pid };
+        memcpy(result.source_name, record.source_name, sizeof(result.source_name));
+        result.source_name[sizeof(result.source_name) - 1] = '\0';
+        offset += (size_t)record.length;
+        if (result_cache_import(&record.key, &result) == 0) {
+            restored++;
+        }
+    }
+
+    launcher_set_next_child_id(state->next_child_id);
+    plog_out("Parent: Hot restart: adopted %zu of %u child(ren), restored %zu of %u cached result(s).\n",
+             adopted, header.child_count, restored, header.result_count);
+}
+
+/*
+ * Purpose:
+ *   Frees a loaded state.
+ * Receives:
+ *   state: The state.
+ * Returns:
+ *   None (void).
+ */
+void hot_restart_free(hot_restart_t *state) {
+    free(state->data);
+    state->data = NULL;
+    state->length = 0;
+}
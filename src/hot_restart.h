@@ -0,0 +1,37 @@
+/*
+ * hot_restart.h
+ *
+ * Description:
+ * Hot restart of the parent: the running instance hands its captured
+ * children (capture pipes and pidfds, see child_output.h), its result cache
+ * (result_cache.h) and its child numbering to a new instance and re-executes
+ * itself, or another parent binary, in the same process. Since exec keeps the
+ * PID, every child stays a child of the parent, so the new instance resumes
+ * forwarding and reaping where the old one stopped; children started without
+ * capture are not affected either.
+ *
+ * The state travels in a memfd whose descriptor is passed with '-H <fd>',
+ * together with the descriptors it names. The format is only meant for a
+ * parent built from the same sources: the new instance checks a version and
+ * the record sizes and refuses the state otherwise.
+ */
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include "child_output.h"
+
+#include <stddef.h>
+
+typedef struct hot_restart_s {
+    char *data;                 /* The state, read from the memfd */
+    size_t length;
+    int output_fd;              /* Child output destination, or -1 for stdout */
+    int next_child_id;
+} hot_restart_t;
+
+int hot_restart_exec(const char *binary_path, char *const argv[], const output_config_t *output_config);
+int hot_restart_load(int state_fd, hot_restart_t *state);
+void hot_restart_resume(hot_restart_t *state);
+void hot_restart_free(hot_restart_t *state);
+
+#endif /* HOT_RESTART_H */
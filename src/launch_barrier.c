@@ -0,0 +1,281 @@
+/*
+ * launch_barrier.c
+ *
+ * Description:
+ * Implements barrier launches (see launch_barrier.h). The gate is an eventfd
+ * in semaphore mode: a child's read takes one token, and the release writes
+ * as many tokens as children were launched, which wakes every parked reader
+ * at once. Both descriptors are close-on-exec in the parent, so children of
+ * other launches never inherit them; a barrier child clears the flag after
+ * fork(). Records from the children are read from one pipe with poll(), on
+ * the command-loop thread.
+ */
+#define _GNU_SOURCE     // pipe2(), eventfd()
+
+#include "launch_barrier.h"
+#include "barrier_protocol.h"
+#include "parent_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BARRIER_READ_RECORDS 256
+
+/* Records collected from one batch. */
+typedef struct barrier_batch_s {
+    size_t launched;
+    size_t parked;
+    size_t started;
+    uint64_t last_parked_ns;
+    uint64_t *start_ns;                 /* One per started child, up to launched */
+    bool closed;                        /* Every child closed its report pipe */
+    bool interrupted;                   /* A signal arrived while waiting */
+    unsigned char carry[sizeof(barrier_record_t)];
+    size_t carry_used;
+} barrier_batch_t;
+
+/*
+ * Purpose:
+ *   Reads the current time.
+ * Receives:
+ *   None.
+ * Returns:
+ *   CLOCK_MONOTONIC in nanoseconds, the children's clock.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Orders start times for the median.
+ * Receives:
+ *   a, b: Pointers to two uint64_t values.
+ * Returns:
+ *   <0, 0 or >0 like strcmp().
+ */
+static int compare_ns(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+    return (left > right) - (left < right);
+}
+
+/*
+ * Purpose:
+ *   Counts one record from a child.
+ * Receives:
+ *   batch:  The batch.
+ *   record: The record.
+ * Returns:
+ *   None (void). Unknown records are ignored.
+ */
+static void take_record(barrier_batch_t *batch, const barrier_record_t *record) {
+    if (record->kind == BARRIER_PARKED) {
+        batch->parked++;
+        if (record->ns > batch->last_parked_ns) {
+            batch->last_parked_ns = record->ns;
+        }
+    } else if (record->kind == BARRIER_STARTED && batch->start_ns != NULL && batch->started < batch->launched) {
+        batch->start_ns[batch->started++] = record->ns;
+    }
+}
+
+/*
+ * Purpose:
+ *   Reads records until enough have arrived, every child closed the pipe,
+ *   the deadline passed or a signal interrupted the wait.
+ * Receives:
+ *   barrier:     The barrier.
+ *   batch:       The batch; updated.
+ *   want_parked: Wait for parked records (true) or for started ones (false).
+ *   deadline_ns: When to give up.
+ * Returns:
+ *   0 when the wait ended, -1 on a read error (error logged).
+ */
+static int collect_records(const launch_barrier_t *barrier, barrier_batch_t *batch, bool want_parked,
+                           uint64_t deadline_ns) {
+    barrier_record_t records[BARRIER_READ_RECORDS];
+    while (!batch->closed && (want_parked ? batch->parked < batch->launched : batch->started < batch->parked)) {
+        uint64_t now = now_ns();
+        if (now >= deadline_ns) {
+            break;
+        }
+        struct pollfd pfd = { .fd = barrier->report_read_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, (int)((deadline_ns - now + 999999) / 1000000));
+        if (ready < 0) {
+            if (errno == EINTR) {
+                batch->interrupted = true;
+                break;
+            }
+            plog_perror("Parent: poll() on the barrier report pipe failed");
+            return -1;
+        }
+        if (ready == 0) {
+            continue;
+        }
+        memcpy(records, batch->carry, batch->carry_used);
+        ssize_t got = read(barrier->report_read_fd, (unsigned char *)records + batch->carry_used,
+                           sizeof(records) - batch->carry_used);
+        if (got < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            plog_perror("Parent: Failed to read the barrier report pipe");
+            return -1;
+        }
+        if (got == 0) {
+            batch->closed = true;
+            break;
+        }
+        size_t available = batch->carry_used + (size_t)got;
+        size_t complete = available / sizeof(barrier_record_t);
+        for (size_t i = 0; i < complete; ++i) {
+            take_record(batch, &records[i]);
+        }
+        batch->carry_used = available - complete * sizeof(barrier_record_t);
+        memcpy(batch->carry, (unsigned char *)records + complete * sizeof(barrier_record_t), batch->carry_used);
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Creates the gate and the report pipe for one batch, before its launches.
+ * Receives:
+ *   barrier: The barrier to set up.
+ * Returns:
+ *   0 on success, -1 on failure (error logged; nothing is left open).
+ */
+int barrier_open(launch_barrier_t *barrier) {
+    int report[2];
+    barrier->gate_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+    if (barrier->gate_fd < 0) {
+        plog_perror("Parent: Failed to create the barrier eventfd");
+        return -1;
+    }
+    if (pipe2(report, O_CLOEXEC) != 0) {
+        plog_perror("Parent: Failed to create the barrier report pipe");
+        close(barrier->gate_fd);
+        barrier->gate_fd = -1;
+        return -1;
+    }
+    barrier->report_read_fd = report[0];
+    barrier->report_write_fd = report[1];
+    snprintf(barrier->env_entry, sizeof(barrier->env_entry), "%s=%d,%d", ENV_VAR_BARRIER_NAME,
+             barrier->gate_fd, barrier->report_write_fd);
+    barrier->open_ns = now_ns();
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Lets the calling (forked) child keep the barrier descriptors across
+ *   execve(). Async-signal-safe.
+ * Receives:
+ *   barrier: The barrier.
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+int barrier_child_inherit(const launch_barrier_t *barrier) {
+    if (fcntl(barrier->gate_fd, F_SETFD, 0) != 0 || fcntl(barrier->report_write_fd, F_SETFD, 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Waits until the batch's children have parked, releases them with one
+ *   write to the gate and prints how far apart they started. Called after
+ *   all of the batch's launches have been attempted.
+ * Receives:
+ *   barrier:  The barrier.
+ *   launched: Children launched successfully.
+ * Returns:
+ *   0 once the batch was released (children that never parked or started
+ *   are reported), -1 if the release failed (error logged).
+ */
+int barrier_release(launch_barrier_t *barrier, size_t launched) {
+    close(barrier->report_write_fd);    // From here on only the children hold it
+    barrier->report_write_fd = -1;
+    if (launched == 0) {
+        return 0;
+    }
+    barrier_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.launched = launched;
+    batch.start_ns = malloc(launched * sizeof(*batch.start_ns));
+    if (batch.start_ns == NULL) {
+        plog_perror("Parent: Failed to allocate barrier start times");
+    }
+
+    int result = collect_records(barrier, &batch, true, now_ns() + BARRIER_PARK_TIMEOUT_MS * 1000000ull);
+    // Children that never parked get their tokens as well, so none can block for good.
+    uint64_t tokens = launched;
+    uint64_t release_ns = now_ns();
+    if (write(barrier->gate_fd, &tokens, sizeof(tokens)) != (ssize_t)sizeof(tokens)) {
+        plog_perror("Parent: Failed to release the barrier");
+        free(batch.start_ns);
+        return -1;
+    }
+    plog_out("Parent: Barrier: %zu of %zu child(ren) parked in %.1f ms; released with one eventfd write.\n",
+             batch.parked, launched,
+             batch.last_parked_ns > barrier->open_ns ? (double)(batch.last_parked_ns - barrier->open_ns) / 1e6 : 0.0);
+    if (batch.parked < launched) {
+        plog_err("Parent: Warning - %zu child(ren) did not park (%s).\n", launched - batch.parked,
+                 batch.interrupted ? "interrupted" : batch.closed ? "exited or failed to execute" : "timed out");
+    }
+    if (batch.start_ns == NULL || batch.interrupted) {
+        free(batch.start_ns);
+        return result;
+    }
+
+    if (result == 0) {
+        result = collect_records(barrier, &batch, false, now_ns() + BARRIER_START_TIMEOUT_MS * 1000000ull);
+    }
+    if (batch.started > 0) {
+        qsort(batch.start_ns, batch.started, sizeof(*batch.start_ns), compare_ns);
+        uint64_t first = batch.start_ns[0];
+        uint64_t last = batch.start_ns[batch.started - 1];
+        uint64_t median = batch.start_ns[batch.started / 2];
+        plog_out("Parent: Barrier: %zu child(ren) started %.1f us to %.1f us after the release "
+                 "(median %.1f us); spread %.1f us.\n", batch.started,
+                 first > release_ns ? (double)(first - release_ns) / 1e3 : 0.0,
+                 last > release_ns ? (double)(last - release_ns) / 1e3 : 0.0,
+                 median > release_ns ? (double)(median - release_ns) / 1e3 : 0.0,
+                 (double)(last - first) / 1e3);
+    }
+    if (batch.started < batch.parked) {
+        plog_err("Parent: Warning - %zu parked child(ren) did not report a start.\n", batch.parked - batch.started);
+    }
+    free(batch.start_ns);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Closes what is left of a barrier. Children still holding the
+ *   descriptors keep their copies.
+ * Receives:
+ *   barrier: The barrier.
+ * Returns:
+ *   None (void).
+ */
+void barrier_close(launch_barrier_t *barrier) {
+    if (barrier->gate_fd >= 0) close(barrier->gate_fd);
+    if (barrier->report_read_fd >= 0) close(barrier->report_read_fd);
+    if (barrier->report_write_fd >= 0) close(barrier->report_write_fd);
+    barrier->gate_fd = -1;
+    barrier->report_read_fd = -1;
+    barrier->report_write_fd = -1;
+}
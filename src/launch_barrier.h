@@ -0,0 +1,41 @@
+/*
+ * launch_barrier.h
+ *
+ * Description:
+ * Barrier launches ('b'). A batch of children is launched as usual, but
+ * every child parks at the start of main() on a shared eventfd (see
+ * barrier_protocol.h). Once all of them have parked, the parent releases the
+ * whole batch with a single eventfd write, so the children start their work
+ * as close together as the scheduler allows, e.g. to load a downstream
+ * service with a thundering herd. Each child reports when it got past the
+ * barrier; the parent prints how long parking took and the spread between
+ * the first and the last child starting.
+ *
+ * A child that dies or fails to execute before parking closes its report
+ * pipe, so the parent does not wait for it; children that have not parked
+ * within BARRIER_PARK_TIMEOUT_MS are released with the rest.
+ */
+#ifndef LAUNCH_BARRIER_H
+#define LAUNCH_BARRIER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BARRIER_PARK_TIMEOUT_MS 10000
+#define BARRIER_START_TIMEOUT_MS 10000
+#define BARRIER_ENV_SIZE 48
+
+typedef struct launch_barrier_s {
+    int gate_fd;                        /* eventfd (EFD_SEMAPHORE) the children read */
+    int report_read_fd;                 /* Parked and started records */
+    int report_write_fd;                /* Inherited by the children; closed once launched */
+    uint64_t open_ns;
+    char env_entry[BARRIER_ENV_SIZE];   /* "CHILD_BARRIER=<gate_fd>,<report_fd>" */
+} launch_barrier_t;
+
+int barrier_open(launch_barrier_t *barrier);
+int barrier_child_inherit(const launch_barrier_t *barrier);
+int barrier_release(launch_barrier_t *barrier, size_t launched);
+void barrier_close(launch_barrier_t *barrier);
+
+#endif /* LAUNCH_BARRIER_H */
@@ -0,0 +1,183 @@
+/*
+ * launch_coalesce.c
+ *
+ * Description:
+ * Coalescing of identical launch requests (see launch_coalesce.h). Recent
+ * launches are kept in a small table of COALESCE_SLOTS entries; a lookup
+ * compares the cheap key fields first and the executable path last. An entry
+ * is only valid for 'window' after its launch: later requests launch again
+ * and replace it, so a coalesced result is never older than the window.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "launch_coalesce.h"
+#include "parent_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct coalesce_entry_s {
+    char method;
+    size_t count;
+    char *exec_path;            // Owned copy; NULL marks a free slot
+    uint64_t env_generation;
+    uint64_t launched_ns;       // CLOCK_MONOTONIC time of the launch
+    coalesce_result_t result;
+} coalesce_entry_t;
+
+static coalesce_entry_t g_coalesce_entries[COALESCE_SLOTS];
+static uint64_t g_coalesce_window_ns;   // 0: coalescing disabled
+static unsigned long g_coalesce_merged; // Requests answered from a recent launch
+static unsigned long g_coalesce_forks_saved;
+
+/*
+ * Purpose:
+ *   Returns the current CLOCK_MONOTONIC time.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The time in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Compares an entry with a request key.
+ * Receives:
+ *   entry: A used entry.
+ *   key:   The request.
+ * Returns:
+ *   true if they describe the same launch.
+ */
+static bool entry_matches(const coalesce_entry_t *entry, const coalesce_key_t *key) {
+    return entry->method == key->method && entry->count == key->count &&
+           entry->env_generation == key->env_generation && strcmp(entry->exec_path, key->exec_path) == 0;
+}
+
+/*
+ * Purpose:
+ *   Enables coalescing with the given window.
+ * Receives:
+ *   window_ms: Window in milliseconds (0 disables coalescing).
+ * Returns:
+ *   None (void).
+ */
+void coalesce_init(unsigned window_ms) {
+    g_coalesce_window_ns = (uint64_t)window_ms * 1000000u;
+}
+
+/*
+ * Purpose:
+ *   Looks for a launch identical to 'key' made within the window. A hit
+ *   counts the request as merged and its children as forks saved.
+ * Receives:
+ *   key:    The request.
+ *   result: Receives the earlier launch's result and age on a hit.
+ * Returns:
+ *   true on a hit (the request must not be launched), false otherwise
+ *   (always false when coalescing is disabled).
+ */
+bool coalesce_lookup(const coalesce_key_t *key, coalesce_result_t *result) {
+    if (g_coalesce_window_ns == 0) {
+        return false;
+    }
+    uint64_t now = now_ns();
+    for (size_t i = 0; i < COALESCE_SLOTS; ++i) {
+        const coalesce_entry_t *entry = &g_coalesce_entries[i];
+        if (entry->exec_path != NULL && now - entry->launched_ns <= g_coalesce_window_ns &&
+            entry_matches(entry, key)) {
+            *result = entry->result;
+            result->age_ms = (double)(now - entry->launched_ns) / 1e6;
+            g_coalesce_merged++;
+            g_coalesce_forks_saved += key->count;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Purpose:
+ *   Remembers a launch so identical requests within the window can share its
+ *   result. Replaces an earlier entry for the same request, else a free or
+ *   expired slot, else the oldest entry.
+ * Receives:
+ *   key:    The launched request.
+ *   result: Its result.
+ * Returns:
+ *   None (void). Without memory the launch is simply not remembered.
+ */
+void coalesce_record(const coalesce_key_t *key, const coalesce_result_t *result) {
+    if (g_coalesce_window_ns == 0) {
+        return;
+    }
+    uint64_t now = now_ns();
+    coalesce_entry_t *slot = NULL;
+    for (size_t i = 0; i < COALESCE_SLOTS && slot == NULL; ++i) {
+        coalesce_entry_t *entry = &g_coalesce_entries[i];
+        if (entry->exec_path != NULL && entry_matches(entry, key)) {
+            slot = entry;
+        }
+    }
+    for (size_t i = 0; i < COALESCE_SLOTS && slot == NULL; ++i) {
+        coalesce_entry_t *entry = &g_coalesce_entries[i];
+        if (entry->exec_path == NULL || now - entry->launched_ns > g_coalesce_window_ns) {
+            slot = entry;
+        }
+    }
+    for (size_t i = 0; slot == NULL && i < COALESCE_SLOTS; ++i) {
+        if (i == 0 || g_coalesce_entries[i].launched_ns < slot->launched_ns) {
+            slot = &g_coalesce_entries[i];
+        }
+    }
+
+    if (slot->exec_path == NULL || strcmp(slot->exec_path, key->exec_path) != 0) {
+        char *exec_path = strdup(key->exec_path);
+        if (exec_path == NULL) {
+            return;
+        }
+        free(slot->exec_path);
+        slot->exec_path = exec_path;
+    }
+    slot->method = key->method;
+    slot->count = key->count;
+    slot->env_generation = key->env_generation;
+    slot->launched_ns = now;
+    slot->result = *result;
+}
+
+/*
+ * Purpose:
+ *   Prints how many requests were coalesced and how many forks that saved.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Prints nothing when coalescing is disabled.
+ */
+void coalesce_print_stats(void) {
+    if (g_coalesce_window_ns == 0) {
+        return;
+    }
+    plog_out("Parent: Coalescing (%llu ms window): %lu request(s) merged, %lu fork(s) saved.\n",
+             (unsigned long long)(g_coalesce_window_ns / 1000000u), g_coalesce_merged, g_coalesce_forks_saved);
+}
+
+/*
+ * Purpose:
+ *   Frees the remembered launches.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void coalesce_shutdown(void) {
+    for (size_t i = 0; i < COALESCE_SLOTS; ++i) {
+        free(g_coalesce_entries[i].exec_path);
+        g_coalesce_entries[i].exec_path = NULL;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * launch_coalesce.h
+ *
+ * Description:
+ * Optional coalescing of identical launch requests. A request is identified
+ * by its method, its count, the resolved child executable and the generation
+ * of the environment the children would get (env_rcu.h), which covers every
+ * 'v'/'u' change and filter file edit. When an identical request arrives
+ * within the window after the first one was launched, it is answered with
+ * that launch's result instead of forking again. Command-loop thread only.
+ */
+#ifndef LAUNCH_COALESCE_H
+#define LAUNCH_COALESCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define COALESCE_MAX_WINDOW_MS 60000
+#define COALESCE_SLOTS 8
+
+typedef struct coalesce_key_s {
+    char method;                /* '+', '*' or '&' */
+    size_t count;               /* Children requested */
+    const char *exec_path;      /* Child executable */
+    uint64_t env_generation;    /* Environment version the children get */
+} coalesce_key_t;
+
+typedef struct coalesce_result_s {
+    size_t launched;            /* Children started */
+    size_t failed;              /* Launches that failed */
+    double age_ms;              /* Set by coalesce_lookup(): time since the launch */
+} coalesce_result_t;
+
+void coalesce_init(unsigned window_ms);
+bool coalesce_lookup(const coalesce_key_t *key, coalesce_result_t *result);
+void coalesce_record(const coalesce_key_t *key, const coalesce_result_t *result);
+void coalesce_print_stats(void);
+void coalesce_shutdown(void);
+
+#endif /* LAUNCH_COALESCE_H */
@@ -0,0 +1,593 @@
+/*
+ * launch_journal.c
+ *
+ * Description:
+ * Implements the launch journal (see launch_journal.h). An append costs one
+ * uncontended read lock, one fetch-add on the mapped cursor, a 128-byte record
+ * store and a release store of its kind; 's' prints the measured average and
+ * minimum. The average is wall time: on a busy machine it includes
+ * preemption, e.g. by the child that was just forked.
+ *
+ * Launches and exits are matched by child id and PID. Compaction and replay
+ * share the same pass: exits go into a small open-addressing set, then every
+ * launch without an exit is moved down to the front of the journal.
+ */
+#define _GNU_SOURCE     // syscall(), MAP_POPULATE
+
+#include "launch_journal.h"
+#include "child_output.h"
+#include "launcher.h"
+#include "parent_log.h"
+#include "parent_memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_START_SLACK_NS 1000000000ull   // Latest plausible start of a child after its launch time
+
+_Static_assert(sizeof(journal_header_t) == 64, "journal header must keep records aligned");
+_Static_assert(sizeof(journal_record_t) == 128, "journal records must stay fixed-size");
+
+/* A child from an earlier run that was found still running. */
+typedef struct journal_survivor_s {
+    int child_id;
+    pid_t pid;
+    int pidfd;
+    char name[24];
+} journal_survivor_t;
+
+static int g_journal_fd = -1;
+static journal_header_t *g_journal_header;
+static journal_record_t *g_journal_records;
+static size_t g_journal_mapped_size;
+static pthread_rwlock_t g_journal_lock = PTHREAD_RWLOCK_INITIALIZER;   // Read: append; write: compaction
+static atomic_ulong g_journal_launches;
+static atomic_ulong g_journal_exits;
+static atomic_ulong g_journal_dropped;
+static atomic_ullong g_journal_append_ns;       // Wall time, so preemption inside an append counts
+static atomic_ullong g_journal_append_min_ns = ULLONG_MAX;
+static unsigned long g_journal_compactions;
+static journal_survivor_t *g_journal_survivors;
+static size_t g_journal_survivor_count;
+static size_t g_journal_stale_count;
+static int g_journal_next_child_id;
+
+/*
+ * Purpose:
+ *   Returns a clock in nanoseconds.
+ * Receives:
+ *   clock_id: The clock.
+ * Returns:
+ *   Nanoseconds, or 0 if the clock cannot be read.
+ */
+static uint64_t clock_ns(clockid_t clock_id) {
+    struct timespec now;
+    if (clock_gettime(clock_id, &now) != 0) {
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Combines a child id and PID into a nonzero set key.
+ * Receives:
+ *   child_id, pid: The child.
+ * Returns:
+ *   The key.
+ */
+static uint64_t child_key(int32_t child_id, int32_t pid) {
+    return ((uint64_t)(uint32_t)child_id << 32) | ((uint64_t)(uint32_t)pid + 1u);
+}
+
+/*
+ * Purpose:
+ *   Moves every launch without an exit to the front of the journal, in order,
+ *   and clears the rest. The caller holds the write lock (or no other thread
+ *   can append yet).
+ * Receives:
+ *   None.
+ * Returns:
+ *   The number of launches kept, or the number of used slots if the exit set
+ *   could not be allocated (nothing is changed; error logged).
+ */
+static size_t compact_records(void) {
+    uint64_t next = atomic_load(&g_journal_header->next);
+    size_t used = next < g_journal_header->capacity ? (size_t)next : g_journal_header->capacity;
+    size_t exits = 0;
+    for (size_t i = 0; i < used; ++i) {
+        exits += atomic_load_explicit(&g_journal_records[i].kind, memory_order_acquire) == JOURNAL_EXIT;
+    }
+    size_t mask = 15;
+    while (mask + 1 < exits * 2) {
+        mask = mask * 2 + 1;
+    }
+    uint64_t *set = calloc(mask + 1, sizeof(*set));
+    if (set == NULL) {
+        plog_perror("Parent: Failed to allocate journal compaction set");
+        return used;
+    }
+    for (size_t i = 0; i < used; ++i) {
+        const journal_record_t *record = &g_journal_records[i];
+        if (atomic_load_explicit(&record->kind, memory_order_relaxed) == JOURNAL_EXIT) {
+            uint64_t key = child_key(record->child_id, record->pid);
+            size_t slot = (size_t)(key * 0x9E3779B97F4A7C15ull >> 32) & mask;
+            while (set[slot] != 0 && set[slot] != key) {
+                slot = (slot + 1) & mask;
+            }
+            set[slot] = key;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < used; ++i) {
+        const journal_record_t *record = &g_journal_records[i];
+        if (atomic_load_explicit(&record->kind, memory_order_relaxed) != JOURNAL_LAUNCH) {
+            continue;
+        }
+        uint64_t key = child_key(record->child_id, record->pid);
+        size_t slot = (size_t)(key * 0x9E3779B97F4A7C15ull >> 32) & mask;
+        while (set[slot] != 0 && set[slot] != key) {
+            slot = (slot + 1) & mask;
+        }
+        if (set[slot] == 0) {
+            if (kept != i) {
+                memcpy(&g_journal_records[kept], record, sizeof(*record));
+            }
+            kept++;
+        }
+    }
+    free(set);
+    memset(&g_journal_records[kept], 0, (used - kept) * sizeof(journal_record_t));
+    atomic_store(&g_journal_header->next, kept);
+    return kept;
+}
+
+/*
+ * Purpose:
+ *   Reads the start time of a process from /proc/<pid>/stat.
+ * Receives:
+ *   pid: The process.
+ * Returns:
+ *   The start time in nanoseconds of CLOCK_BOOTTIME, or 0 if it cannot be read.
+ */
+static uint64_t process_start_ns(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    char text[1024];
+    ssize_t length = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (length <= 0) {
+        return 0;
+    }
+    text[length] = '\0';
+    // The command name (field 2) may contain spaces; fields after it are counted from its ')'.
+    char *field = strrchr(text, ')');
+    for (int index = 2; field != NULL && index < 22; ++index) {
+        field = strchr(field + 1, ' ');
+    }
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    if (field == NULL || ticks_per_second <= 0) {
+        return 0;
+    }
+    unsigned long long ticks = strtoull(field + 1, NULL, 10);
+    return ticks * (1000000000ull / (unsigned long long)ticks_per_second);
+}
+
+/*
+ * Purpose:
+ *   Looks for a journaled child that may still be running: its PID must
+ *   exist and have been started right after the journaled launch time.
+ * Receives:
+ *   record: The child's launch record.
+ * Returns:
+ *   A pidfd for the child, or -1 if it is gone (or its PID now belongs to
+ *   another process).
+ */
+static int find_survivor(const journal_record_t *record) {
+    int pidfd = (int)syscall(SYS_pidfd_open, (pid_t)record->pid, 0);
+    if (pidfd < 0) {
+        return -1;
+    }
+    // The start time is read by PID, so the pidfd must not have been readable
+    // (process exited) afterwards: only then did the PID still name its process.
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    uint64_t tick_ns = ticks_per_second > 0 ? 1000000000ull / (uint64_t)ticks_per_second : 10000000ull;
+    uint64_t start_ns = process_start_ns((pid_t)record->pid);
+    struct pollfd exited = { .fd = pidfd, .events = POLLIN, .revents = 0 };
+    if (start_ns == 0 || start_ns + tick_ns < record->boot_ns || start_ns > record->boot_ns + JOURNAL_START_SLACK_NS ||
+        poll(&exited, 1, 0) != 0) {
+        close(pidfd);
+        return -1;
+    }
+    if (fcntl(pidfd, F_SETFD, FD_CLOEXEC) != 0) {
+        plog_perror("Parent: Failed to make child pidfd close-on-exec");
+    }
+    return pidfd;
+}
+
+/*
+ * Purpose:
+ *   Replays the journal of an earlier run: keeps the launches whose children
+ *   are still running (see journal_resume()) and drops all other records.
+ *   Single-threaded, before anything is appended.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Failures are logged; the journal is then left compacted.
+ */
+static void recover_children(void) {
+    size_t candidates = compact_records();
+    if (candidates == 0) {
+        return;
+    }
+    g_journal_survivors = calloc(candidates, sizeof(*g_journal_survivors));
+    if (g_journal_survivors == NULL) {
+        plog_perror("Parent: Failed to allocate recovered children");
+        return;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < candidates; ++i) {
+        const journal_record_t *record = &g_journal_records[i];
+        int pidfd = find_survivor(record);
+        if (pidfd < 0) {
+            g_journal_stale_count++;
+            continue;
+        }
+        journal_survivor_t *survivor = &g_journal_survivors[g_journal_survivor_count++];
+        survivor->child_id = record->child_id;
+        survivor->pid = (pid_t)record->pid;
+        survivor->pidfd = pidfd;
+        memcpy(survivor->name, record->name, sizeof(survivor->name));
+        survivor->name[sizeof(survivor->name) - 1] = '\0';
+        if (kept != i) {
+            memcpy(&g_journal_records[kept], record, sizeof(*record));
+        }
+        kept++;
+    }
+    memset(&g_journal_records[kept], 0, (candidates - kept) * sizeof(journal_record_t));
+    atomic_store(&g_journal_header->next, kept);
+}
+
+/*
+ * Purpose:
+ *   Opens (or creates) the journal and maps it. An existing journal is
+ *   compacted and, with 'recover', replayed to find children of an earlier
+ *   run that still run.
+ * Receives:
+ *   path:    Journal file; a file that is not a journal is replaced.
+ *   recover: false after a hot restart, whose children are handed over
+ *            directly (the journal is only compacted).
+ * Returns:
+ *   0 on success, -1 on failure (error logged; journaling stays off).
+ */
+int journal_open(const char *path, bool recover) {
+    size_t size = sizeof(journal_header_t) + (size_t)JOURNAL_RECORDS * sizeof(journal_record_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        plog_perror("Parent: Failed to open launch journal");
+        return -1;
+    }
+    journal_header_t header;
+    memset(&header, 0, sizeof(header));
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && (size_t)st.st_size == size &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 header.magic == JOURNAL_MAGIC && header.version == JOURNAL_VERSION &&
+                 header.record_size == sizeof(journal_record_t) && header.capacity == JOURNAL_RECORDS;
+    if (!valid) {
+        if (st.st_size > 0) {
+            plog_err("Parent: Warning - '%s' is not a launch journal of this parent; starting a new one.\n", path);
+        }
+        if (ftruncate(fd, 0) != 0 || (posix_fallocate(fd, 0, (off_t)size) != 0 && ftruncate(fd, (off_t)size) != 0)) {
+            plog_perror("Parent: Failed to size launch journal");
+            close(fd);
+            return -1;
+        }
+    }
+    // Prefaulted, so no append takes a page fault on a fresh page.
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        plog_perror("Parent: Failed to map launch journal");
+        close(fd);
+        return -1;
+    }
+    pmem_dontfork(mapping, size);     // Appended to by the parent only
+    g_journal_fd = fd;
+    g_journal_mapped_size = size;
+    g_journal_header = mapping;
+    g_journal_records = (journal_record_t *)((char *)mapping + sizeof(journal_header_t));
+    if (!valid) {
+        g_journal_header->magic = JOURNAL_MAGIC;
+        g_journal_header->version = JOURNAL_VERSION;
+        g_journal_header->record_size = sizeof(journal_record_t);
+        g_journal_header->capacity = JOURNAL_RECORDS;
+        atomic_store(&g_journal_header->next, 0);
+        return 0;
+    }
+
+    uint64_t next = atomic_load(&g_journal_header->next);
+    size_t used = next < JOURNAL_RECORDS ? (size_t)next : JOURNAL_RECORDS;
+    for (size_t i = 0; i < used; ++i) {
+        if (g_journal_records[i].child_id >= g_journal_next_child_id) {
+            g_journal_next_child_id = g_journal_records[i].child_id + 1;
+        }
+    }
+    if (recover) {
+        recover_children();
+    } else {
+        compact_records();
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Tells whether journaling is on.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true after a successful journal_open().
+ */
+bool journal_enabled(void) {
+    return g_journal_header != NULL;
+}
+
+/*
+ * Purpose:
+ *   Takes the launch time of a child, just before fork().
+ * Receives:
+ *   None.
+ * Returns:
+ *   CLOCK_BOOTTIME in nanoseconds, or 0 when journaling is off.
+ */
+uint64_t journal_now(void) {
+    return g_journal_header != NULL ? clock_ns(CLOCK_BOOTTIME) : 0;
+}
+
+/*
+ * Purpose:
+ *   Reserves the next record slot and takes the read side of the lock, which
+ *   publish_record() drops. Any thread.
+ * Receives:
+ *   started_ns: Receives the start time of the append.
+ * Returns:
+ *   The slot (zeroed, since slots past the cursor are never written), or NULL
+ *   if the journal is full (the record is dropped and counted; the lock is
+ *   not held).
+ */
+static journal_record_t *reserve_record(uint64_t *started_ns) {
+    *started_ns = clock_ns(CLOCK_MONOTONIC);
+    pthread_rwlock_rdlock(&g_journal_lock);
+    uint64_t index = atomic_fetch_add_explicit(&g_journal_header->next, 1, memory_order_relaxed);
+    if (index >= g_journal_header->capacity) {
+        pthread_rwlock_unlock(&g_journal_lock);
+        atomic_fetch_add_explicit(&g_journal_dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return &g_journal_records[index];
+}
+
+/*
+ * Purpose:
+ *   Publishes a filled-in slot by storing its kind, drops the lock and
+ *   accounts for the time the append took.
+ * Receives:
+ *   slot:       The slot from reserve_record().
+ *   kind:       JOURNAL_LAUNCH or JOURNAL_EXIT.
+ *   started_ns: From reserve_record().
+ * Returns:
+ *   None (void).
+ */
+static void publish_record(journal_record_t *slot, uint32_t kind, uint64_t started_ns) {
+    atomic_store_explicit(&slot->kind, kind, memory_order_release);
+    pthread_rwlock_unlock(&g_journal_lock);
+    unsigned long long elapsed_ns = clock_ns(CLOCK_MONOTONIC) - started_ns;
+    atomic_fetch_add_explicit(&g_journal_append_ns, elapsed_ns, memory_order_relaxed);
+    unsigned long long min_ns = atomic_load_explicit(&g_journal_append_min_ns, memory_order_relaxed);
+    while (elapsed_ns < min_ns &&
+           !atomic_compare_exchange_weak_explicit(&g_journal_append_min_ns, &min_ns, elapsed_ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/*
+ * Purpose:
+ *   Journals a launch, right after fork() succeeded. Any thread.
+ * Receives:
+ *   child_id:       The child's number.
+ *   pid:            The child's PID.
+ *   name:           The child's name ("child_NN").
+ *   method:         '+', '*' or '&'.
+ *   exec_path:      The child executable.
+ *   env_generation: Environment version the child got.
+ *   launch_ns:      journal_now() taken before fork().
+ * Returns:
+ *   None (void). Does nothing when journaling is off.
+ */
+void journal_launch(int child_id, pid_t pid, const char *name, char method, const char *exec_path,
+                    uint64_t env_generation, uint64_t launch_ns) {
+    if (g_journal_header == NULL) {
+        return;
+    }
+    uint64_t started_ns;
+    journal_record_t *slot = reserve_record(&started_ns);
+    if (slot == NULL) {
+        return;
+    }
+    slot->child_id = child_id;
+    slot->pid = (int32_t)pid;
+    slot->method = method;
+    slot->boot_ns = launch_ns;
+    slot->env_generation = env_generation;
+    memcpy(slot->name, name, strnlen(name, sizeof(slot->name) - 1));
+    size_t path_len = strlen(exec_path);
+    size_t kept = path_len < sizeof(slot->exec_path) ? path_len : sizeof(slot->exec_path) - 1;
+    memcpy(slot->exec_path, exec_path + path_len - kept, kept);
+    publish_record(slot, JOURNAL_LAUNCH, started_ns);
+    atomic_fetch_add_explicit(&g_journal_launches, 1, memory_order_relaxed);
+}
+
+/*
+ * Purpose:
+ *   Journals the exit of a child. Called by the output reactors.
+ * Receives:
+ *   child_id:    The child's number.
+ *   pid:         The child's PID.
+ *   exit_code:   CLD_EXITED, CLD_KILLED or CLD_DUMPED, or 0 if unknown.
+ *   exit_status: Exit status or signal number.
+ * Returns:
+ *   None (void). Does nothing when journaling is off.
+ */
+void journal_exit(int child_id, pid_t pid, int exit_code, int exit_status) {
+    if (g_journal_header == NULL) {
+        return;
+    }
+    uint64_t started_ns;
+    journal_record_t *slot = reserve_record(&started_ns);
+    if (slot == NULL) {
+        return;
+    }
+    slot->child_id = child_id;
+    slot->pid = (int32_t)pid;
+    slot->exit_code = exit_code;
+    slot->exit_status = exit_status;
+    slot->boot_ns = clock_ns(CLOCK_BOOTTIME);
+    publish_record(slot, JOURNAL_EXIT, started_ns);
+    atomic_fetch_add_explicit(&g_journal_exits, 1, memory_order_relaxed);
+}
+
+/*
+ * Purpose:
+ *   Resumes accounting for the children found by the replay: each one is
+ *   watched by the output reactors (when capture is on) until it exits, and
+ *   child numbering continues after the highest journaled id. Call after
+ *   output_start(), before launcher_start().
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void journal_resume(void) {
+    size_t watched = 0;
+    for (size_t i = 0; i < g_journal_survivor_count; ++i) {
+        journal_survivor_t *survivor = &g_journal_survivors[i];
+        if (!output_enabled()) {
+            close(survivor->pidfd);     // Stays journaled; found again by the next replay.
+            continue;
+        }
+        output_child_state_t child;
+        memset(&child, 0, sizeof(child));
+        child.child_id = survivor->child_id;
+        child.pid = survivor->pid;
+        child.read_fd = -1;
+        child.pidfd = survivor->pidfd;
+        child.at_line_start = true;
+        snprintf(child.name, sizeof(child.name), "%s", survivor->name);
+        if (output_adopt(&child) == 0) {
+            watched++;
+        }
+    }
+    if (g_journal_survivor_count > 0 || g_journal_stale_count > 0) {
+        plog_out("Parent: Journal: %zu child(ren) of an earlier run still running (%zu watched), "
+                 "%zu no longer running.\n", g_journal_survivor_count, watched, g_journal_stale_count);
+    }
+    free(g_journal_survivors);
+    g_journal_survivors = NULL;
+    g_journal_survivor_count = 0;
+    if (g_journal_next_child_id > launcher_next_child_id()) {
+        launcher_set_next_child_id(g_journal_next_child_id);
+    }
+}
+
+/*
+ * Purpose:
+ *   Compacts the journal once it is three quarters full, or would be after
+ *   the upcoming launches. Command-loop thread only.
+ * Receives:
+ *   upcoming: Number of launches about to be journaled.
+ * Returns:
+ *   None (void).
+ */
+void journal_maintain(size_t upcoming) {
+    if (g_journal_header == NULL) {
+        return;
+    }
+    uint64_t next = atomic_load_explicit(&g_journal_header->next, memory_order_relaxed);
+    if (next + upcoming <= (uint64_t)g_journal_header->capacity / 4 * 3) {
+        return;
+    }
+    pthread_rwlock_wrlock(&g_journal_lock);
+    compact_records();
+    g_journal_compactions++;
+    pthread_rwlock_unlock(&g_journal_lock);
+}
+
+/*
+ * Purpose:
+ *   Prints the journal counters and the average cost of an append.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Prints nothing when journaling is off.
+ */
+void journal_print_stats(void) {
+    if (g_journal_header == NULL) {
+        return;
+    }
+    unsigned long launches = atomic_load(&g_journal_launches);
+    unsigned long exits = atomic_load(&g_journal_exits);
+    unsigned long dropped = atomic_load(&g_journal_dropped);
+    unsigned long long append_ns = atomic_load(&g_journal_append_ns);
+    uint64_t next = atomic_load(&g_journal_header->next);
+    unsigned long appends = launches + exits;
+    plog_out("Parent: Journal: %lu launch(es) and %lu exit(s) journaled, %lu dropped (full); "
+             "%llu of %u slots used, %lu compaction(s); %.0f ns per append (min %llu ns).\n",
+             launches, exits, dropped,
+             (unsigned long long)(next < g_journal_header->capacity ? next : g_journal_header->capacity),
+             g_journal_header->capacity, g_journal_compactions,
+             appends > 0 ? (double)append_ns / (double)appends : 0.0,
+             appends > 0 ? (unsigned long long)atomic_load(&g_journal_append_min_ns) : 0ull);
+}
+
+/*
+ * Purpose:
+ *   Unmaps and closes the journal. Called after the output reactors have
+ *   stopped; records already written stay in the file for the next run.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void journal_close(void) {
+    for (size_t i = 0; i < g_journal_survivor_count; ++i) {
+        close(g_journal_survivors[i].pidfd);
+    }
+    free(g_journal_survivors);
+    g_journal_survivors = NULL;
+    g_journal_survivor_count = 0;
+    if (g_journal_header != NULL) {
+        munmap(g_journal_header, g_journal_mapped_size);
+        g_journal_header = NULL;
+        g_journal_records = NULL;
+    }
+    if (g_journal_fd >= 0) {
+        close(g_journal_fd);
+        g_journal_fd = -1;
+    }
+}
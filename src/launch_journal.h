@@ -0,0 +1,78 @@
+/*
+ * launch_journal.h
+ *
+ * Description:
+ * Optional crash-recovery journal of launched children (-J). The journal is a
+ * preallocated file mapped with MAP_SHARED: every launch and every reaped exit
+ * appends one fixed-size record, reserved with one fetch-add on the header's
+ * cursor and published by storing its kind last, so the records survive a
+ * crash of the parent without any msync(). When the parent starts with an
+ * existing journal it replays it: a launch without an exit is a child that
+ * may still run. The child is re-found with pidfd_open() and its start time
+ * (/proc/<pid>/stat) is compared with the launch time, so a recycled PID is
+ * not mistaken for it. Children found alive are watched again by the output
+ * reactors (child_output.h); having been re-parented, their exit status is
+ * unknown. Child numbering resumes after the highest journaled id.
+ *
+ * Once the journal is three quarters full it is compacted in place down to
+ * the launches that have no exit yet. Appends from launcher threads and
+ * output reactors only take the read side of a lock; compaction, done by the
+ * command-loop thread, takes the write side.
+ *
+ * File layout: [journal_header_t][journal_record_t] x JOURNAL_RECORDS.
+ */
+#ifndef LAUNCH_JOURNAL_H
+#define LAUNCH_JOURNAL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define JOURNAL_MAGIC 0x4C4E524Au      /* "JRNL" */
+#define JOURNAL_VERSION 1u
+#define JOURNAL_RECORDS 65536u
+#define JOURNAL_PATH_SIZE 64
+
+enum {
+    JOURNAL_EMPTY = 0,                  /* Not written (or torn by a crash). */
+    JOURNAL_LAUNCH = 1,
+    JOURNAL_EXIT = 2
+};
+
+typedef struct journal_header_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;               /* sizeof(journal_record_t) */
+    uint32_t capacity;                  /* Number of record slots */
+    _Atomic uint64_t next;              /* Next free slot (may exceed capacity) */
+    uint64_t reserved[5];
+} journal_header_t;
+
+typedef struct journal_record_s {
+    _Atomic uint32_t kind;              /* JOURNAL_*; stored last */
+    int32_t child_id;
+    int32_t pid;
+    int32_t exit_code;                  /* Exit: CLD_EXITED, CLD_KILLED, CLD_DUMPED, or 0 if unknown */
+    int32_t exit_status;                /* Exit: status or signal number */
+    char method;                        /* Launch: '+', '*' or '&' */
+    char reserved[3];
+    uint64_t boot_ns;                   /* Launch: CLOCK_BOOTTIME just before fork(); exit: when reaped */
+    uint64_t env_generation;            /* Launch: environment version (env_rcu.h) */
+    char name[24];                      /* "child_NN" */
+    char exec_path[JOURNAL_PATH_SIZE];  /* Launch: executable, last bytes kept if longer */
+} journal_record_t;
+
+int journal_open(const char *path, bool recover);
+bool journal_enabled(void);
+uint64_t journal_now(void);
+void journal_launch(int child_id, pid_t pid, const char *name, char method, const char *exec_path,
+                    uint64_t env_generation, uint64_t launch_ns);
+void journal_exit(int child_id, pid_t pid, int exit_code, int exit_status);
+void journal_resume(void);
+void journal_maintain(size_t upcoming);
+void journal_print_stats(void);
+void journal_close(void);
+
+#endif /* LAUNCH_JOURNAL_H */
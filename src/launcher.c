@@ -0,0 +1,545 @@
+/*
+ * launcher.c
+ *
+ * Description:
+ * Work-stealing launcher threads (see launcher.h). Every deque is a growable
+ * ring guarded by its own mutex: launcher_run() pushes requests round-robin at
+ * the bottom, the owner pops from the bottom and thieves take from the top, so
+ * the two ends rarely contend. Forking is by far the most expensive step of a
+ * launch, so the per-deque locks cost nothing measurable, and they are never
+ * held while spawn() runs.
+ *
+ * Idle threads sleep on a condition variable until 'queued' (requests pushed
+ * but not yet taken) becomes non-zero; launcher_run() waits until 'outstanding'
+ * (requests not yet finished) drops to zero. Both counters are raised before
+ * the request is pushed, so they never go negative.
+ *
+ * Fork safety: no launcher lock is held while a thread forks, the forked child
+ * only runs async-signal-safe code until execve(), and pthread_atfork()
+ * handlers hold the parent log's lock across fork(), since other launcher and
+ * reactor threads may be logging at that moment. Launcher threads block all
+ * signals, so SIGINT/SIGTERM still interrupt the main thread's read of the
+ * next command.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "launcher.h"
+#include "parent_log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LAUNCHER_DEQUE_INITIAL 64   /* Must be a power of two. */
+
+typedef struct launch_deque_s {
+    pthread_mutex_t lock;
+    launch_request_t *items;
+    size_t capacity;                // Power of two
+    size_t top;                     // Oldest request (steal end)
+    size_t bottom;                  // One past the newest request (owner end)
+} launch_deque_t;
+
+typedef struct launcher_worker_s {
+    _Alignas(64) launch_deque_t deque;
+    pthread_t thread;
+    int index;
+    atomic_ulong launched;
+    atomic_ulong failed;
+    atomic_ulong stolen;
+} launcher_worker_t;
+
+static launcher_worker_t *g_launcher_workers;   // thread_count entries, or one for inline mode
+static int g_launcher_worker_count;
+static int g_launcher_thread_count;             // Running threads (0 in inline mode)
+static launcher_spawn_fn g_launcher_spawn;
+static atomic_int g_launcher_next_id;           // Next child id to hand out
+static atomic_size_t g_launcher_queued;         // Pushed but not yet taken
+static atomic_size_t g_launcher_outstanding;    // Pushed but not yet finished
+static bool g_launcher_stopping;                // Guarded by g_launcher_idle_lock
+static pthread_mutex_t g_launcher_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_launcher_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_launcher_done_cond = PTHREAD_COND_INITIALIZER;
+static size_t g_launcher_next_deque;            // Round-robin cursor, submitting thread only
+static unsigned long long g_launcher_busy_ns;   // Time spent in launcher_run(), submitting thread only
+static bool g_launcher_atfork_registered;
+
+/*
+ * Purpose:
+ *   Returns the monotonic clock in nanoseconds.
+ * Receives:
+ *   None.
+ * Returns:
+ *   Nanoseconds since an arbitrary fixed point.
+ */
+static unsigned long long launcher_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Initializes an empty deque.
+ * Receives:
+ *   deque: The deque to initialize.
+ * Returns:
+ *   0 on success, -1 on allocation failure.
+ */
+static int deque_init(launch_deque_t *deque) {
+    deque->items = malloc(LAUNCHER_DEQUE_INITIAL * sizeof(*deque->items));
+    if (deque->items == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->capacity = LAUNCHER_DEQUE_INITIAL;
+    deque->top = 0;
+    deque->bottom = 0;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Releases a deque's storage.
+ * Receives:
+ *   deque: The deque to destroy.
+ * Returns:
+ *   None (void).
+ */
+static void deque_destroy(launch_deque_t *deque) {
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->items);
+    deque->items = NULL;
+}
+
+/*
+ * Purpose:
+ *   Appends a request at the bottom of a deque, doubling the ring when full.
+ * Receives:
+ *   deque:   The deque.
+ *   request: The request to copy in.
+ * Returns:
+ *   0 on success, -1 on allocation failure (the deque is unchanged).
+ */
+static int deque_push_bottom(launch_deque_t *deque, const launch_request_t *request) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t new_capacity = deque->capacity * 2;
+        launch_request_t *items = malloc(new_capacity * sizeof(*items));
+        if (items == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = deque->top; i != deque->bottom; ++i) {
+            items[i & (new_capacity - 1)] = deque->items[i & (deque->capacity - 1)];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->capacity = new_capacity;
+    }
+    deque->items[deque->bottom & (deque->capacity - 1)] = *request;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Takes the newest request (owner end) or the oldest one (steal end).
+ * Receives:
+ *   deque:    The deque.
+ *   from_top: true to steal from the top, false to pop from the bottom.
+ *   request:  Receives the request.
+ * Returns:
+ *   true if a request was taken, false if the deque was empty.
+ */
+static bool deque_take(launch_deque_t *deque, bool from_top, launch_request_t *request) {
+    bool taken = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        if (from_top) {
+            *request = deque->items[deque->top & (deque->capacity - 1)];
+            deque->top++;
+        } else {
+            deque->bottom--;
+            *request = deque->items[deque->bottom & (deque->capacity - 1)];
+        }
+        taken = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return taken;
+}
+
+/*
+ * Purpose:
+ *   Hands out the next child id from the shared counter.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The child id.
+ */
+static int claim_child_id(void) {
+    return atomic_fetch_add(&g_launcher_next_id, 1);
+}
+
+/*
+ * Purpose:
+ *   Gives back the id of a failed launch, unless another thread has claimed
+ *   an id since, in which case the number is skipped.
+ * Receives:
+ *   child_id: The id claimed for the failed launch.
+ * Returns:
+ *   None (void).
+ */
+static void release_child_id(int child_id) {
+    int expected = child_id + 1;
+    atomic_compare_exchange_strong(&g_launcher_next_id, &expected, child_id);
+}
+
+/*
+ * Purpose:
+ *   Launches one child for a request and updates the thread's counters. The id
+ *   of a failed launch is given back when no other launch has claimed one
+ *   since, so numbering stays contiguous when launches fail (e.g., an
+ *   unreadable filter file) on the command loop or a single launcher thread.
+ * Receives:
+ *   worker:  The launching thread.
+ *   request: The request.
+ *   stolen:  Whether the request came from another thread's deque.
+ * Returns:
+ *   None (void).
+ */
+static void run_request(launcher_worker_t *worker, const launch_request_t *request, bool stolen) {
+    int child_id = claim_child_id();
+    if (g_launcher_spawn(request, child_id) == 0) {
+        atomic_fetch_add_explicit(&worker->launched, 1, memory_order_relaxed);
+    } else {
+        release_child_id(child_id);
+        atomic_fetch_add_explicit(&worker->failed, 1, memory_order_relaxed);
+    }
+    if (stolen) {
+        atomic_fetch_add_explicit(&worker->stolen, 1, memory_order_relaxed);
+    }
+}
+
+/*
+ * Purpose:
+ *   Marks one request as finished and wakes launcher_run() after the last one.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void finish_request(void) {
+    if (atomic_fetch_sub(&g_launcher_outstanding, 1) == 1) {
+        pthread_mutex_lock(&g_launcher_idle_lock);
+        pthread_cond_broadcast(&g_launcher_done_cond);
+        pthread_mutex_unlock(&g_launcher_idle_lock);
+    }
+}
+
+/*
+ * Purpose:
+ *   Tries to steal one request from the other threads' deques, starting with
+ *   the thread after 'self'.
+ * Receives:
+ *   self:    The stealing thread.
+ *   request: Receives the request.
+ * Returns:
+ *   true if a request was stolen.
+ */
+static bool steal_request(const launcher_worker_t *self, launch_request_t *request) {
+    for (int i = 1; i < g_launcher_thread_count; ++i) {
+        launcher_worker_t *victim = &g_launcher_workers[(self->index + i) % g_launcher_thread_count];
+        if (deque_take(&victim->deque, true, request)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Purpose:
+ *   Launcher thread: runs requests from its own deque, steals when it is
+ *   empty and sleeps while nothing is queued anywhere.
+ * Receives:
+ *   arg: The thread's launcher_worker_t.
+ * Returns:
+ *   NULL once launcher_stop() has been called and no work is left.
+ */
+static void *launcher_thread_main(void *arg) {
+    launcher_worker_t *self = arg;
+    launch_request_t request;
+
+    for (;;) {
+        bool stolen = false;
+        bool found = deque_take(&self->deque, false, &request);
+        if (!found) {
+            found = steal_request(self, &request);
+            stolen = found;
+        }
+        if (!found) {
+            pthread_mutex_lock(&g_launcher_idle_lock);
+            while (atomic_load(&g_launcher_queued) == 0 && !g_launcher_stopping) {
+                pthread_cond_wait(&g_launcher_work_cond, &g_launcher_idle_lock);
+            }
+            bool stop = g_launcher_stopping && atomic_load(&g_launcher_queued) == 0;
+            pthread_mutex_unlock(&g_launcher_idle_lock);
+            if (stop) {
+                return NULL;
+            }
+            continue;
+        }
+        atomic_fetch_sub(&g_launcher_queued, 1);
+        run_request(self, &request, stolen);
+        finish_request();
+    }
+}
+
+/*
+ * Purpose:
+ *   Sets up the launcher. With thread_count > 0 the launcher threads are
+ *   started (with all signals blocked); with 0 requests run inline.
+ * Receives:
+ *   thread_count: Number of launcher threads (0..LAUNCHER_MAX_THREADS).
+ *   spawn:        Function launching one child.
+ * Returns:
+ *   0 on success, -1 on failure (error logged; the launcher is left stopped).
+ */
+int launcher_start(int thread_count, launcher_spawn_fn spawn) {
+    if (thread_count < 0 || thread_count > LAUNCHER_MAX_THREADS) {
+        plog_err("Parent: Invalid launcher thread count %d.\n", thread_count);
+        return -1;
+    }
+    int worker_count = thread_count > 0 ? thread_count : 1;
+    g_launcher_workers = calloc((size_t)worker_count, sizeof(*g_launcher_workers));
+    if (g_launcher_workers == NULL) {
+        plog_perror("Parent: Failed to allocate launcher threads");
+        return -1;
+    }
+    g_launcher_worker_count = worker_count;
+    g_launcher_spawn = spawn;
+    g_launcher_stopping = false;
+    for (int i = 0; i < worker_count; ++i) {
+        g_launcher_workers[i].index = i;
+        if (deque_init(&g_launcher_workers[i].deque) != 0) {
+            plog_perror("Parent: Failed to allocate launch queue");
+            while (i-- > 0) {
+                deque_destroy(&g_launcher_workers[i].deque);
+            }
+            free(g_launcher_workers);
+            g_launcher_workers = NULL;
+            return -1;
+        }
+    }
+
+    // Registered even without launcher threads: the reactor threads log too.
+    if (!g_launcher_atfork_registered) {
+        int error_number = pthread_atfork(plog_atfork_prepare, plog_atfork_parent, plog_atfork_child);
+        if (error_number != 0) {
+            errno = error_number;
+            plog_perror("Parent: Warning - pthread_atfork failed");
+        } else {
+            g_launcher_atfork_registered = true;
+        }
+    }
+
+    sigset_t all_signals;
+    sigset_t previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+    int started = 0;
+    for (; started < thread_count; ++started) {
+        int error_number = pthread_create(&g_launcher_workers[started].thread, NULL, launcher_thread_main,
+                                          &g_launcher_workers[started]);
+        if (error_number != 0) {
+            errno = error_number;
+            plog_perror("Parent: Failed to start launcher thread");
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    g_launcher_thread_count = started;
+    if (started < thread_count) {
+        launcher_stop();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Launches 'count' children for the same request and waits until every
+ *   launch has been attempted (not for the children to exit).
+ * Receives:
+ *   request: The request, copied once per launch.
+ *   count:   Number of children to launch.
+ * Returns:
+ *   The number of launches that failed.
+ */
+size_t launcher_run(const launch_request_t *request, size_t count) {
+    if (g_launcher_workers == NULL) {
+        return count;
+    }
+    unsigned long long start_ns = launcher_now_ns();
+    size_t failed = 0;
+
+    if (g_launcher_thread_count == 0) {
+        launcher_worker_t *worker = &g_launcher_workers[0];
+        unsigned long before = atomic_load(&worker->failed);
+        for (size_t i = 0; i < count; ++i) {
+            run_request(worker, request, false);
+        }
+        failed = atomic_load(&worker->failed) - before;
+        g_launcher_busy_ns += launcher_now_ns() - start_ns;
+        return failed;
+    }
+
+    unsigned long failed_before = 0;
+    for (int i = 0; i < g_launcher_thread_count; ++i) {
+        failed_before += atomic_load(&g_launcher_workers[i].failed);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        launcher_worker_t *worker = &g_launcher_workers[g_launcher_next_deque];
+        g_launcher_next_deque = (g_launcher_next_deque + 1) % (size_t)g_launcher_thread_count;
+        atomic_fetch_add(&g_launcher_outstanding, 1);
+        atomic_fetch_add(&g_launcher_queued, 1);
+        if (deque_push_bottom(&worker->deque, request) != 0) {
+            plog_perror("Parent: Failed to queue launch request");
+            atomic_fetch_sub(&g_launcher_queued, 1);
+            finish_request();
+            failed += count - i;
+            break;
+        }
+        if (i == 0 || i + 1 == count || i % (size_t)g_launcher_thread_count == 0) {
+            pthread_mutex_lock(&g_launcher_idle_lock);
+            pthread_cond_broadcast(&g_launcher_work_cond);
+            pthread_mutex_unlock(&g_launcher_idle_lock);
+        }
+    }
+
+    pthread_mutex_lock(&g_launcher_idle_lock);
+    while (atomic_load(&g_launcher_outstanding) > 0) {
+        pthread_cond_wait(&g_launcher_done_cond, &g_launcher_idle_lock);
+    }
+    pthread_mutex_unlock(&g_launcher_idle_lock);
+
+    unsigned long failed_after = 0;
+    for (int i = 0; i < g_launcher_thread_count; ++i) {
+        failed_after += atomic_load(&g_launcher_workers[i].failed);
+    }
+    g_launcher_busy_ns += launcher_now_ns() - start_ns;
+    return failed + (failed_after - failed_before);
+}
+
+/*
+ * Purpose:
+ *   Logs the launch counters: totals with the launch rate over the time spent
+ *   in launcher_run(), then one line per launcher thread.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void launcher_print_stats(void) {
+    if (g_launcher_workers == NULL) {
+        return;
+    }
+    unsigned long launched = 0;
+    unsigned long failed = 0;
+    unsigned long stolen = 0;
+    for (int i = 0; i < g_launcher_worker_count; ++i) {
+        launched += atomic_load(&g_launcher_workers[i].launched);
+        failed += atomic_load(&g_launcher_workers[i].failed);
+        stolen += atomic_load(&g_launcher_workers[i].stolen);
+    }
+    double busy_s = (double)g_launcher_busy_ns / 1e9;
+    plog_out("Parent: Launcher (%d thread(s)): %lu launched, %lu failed, %lu stolen in %.3f s "
+             "(%.0f launches/s).\n", g_launcher_thread_count, launched, failed, stolen, busy_s,
+             busy_s > 0 ? (double)launched / busy_s : 0.0);
+    for (int i = 0; i < g_launcher_thread_count; ++i) {
+        const launcher_worker_t *worker = &g_launcher_workers[i];
+        plog_out("Parent:   thread %d: %lu launched, %lu failed, %lu stolen.\n", i,
+                 atomic_load(&worker->launched), atomic_load(&worker->failed), atomic_load(&worker->stolen));
+    }
+}
+
+/*
+ * Purpose:
+ *   Reports how many children were launched and how many launches failed
+ *   since the launcher started.
+ * Receives:
+ *   launched: Receives the number of children launched.
+ *   failed:   Receives the number of failed launches.
+ * Returns:
+ *   None (void). Both are 0 when the launcher is not running.
+ */
+void launcher_counts(unsigned long *launched, unsigned long *failed) {
+    *launched = 0;
+    *failed = 0;
+    for (int i = 0; g_launcher_workers != NULL && i < g_launcher_worker_count; ++i) {
+        *launched += atomic_load(&g_launcher_workers[i].launched);
+        *failed += atomic_load(&g_launcher_workers[i].failed);
+    }
+}
+
+/*
+ * Purpose:
+ *   Returns the first child id no launcher thread has reserved yet; every
+ *   child launched so far has a lower id.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The id.
+ */
+int launcher_next_child_id(void) {
+    return atomic_load(&g_launcher_next_id);
+}
+
+/*
+ * Purpose:
+ *   Makes child ids start at a given value (hot restart: the new instance
+ *   continues the numbering of the old one). Call before launcher_start().
+ * Receives:
+ *   child_id: The first id to hand out.
+ * Returns:
+ *   None (void).
+ */
+void launcher_set_next_child_id(int child_id) {
+    atomic_store(&g_launcher_next_id, child_id);
+}
+
+/*
+ * Purpose:
+ *   Stops and joins the launcher threads and releases the deques. Safe to
+ *   call when the launcher was never started.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void launcher_stop(void) {
+    if (g_launcher_workers == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&g_launcher_idle_lock);
+    g_launcher_stopping = true;
+    pthread_cond_broadcast(&g_launcher_work_cond);
+    pthread_mutex_unlock(&g_launcher_idle_lock);
+
+    for (int i = 0; i < g_launcher_thread_count; ++i) {
+        pthread_join(g_launcher_workers[i].thread, NULL);
+    }
+    for (int i = 0; i < g_launcher_worker_count; ++i) {
+        deque_destroy(&g_launcher_workers[i].deque);
+    }
+    free(g_launcher_workers);
+    g_launcher_workers = NULL;
+    g_launcher_thread_count = 0;
+    g_launcher_worker_count = 0;
+}
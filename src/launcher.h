@@ -0,0 +1,44 @@
+/*
+ * launcher.h
+ *
+ * Description:
+ * Launch queue of the parent. A batch of launch requests is spread over N
+ * launcher threads, each owning a deque of pending requests: a thread takes
+ * work from the bottom of its own deque and, once that is empty, steals from
+ * the top of another thread's deque, so every thread stays busy until the
+ * whole batch is done. Child ids come one at a time from a single atomic
+ * counter, so naming a child needs no shared lock and ids stay dense; with
+ * several threads, the order of the ids follows the order of the claims,
+ * not of the completed launches.
+ *
+ * With zero threads every request runs on the submitting thread, which keeps
+ * the original single-threaded behavior. Per-thread counters and the total
+ * busy time give the launch rate for comparing thread counts.
+ */
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <stddef.h>
+
+#define LAUNCHER_MAX_THREADS 64
+
+struct launch_barrier_s;
+
+typedef struct launch_request_s {
+    char method;                /* '+', '*' or '&' */
+    const char *exec_path;      /* Child executable; must outlive launcher_run() */
+    const struct launch_barrier_s *barrier;     /* Barrier the children park at ('b'), or NULL */
+} launch_request_t;
+
+/* Launches one child; returns 0 on success, -1 on failure (already logged). */
+typedef int (*launcher_spawn_fn)(const launch_request_t *request, int child_id);
+
+int launcher_start(int thread_count, launcher_spawn_fn spawn);
+size_t launcher_run(const launch_request_t *request, size_t count);
+void launcher_print_stats(void);
+void launcher_counts(unsigned long *launched, unsigned long *failed);
+int launcher_next_child_id(void);
+void launcher_set_next_child_id(int child_id);
+void launcher_stop(void);
+
+#endif /* LAUNCHER_H */
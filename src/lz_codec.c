@@ -0,0 +1,224 @@
+/*
+ * lz_codec.c
+ *
+ * Description:
+ * Greedy LZ77 compressor and bounds-checked decompressor for the format
+ * described in lz_codec.h. Matches are found through a hash table of the last
+ * position of every 4-byte prefix, which keeps compression a single pass over
+ * the input; child output (repeated variable names, paths, prefixes) compresses
+ * well with it even without lazy matching.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "lz_codec.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 13
+#define LZ_LAST_LITERALS 5      /* The final bytes are always emitted as literals. */
+
+/*
+ * Purpose:
+ *   Hashes the 4 bytes at 'p' into a table index.
+ * Receives:
+ *   p: Pointer to at least 4 readable bytes.
+ * Returns:
+ *   An index below 1 << LZ_HASH_BITS.
+ */
+static uint32_t hash4(const char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * Purpose:
+ *   Writes an extended length (the part of a length beyond 15) as a run of 255
+ *   bytes followed by the remainder.
+ * Receives:
+ *   op:     Output position.
+ *   op_end: End of the output buffer.
+ *   length: The remaining length (already reduced by 15).
+ * Returns:
+ *   The new output position, or NULL if the output buffer is too small.
+ */
+static char *write_length(char *op, const char *op_end, size_t length) {
+    while (length >= 255) {
+        if (op >= op_end) {
+            return NULL;
+        }
+        *op++ = (char)255;
+        length -= 255;
+    }
+    if (op >= op_end) {
+        return NULL;
+    }
+    *op++ = (char)length;
+    return op;
+}
+
+/*
+ * Purpose:
+ *   Emits one sequence: token, literals and (unless this is the last sequence)
+ *   the match offset and extended match length.
+ * Receives:
+ *   op, op_end:    Output position and end of the output buffer.
+ *   literals:      Start of the literal run.
+ *   literal_len:   Number of literals.
+ *   match_len:     Match length (0 for the last sequence).
+ *   offset:        Match distance.
+ * Returns:
+ *   The new output position, or NULL if the output buffer is too small.
+ */
+static char *emit_sequence(char *op, const char *op_end, const char *literals, size_t literal_len,
+                           size_t match_len, size_t offset) {
+    if (op >= op_end) {
+        return NULL;
+    }
+    char *token = op++;
+    size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    *token = (char)(((literal_len < 15 ? literal_len : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_len >= 15 && (op = write_length(op, op_end, literal_len - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(op_end - op) < literal_len) {
+        return NULL;
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len == 0) {
+        return op;
+    }
+    if (op_end - op < 2) {
+        return NULL;
+    }
+    *op++ = (char)(offset & 0xFF);
+    *op++ = (char)(offset >> 8);
+    if (match_code >= 15 && (op = write_length(op, op_end, match_code - 15)) == NULL) {
+        return NULL;
+    }
+    return op;
+}
+
+/*
+ * Purpose:
+ *   Compresses one block.
+ * Receives:
+ *   src, src_len:      Input bytes.
+ *   dst, dst_capacity: Output buffer (LZ_COMPRESS_BOUND(src_len) is always enough).
+ * Returns:
+ *   The compressed size, or 0 if it does not fit into 'dst_capacity' (the
+ *   caller then stores the block uncompressed).
+ */
+size_t lz_compress(const char *src, size_t src_len, char *dst, size_t dst_capacity) {
+    uint32_t table[1u << LZ_HASH_BITS];
+    const char *op_end = dst + dst_capacity;
+    char *op = dst;
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    if (src_len > LZ_MIN_MATCH + LZ_LAST_LITERALS) {
+        memset(table, 0xFF, sizeof(table));
+        size_t match_limit = src_len - LZ_LAST_LITERALS;
+        while (pos + LZ_MIN_MATCH <= match_limit) {
+            uint32_t h = hash4(src + pos);
+            uint32_t candidate = table[h];
+            table[h] = (uint32_t)pos;
+            if (candidate == UINT32_MAX || pos - candidate > LZ_MAX_OFFSET ||
+                memcmp(src + candidate, src + pos, LZ_MIN_MATCH) != 0) {
+                pos++;
+                continue;
+            }
+            size_t match_len = LZ_MIN_MATCH;
+            while (pos + match_len < match_limit && src[candidate + match_len] == src[pos + match_len]) {
+                match_len++;
+            }
+            op = emit_sequence(op, op_end, src + anchor, pos - anchor, match_len, pos - candidate);
+            if (op == NULL) {
+                return 0;
+            }
+            pos += match_len;
+            anchor = pos;
+        }
+    }
+    op = emit_sequence(op, op_end, src + anchor, src_len - anchor, 0, 0);
+    return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+/*
+ * Purpose:
+ *   Reads an extended length.
+ * Receives:
+ *   ip, ip_end: Input position (advanced) and end of the input.
+ *   length:     In/out length, increased by the bytes read.
+ * Returns:
+ *   0 on success, -1 if the input ends inside the length.
+ */
+static int read_length(const unsigned char **ip, const unsigned char *ip_end, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= ip_end) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Decompresses one block, validating every length and offset.
+ * Receives:
+ *   src, src_len: Compressed bytes.
+ *   dst, dst_len: Output buffer and the exact decompressed size.
+ * Returns:
+ *   0 on success, -1 if the input is corrupt or does not decode to exactly
+ *   'dst_len' bytes.
+ */
+int lz_decompress(const char *src, size_t src_len, char *dst, size_t dst_len) {
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *ip_end = ip + src_len;
+    size_t out = 0;
+
+    while (ip < ip_end) {
+        unsigned token = *ip++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && read_length(&ip, ip_end, &literal_len) != 0) {
+            return -1;
+        }
+        if (literal_len > (size_t)(ip_end - ip) || literal_len > dst_len - out) {
+            return -1;
+        }
+        memcpy(dst + out, ip, literal_len);
+        ip += literal_len;
+        out += literal_len;
+        if (ip == ip_end) {
+            break;  /* Last sequence */
+        }
+
+        if (ip_end - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t match_len = (token & 15u);
+        if (match_len == 15 && read_length(&ip, ip_end, &match_len) != 0) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || match_len > dst_len - out) {
+            return -1;
+        }
+        /* Byte by byte: the match may overlap the bytes it produces. */
+        const char *match = dst + out - offset;
+        for (size_t i = 0; i < match_len; ++i) {
+            dst[out + i] = match[i];
+        }
+        out += match_len;
+    }
+    return out == dst_len ? 0 : -1;
+}
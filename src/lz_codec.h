@@ -0,0 +1,23 @@
+/*
+ * lz_codec.h
+ *
+ * Description:
+ * Small LZ77-family block codec used by the output archive, so the project
+ * needs no compression library. The format follows the LZ4 block layout: a
+ * sequence is a token byte (literal count in the high nibble, match length - 4
+ * in the low nibble, 15 meaning "more length bytes follow"), the literals, and
+ * a 16-bit little-endian match offset. The last sequence has literals only.
+ * Blocks are self-contained; the decoder needs the exact decompressed size.
+ */
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <stddef.h>
+
+/* Worst-case compressed size for 'size' input bytes. */
+#define LZ_COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+size_t lz_compress(const char *src, size_t src_len, char *dst, size_t dst_capacity);
+int lz_decompress(const char *src, size_t src_len, char *dst, size_t dst_len);
+
+#endif /* LZ_CODEC_H */
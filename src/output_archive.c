@@ -0,0 +1,318 @@
+/*
+ * output_archive.c
+ *
+ * Description:
+ * Archive writer (see output_archive.h). It is driven by the output reactor
+ * thread: archive_append() and archive_stream_close() are only called from
+ * there, archive_open() before the reactor starts and archive_close() after it
+ * has been joined, so the writer needs no locking. Blocks are written with one
+ * writev() (header + data); the index is kept in memory until close.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "output_archive.h"
+#include "lz_codec.h"
+#include "parent_log.h"
+#include "parent_memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+static int g_archive_fd = -1;
+static uint64_t g_archive_offset;                   // Current end of the file
+static archive_index_entry_t *g_archive_index;
+static size_t g_archive_index_count;
+static size_t g_archive_index_capacity;
+static char *g_archive_compressed;                  // Compression scratch buffer
+
+/*
+ * Purpose:
+ *   Writes all given iovecs, retrying after short writes and EINTR.
+ * Receives:
+ *   iov, iov_count: The data to write (modified in place).
+ * Returns:
+ *   0 on success, -1 on a write error (errno is set).
+ */
+static int archive_writev(struct iovec *iov, int iov_count) {
+    while (iov_count > 0) {
+        ssize_t written = writev(g_archive_fd, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        g_archive_offset += (uint64_t)written;
+        size_t remaining = (size_t)written;
+        while (iov_count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *)iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Returns the current wall-clock time in nanoseconds.
+ * Receives:
+ *   None.
+ * Returns:
+ *   Nanoseconds since the epoch.
+ */
+static uint64_t archive_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Creates the archive file and writes its header.
+ * Receives:
+ *   path: Archive path (truncated if it exists).
+ * Returns:
+ *   0 on success, -1 on failure (error logged; archiving stays disabled).
+ */
+int archive_open(const char *path) {
+    g_archive_compressed = pmem_alloc(PMEM_BUFFER, LZ_COMPRESS_BOUND(OUTPUT_ARCHIVE_BLOCK_SIZE));
+    if (g_archive_compressed == NULL) {
+        plog_perror("Parent: Failed to allocate archive buffer");
+        return -1;
+    }
+    g_archive_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (g_archive_fd < 0) {
+        plog_perror("Parent: Failed to create output archive");
+        pmem_free(PMEM_BUFFER, g_archive_compressed, LZ_COMPRESS_BOUND(OUTPUT_ARCHIVE_BLOCK_SIZE));
+        g_archive_compressed = NULL;
+        return -1;
+    }
+    archive_file_header_t header = { OUTPUT_ARCHIVE_MAGIC, OUTPUT_ARCHIVE_VERSION };
+    struct iovec iov = { &header, sizeof(header) };
+    g_archive_offset = 0;
+    if (archive_writev(&iov, 1) != 0) {
+        plog_perror("Parent: Failed to write output archive header");
+        close(g_archive_fd);
+        g_archive_fd = -1;
+        pmem_free(PMEM_BUFFER, g_archive_compressed, LZ_COMPRESS_BOUND(OUTPUT_ARCHIVE_BLOCK_SIZE));
+        g_archive_compressed = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Tells whether an archive is open.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true between a successful archive_open() and archive_close().
+ */
+bool archive_enabled(void) {
+    return g_archive_fd >= 0;
+}
+
+/*
+ * Purpose:
+ *   Prepares the per-child block state; no memory is allocated until the child
+ *   produces output.
+ * Receives:
+ *   stream:   State to initialize.
+ *   child_id: The child's number (e.g., 7 for child_07).
+ * Returns:
+ *   None (void).
+ */
+void archive_stream_init(archive_stream_t *stream, uint32_t child_id) {
+    stream->child_id = child_id;
+    stream->first_ns = 0;
+    stream->used = 0;
+    stream->block = NULL;
+}
+
+/*
+ * Purpose:
+ *   Compresses the child's current block, appends it to the archive and
+ *   records its index entry. A block that does not shrink is stored as is.
+ * Receives:
+ *   stream: The child's block state (emptied on success).
+ * Returns:
+ *   0 on success (or nothing to write), -1 on a write or allocation error.
+ */
+static int flush_block(archive_stream_t *stream) {
+    if (stream->used == 0) {
+        return 0;
+    }
+    if (g_archive_index_count == g_archive_index_capacity) {
+        size_t new_capacity = g_archive_index_capacity == 0 ? 256 : g_archive_index_capacity * 2;
+        archive_index_entry_t *new_index = pmem_realloc(PMEM_BUFFER, g_archive_index,
+                                                        g_archive_index_capacity * sizeof(*new_index),
+                                                        new_capacity * sizeof(*new_index));
+        if (new_index == NULL) {
+            return -1;
+        }
+        g_archive_index = new_index;
+        g_archive_index_capacity = new_capacity;
+    }
+
+    size_t compressed = lz_compress(stream->block, stream->used, g_archive_compressed,
+                                    LZ_COMPRESS_BOUND(OUTPUT_ARCHIVE_BLOCK_SIZE));
+    bool use_compressed = compressed > 0 && compressed < stream->used;
+
+    archive_block_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = OUTPUT_ARCHIVE_BLOCK_MAGIC;
+    header.child_id = stream->child_id;
+    header.time_ns = stream->first_ns;
+    header.raw_len = (uint32_t)stream->used;
+    header.stored_len = (uint32_t)(use_compressed ? compressed : stream->used);
+    header.flags = use_compressed ? OUTPUT_ARCHIVE_COMPRESSED : 0;
+
+    archive_index_entry_t *entry = &g_archive_index[g_archive_index_count];
+    entry->child_id = stream->child_id;
+    entry->reserved = 0;
+    entry->time_ns = stream->first_ns;
+    entry->offset = g_archive_offset;
+
+    struct iovec iov[2] = {
+        { &header, sizeof(header) },
+        { use_compressed ? g_archive_compressed : stream->block, header.stored_len }
+    };
+    if (archive_writev(iov, 2) != 0) {
+        return -1;
+    }
+    g_archive_index_count++;
+    stream->used = 0;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Adds output of one child to its current block, writing out every block
+ *   that fills up.
+ * Receives:
+ *   stream:       The child's block state.
+ *   data, length: Output bytes, as forwarded to the destination.
+ * Returns:
+ *   0 on success, -1 on a write or allocation error.
+ */
+int archive_append(archive_stream_t *stream, const char *data, size_t length) {
+    if (g_archive_fd < 0 || length == 0) {
+        return 0;
+    }
+    if (stream->block == NULL) {
+        stream->block = pmem_alloc(PMEM_BUFFER, OUTPUT_ARCHIVE_BLOCK_SIZE);
+        if (stream->block == NULL) {
+            return -1;
+        }
+    }
+    while (length > 0) {
+        if (stream->used == 0) {
+            stream->first_ns = archive_now_ns();
+        }
+        size_t piece = OUTPUT_ARCHIVE_BLOCK_SIZE - stream->used;
+        if (piece > length) {
+            piece = length;
+        }
+        memcpy(stream->block + stream->used, data, piece);
+        stream->used += piece;
+        data += piece;
+        length -= piece;
+        if (stream->used == OUTPUT_ARCHIVE_BLOCK_SIZE && flush_block(stream) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Writes out a child's last, partial block and releases its buffer. Called
+ *   when the child's output stream ends.
+ * Receives:
+ *   stream: The child's block state.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+int archive_stream_close(archive_stream_t *stream) {
+    int rc = 0;
+    if (g_archive_fd >= 0) {
+        rc = flush_block(stream);
+    }
+    pmem_free(PMEM_BUFFER, stream->block, OUTPUT_ARCHIVE_BLOCK_SIZE);
+    stream->block = NULL;
+    stream->used = 0;
+    return rc;
+}
+
+/*
+ * Purpose:
+ *   qsort() comparison ordering index entries by child id, then time, then
+ *   file offset.
+ * Receives:
+ *   a, b: Pointers to archive_index_entry_t.
+ * Returns:
+ *   <0, 0 or >0.
+ */
+static int compare_index_entries(const void *a, const void *b) {
+    const archive_index_entry_t *x = a;
+    const archive_index_entry_t *y = b;
+    if (x->child_id != y->child_id) return x->child_id < y->child_id ? -1 : 1;
+    if (x->time_ns != y->time_ns) return x->time_ns < y->time_ns ? -1 : 1;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Appends the sorted index (8-byte aligned) and the trailer and closes the archive. All
+ *   streams must have been closed with archive_stream_close() first.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success (or no archive open), -1 on a write error (logged).
+ */
+int archive_close(void) {
+    if (g_archive_fd < 0) {
+        return 0;
+    }
+    qsort(g_archive_index, g_archive_index_count, sizeof(*g_archive_index), compare_index_entries);
+    // Align the index so readers can use it in place from a mapping of the file.
+    static char padding[sizeof(uint64_t)];
+    size_t padding_len = (sizeof(uint64_t) - g_archive_offset % sizeof(uint64_t)) % sizeof(uint64_t);
+    archive_trailer_t trailer = { g_archive_offset + padding_len, g_archive_index_count,
+                                  OUTPUT_ARCHIVE_INDEX_MAGIC, OUTPUT_ARCHIVE_VERSION };
+    struct iovec iov[3] = {
+        { padding, padding_len },
+        { g_archive_index, g_archive_index_count * sizeof(*g_archive_index) },
+        { &trailer, sizeof(trailer) }
+    };
+    int rc = 0;
+    if (archive_writev(iov, 3) != 0) {
+        plog_perror("Parent: Failed to write output archive index");
+        rc = -1;
+    }
+    if (close(g_archive_fd) != 0) {
+        plog_perror("Parent: Failed to close output archive");
+        rc = -1;
+    }
+    g_archive_fd = -1;
+    pmem_free(PMEM_BUFFER, g_archive_index, g_archive_index_capacity * sizeof(*g_archive_index));
+    pmem_free(PMEM_BUFFER, g_archive_compressed, LZ_COMPRESS_BOUND(OUTPUT_ARCHIVE_BLOCK_SIZE));
+    g_archive_index = NULL;
+    g_archive_compressed = NULL;
+    g_archive_index_count = 0;
+    g_archive_index_capacity = 0;
+    return rc;
+}
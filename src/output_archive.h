@@ -0,0 +1,77 @@
+/*
+ * output_archive.h
+ *
+ * Description:
+ * Append-only archive of captured child output. Output is collected per child
+ * into blocks of up to OUTPUT_ARCHIVE_BLOCK_SIZE bytes; every full block (and
+ * the last one of a child) is compressed with the built-in LZ codec and
+ * appended to the archive file. One index entry per block records the child
+ * id, the time of the block's first byte and the block's file offset. When the
+ * archive is closed the index is sorted by (child id, time) and appended,
+ * followed by a fixed-size trailer, so a reader can find one child's blocks
+ * with a binary search.
+ *
+ * File layout:
+ *   file header | block header + data | ... | index entries | trailer
+ * An archive without a trailer (parent killed) is still readable: its blocks
+ * can be found by scanning the block headers.
+ */
+#ifndef OUTPUT_ARCHIVE_H
+#define OUTPUT_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTPUT_ARCHIVE_MAGIC 0x43524143u         /* "CARC" */
+#define OUTPUT_ARCHIVE_BLOCK_MAGIC 0x314B4C42u   /* "BLK1" */
+#define OUTPUT_ARCHIVE_INDEX_MAGIC 0x58444943u   /* "CIDX" */
+#define OUTPUT_ARCHIVE_VERSION 1u
+#define OUTPUT_ARCHIVE_BLOCK_SIZE (64u * 1024u)
+#define OUTPUT_ARCHIVE_COMPRESSED 0x1u           /* Block flag: data is LZ-compressed */
+
+typedef struct archive_file_header_s {
+    uint32_t magic;
+    uint32_t version;
+} archive_file_header_t;
+
+typedef struct archive_block_header_s {
+    uint32_t magic;
+    uint32_t child_id;
+    uint64_t time_ns;       /* CLOCK_REALTIME of the block's first byte */
+    uint32_t raw_len;
+    uint32_t stored_len;
+    uint32_t flags;
+    uint32_t reserved;
+} archive_block_header_t;
+
+typedef struct archive_index_entry_s {
+    uint32_t child_id;
+    uint32_t reserved;
+    uint64_t time_ns;
+    uint64_t offset;        /* File offset of the block header */
+} archive_index_entry_t;
+
+typedef struct archive_trailer_s {
+    uint64_t index_offset;
+    uint64_t entry_count;
+    uint32_t magic;
+    uint32_t version;
+} archive_trailer_t;
+
+/* Per-child block being filled; embedded in the caller's stream state. */
+typedef struct archive_stream_s {
+    uint32_t child_id;
+    uint64_t first_ns;
+    size_t used;
+    char *block;            /* Allocated on first use */
+} archive_stream_t;
+
+int archive_open(const char *path);
+bool archive_enabled(void);
+void archive_stream_init(archive_stream_t *stream, uint32_t child_id);
+int archive_append(archive_stream_t *stream, const char *data, size_t length);
+int archive_stream_close(archive_stream_t *stream);
+int archive_close(void);
+
+#endif /* OUTPUT_ARCHIVE_H */
@@ -12,8 +12,35 @@
  * - Uses different methods (+: getenv, *: main's envp, &: environ) to locate the
  *   path to the child executable, specified by the CHILD_PATH environment variable.
  * - Creates a filtered environment for each child based on variable names listed
- *   in a file specified as a command-line argument.
+ *   in a file specified as a command-line argument (re-read when it changes).
+ * - Sets and unsets its own environment variables at runtime (v, u commands),
+ *   updating the cached filtered environment incrementally.
  * - Passes the filter file path itself to the child via an environment variable.
+ * - Optionally (-m) gives children a shared mmap log to append their reports to.
+ * - Optionally (-r binary) has children send binary reports that are decoded here.
+ * - Optionally (-a) keeps captured output in a compressed, indexed archive.
+ * - Optionally (-O) emits captured output as per-child blocks in launch order.
+ * - Optionally (-j) launches children from several work-stealing launcher
+ *   threads; a count after the command ("+ 100") launches a batch.
+ * - Optionally (-R) spreads captured output and child reaping over several
+ *   reactor threads.
+ * - Optionally (-C) replays the recorded output of an identical earlier child
+ *   (same binary, arguments and filtered environment) instead of forking.
+ * - Optionally (-W) answers identical launch requests that arrive within a
+ *   short window with the result of the first one instead of forking again.
+ * - Re-executes itself (or a new parent binary) on the 'h' command without
+ *   losing running children: captured children, cached results and the child
+ *   numbering are handed to the new instance (-H).
+ * - Optionally (-J) journals every launch and exit in an mmap'd file, so that
+ *   children still running after a crash are found and watched again.
+ * - Optionally (-D) acts as a subreaper: processes that children leave behind
+ *   are reaped too and their resource usage is added to the child's launch.
+ * - Optionally (-S) runs as one shard behind a shard router, taking its
+ *   commands from the router's Unix socket and acknowledging each of them.
+ * - Optionally (-w) warms the child executable and its libraries in the page
+ *   cache at startup (or locks them there) and times the first launches' exec.
+ * - Optionally (-I) executes children from a sealed in-memory copy of the
+ *   child executable, refreshed by the 'i' command when the file changes.
  * - The '&' command launches a child and the parent continues execution.
  * - Manages child process numbering (e.g., child_00, child_01).
  *
@@ -36,17 +63,48 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <signal.h> // Required for signal handling
+#include <fcntl.h>
+
+#include "env_snapshot.h"
+#include "env_filter.h"
+#include "env_rcu.h"
+#include "env_sort.h"
+#include "env_dump.h"
+#include "parent_log.h"
+#include "child_output.h"
+#include "shared_log.h"
+#include "child_report.h"
+#include "output_archive.h"
+#include "launcher.h"
+#include "launch_coalesce.h"
+#include "result_cache.h"
+#include "hot_restart.h"
+#include "launch_journal.h"
+#include "subreaper.h"
+#include "shard_link.h"
+#include "shard_protocol.h"
+#include "exec_warmup.h"
+#include "child_image.h"
+#include "parent_memory.h"
+#include "launch_barrier.h"
 
 
 extern char **environ;
 
 
-#define MAX_CHILDREN 100
+#define MAX_CHILDREN SHARD_MAX_CHILDREN     // Known to the shard router as well
 #define PATH_BUFFER_SIZE 4096
+#define COMMAND_ARGUMENT_SIZE 4096
 #define CHILD_EXECUTABLE_NAME "child"
 #define ENV_VAR_FILTER_FILE_NAME "CHILD_ENV_FILTER_FILE"
 
 
+typedef enum env_dump_mode_e {
+    ENV_DUMP_FULL,  // Sort and print the environment at startup (default)
+    ENV_DUMP_LAZY,  // Defer sorting and printing until the 'e' command
+    ENV_DUMP_NONE   // Never print the environment
+} env_dump_mode_t;
+
 typedef struct env_list_s {
     char **vars;
     size_t count;
@@ -54,18 +112,36 @@ typedef struct env_list_s {
 } env_list_t;
 
 
-static int g_child_number;
+static const char *g_env_filter_file;      // Filter file passed to every child
+static env_list_t g_child_fixed_env;        // Entries every child gets after the filtered ones
+static char **g_main_envp;                  // main()'s envp, for the '*' method
+static char **g_main_argv;                  // main()'s argv, passed on by a hot restart
+static const char *g_shared_log_path = NULL; // Shared append log passed to children (-m), or NULL
+static uint64_t g_shared_log_capacity = SHARED_LOG_DEFAULT_CAPACITY;
+static bool g_binary_reports = false; // Children send binary reports (-r binary)
+static shared_log_t g_shared_log = { .fd = -1, .header = NULL, .mapped_size = 0 }; // Read-only view for rotation checks
 static volatile sig_atomic_t signal_flag = 0; // Flag to indicate a signal was received
 
 /* --- Function Prototypes --- */
 
 static int compare_env_vars(const void *a, const void *b);
 static char *find_env_var_value(const char *var_name, char **env_array);
-static env_list_t create_filtered_env(const char *filter_filename, char **source_env);
+static int refresh_env_filter(void);
+static int build_child_fixed_env(void);
+static void change_environment(char command, char *argument, bool truncated);
 static void free_env_list(env_list_t *list);
-static int launch_child(char method, const char *filter_filename, char **main_envp);
+static int append_env_entry(env_list_t *list, const char *name, const char *value);
+static int open_shared_log(bool rotate);
+static void check_shared_log_rotation(void);
+static int launch_children(char method, size_t count, launch_barrier_t *barrier);
+static int spawn_child(const launch_request_t *request, int child_id);
+static _Noreturn void child_fail(const char *message, const char *detail);
 static void print_usage(const char *prog_name);
 static void handle_interrupt_signal(int signum);
+static int refresh_env_snapshot(void);
+static int print_sorted_environment(char **envp, const char *heading);
+static int print_current_environment(void);
+static void shutdown_at_exit(void);
 
 /*
  * Purpose:
@@ -80,22 +156,28 @@ static void handle_interrupt_signal(int signum) {
     signal_flag = signum;
 }
 
-
 /*
  * Purpose:
  *   Main entry point for the parent program. It orchestrates the setup and
  *   command loop for launching child processes.
- *   1. Validates command-line arguments (requires one: filter file path).
- *   2. Prints its own PID.
- *   3. Sorts its initial environment variables using the "C" locale and prints them.
- *   4. Enters a loop, prompting the user for commands (+, *, &, q).
- *   5. Based on the command, calls launch_child() to create and execute a
- *      child process with appropriate settings.
+ *   1. Validates command-line arguments (requires one: filter file path; the
+ *      options are listed by print_usage()).
+ *   2. Prints its own PID, or resumes the state of a hot restart (-H).
+ *   3. Sorts its initial environment variables using the "C" locale and prints them
+ *      (unless the dump is deferred or disabled).
+ *   4. Starts the output reactors, the launcher threads and the optional
+ *      journal, subreaper, result cache, child image and shard link.
+ *   5. Enters a loop, reading commands from stdin or the shard router:
+ *      '+', '*', '&' [count] hand a batch of launches to the launcher
+ *      (launch_children()), 'b' [count] launches a batch behind a barrier,
+ *      'v' / 'u' set or unset a variable of the children's environment,
+ *      'e' prints the current environment, 's' prints statistics, 'h' [binary]
+ *      hot-restarts, 'i' refreshes the child image and 'q' quits.
  *   6. Exits the loop and terminates if 'q' is entered or a signal is caught.
  * Receives:
  *   argc: The number of command-line arguments.
  *   argv: An array of command-line argument strings. argv[0] is the program name,
- *         argv[1] should be the path to the environment filter file.
+ *         the only non-option argument is the path to the environment filter file.
  *   envp: An array of strings representing the environment variables passed to
  *         this process by the operating system when it started.
  * Returns:
@@ -104,7 +186,8 @@ static void handle_interrupt_signal(int signum) {
  *   allocation failure, failure during setup).
  */
 int main(int argc, char *argv[], char *envp[]) {
-    g_child_number = 0;
+    g_main_envp = envp;
+    g_main_argv = argv;
 
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -123,93 +206,353 @@ int main(int argc, char *argv[], char *envp[]) {
     }
 
 
-    if (argc != 2) {
+    env_dump_mode_t env_dump_mode = ENV_DUMP_FULL;
+    bool async_log = false;
+    plog_overflow_policy_t log_policy = PLOG_OVERFLOW_BLOCK;
+    bool capture_output = false;
+    const char *output_path = NULL;
+    const char *archive_path = NULL;
+    int launcher_threads = 0;
+    unsigned coalesce_window_ms = 0;
+    size_t result_cache_entries = 0;
+    int restart_fd = -1;
+    const char *journal_path = NULL;
+    bool subreaper = false;
+    const char *shard_socket = NULL;
+    warmup_mode_t warmup_mode = WARMUP_OFF;
+    bool in_memory_child = false;
+    output_config_t output_config = { .dest_fd = STDOUT_FILENO, .tag_terminal = false, .pipe_size = 0,
+                                      .decode_reports = false, .reorder_window = 0, .shard_count = 1 };
+    int option;
+    while ((option = getopt(argc, argv, "e:l:co:p:tm:M:r:a:O:j:R:W:C:H:J:DS:w:I")) != -1) {
+        switch (option) {
+            case 'e':
+                if (strcmp(optarg, "full") == 0) {
+                    env_dump_mode = ENV_DUMP_FULL;
+                } else if (strcmp(optarg, "lazy") == 0) {
+                    env_dump_mode = ENV_DUMP_LAZY;
+                } else if (strcmp(optarg, "none") == 0) {
+                    env_dump_mode = ENV_DUMP_NONE;
+                } else {
+                    fprintf(stderr, "Parent: Invalid environment dump mode '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                async_log = true;
+                if (strcmp(optarg, "sync") == 0) {
+                    async_log = false;
+                } else if (strcmp(optarg, "block") == 0) {
+                    log_policy = PLOG_OVERFLOW_BLOCK;
+                } else if (strcmp(optarg, "drop-oldest") == 0) {
+                    log_policy = PLOG_OVERFLOW_DROP_OLDEST;
+                } else if (strcmp(optarg, "drop") == 0) {
+                    log_policy = PLOG_OVERFLOW_DROP;
+                } else {
+                    fprintf(stderr, "Parent: Invalid log mode '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                capture_output = true;
+                break;
+            case 'o':
+                capture_output = true;
+                output_path = optarg;
+                break;
+            case 'p': {
+                char *end = NULL;
+                long pipe_size = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || pipe_size <= 0 || pipe_size > INT_MAX) {
+                    fprintf(stderr, "Parent: Invalid pipe size '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                output_config.pipe_size = (int)pipe_size;
+                break;
+            }
+            case 't':
+                output_config.tag_terminal = true;
+                break;
+            case 'm':
+                g_shared_log_path = optarg;
+                break;
+            case 'M': {
+                char *end = NULL;
+                unsigned long long capacity = strtoull(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || optarg[0] == '-' || capacity < 4096 || capacity > UINT32_MAX) {
+                    fprintf(stderr, "Parent: Invalid shared log size '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                g_shared_log_capacity = capacity;
+                break;
+            }
+            case 'O': {
+                char *end = NULL;
+                unsigned long long window = strtoull(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || optarg[0] == '-' || window == 0 || window > SIZE_MAX / 2) {
+                    fprintf(stderr, "Parent: Invalid reorder window '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                capture_output = true;
+                output_config.reorder_window = (size_t)window;
+                break;
+            }
+            case 'a':
+                capture_output = true;
+                archive_path = optarg;
+                break;
+            case 'j': {
+                char *end = NULL;
+                long threads = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || threads < 0 || threads > LAUNCHER_MAX_THREADS) {
+                    fprintf(stderr, "Parent: Invalid launcher thread count '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                launcher_threads = (int)threads;
+                break;
+            }
+            case 'R': {
+                char *end = NULL;
+                long shards = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || shards < 1 || shards > OUTPUT_MAX_SHARDS) {
+                    fprintf(stderr, "Parent: Invalid reactor count '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                capture_output = true;
+                output_config.shard_count = (int)shards;
+                break;
+            }
+            case 'W': {
+                char *end = NULL;
+                long window_ms = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || window_ms < 1 || window_ms > COALESCE_MAX_WINDOW_MS) {
+                    fprintf(stderr, "Parent: Invalid coalescing window '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                coalesce_window_ms = (unsigned)window_ms;
+                break;
+            }
+            case 'C': {
+                char *end = NULL;
+                long entries = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || entries < 1 || entries > RESULT_CACHE_MAX_ENTRIES) {
+                    fprintf(stderr, "Parent: Invalid result cache size '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                capture_output = true;
+                result_cache_entries = (size_t)entries;
+                break;
+            }
+            case 'H': {
+                char *end = NULL;
+                long fd = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || fd < 0 || fd > INT_MAX) {
+                    fprintf(stderr, "Parent: Invalid hot restart descriptor '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                restart_fd = (int)fd;
+                break;
+            }
+            case 'J':
+                journal_path = optarg;
+                break;
+            case 'D':
+                // Descendants are reaped by the output reactor.
+                capture_output = true;
+                subreaper = true;
+                break;
+            case 'S':
+                shard_socket = optarg;
+                break;
+            case 'I':
+                in_memory_child = true;
+                break;
+            case 'w':
+                if (warmup_parse_mode(optarg, &warmup_mode) != 0) {
+                    fprintf(stderr, "Parent: Invalid warmup mode '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                if (strcmp(optarg, "text") == 0) {
+                    g_binary_reports = false;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    g_binary_reports = true;
+                } else {
+                    fprintf(stderr, "Parent: Invalid report format '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
-    const char *env_filter_file = argv[1];
-
+    g_env_filter_file = argv[optind];
 
-    if (printf("Parent PID: %d\n", getpid()) < 0) {
-        perror("Parent: printf failed for PID");
-    }
-    if (printf("Initial environment variables (sorted LC_COLLATE=C):\n") < 0) {
-        perror("Parent: printf failed for env header");
+    // Binary reports are decoded by the output reactor, so they need capture.
+    if (g_binary_reports) {
+        capture_output = true;
+        output_config.decode_reports = true;
     }
 
+    // Anything still buffered when the parent exits (including early error returns) is written out.
+    if (atexit(shutdown_at_exit) != 0) {
+        fprintf(stderr, "Parent: Warning - Failed to register log flush at exit.\n");
+    }
 
-    int env_count = 0;
-    for (char **env = envp; *env != NULL; ++env) {
-        env_count++;
+    // Before any thread starts: every thread has to inherit the blocked SIGCHLD.
+    if (subreaper && subreaper_enable() != 0) {
+        plog_err("Parent: Warning - Subreaper mode disabled.\n");
     }
 
+    if (async_log && plog_start_async(log_policy) != 0) {
+        plog_err("Parent: Warning - Falling back to synchronous logging.\n");
+    }
 
-    char **sorted_envp = NULL;
-    if (env_count > 0) {
-        sorted_envp = malloc((size_t)env_count * sizeof(char *));
-        if (sorted_envp == NULL) {
-            perror("Parent: Failed to allocate memory for environment sorting");
+    // Commands are read without stdio buffering: a hot restart must not leave
+    // commands that were read ahead behind in a buffer that execve() discards.
+    setvbuf(stdin, NULL, _IONBF, 0);
+    hot_restart_t restart = { .data = NULL, .length = 0, .output_fd = -1, .next_child_id = 0 };
+    bool restarting = restart_fd >= 0 && hot_restart_load(restart_fd, &restart) == 0;
+
+    if (capture_output) {
+        if (restarting && restart.output_fd >= 0) {
+            output_config.dest_fd = restart.output_fd;     // Still open; not truncated again
+        } else if (output_path != NULL) {
+            output_config.dest_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (output_config.dest_fd < 0) {
+                plog_perror("Parent: Failed to open child output file");
+                return EXIT_FAILURE;
+            }
+        }
+        if (archive_path != NULL && archive_open(archive_path) != 0) {
             return EXIT_FAILURE;
         }
-        for (int i = 0; i < env_count; ++i) {
-            sorted_envp[i] = envp[i];
+        if (output_start(&output_config) != 0) {
+            plog_err("Parent: Warning - Child output capture disabled.\n");
         }
+    }
 
-        if (setlocale(LC_COLLATE, "C") == NULL) {
-            fprintf(stderr, "Parent: Warning - Failed to set LC_COLLATE to C. Sorting might be incorrect.\n");
+    if (g_shared_log_path != NULL) {
+        // After a hot restart, running children still append to the current log.
+        bool exists = access(g_shared_log_path, F_OK) == 0;
+        int rc = restarting && exists ? shared_log_open(&g_shared_log, g_shared_log_path, false)
+                                      : open_shared_log(exists);
+        if (rc != 0) {
+            if (restarting && exists) plog_perror("Parent: Failed to map shared log");
+            return EXIT_FAILURE;
         }
+    }
 
-        qsort(sorted_envp, (size_t)env_count, sizeof(char *), compare_env_vars);
+    if (build_child_fixed_env() != 0 || refresh_env_snapshot() != 0) {
+        return EXIT_FAILURE;
+    }
 
-        for (int i = 0; i < env_count; ++i) {
-            if (printf("%s\n", sorted_envp[i]) < 0) {
-                perror("Parent: Failed to print environment variable");
-                // Consider breaking or returning
-            }
+    coalesce_init(coalesce_window_ms);
+    if (result_cache_entries > 0) {
+        // Replayed output bypasses the reactors, so it could not keep launch order or be archived.
+        if (output_config.reorder_window > 0 || archive_path != NULL) {
+            plog_err("Parent: Warning - The result cache is disabled with ordered output (-O) and the archive (-a).\n");
+        } else if (output_enabled() && result_cache_init(result_cache_entries) != 0) {
+            plog_err("Parent: Warning - Result cache disabled.\n");
         }
-        free(sorted_envp);
-        sorted_envp = NULL;
+    }
+
+    // After a hot restart the children are handed over directly; otherwise the
+    // journal is replayed for children of an earlier run.
+    if (journal_path != NULL && journal_open(journal_path, !restarting) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (restarting) {
+        hot_restart_resume(&restart);
+        hot_restart_free(&restart);
     } else {
-        if (printf("(No environment variables found or envp is empty)\n") < 0) {
-            perror("Parent: printf failed for no env message");
+        journal_resume();
+    }
+
+    // Warmed and loaded from the path the '+' method resolves; '*' and '&' normally resolve the same one.
+    if (warmup_mode != WARMUP_OFF || in_memory_child) {
+        const char *child_dir = getenv("CHILD_PATH");
+        char child_exec_path[PATH_BUFFER_SIZE];
+        int path_len = child_dir != NULL ? snprintf(child_exec_path, sizeof(child_exec_path), "%s/%s", child_dir,
+                                                    CHILD_EXECUTABLE_NAME) : -1;
+        bool resolved = path_len >= 0 && (size_t)path_len < sizeof(child_exec_path);
+        if (warmup_mode != WARMUP_OFF && (!resolved || warmup_start(child_exec_path, warmup_mode) != 0)) {
+            plog_err("Parent: Warning - Child executable warmup disabled.\n");
+        }
+        if (in_memory_child && (!resolved || child_image_load(child_exec_path) != 0)) {
+            plog_err("Parent: Warning - Children are executed from the file system.\n");
         }
     }
 
+    // Started after the first snapshot is published: launcher threads read it while building environments.
+    if (launcher_start(launcher_threads, spawn_child) != 0) {
+        return EXIT_FAILURE;
+    }
+    // Last, so that the first acknowledgement (after a hot restart) reports the adopted children.
+    if (shard_socket != NULL && shard_link_open(shard_socket, restarting) != 0) {
+        return EXIT_FAILURE;
+    }
 
-    if (printf("----------------------------------------\n") < 0) {
-        perror("Parent: printf failed for separator");
+    plog_out("Parent PID: %d\n", getpid());
+    if (env_dump_mode == ENV_DUMP_FULL) {
+        if (print_sorted_environment(envp, "Initial environment variables") != 0) {
+            return EXIT_FAILURE;
+        }
+    } else if (env_dump_mode == ENV_DUMP_LAZY) {
+        plog_out("Initial environment dump deferred (use 'e' to print it).\n");
     }
 
+    plog_out("----------------------------------------\n");
+
     int command_char;
     bool terminate_parent = false;
 
     while (!terminate_parent) {
         if (signal_flag != 0) {
-            // A signal was caught, print message and prepare to exit.
-            // Using write for signal-safety if this were in the handler,
-            // but here in the main loop, printf is generally okay.
-            fprintf(stdout, "\nParent: Signal %d received. Exiting gracefully.\n", signal_flag);
-            fflush(stdout); // Ensure message is printed
+            // A signal was caught, log the message and prepare to exit.
+            // The handler only sets the flag; logging from the main loop is safe.
+            plog_out("\nParent: Signal %d received. Exiting gracefully.\n", signal_flag);
             terminate_parent = true;
             break;
         }
 
-        if (printf("Enter command (+, *, & to launch child, q to quit):\n> ") < 0) {
-            perror("Parent: printf failed for prompt");
-            if (signal_flag != 0) continue; // If signal came during printf, re-check
-            break;
-        }
-        if (fflush(stdout) == EOF) {
-            perror("Parent: fflush stdout failed for prompt");
-            if (signal_flag != 0) continue;
+        // Environment versions replaced earlier are freed once no launch uses them any more.
+        env_rcu_reclaim();
+        journal_maintain(0);
+
+        // One flush per loop iteration: everything logged since the last prompt goes out here.
+        plog_out("Enter command (+, *, & [count] to launch children, b [count] to launch them behind a barrier, "
+                 "e to print environment, v NAME=VALUE or u NAME to change it, s for launch stats, h [binary] "
+                 "to restart, i to refresh the child image, q to quit):\n> ");
+        if (plog_flush() != 0) {
+            perror("Parent: Failed to write output for prompt");
+            if (signal_flag != 0) continue; // If signal came during the write, re-check
             break;
         }
 
         command_char = getchar();
 
         if (signal_flag != 0) { // Check flag immediately after getchar returns
-            fprintf(stdout, "\nParent: Signal %d received during input. Exiting gracefully.\n", signal_flag);
-            fflush(stdout);
+            plog_out("\nParent: Signal %d received during input. Exiting gracefully.\n", signal_flag);
             terminate_parent = true;
             if (command_char == EOF && errno == EINTR) { // If getchar was interrupted
                 clearerr(stdin); // Clear error state on stdin
@@ -219,9 +562,7 @@ int main(int argc, char *argv[], char *envp[]) {
 
         if (command_char == EOF) {
             if (feof(stdin)) {
-                if(printf("\nParent: EOF detected on stdin. Exiting.\n") < 0) {
-                    perror("Parent: printf failed for EOF message");
-                }
+                plog_out("\nParent: EOF detected on stdin. Exiting.\n");
                 terminate_parent = true;
             } else if (ferror(stdin)) {
                 if (errno == EINTR) {
@@ -231,7 +572,7 @@ int main(int argc, char *argv[], char *envp[]) {
                     clearerr(stdin);
                     continue;
                 }
-                perror("Parent: Error reading from stdin");
+                plog_perror("Parent: Error reading from stdin");
                 terminate_parent = true;
             }
             break;
@@ -242,14 +583,22 @@ int main(int argc, char *argv[], char *envp[]) {
         }
 
         int ch_consume;
-        // Consume the rest of the line
+        char argument[COMMAND_ARGUMENT_SIZE];
+        size_t argument_len = 0;
+        bool argument_truncated = false;
+        // Consume the rest of the line, keeping its start as the command's argument
         while ((ch_consume = getchar()) != '\n' && ch_consume != EOF) {
             if (signal_flag != 0) break; // Check during consumption too
+            if (argument_len < sizeof(argument) - 1) {
+                argument[argument_len++] = (char)ch_consume;
+            } else {
+                argument_truncated = true;
+            }
         }
+        argument[argument_len] = '\0';
 
         if (signal_flag != 0) { // Check again after consuming line
-            fprintf(stdout, "\nParent: Signal %d received during input processing. Exiting gracefully.\n", signal_flag);
-            fflush(stdout);
+            plog_out("\nParent: Signal %d received during input processing. Exiting gracefully.\n", signal_flag);
             terminate_parent = true;
             if (ch_consume == EOF && errno == EINTR) { // If the consuming getchar was interrupted
                 clearerr(stdin);
@@ -261,49 +610,299 @@ int main(int argc, char *argv[], char *envp[]) {
             continue;
         }
         if (ch_consume == EOF && feof(stdin)) { // EOF while consuming
-            if(printf("\nParent: EOF detected while consuming input. Exiting.\n") < 0) {
-                perror("Parent: printf failed for EOF message");
-            }
+            plog_out("\nParent: EOF detected while consuming input. Exiting.\n");
             terminate_parent = true;
             break;
         }
 
-
         switch (command_char) {
             case '+':
             case '*':
             case '&':
-                if (launch_child((char)command_char, env_filter_file, envp) != 0) {
-                    fprintf(stderr, "Parent: Failed to launch child process for command '%c'.\n", command_char);
+            case 'b': {
+                char *end = NULL;
+                long count = strtol(argument, &end, 10);
+                while (end != NULL && (*end == ' ' || *end == '\t')) {
+                    end++;
                 }
-                if (command_char == '&') {
-                    if(printf("Parent: Launched child via '&', parent continues.\n") < 0) {
-                        perror("Parent: printf failed for '&' confirmation");
+                if (end == argument) {
+                    count = 1;      // No count given
+                } else if (*end != '\0' || count < 1 || count > MAX_CHILDREN) {
+                    plog_out("Parent: Invalid launch count '%s' (1..%d).\n", argument, MAX_CHILDREN);
+                    break;
+                }
+                if (command_char == 'b') {
+                    // Launched like '+', then released together once all have parked.
+                    launch_barrier_t barrier = { .gate_fd = -1, .report_read_fd = -1, .report_write_fd = -1 };
+                    if (barrier_open(&barrier) != 0 || launch_children('+', (size_t)count, &barrier) != 0) {
+                        plog_err("Parent: Failed to launch child process for command '%c'.\n", command_char);
                     }
+                    barrier_close(&barrier);
+                } else if (launch_children((char)command_char, (size_t)count, NULL) != 0) {
+                    plog_err("Parent: Failed to launch child process for command '%c'.\n", command_char);
+                }
+                if (command_char == '&') {
+                    plog_out("Parent: Launched child via '&', parent continues.\n");
+                }
+                break;
+            }
+            case 's':
+                launcher_print_stats();
+                plog_out("Parent: Environment generation %llu (%zu retired version(s) awaiting readers).\n",
+                         (unsigned long long)env_rcu_generation(), env_rcu_retired_count());
+                output_print_stats();
+                coalesce_print_stats();
+                result_cache_print_stats();
+                journal_print_stats();
+                subreaper_print_stats();
+                warmup_print_stats();
+                child_image_print_stats();
+                pmem_print_stats();
+                break;
+            case 'v':
+            case 'u':
+                change_environment((char)command_char, argument, argument_truncated);
+                break;
+            case 'h': {
+                char *binary = argument;
+                while (*binary == ' ' || *binary == '\t') {
+                    binary++;
+                }
+                if (argument_truncated) {
+                    plog_out("Parent: Hot restart binary path is too long.\n");
+                    break;
+                }
+                if (hot_restart_exec(*binary != '\0' ? binary : NULL, g_main_argv, &output_config) != 0) {
+                    plog_err("Parent: Hot restart failed; continuing.\n");
+                }
+                break;
+            }
+            case 'i':
+                child_image_refresh();
+                break;
+            case 'e':
+                if (env_dump_mode == ENV_DUMP_NONE) {
+                    plog_out("Parent: Environment dump is disabled (-e none).\n");
+                } else if (print_current_environment() != 0) {
+                    plog_err("Parent: Failed to print the environment.\n");
                 }
                 break;
             case 'q':
             case 'Q':
-                if(printf("Parent: Quit command received. Exiting.\n") < 0) {
-                    perror("Parent: printf failed for quit message");
-                }
+                plog_out("Parent: Quit command received. Exiting.\n");
                 terminate_parent = true;
                 break;
+            case SHARD_PROBE:
+                break;      // Shard router status probe: only acknowledged
             default:
-                if(printf("Parent: Unknown command '%c'. Use +, *, &, or q.\n", command_char) < 0) {
-                    perror("Parent: printf failed for unknown command");
-                }
+                plog_out("Parent: Unknown command '%c'. Use +, *, &, b, e, v, u, s, h, i, or q.\n", command_char);
                 break;
         }
+        shard_link_ack();
     } // end while(!terminate_parent)
 
-    if(printf("Parent: Exiting cleanly.\n") < 0) {
-        perror("Parent: printf failed for exit message");
+    if (signal_flag != 0 && subreaper_enabled()) {
+        // Children lead their own process groups (-D), out of reach of the terminal's Ctrl-C.
+        size_t groups = subreaper_forward_signal(signal_flag);
+        plog_out("Parent: Forwarded signal %d to %zu child process group(s).\n", (int)signal_flag, groups);
     }
-    // Normal return from main will trigger atexit handlers, including stdio cleanup.
+    plog_out("Parent: Exiting cleanly.\n");
+    shared_log_close(&g_shared_log);
+    // Normal return from main will trigger atexit handlers, including the log flush.
     return EXIT_SUCCESS;
 }
 
+/*
+ * Purpose:
+ *   atexit() handler that stops the launcher threads (then drops the child
+ *   image and frees the published environment versions) and child output
+ *   capture (forwarding what running children still write), closes the
+ *   subreaper, the shard router link, the launch journal and the result
+ *   cache, completes the output archive, then writes out whatever is still in
+ *   the parent log and stops the logger thread, if one is running. Forked
+ *   children leave through _exit() or execve(), so it never runs in them.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void shutdown_at_exit(void) {
+    launcher_stop();
+    warmup_shutdown();
+    child_image_shutdown();
+    env_rcu_shutdown();
+    free_env_list(&g_child_fixed_env);
+    coalesce_shutdown();
+    output_shutdown();
+    subreaper_shutdown();
+    shard_link_close();
+    journal_close();
+    result_cache_shutdown();
+    archive_close();
+    plog_shutdown();
+}
+
+/*
+ * Purpose:
+ *   Creates (or rotates) the shared append log named by -m and maps it
+ *   read-only so the parent can watch how full it is. Children map the file
+ *   themselves and append to it without involving the parent.
+ * Receives:
+ *   rotate: true to keep the existing file as <path>.1 instead of replacing it.
+ * Returns:
+ *   0 on success, -1 on failure (an error message is printed).
+ */
+static int open_shared_log(bool rotate) {
+    int rc = rotate ? shared_log_rotate(g_shared_log_path, g_shared_log_capacity)
+                    : shared_log_create(g_shared_log_path, g_shared_log_capacity, 0);
+    if (rc != 0) {
+        return -1;
+    }
+    shared_log_close(&g_shared_log);
+    if (shared_log_open(&g_shared_log, g_shared_log_path, false) != 0) {
+        plog_perror("Parent: Failed to map shared log");
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Purpose:
+ *   Rotates the shared log once it is three quarters full, so children launched
+ *   from now on get an empty log. Children still running keep writing to the
+ *   old file, which stays readable as <path>.1.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Failures are reported; the current log stays in use.
+ */
+static void check_shared_log_rotation(void) {
+    if (g_shared_log_path == NULL || g_shared_log.header == NULL) {
+        return;
+    }
+    if (shared_log_used(&g_shared_log) < g_shared_log.header->capacity / 4 * 3) {
+        return;
+    }
+    if (open_shared_log(true) == 0) {
+        plog_out("Parent: Shared log rotated (generation %llu).\n",
+                 (unsigned long long)g_shared_log.header->generation);
+    }
+}
+
+
+/*
+ * Purpose:
+ *   Builds a struct-of-arrays snapshot of 'environ' and publishes it as the
+ *   new environment version (env_rcu.h). Must be called once at startup and
+ *   again after any change to the parent's environment, so lookups made through
+ *   the snapshot (the '&' method and filtered environments) stay consistent
+ *   with 'environ'. Launches in progress keep the version they started with.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success.
+ *   -1 if the new snapshot could not be built; the previous version stays current.
+ */
+static int refresh_env_snapshot(void) {
+    if (env_rcu_publish(environ, NULL) != 0) {
+        plog_err("Parent: Failed to build environment snapshot.\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Purpose:
+ *   Sorts a copy of the given environment array using the "C" locale and writes
+ *   it to stdout, preceded by a header line. The entries are emitted with a few
+ *   large writev() calls rather than one printf() per variable.
+ * Receives:
+ *   envp:    The NULL-terminated environment array to print.
+ *   heading: Start of the header line (e.g. "Initial environment variables").
+ * Returns:
+ *   0 on success (including an empty environment).
+ *   -1 on memory allocation failure. Write errors are reported but not fatal.
+ */
+static int print_sorted_environment(char **envp, const char *heading) {
+    plog_out("%s (sorted LC_COLLATE=C):\n", heading);
+
+    size_t env_count = 0;
+    for (char **env = envp; *env != NULL; ++env) {
+        env_count++;
+    }
+
+    if (env_count == 0) {
+        plog_out("(No environment variables found or envp is empty)\n");
+        return 0;
+    }
+
+    char **sorted_envp = malloc(env_count * sizeof(char *));
+    if (sorted_envp == NULL) {
+        plog_perror("Parent: Failed to allocate memory for environment sorting");
+        return -1;
+    }
+    memcpy(sorted_envp, envp, env_count * sizeof(char *));
+
+    if (setlocale(LC_COLLATE, "C") == NULL) {
+        plog_err("Parent: Warning - Failed to set LC_COLLATE to C. Sorting might be incorrect.\n");
+    }
+
+    // In the "C" locale strcoll() is plain byte order, so a radix sort gives the
+    // same result without a locale-aware comparison per pair.
+    if (env_sort_c_locale(sorted_envp, env_count) != 0) {
+        plog_err("Parent: Warning - Radix sort failed, falling back to qsort.\n");
+        qsort(sorted_envp, env_count, sizeof(char *), compare_env_vars);
+    }
+
+    // The header above is still in the log buffer; flush it before writing to the fd.
+    if (plog_flush() != 0) {
+        perror("Parent: Failed to write output before env dump");
+    }
+    if (env_dump_writev(STDOUT_FILENO, sorted_envp, env_count) != 0) {
+        plog_perror("Parent: Failed to print environment variables");
+    }
+    free(sorted_envp);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Prints the current environment ('e'): the published environment version,
+ *   including the changes made with 'v' and 'u' since startup.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success, -1 if no environment is published or on allocation failure
+ *   (error logged).
+ */
+static int print_current_environment(void) {
+    env_version_t *version = env_rcu_acquire();
+    if (version == NULL) {
+        plog_err("Parent: No environment published.\n");
+        return -1;
+    }
+    char **vars = malloc((version->snap.count + 1) * sizeof(char *));
+    if (vars == NULL) {
+        plog_perror("Parent: Failed to allocate memory for environment dump");
+        env_rcu_release(version);
+        return -1;
+    }
+    for (size_t i = 0; i < version->snap.count; ++i) {
+        vars[i] = (char *)env_snapshot_entry(&version->snap, i);
+    }
+    vars[version->snap.count] = NULL;
+    char heading[80];
+    snprintf(heading, sizeof(heading), "Current environment variables, generation %llu",
+             (unsigned long long)version->generation);
+    int result = print_sorted_environment(vars, heading);
+    free(vars);
+    env_rcu_release(version);
+    return result;
+}
+
+
 /*
  * Purpose:
  *   Prints usage instructions for the parent program to the standard error stream.
@@ -313,7 +912,61 @@ int main(int argc, char *argv[], char *envp[]) {
  *   None (void).
  */
 static void print_usage(const char *prog_name) {
-    fprintf(stderr, "Usage: %s <environment_filter_file>\n", prog_name ? prog_name : "parent");
+    fprintf(stderr, "Usage: %s [-e full|lazy|none] [-l sync|block|drop-oldest|drop]\n"
+                    "          [-c] [-o output_file] [-p pipe_bytes] [-t] [-m log_file [-M log_bytes]]\n"
+                    "          [-r text|binary] [-a archive_file] [-O window_bytes] [-j threads]\n"
+                    "          [-R reactors] [-W window_ms] [-C entries] [-J journal_file] [-D]\n"
+                    "          [-S router_socket]\n"
+                    "          [-w cold|measure|warm|lock] [-I] [-H state_fd]\n"
+                    "          <environment_filter_file>\n",
+            prog_name ? prog_name : "parent");
+    fprintf(stderr, "  -e full|lazy|none: Print the sorted environment at startup (full, default),\n");
+    fprintf(stderr, "                     only on the 'e' command (lazy), or never (none).\n");
+    fprintf(stderr, "  -l sync|block|drop-oldest|drop: Log synchronously (sync, default) or through\n");
+    fprintf(stderr, "                     a logger thread whose full queue blocks the launcher (block),\n");
+    fprintf(stderr, "                     discards the oldest message (drop-oldest) or the newest (drop).\n");
+    fprintf(stderr, "  -c:                Capture child stdout/stderr through pipes and forward it\n");
+    fprintf(stderr, "                     (with splice() where possible) to stdout.\n");
+    fprintf(stderr, "  -o output_file:    Like -c, but forward captured output into output_file.\n");
+    fprintf(stderr, "  -p pipe_bytes:     Capacity of each child's capture pipe (F_SETPIPE_SZ).\n");
+    fprintf(stderr, "  -t:                Prefix captured lines with the child name when the\n");
+    fprintf(stderr, "                     destination is a terminal.\n");
+    fprintf(stderr, "  -m log_file:       Children append their reports to this shared mmap log\n");
+    fprintf(stderr, "                     (read it with shared_log_read); rotated when 3/4 full.\n");
+    fprintf(stderr, "  -M log_bytes:      Size of the shared log file (default %u).\n", SHARED_LOG_DEFAULT_CAPACITY);
+    fprintf(stderr, "  -r text|binary:    Child report format; binary reports are sent in one write\n");
+    fprintf(stderr, "                     and decoded by the parent (implies -c).\n");
+    fprintf(stderr, "  -a archive_file:   Also store captured output in a compressed archive indexed\n");
+    fprintf(stderr, "                     by child and time (implies -c; query with archive_query).\n");
+    fprintf(stderr, "  -O window_bytes:   Emit captured output as one block per child in launch order,\n");
+    fprintf(stderr, "                     holding at most window_bytes of later children (implies -c).\n");
+    fprintf(stderr, "  -j threads:        Launch children from this many work-stealing launcher threads\n");
+    fprintf(stderr, "                     (default 0: launch from the command loop; max %d).\n", LAUNCHER_MAX_THREADS);
+    fprintf(stderr, "  -R reactors:       Spread captured output and child reaping over this many reactor\n");
+    fprintf(stderr, "                     threads (implies -c; max %d; one with -O or -a).\n", OUTPUT_MAX_SHARDS);
+    fprintf(stderr, "  -W window_ms:      Answer a launch request identical to one launched at most\n");
+    fprintf(stderr, "                     window_ms ago (same method, count, executable and environment)\n");
+    fprintf(stderr, "                     with that launch's result instead of forking (max %d).\n",
+            COALESCE_MAX_WINDOW_MS);
+    fprintf(stderr, "  -C entries:        Cache up to this many child results (output and exit status)\n");
+    fprintf(stderr, "                     keyed by binary, arguments and environment, and replay them\n");
+    fprintf(stderr, "                     instead of forking (implies -c; not with -O or -a; max %d).\n",
+            RESULT_CACHE_MAX_ENTRIES);
+    fprintf(stderr, "  -J journal_file:   Journal launches and exits in this mmap'd file; on startup,\n");
+    fprintf(stderr, "                     children of an earlier run that still run are watched again.\n");
+    fprintf(stderr, "  -D:                Become a subreaper: reap what children leave running and add\n");
+    fprintf(stderr, "                     its resource usage to the child's launch (implies -c; children\n");
+    fprintf(stderr, "                     run in their own process group, so SIGINT/SIGTERM reach them\n");
+    fprintf(stderr, "                     only as forwarded by the parent on exit; one reactor).\n");
+    fprintf(stderr, "  -S router_socket:  Run as a shard: connect to this shard router socket and take\n");
+    fprintf(stderr, "                     commands from it instead of stdin (see shard_router).\n");
+    fprintf(stderr, "  -w cold|measure|warm|lock: At startup, evict (cold), leave (measure), read ahead\n");
+    fprintf(stderr, "                     (warm) or read ahead and mlock (lock) the child executable, its\n");
+    fprintf(stderr, "                     interpreter and libraries in the page cache; time the exec of\n");
+    fprintf(stderr, "                     the first %d launches ('s').\n", WARMUP_SAMPLES);
+    fprintf(stderr, "  -I:                Copy the child executable into a sealed memfd at startup and\n");
+    fprintf(stderr, "                     execute children from it (execveat); 'i' reloads a new build.\n");
+    fprintf(stderr, "  -H state_fd:       Internal: state handed over by a hot restart ('h' command).\n");
     fprintf(stderr, "  <environment_filter_file>: Path to a file listing environment variables\n");
     fprintf(stderr, "                             (one per line) to pass to child processes.\n");
     fprintf(stderr, "  Requires CHILD_PATH environment variable to be set to the directory\n");
@@ -372,163 +1025,174 @@ static char *find_env_var_value(const char *var_name, char **env_array) {
 
 /*
  * Purpose:
- *   Creates a new, dynamically allocated environment array (suitable for execve)
- *   containing only the environment variables specified in a filter file. It reads
- *   variable names from the file, looks up their values in a source environment
- *   (e.g., the parent's 'environ'), and constructs "NAME=VALUE" strings for the
- *   new array. It also automatically includes an entry for ENV_VAR_FILTER_FILE_NAME
- *   pointing to the provided filter file path, so the child can locate it.
+ *   Makes sure the published environment uses the current contents of the
+ *   filter file. The file is re-read (and the filtered environment rebuilt
+ *   from 'environ') only when its identity, size or modification time changed
+ *   since it was last loaded, so a batch does not read it once per child.
+ *   Command-loop thread only.
  * Receives:
- *   filter_filename: Path to the text file listing desired environment variable names,
- *                    one per line. Lines starting with '#' are ignored.
- *   source_env:      The environment array (e.g., 'environ') from which to retrieve
- *                    the values for the variables listed in the filter file.
+ *   None.
  * Returns:
- *   An env_list_t structure containing the newly allocated, NULL-terminated
- *   environment array (`list.vars`). The caller is responsible for freeing
- *   this list using free_env_list().
- *   On error (e.g., cannot open file, memory allocation fails), the returned
- *   list will have `list.vars` set to NULL and `list.count` to 0.
- *   An error message is printed to stderr.
+ *   0 if the published filter is current.
+ *   -1 if the file could not be read or the new version could not be built
+ *      (an error message is printed).
  */
-static env_list_t create_filtered_env(const char *filter_filename, char **source_env) {
-    env_list_t list = { .vars = NULL, .count = 0, .capacity = 10 };
-    FILE *file = fopen(filter_filename, "r");
-    if (file == NULL) {
-        perror("Parent: Failed to open environment filter file");
-        return list;
+static int refresh_env_filter(void) {
+    if (env_filter_is_current(env_rcu_filter(), g_env_filter_file)) {
+        return 0;
     }
-
-    list.vars = malloc(list.capacity * sizeof(char *));
-    if (list.vars == NULL) {
-        perror("Parent: Failed to allocate initial memory for filtered environment");
-        if (fclose(file) != 0) perror("Parent: fclose failed in create_filtered_env error path");
-        return list;
+    env_filter_t *filter = env_filter_load(g_env_filter_file);
+    if (filter == NULL) {
+        return -1;
     }
+    if (env_rcu_publish(environ, filter) != 0) {
+        plog_err("Parent: Failed to build filtered environment.\n");
+        env_filter_free(filter);
+        return -1;
+    }
+    return 0;
+}
 
-    char *line_buf = NULL;
-    size_t line_buf_size = 0;
-    ssize_t line_len;
-
-    while ((line_len = getline(&line_buf, &line_buf_size, file)) != -1) {
-        if (signal_flag != 0) { // Check for signal during file processing
-            fprintf(stderr, "Parent: Signal received during environment creation. Aborting creation.\n");
-            free(line_buf);
-            if (fclose(file) != 0) perror("Parent: fclose failed in create_filtered_env signal path");
-            free_env_list(&list);
-            list.vars = NULL; list.count = 0;
-            return list;
-        }
-
-        if (line_len > 0 && line_buf[line_len - 1] == '\n') {
-            line_buf[line_len - 1] = '\0';
-            line_len--;
-        }
-
-        if (line_len == 0 || line_buf[0] == '#') {
-            continue;
-        }
-
-        char *var_name = line_buf;
-        char *var_value = find_env_var_value(var_name, source_env);
-
-        if (var_value != NULL) {
-            size_t name_len_val = strlen(var_name);
-            size_t value_len_val = strlen(var_value);
-            size_t entry_len = name_len_val + 1 + value_len_val + 1;
-            char *env_entry = malloc(entry_len);
-            if (env_entry == NULL) {
-                perror("Parent: Failed to allocate memory for environment entry");
-                free(line_buf);
-                if (fclose(file) != 0) perror("Parent: fclose failed in create_filtered_env error path");
-                free_env_list(&list);
-                list.vars = NULL; list.count = 0;
-                return list;
-            }
 
-            int written = snprintf(env_entry, entry_len, "%s=%s", var_name, var_value);
-            if (written < 0 || (size_t)written >= entry_len) {
-                fprintf(stderr, "Parent: snprintf error or truncation for env_entry '%s'. Skipping.\n", var_name);
-                free(env_entry);
-                continue;
-            }
+/*
+ * Purpose:
+ *   Builds the entries every child gets after its filtered environment: the
+ *   filter file path (ENV_VAR_FILTER_FILE_NAME) so the child can locate it,
+ *   the shared log path (-m) and the report format (-r binary). They do not
+ *   change while the parent runs, so they are formatted once.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success, -1 on allocation failure (an error message is printed).
+ */
+static int build_child_fixed_env(void) {
+    g_child_fixed_env.capacity = 4;
+    g_child_fixed_env.count = 0;
+    g_child_fixed_env.vars = malloc(g_child_fixed_env.capacity * sizeof(char *));
+    if (g_child_fixed_env.vars == NULL) {
+        plog_perror("Parent: Failed to allocate memory for child environment");
+        return -1;
+    }
+    g_child_fixed_env.vars[0] = NULL;
 
-            if (list.count >= list.capacity - 1) {
-                size_t new_capacity = list.capacity == 0 ? 10 : list.capacity * 2;
-                char **new_vars = realloc(list.vars, new_capacity * sizeof(char *));
-                if (new_vars == NULL) {
-                    perror("Parent: Failed to reallocate memory for filtered environment");
-                    free(env_entry);
-                    free(line_buf);
-                    if (fclose(file) != 0) perror("Parent: fclose failed in create_filtered_env error path");
-                    free_env_list(&list);
-                    list.vars = NULL; list.count = 0;
-                    return list;
-                }
-                list.vars = new_vars;
-                list.capacity = new_capacity;
-            }
-            list.vars[list.count++] = env_entry;
-        }
+    if (append_env_entry(&g_child_fixed_env, ENV_VAR_FILTER_FILE_NAME, g_env_filter_file) != 0 ||
+        (g_shared_log_path != NULL &&
+         append_env_entry(&g_child_fixed_env, ENV_VAR_SHARED_LOG_NAME, g_shared_log_path) != 0) ||
+        (g_binary_reports && append_env_entry(&g_child_fixed_env, ENV_VAR_REPORT_FORMAT_NAME, "binary") != 0)) {
+        free_env_list(&g_child_fixed_env);
+        return -1;
     }
-    free(line_buf);
-    line_buf = NULL;
+    return 0;
+}
+
 
-    if (ferror(file)) {
-        perror("Parent: Error reading from filter file");
+/*
+ * Purpose:
+ *   Handles the 'v NAME=VALUE' (set) and 'u NAME' (unset) commands. The
+ *   parent's environment is changed with setenv()/unsetenv(), so getenv() ('+')
+ *   sees it, and a new environment version is derived from the current one by
+ *   patching only that variable (env_rcu_setenv()/env_rcu_unsetenv()), so the
+ *   '&' lookups, the filtered environment of later children and the 'e' dump
+ *   see it too. Only '*' uses main()'s envp, which keeps the startup
+ *   environment.
+ * Receives:
+ *   command:   'v' or 'u'.
+ *   argument:  The rest of the command line (modified in place).
+ *   truncated: Whether the command line was longer than the argument buffer.
+ * Returns:
+ *   None (void). Errors are reported on stderr.
+ */
+static void change_environment(char command, char *argument, bool truncated) {
+    if (truncated) {
+        plog_out("Parent: Command line too long (at most %d characters).\n", COMMAND_ARGUMENT_SIZE - 1);
+        return;
     }
-    if (fclose(file) != 0) {
-        perror("Parent: fclose failed for filter file");
+    while (*argument == ' ' || *argument == '\t') {
+        argument++;
     }
 
-    if (signal_flag != 0) { // Check again before adding the final entry
-        fprintf(stderr, "Parent: Signal received before finalizing environment. Aborting.\n");
-        free_env_list(&list);
-        list.vars = NULL; list.count = 0;
-        return list;
+    if (command == 'v') {
+        char *eq = strchr(argument, '=');
+        if (eq == NULL || eq == argument) {
+            plog_out("Parent: Usage: v NAME=VALUE\n");
+            return;
+        }
+        *eq = '\0';
+        const char *value = eq + 1;
+        if (setenv(argument, value, 1) != 0) {
+            plog_perror("Parent: setenv failed");
+            return;
+        }
+        if (env_rcu_setenv(argument, value) != 0 && refresh_env_snapshot() != 0) {
+            plog_err("Parent: Warning - Launches keep the previous environment of %s.\n", argument);
+            return;
+        }
+        plog_out("Parent: Set %s (environment generation %llu).\n", argument,
+                 (unsigned long long)env_rcu_generation());
+    } else {
+        size_t len = strlen(argument);
+        while (len > 0 && (argument[len - 1] == ' ' || argument[len - 1] == '\t')) {
+            argument[--len] = '\0';
+        }
+        if (len == 0 || strchr(argument, '=') != NULL) {
+            plog_out("Parent: Usage: u NAME\n");
+            return;
+        }
+        if (unsetenv(argument) != 0) {
+            plog_perror("Parent: unsetenv failed");
+            return;
+        }
+        if (env_rcu_unsetenv(argument) != 0 && refresh_env_snapshot() != 0) {
+            plog_err("Parent: Warning - Launches keep the previous environment of %s.\n", argument);
+            return;
+        }
+        plog_out("Parent: Unset %s (environment generation %llu).\n", argument,
+                 (unsigned long long)env_rcu_generation());
     }
+}
 
-    const char *filter_var_name = ENV_VAR_FILTER_FILE_NAME;
-    const char *filter_var_value = filter_filename;
-
-    size_t filter_name_len = strlen(filter_var_name);
-    size_t filter_value_len = strlen(filter_var_value);
-    size_t filter_entry_len = filter_name_len + 1 + filter_value_len + 1;
-    char *filter_env_entry = malloc(filter_entry_len);
 
-    if (filter_env_entry == NULL) {
-        perror("Parent: Failed to allocate memory for filter file path env entry");
-        free_env_list(&list);
-        list.vars = NULL; list.count = 0;
-        return list;
+/*
+ * Purpose:
+ *   Appends a "NAME=VALUE" entry to an environment list, growing the array if
+ *   needed and keeping it NULL-terminated.
+ * Receives:
+ *   list:  The list to extend (its 'vars' must not be NULL).
+ *   name:  Variable name.
+ *   value: Variable value.
+ * Returns:
+ *   0 on success, -1 on allocation or formatting failure (an error message is
+ *   printed; the list is left unchanged and still valid).
+ */
+static int append_env_entry(env_list_t *list, const char *name, const char *value) {
+    size_t entry_len = strlen(name) + 1 + strlen(value) + 1;
+    char *env_entry = malloc(entry_len);
+    if (env_entry == NULL) {
+        plog_perror("Parent: Failed to allocate memory for environment entry");
+        return -1;
     }
 
-    int written_filter = snprintf(filter_env_entry, filter_entry_len, "%s=%s", filter_var_name, filter_var_value);
-    if (written_filter < 0 || (size_t)written_filter >= filter_entry_len) {
-        fprintf(stderr, "Parent: snprintf error or truncation for %s. Critical failure.\n", ENV_VAR_FILTER_FILE_NAME);
-        free(filter_env_entry);
-        free_env_list(&list);
-        list.vars = NULL; list.count = 0;
-        return list;
+    int written = snprintf(env_entry, entry_len, "%s=%s", name, value);
+    if (written < 0 || (size_t)written >= entry_len) {
+        plog_err("Parent: snprintf error or truncation for %s. Critical failure.\n", name);
+        free(env_entry);
+        return -1;
     }
 
-    if (list.count >= list.capacity - 1) {
-        size_t new_capacity = list.capacity + 2;
-        char **new_vars = realloc(list.vars, new_capacity * sizeof(char *));
+    if (list->count >= list->capacity - 1) {
+        size_t new_capacity = list->capacity + 2;
+        char **new_vars = realloc(list->vars, new_capacity * sizeof(char *));
         if (new_vars == NULL) {
-            perror("Parent: Failed to reallocate for filter file path env entry");
-            free(filter_env_entry);
-            free_env_list(&list);
-            list.vars = NULL; list.count = 0;
-            return list;
+            plog_perror("Parent: Failed to reallocate for environment entry");
+            free(env_entry);
+            return -1;
         }
-        list.vars = new_vars;
-        list.capacity = new_capacity;
+        list->vars = new_vars;
+        list->capacity = new_capacity;
     }
-    list.vars[list.count++] = filter_env_entry;
-    list.vars[list.count] = NULL;
-
-    return list;
+    list->vars[list->count++] = env_entry;
+    list->vars[list->count] = NULL;
+    return 0;
 }
 
 
@@ -563,136 +1227,305 @@ static void free_env_list(env_list_t *list) {
 
 /*
  * Purpose:
- *   Handles the process of launching a child process. This involves:
+ *   Handles a launch command ('+', '*', '&', optionally with a count). This involves:
  *   1. Determining the directory containing the child executable (CHILD_PATH)
  *      based on the specified method ('+', '*', '&').
  *   2. Constructing the full path to the child executable.
- *   3. Creating a unique name for the child instance (e.g., "child_00").
- *   4. Creating the filtered environment array for the child using create_filtered_env().
- *   5. Forking the current process.
- *   6. In the child process: Executing the child program ('child') using execve(),
- *      passing the constructed name, arguments, and the filtered environment. Handles
- *      execve errors by printing an error and calling _exit().
- *   7. In the parent process: Prints the PID of the forked child, frees the memory
- *      allocated for the filtered environment (as the child has its own copy), and
- *      returns. The parent does not wait for the child to complete.
+ *   3. Re-reading the filter file if it changed. If an identical request was
+ *      launched within the coalescing window (-W), its result is reported and
+ *      nothing is launched.
+ *   4. Rotating the shared log if needed, once for the whole batch.
+ *   5. Handing 'count' launch requests to the launcher, which calls spawn_child()
+ *      for each of them (inline, or from the launcher threads with -j), and
+ *      waiting until all of them have been attempted.
+ *   6. For a barrier launch ('b'), waiting until the children have parked and
+ *      releasing them together (coalescing is skipped).
+ *   Steps 1-4 stay on the command-loop thread: getenv(), main's
+ *   envp and the rotation are not shared with the launcher threads.
  * Receives:
- *   method:          A character indicating how to find CHILD_PATH:
- *                    '+' uses getenv().
- *                    '*' uses the envp array passed to parent's main().
- *                    '&' uses the global 'environ' variable.
- *   filter_filename: The path to the environment filter file.
- *   main_envp:       The 'envp' array received by the parent's main function (used only
- *                    if method is '*').
+ *   method: A character indicating how to find CHILD_PATH:
+ *           '+' uses getenv().
+ *           '*' uses the envp array passed to parent's main().
+ *           '&' uses the global 'environ' variable (through its snapshot).
+ *   count:  Number of children to launch.
+ *   barrier: Barrier the children park at, or NULL.
  * Returns:
- *   0 if the fork and setup in the parent were successful (execve success/failure
- *     is handled within the child).
- *   -1 if an error occurs in the parent before or during the fork (e.g., CHILD_PATH
- *      not found, memory allocation failure, fork failure). Error messages are
+ *   0 if every launch succeeded (execve success/failure is handled within the child).
+ *   -1 if CHILD_PATH could not be resolved or any launch failed (for a coalesced
+ *      request: any launch of the request it was merged with). Error messages are
  *      printed to stderr.
  */
-static int launch_child(char method, const char *filter_filename, char **main_envp) {
+static int launch_children(char method, size_t count, launch_barrier_t *barrier) {
     if (signal_flag != 0) { // Check for signal before launching
-        fprintf(stderr, "Parent: Signal received, aborting child launch.\n");
-        return -1;
-    }
-
-    if (g_child_number >= MAX_CHILDREN) {
-        fprintf(stderr, "Parent: Maximum number of children (%d) reached.\n", MAX_CHILDREN);
+        plog_err("Parent: Signal received, aborting child launch.\n");
         return -1;
     }
 
-    char *child_dir = NULL;
+    const char *child_dir = NULL;
     const char *child_path_var_name = "CHILD_PATH";
+    env_version_t *env_version = NULL;   // Held while child_dir points into it ('&')
 
     switch (method) {
         case '+': child_dir = getenv(child_path_var_name); break;
-        case '*': child_dir = find_env_var_value(child_path_var_name, main_envp); break;
-        case '&': child_dir = find_env_var_value(child_path_var_name, environ); break;
+        case '*': child_dir = find_env_var_value(child_path_var_name, g_main_envp); break;
+        case '&':
+            env_version = env_rcu_acquire();
+            child_dir = env_version != NULL ? env_snapshot_lookup(&env_version->snap, child_path_var_name) : NULL;
+            break;
         default:
-            fprintf(stderr, "Parent: Internal error - Invalid launch method '%c'.\n", method);
+            plog_err("Parent: Internal error - Invalid launch method '%c'.\n", method);
             return -1;
     }
 
     if (child_dir == NULL) {
-        fprintf(stderr, "Parent: Error - CHILD_PATH environment variable not found using method '%c'.\n", method);
+        plog_err("Parent: Error - CHILD_PATH environment variable not found using method '%c'.\n", method);
+        env_rcu_release(env_version);
         return -1;
     }
     if (strlen(child_dir) == 0) {
-        fprintf(stderr, "Parent: Error - CHILD_PATH environment variable is empty for method '%c'.\n", method);
+        plog_err("Parent: Error - CHILD_PATH environment variable is empty for method '%c'.\n", method);
+        env_rcu_release(env_version);
         return -1;
     }
 
     char child_exec_path[PATH_BUFFER_SIZE];
     int path_len = snprintf(child_exec_path, sizeof(child_exec_path), "%s/%s", child_dir, CHILD_EXECUTABLE_NAME);
+    env_rcu_release(env_version);
     if (path_len < 0 || (size_t)path_len >= sizeof(child_exec_path)) {
-        fprintf(stderr, "Parent: Error constructing child executable path (too long or snprintf error).\n");
+        plog_err("Parent: Error constructing child executable path (too long or snprintf error).\n");
         return -1;
     }
 
-    char child_argv0[32];
-    int argv0_len = snprintf(child_argv0, sizeof(child_argv0), "%s_%.2d", CHILD_EXECUTABLE_NAME, g_child_number);
-    if (argv0_len < 0 || (size_t)argv0_len >= sizeof(child_argv0)) {
-        perror("Parent: snprintf failed or truncated for child_argv0");
+    if (refresh_env_filter() != 0) {
+        plog_err("Parent: Failed to create filtered environment for child.\n");
         return -1;
     }
 
-    env_list_t filtered_env_list = create_filtered_env(filter_filename, environ);
-    if (filtered_env_list.vars == NULL) {
-        // create_filtered_env might have returned early due to a signal.
-        // The signal_flag should already be set if that's the case.
-        if (signal_flag == 0) { // If not due to signal, it's another error
-            fprintf(stderr, "Parent: Failed to create filtered environment for child.\n");
-        }
+    // The environment generation is read after the filter refresh, so a
+    // changed filter file makes the request different from earlier ones.
+    coalesce_key_t key = { .method = method, .count = count, .exec_path = child_exec_path,
+                           .env_generation = env_rcu_generation() };
+    coalesce_result_t result;
+    if (barrier == NULL && coalesce_lookup(&key, &result)) {
+        plog_out("Parent: Coalesced with the identical request launched %.1f ms ago "
+                 "(%zu launched, %zu failed; %zu fork(s) saved).\n",
+                 result.age_ms, result.launched, result.failed, count);
+        return result.failed == 0 ? 0 : -1;
+    }
+
+    check_shared_log_rotation();
+    journal_maintain(count);
+
+    launch_request_t request = { .method = method, .exec_path = child_exec_path, .barrier = barrier };
+    size_t failed = launcher_run(&request, count);
+    if (barrier != NULL && barrier_release(barrier, count - failed) != 0) {
         return -1;
     }
-    if (signal_flag != 0) { // Double check if signal occurred during create_filtered_env
-        fprintf(stderr, "Parent: Signal received during child setup, aborting launch.\n");
-        free_env_list(&filtered_env_list);
+    if (signal_flag != 0 && failed > 0) {
+        plog_err("Parent: Signal received, aborted %zu child launch(es).\n", failed);
+    } else if (count > 1 && failed > 0) {
+        plog_err("Parent: %zu of %zu launches failed.\n", failed, count);
+    }
+    if (signal_flag == 0 && barrier == NULL) {
+        coalesce_record(&key, &(coalesce_result_t){ .launched = count - failed, .failed = failed });
+    }
+    return failed == 0 ? 0 : -1;
+}
+
+
+/*
+ * Purpose:
+ *   Launches one child for a request prepared by launch_children(). Called by
+ *   the launcher, possibly from several launcher threads at once, so it only
+ *   reads shared parent state. This involves:
+ *   1. Creating a unique name for the child instance (e.g., "child_00").
+ *   2. Creating the environment array for the child from the filtered entries cached
+ *      in the environment version current when the launch starts, followed by the
+ *      fixed entries (filter file path, shared log, report format) and, for a
+ *      barrier launch, the barrier's descriptors.
+ *   3. Forking the current process.
+ *   4. In the child process: Executing the child program ('child') using execve(),
+ *      passing the constructed name, arguments, and the filtered environment. Only
+ *      async-signal-safe calls are made until execve(), since other parent
+ *      threads may have held locks (malloc, stdio) at the moment of fork().
+ *   5. In the parent process: Prints the PID of the forked child, frees the
+ *      environment array and releases the environment version (the child has its
+ *      own copy of both), and returns.
+ *   With the result cache (-C), steps 3-5 are replaced by replaying the recorded
+ *   output of an identical earlier child when there is one (behind a marker
+ *   naming that child); otherwise the new child's output and exit status are
+ *   recorded by its output reactor. The parent does not wait for the child to
+ *   complete.
+ * Receives:
+ *   request:  The method (for messages) and the child executable path.
+ *   child_id: The child's number, from the launcher's shared id counter.
+ * Returns:
+ *   0 if the fork and setup in the parent were successful.
+ *   -1 if an error occurs in the parent before or during the fork (e.g., too many
+ *      children, memory allocation failure, fork failure). Error messages are
+ *      printed to stderr.
+ */
+static int spawn_child(const launch_request_t *request, int child_id) {
+    if (signal_flag != 0) { // The rest of a batch is dropped; launch_children() reports it once
         return -1;
     }
 
+    if (child_id >= MAX_CHILDREN) {
+        plog_err("Parent: Maximum number of children (%d) reached.\n", MAX_CHILDREN);
+        return -1;
+    }
+
+    char child_argv0[32];
+    int argv0_len = snprintf(child_argv0, sizeof(child_argv0), "%s_%.2d", CHILD_EXECUTABLE_NAME, child_id);
+    if (argv0_len < 0 || (size_t)argv0_len >= sizeof(child_argv0)) {
+        plog_perror("Parent: snprintf failed or truncated for child_argv0");
+        return -1;
+    }
 
-    if (printf("Parent: Launching child '%s' using method '%c'...\n", child_argv0, method) < 0) {
-        perror("Parent: printf failed for launch message");
+    // The current environment version, taken without locking; a concurrent
+    // publish does not affect this launch. Its entries are used in place until
+    // fork() has copied them into the child.
+    env_version_t *env_version = env_rcu_acquire();
+    if (env_version == NULL || env_version->filter == NULL) {
+        plog_err("Parent: No filtered environment published.\n");
+        env_rcu_release(env_version);
+        return -1;
     }
-    if (printf("Parent: Child executable path: %s\n", child_exec_path) < 0) {
-        perror("Parent: printf failed for exec path message");
+    char **child_env = malloc((env_version->filter->count + g_child_fixed_env.count + 2) * sizeof(char *));
+    if (child_env == NULL) {
+        plog_perror("Parent: Failed to allocate environment for child");
+        env_rcu_release(env_version);
+        return -1;
     }
-    if (fflush(stdout) == EOF) {
-        perror("Parent: fflush stdout failed before fork");
+    size_t child_env_count = env_version_filtered(env_version, child_env);
+    memcpy(child_env + child_env_count, g_child_fixed_env.vars, g_child_fixed_env.count * sizeof(char *));
+    child_env_count += g_child_fixed_env.count;
+    if (request->barrier != NULL) {
+        child_env[child_env_count++] = (char *)request->barrier->env_entry;
+    }
+    child_env[child_env_count] = NULL;
+    char *child_argv[] = {child_argv0, NULL};
+
+    // With the result cache (-C), a launch identical to a recorded one is
+    // answered by replaying that child's output instead of forking.
+    result_key_t result_key;
+    bool cacheable = result_cache_enabled() && output_enabled() && request->barrier == NULL &&
+                     result_key_make(&result_key, request->exec_path, child_argv, child_env) == 0;
+    result_cache_hit_t hit;
+    if (cacheable && result_cache_lookup(&result_key, &hit)) {
+        free(child_env);
+        env_rcu_release(env_version);
+        int replayed = output_replay(child_argv0, hit.source_name, hit.source_pid, hit.output, hit.length);
+        free(hit.output);
+        plog_event_number(hit.exit_code == CLD_EXITED ? PLOG_EVENT_REPLAYED_EXIT : PLOG_EVENT_REPLAYED_SIGNAL,
+                          child_argv0, hit.exit_status);
+        return replayed;
+    }
+
+    output_pipe_t output_pipe = { .read_fd = -1, .write_fd = -1 };
+    if (output_enabled() && output_pipe_open(&output_pipe) != 0) {
+        free(child_env);
+        env_rcu_release(env_version);
+        return -1;
     }
 
+    plog_event_number(PLOG_EVENT_LAUNCHING, child_argv0, request->method);
+    plog_event(PLOG_EVENT_EXEC_PATH, request->exec_path);
+    // Nothing may stay buffered across fork(), or it could be written twice.
+    if (plog_prepare_fork() != 0) {
+        perror("Parent: Failed to write output before fork");
+    }
+
+    int child_stdin = shard_link_child_stdin();     // Not the shard router connection
+    uint64_t launch_ns = journal_now();
+    child_image_t *image = child_image_acquire(request->exec_path);   // Held until fork() returns
+    warmup_probe_t exec_probe;
+    warmup_probe_begin(&exec_probe);
+    subreaper_forking();
+    uint64_t fork_ns = pmem_fork_begin();
     pid_t pid = fork();
 
     if (pid < 0) {
-        perror("Parent: fork() failed");
-        free_env_list(&filtered_env_list);
+        plog_perror("Parent: fork() failed");
+        warmup_probe_finish(&exec_probe, false);
+        child_image_release(image);
+        subreaper_launched(-1, child_id, child_argv0);
+        output_pipe_close(&output_pipe);
+        free(child_env);
+        env_rcu_release(env_version);
         return -1;
     } else if (pid == 0) {
-        // Child process: Restore default signal handlers for exec'd program
+        // Child process: Restore default signal handlers for exec'd program.
+        // The signal mask is inherited from the forking thread (launcher threads
+        // block everything), so it is cleared as well.
         struct sigaction sa_default;
         memset(&sa_default, 0, sizeof(sa_default));
         sa_default.sa_handler = SIG_DFL;
         sigaction(SIGINT, &sa_default, NULL);
         sigaction(SIGTERM, &sa_default, NULL);
+        sigset_t no_signals;
+        sigemptyset(&no_signals);
+        sigprocmask(SIG_SETMASK, &no_signals, NULL);
 
-        char *child_argv[] = {child_argv0, NULL};
-        execve(child_exec_path, child_argv, filtered_env_list.vars);
+        // The child's descendants inherit its process group, which attributes them to it.
+        if (subreaper_enabled() && setpgid(0, 0) != 0) {
+            child_fail("Child (failed to create its process group)\n", NULL);
+        }
+        if (child_stdin >= 0 && dup2(child_stdin, STDIN_FILENO) < 0) {
+            child_fail("Child (failed to redirect standard input)\n", NULL);
+        }
+        if (output_pipe.write_fd >= 0 && output_child_redirect(&output_pipe) != 0) {
+            child_fail("Child (failed to redirect output to capture pipe)\n", NULL);
+        }
+        if (request->barrier != NULL && barrier_child_inherit(request->barrier) != 0) {
+            child_fail("Child (failed to inherit the launch barrier)\n", NULL);
+        }
 
-        perror("Child (execve failed)");
-        fprintf(stderr, "Child: Failed attempt to execute '%s' as '%s'\n", child_exec_path, child_argv0);
-        free_env_list(&filtered_env_list);
-        _exit(EXIT_FAILURE);
-    } else {
-        g_child_number++;
-        if (printf("Parent: Forked child process '%s' with PID %d.\n", child_argv0, pid) < 0) {
-            perror("Parent: printf failed for fork success message");
+        if (image != NULL) {
+            child_image_exec(image, child_argv, child_env);
+        } else {
+            execve(request->exec_path, child_argv, child_env);
         }
-        if (fflush(stdout) == EOF) {
-            perror("Parent: fflush stdout failed after fork");
+
+        child_fail("Child (execve failed): Failed attempt to execute ", request->exec_path);
+    } else {
+        pmem_fork_end(fork_ns);
+        warmup_probe_finish(&exec_probe, true);     // Waits for execve() in the first launches only
+        child_image_release(image);
+        plog_event_number(PLOG_EVENT_FORKED, child_argv0, (int)pid);
+        subreaper_launched(pid, child_id, child_argv0);
+        // Journaled before the reactor can see the exit, so the exit record comes second.
+        journal_launch(child_id, pid, child_argv0, request->method, request->exec_path,
+                       env_version->generation, launch_ns);
+        if (output_pipe.read_fd >= 0) {
+            void *fill = cacheable ? result_cache_fill_begin(&result_key, child_argv0, pid) : NULL;
+            output_register(&output_pipe, child_argv0, child_id, pid,
+                            fill != NULL ? result_cache_fill : NULL, fill);
         }
-        free_env_list(&filtered_env_list);
+        free(child_env);
+        env_rcu_release(env_version);
     }
     return 0;
 }
+
+/*
+ * Purpose:
+ *   Reports a failure in a forked child before execve() and terminates it.
+ *   Uses only write() and _exit(): stdio and malloc may have been locked by
+ *   another parent thread when the child was forked.
+ * Receives:
+ *   message: Message to write to stderr.
+ *   detail:  Optional text appended after the message (followed by a newline),
+ *            or NULL.
+ * Returns:
+ *   Does not return.
+ */
+static _Noreturn void child_fail(const char *message, const char *detail) {
+    ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+    if (detail != NULL) {
+        ignored = write(STDERR_FILENO, detail, strlen(detail));
+        ignored = write(STDERR_FILENO, "\n", 1);
+    }
+    (void)ignored;
+    _exit(EXIT_FAILURE);
+}
@@ -0,0 +1,1021 @@
+/*
+ * parent_log.c
+ *
+ * Description:
+ * Implements the parent log declared in parent_log.h. The output buffer is a
+ * sequence of segments, each holding consecutive bytes for one file descriptor;
+ * appending to the same descriptor as the previous message extends the last
+ * segment, so writing it out usually costs a single write() per descriptor
+ * switch. Messages that do not fit even into an empty buffer are written directly.
+ *
+ * In synchronous mode the calling thread owns the buffer. In asynchronous mode
+ * the buffer belongs to the logger thread, which is fed through a bounded ring
+ * of slots, each carrying a sequence number in the style of Vyukov's bounded
+ * queue: a slot is free for position p when its sequence is p, holds a
+ * published record when it is p + 1, and is free again for the next lap at
+ * p + PLOG_RING_SLOTS. A message longer than one record occupies consecutive
+ * slots; its first slot holds the record count and is published last, so the
+ * whole message becomes visible at once. 'tail' is the oldest message nobody
+ * has claimed yet. The logger claims a message by advancing 'tail' past it
+ * with compare-and-swap before reading any slot, and frees the slots once it
+ * is done with them. Under the drop-oldest policy the producer claims the
+ * oldest message in the same way and discards it, so a slot is only ever read
+ * or written by its current owner and messages are dropped whole. A
+ * semaphore wakes the logger when messages arrive; a second one wakes a
+ * producer waiting for free slots.
+ *
+ * Several threads may log (the launcher and reactor threads): g_plog_lock
+ * serializes them, guarding the buffer in synchronous mode and the producer
+ * side of the ring in asynchronous mode, so each message stays contiguous.
+ * The logger thread never takes it. fork() is bracketed by the pthread_atfork()
+ * handlers plog_atfork_prepare() (which takes the lock, so no other thread is
+ * halfway through a message) and plog_atfork_parent()/plog_atfork_child().
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "parent_log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PLOG_MAX_SEGMENTS 64
+#define PLOG_ERROR_TEXT_SIZE 128
+#define PLOG_EVENT_TEXT_SIZE 512
+#define PLOG_CHUNK_SIZE (PLOG_RECORD_TEXT_SIZE - 1)
+#define PLOG_MESSAGE_MAX_RECORDS (PLOG_RING_SLOTS / 8)     // Longer messages bypass the ring
+
+typedef struct plog_segment_s {
+    int fd;         // Destination descriptor of the bytes in this segment
+    size_t end;     // Offset in the buffer one past the segment's last byte
+} plog_segment_t;
+
+typedef enum plog_record_kind_e {
+    PLOG_RECORD_TEXT,   // Preformatted text chunk
+    PLOG_RECORD_ERRNO,  // "text: strerror(number)\n"
+    PLOG_RECORD_EVENT,  // plog_event_t 'event' with text and number, formatted by the logger thread
+    PLOG_RECORD_FLUSH,  // Write everything out, then count it in g_plog_flushes_done
+    PLOG_RECORD_STOP    // Write everything out and terminate the logger thread
+} plog_record_kind_t;
+
+typedef struct plog_record_s {
+    plog_record_kind_t kind;
+    int fd;
+    int number;
+    plog_event_t event;
+    char text[PLOG_RECORD_TEXT_SIZE];
+} plog_record_t;
+
+typedef struct plog_slot_s {
+    atomic_size_t sequence;     // Position, position + 1 once published, + PLOG_RING_SLOTS once freed
+    atomic_size_t records;      // Records of the message starting here (first slot only)
+    plog_record_t record;
+} plog_slot_t;
+
+typedef struct plog_ring_s {
+    size_t head;                        // Next position the producer fills; guarded by g_plog_lock
+    _Alignas(64) atomic_size_t tail;    // Oldest position not claimed by the logger or dropped
+    _Alignas(64) plog_slot_t slots[PLOG_RING_SLOTS];
+} plog_ring_t;
+
+static char g_plog_buffer[PLOG_BUFFER_SIZE];
+static size_t g_plog_used;
+static plog_segment_t g_plog_segments[PLOG_MAX_SEGMENTS];
+static size_t g_plog_segment_count;
+
+static bool g_plog_async;
+static plog_overflow_policy_t g_plog_policy;
+static plog_ring_t g_plog_ring;
+static pthread_t g_plog_thread;
+static sem_t g_plog_items;              // Posted for every published record
+static sem_t g_plog_space;              // Posted when a waiting producer may retry
+static unsigned long g_plog_flush_requests;    // FLUSH records queued; guarded by g_plog_lock
+static unsigned long g_plog_flushes_done;       // FLUSH records written out; guarded by g_plog_flush_lock
+static pthread_mutex_t g_plog_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_plog_flush_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool g_plog_producer_waiting;
+static atomic_ulong g_plog_dropped;
+static pthread_mutex_t g_plog_lock = PTHREAD_MUTEX_INITIALIZER;    // Serializes producers
+
+/*
+ * Purpose:
+ *   Writes a whole byte range to a file descriptor, retrying after short writes
+ *   and EINTR.
+ * Receives:
+ *   fd:     Destination file descriptor.
+ *   data:   Bytes to write.
+ *   length: Number of bytes.
+ * Returns:
+ *   0 on success, -1 on a write error (errno is set).
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Writes out everything in the output buffer, segment by segment, and empties it.
+ *   Called by whichever thread currently owns the buffer.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success, -1 if any write failed (the buffer is emptied regardless).
+ */
+static int buffer_write_out(void) {
+    int result = 0;
+    size_t start = 0;
+    int saved_errno = errno;
+
+    for (size_t i = 0; i < g_plog_segment_count; ++i) {
+        const plog_segment_t *segment = &g_plog_segments[i];
+        if (write_all(segment->fd, g_plog_buffer + start, segment->end - start) != 0) {
+            result = -1;
+        }
+        start = segment->end;
+    }
+    g_plog_used = 0;
+    g_plog_segment_count = 0;
+    errno = saved_errno;
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Formats a message and appends it to the output buffer for the given descriptor,
+ *   writing the buffer out first if the message would not fit and afterwards if
+ *   the buffer has passed PLOG_FLUSH_THRESHOLD.
+ * Receives:
+ *   fd:     Destination file descriptor (STDOUT_FILENO or STDERR_FILENO).
+ *   format: printf-style format string.
+ *   args:   Arguments for the format.
+ * Returns:
+ *   None (void). Formatting errors drop the message.
+ */
+static void buffer_vappend(int fd, const char *format, va_list args) {
+    va_list retry_args;
+    va_list large_args;
+    va_copy(retry_args, args);
+    va_copy(large_args, args);
+
+    int length = -1;
+    size_t space = PLOG_BUFFER_SIZE - g_plog_used;
+    if (g_plog_segment_count < PLOG_MAX_SEGMENTS) {
+        length = vsnprintf(g_plog_buffer + g_plog_used, space, format, args);
+        if (length < 0) {
+            goto done;
+        }
+    }
+
+    if (length < 0 || (size_t)length >= space) {
+        // Did not fit (or no segment left): write out and format again into the empty buffer.
+        buffer_write_out();
+        length = vsnprintf(g_plog_buffer, PLOG_BUFFER_SIZE, format, retry_args);
+        if (length < 0) {
+            goto done;
+        }
+        if ((size_t)length >= PLOG_BUFFER_SIZE) {
+            // Larger than the whole buffer: format into a temporary and write it directly.
+            char *message = malloc((size_t)length + 1);
+            if (message != NULL) {
+                vsnprintf(message, (size_t)length + 1, format, large_args);
+                write_all(fd, message, (size_t)length);
+                free(message);
+            }
+            goto done;
+        }
+    }
+
+    g_plog_used += (size_t)length;
+    if (g_plog_segment_count > 0 && g_plog_segments[g_plog_segment_count - 1].fd == fd) {
+        g_plog_segments[g_plog_segment_count - 1].end = g_plog_used;
+    } else {
+        g_plog_segments[g_plog_segment_count].fd = fd;
+        g_plog_segments[g_plog_segment_count].end = g_plog_used;
+        g_plog_segment_count++;
+    }
+
+    if (g_plog_used >= PLOG_FLUSH_THRESHOLD) {
+        buffer_write_out();
+    }
+
+done:
+    va_end(retry_args);
+    va_end(large_args);
+}
+
+/*
+ * Purpose:
+ *   Variadic wrapper around buffer_vappend().
+ * Receives:
+ *   fd, format, ...: Destination descriptor, format string and arguments.
+ * Returns:
+ *   None (void).
+ */
+static void buffer_printf(int fd, const char *format, ...) PLOG_PRINTF_FORMAT(2, 3);
+static void buffer_printf(int fd, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    buffer_vappend(fd, format, args);
+    va_end(args);
+}
+
+/*
+ * Purpose:
+ *   Appends "message: <description of error_number>" to the output buffer.
+ * Receives:
+ *   message:      Prefix; may be empty, in which case only the description is added.
+ *   error_number: The errno value to describe.
+ * Returns:
+ *   None (void).
+ */
+static void buffer_append_error(const char *message, int error_number) {
+    char description[PLOG_ERROR_TEXT_SIZE];
+    if (strerror_r(error_number, description, sizeof(description)) != 0) {
+        snprintf(description, sizeof(description), "Unknown error %d", error_number);
+    }
+    if (message[0] != '\0') {
+        buffer_printf(STDERR_FILENO, "%s: %s\n", message, description);
+    } else {
+        buffer_printf(STDERR_FILENO, "%s\n", description);
+    }
+}
+
+/*
+ * Purpose:
+ *   Formats an event with its fixed format.
+ * Receives:
+ *   buffer, size: Destination, as for snprintf().
+ *   event:        The event.
+ *   text, number: Its arguments (see plog_event_t).
+ * Returns:
+ *   The length of the formatted event, as for snprintf(); -1 for an unknown event.
+ */
+static int event_format(char *buffer, size_t size, plog_event_t event, const char *text, int number) {
+    switch (event) {
+        case PLOG_EVENT_LAUNCHING:
+            return snprintf(buffer, size, "Parent: Launching child '%s' using method '%c'...\n", text, number);
+        case PLOG_EVENT_EXEC_PATH:
+            return snprintf(buffer, size, "Parent: Child executable path: %s\n", text);
+        case PLOG_EVENT_FORKED:
+            return snprintf(buffer, size, "Parent: Forked child process '%s' with PID %d.\n", text, number);
+        case PLOG_EVENT_REPLAYED_EXIT:
+            return snprintf(buffer, size, "Parent: Replayed cached result of '%s' (exit status %d) instead of "
+                            "forking.\n", text, number);
+        case PLOG_EVENT_REPLAYED_SIGNAL:
+            return snprintf(buffer, size, "Parent: Replayed cached result of '%s' (terminated by signal %d) "
+                            "instead of forking.\n", text, number);
+    }
+    return -1;
+}
+
+/*
+ * Purpose:
+ *   Formats an event into 'local' or, if it does not fit, into a new buffer.
+ * Receives:
+ *   event, text, number: The event and its arguments.
+ *   local:               Buffer of PLOG_EVENT_TEXT_SIZE bytes.
+ *   length:              Receives the length of the formatted event.
+ * Returns:
+ *   'local', a malloc()ed buffer the caller frees, or NULL on failure.
+ */
+static char *event_text(plog_event_t event, const char *text, int number, char *local, size_t *length) {
+    int formatted = event_format(local, PLOG_EVENT_TEXT_SIZE, event, text, number);
+    if (formatted < 0) {
+        return NULL;
+    }
+    *length = (size_t)formatted;
+    if ((size_t)formatted < PLOG_EVENT_TEXT_SIZE) {
+        return local;
+    }
+    char *message = malloc((size_t)formatted + 1);
+    if (message != NULL) {
+        event_format(message, (size_t)formatted + 1, event, text, number);
+    }
+    return message;
+}
+
+/*
+ * Purpose:
+ *   Appends a formatted event to the output buffer (stdout).
+ * Receives:
+ *   event, text, number: The event and its arguments.
+ * Returns:
+ *   None (void). Unknown events and allocation failures drop the message.
+ */
+static void buffer_append_event(plog_event_t event, const char *text, int number) {
+    char local[PLOG_EVENT_TEXT_SIZE];
+    size_t length = 0;
+    char *message = event_text(event, text, number, local, &length);
+    if (message != NULL) {
+        buffer_printf(STDOUT_FILENO, "%s", message);
+        if (message != local) {
+            free(message);
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Tells whether the next 'count' positions of the ring are free. Caller holds
+ *   g_plog_lock.
+ * Receives:
+ *   count: Number of slots needed.
+ * Returns:
+ *   true if all of them can be written.
+ */
+static bool ring_has_space(size_t count) {
+    plog_ring_t *ring = &g_plog_ring;
+    for (size_t i = 0; i < count; ++i) {
+        size_t position = ring->head + i;
+        const plog_slot_t *slot = &ring->slots[position & (PLOG_RING_SLOTS - 1)];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != position) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Called by a producer that found too few free slots under the block policy
+ *   (or for a record that must not be dropped). Announces the wait, re-checks
+ *   the ring and sleeps until the logger thread has freed slots.
+ * Receives:
+ *   count: Number of slots needed.
+ * Returns:
+ *   None (void). The caller re-checks the ring afterwards.
+ */
+static void wait_for_space(size_t count) {
+    atomic_store(&g_plog_producer_waiting, true);
+    if (ring_has_space(count)) {
+        return;
+    }
+    while (sem_wait(&g_plog_space) != 0 && errno == EINTR) {
+    }
+}
+
+/*
+ * Purpose:
+ *   Drop-oldest policy: claims the oldest message the logger has not claimed
+ *   yet, exactly as the logger would, and frees its slots unread.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true if a message was dropped or the logger claimed it first (the caller
+ *   re-checks the ring), false if every queued message is already claimed by
+ *   the logger, whose slots only it can free, or the oldest one is a FLUSH or
+ *   STOP marker: dropping a flush would leave its caller waiting forever.
+ */
+static bool ring_drop_oldest(void) {
+    plog_ring_t *ring = &g_plog_ring;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (tail == ring->head) {
+        return false;
+    }
+    // Positions below 'head' are published, and 'records' is only rewritten
+    // after the slot has been claimed, so a stale count never wins the CAS.
+    plog_slot_t *oldest = &ring->slots[tail & (PLOG_RING_SLOTS - 1)];
+    size_t records = atomic_load_explicit(&oldest->records, memory_order_relaxed);
+    // Only the producer writes records, so the kind is stable while the slot is queued.
+    if (oldest->record.kind == PLOG_RECORD_FLUSH || oldest->record.kind == PLOG_RECORD_STOP) {
+        return false;
+    }
+    if (!atomic_compare_exchange_strong(&ring->tail, &tail, tail + records)) {
+        return true;
+    }
+    for (size_t i = 0; i < records; ++i) {
+        plog_slot_t *slot = &ring->slots[(tail + i) & (PLOG_RING_SLOTS - 1)];
+        atomic_store_explicit(&slot->sequence, tail + i + PLOG_RING_SLOTS, memory_order_release);
+    }
+    atomic_fetch_add(&g_plog_dropped, 1);
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Makes room for one message of 'count' records, applying the overflow
+ *   policy if the ring is too full. Caller holds g_plog_lock, which makes it
+ *   the ring's single producer.
+ * Receives:
+ *   count:        Records in the message (1..PLOG_MESSAGE_MAX_RECORDS).
+ *   must_deliver: If true, wait for space regardless of the policy (used for
+ *                 FLUSH and STOP markers).
+ * Returns:
+ *   true if the slots at ring_record(0 .. count - 1) may be written, false if
+ *   the message was dropped.
+ */
+static bool ring_reserve(size_t count, bool must_deliver) {
+    while (!ring_has_space(count)) {
+        if (must_deliver || g_plog_policy == PLOG_OVERFLOW_BLOCK) {
+            wait_for_space(count);
+        } else if (g_plog_policy == PLOG_OVERFLOW_DROP) {
+            atomic_fetch_add(&g_plog_dropped, 1);
+            return false;
+        } else if (!ring_drop_oldest()) {
+            wait_for_space(count);
+        }
+    }
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Returns the record of a reserved slot.
+ * Receives:
+ *   index: Record of the message being written (0-based).
+ * Returns:
+ *   The record to fill in.
+ */
+static plog_record_t *ring_record(size_t index) {
+    return &g_plog_ring.slots[(g_plog_ring.head + index) & (PLOG_RING_SLOTS - 1)].record;
+}
+
+/*
+ * Purpose:
+ *   Publishes a message written into reserved slots: the later records first,
+ *   then the first one with the record count, so the logger sees all of them
+ *   together, and wakes the logger.
+ * Receives:
+ *   count: Records in the message.
+ * Returns:
+ *   None (void).
+ */
+static void ring_publish(size_t count) {
+    plog_ring_t *ring = &g_plog_ring;
+    size_t head = ring->head;
+    atomic_store_explicit(&ring->slots[head & (PLOG_RING_SLOTS - 1)].records, count, memory_order_relaxed);
+    for (size_t i = count; i-- > 0;) {
+        plog_slot_t *slot = &ring->slots[(head + i) & (PLOG_RING_SLOTS - 1)];
+        atomic_store_explicit(&slot->sequence, head + i + 1, memory_order_release);
+    }
+    ring->head = head + count;
+    sem_post(&g_plog_items);
+}
+
+/*
+ * Purpose:
+ *   Queues a single-record message.
+ * Receives:
+ *   record:       The record to copy into the ring.
+ *   must_deliver: As for ring_reserve().
+ * Returns:
+ *   true if the record was queued, false if it was dropped.
+ */
+static bool ring_push(const plog_record_t *record, bool must_deliver) {
+    if (!ring_reserve(1, must_deliver)) {
+        return false;
+    }
+    *ring_record(0) = *record;
+    ring_publish(1);
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Queues a FLUSH record. Caller holds g_plog_lock.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The ticket to pass to wait_for_flush().
+ */
+static unsigned long ring_push_flush(void) {
+    plog_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.kind = PLOG_RECORD_FLUSH;
+    ring_push(&record, true);
+    return ++g_plog_flush_requests;
+}
+
+/*
+ * Purpose:
+ *   Waits until the logger thread has written out everything queued before
+ *   the FLUSH record with the given ticket.
+ * Receives:
+ *   ticket: From ring_push_flush().
+ * Returns:
+ *   None (void).
+ */
+static void wait_for_flush(unsigned long ticket) {
+    pthread_mutex_lock(&g_plog_flush_lock);
+    while (g_plog_flushes_done < ticket) {
+        pthread_cond_wait(&g_plog_flush_cond, &g_plog_flush_lock);
+    }
+    pthread_mutex_unlock(&g_plog_flush_lock);
+}
+
+/*
+ * Purpose:
+ *   Queues preformatted text as one message of as many TEXT records as needed.
+ *   Text too long for PLOG_MESSAGE_MAX_RECORDS records is written directly,
+ *   after the logger has written out everything queued before it (the caller
+ *   holds g_plog_lock, so nothing can be queued in between).
+ * Receives:
+ *   fd:     Destination file descriptor.
+ *   text:   The text to queue.
+ *   length: Length of the text.
+ * Returns:
+ *   None (void).
+ */
+static void ring_push_text(int fd, const char *text, size_t length) {
+    size_t count = (length + PLOG_CHUNK_SIZE - 1) / PLOG_CHUNK_SIZE;
+    if (count == 0) {
+        return;
+    }
+    if (count > PLOG_MESSAGE_MAX_RECORDS) {
+        wait_for_flush(ring_push_flush());
+        write_all(fd, text, length);
+        return;
+    }
+    if (!ring_reserve(count, false)) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        size_t chunk = length < PLOG_CHUNK_SIZE ? length : PLOG_CHUNK_SIZE;
+        plog_record_t *record = ring_record(i);
+        record->kind = PLOG_RECORD_TEXT;
+        record->fd = fd;
+        record->number = 0;
+        memcpy(record->text, text, chunk);
+        record->text[chunk] = '\0';
+        text += chunk;
+        length -= chunk;
+    }
+    ring_publish(count);
+}
+
+/*
+ * Purpose:
+ *   Formats a variadic message on the producer side and queues it as text. Used
+ *   for the general-purpose plog_out()/plog_err() calls in asynchronous mode.
+ * Receives:
+ *   fd, format, args: Destination descriptor, format string and arguments.
+ * Returns:
+ *   None (void).
+ */
+static void ring_push_vformat(int fd, const char *format, va_list args) {
+    char local[PLOG_RECORD_TEXT_SIZE];
+    va_list retry_args;
+    va_copy(retry_args, args);
+
+    int length = vsnprintf(local, sizeof(local), format, args);
+    if (length >= 0 && (size_t)length < sizeof(local)) {
+        ring_push_text(fd, local, (size_t)length);
+    } else if (length >= 0) {
+        char *message = malloc((size_t)length + 1);
+        if (message != NULL) {
+            vsnprintf(message, (size_t)length + 1, format, retry_args);
+            ring_push_text(fd, message, (size_t)length);
+            free(message);
+        }
+    }
+    va_end(retry_args);
+}
+
+/*
+ * Purpose:
+ *   Wakes a producer blocked in wait_for_space(), if there is one.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void notify_space(void) {
+    if (atomic_exchange(&g_plog_producer_waiting, false)) {
+        sem_post(&g_plog_space);
+    }
+}
+
+/*
+ * Purpose:
+ *   Logger thread: takes records off the ring, formats them into the output
+ *   buffer and writes the buffer out whenever the ring runs empty (or the buffer
+ *   passes its threshold), so a burst of records costs only a few write() calls.
+ * Receives:
+ *   arg: Unused.
+ * Returns:
+ *   NULL when a STOP record has been processed.
+ */
+static void *logger_thread_main(void *arg) {
+    (void)arg;
+    plog_ring_t *ring = &g_plog_ring;
+
+    for (;;) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        plog_slot_t *first = &ring->slots[tail & (PLOG_RING_SLOTS - 1)];
+        if (atomic_load_explicit(&first->sequence, memory_order_acquire) != tail + 1) {
+            buffer_write_out();
+            while (sem_wait(&g_plog_items) != 0 && errno == EINTR) {
+            }
+            continue;
+        }
+
+        // Claim the message before touching its slots. If the producer dropped
+        // it meanwhile (drop-oldest), the CAS fails and nothing was read.
+        size_t records = atomic_load_explicit(&first->records, memory_order_relaxed);
+        if (!atomic_compare_exchange_strong(&ring->tail, &tail, tail + records)) {
+            continue;
+        }
+
+        bool stop = false;
+        for (size_t i = 0; i < records; ++i) {
+            plog_slot_t *slot = &ring->slots[(tail + i) & (PLOG_RING_SLOTS - 1)];
+            const plog_record_t *record = &slot->record;
+            switch (record->kind) {
+                case PLOG_RECORD_TEXT:
+                    buffer_printf(record->fd, "%s", record->text);
+                    break;
+                case PLOG_RECORD_ERRNO:
+                    buffer_append_error(record->text, record->number);
+                    break;
+                case PLOG_RECORD_EVENT:
+                    buffer_append_event(record->event, record->text, record->number);
+                    break;
+                case PLOG_RECORD_FLUSH:
+                    buffer_write_out();
+                    pthread_mutex_lock(&g_plog_flush_lock);
+                    g_plog_flushes_done++;
+                    pthread_cond_broadcast(&g_plog_flush_cond);
+                    pthread_mutex_unlock(&g_plog_flush_lock);
+                    break;
+                case PLOG_RECORD_STOP:
+                    buffer_write_out();
+                    stop = true;
+                    break;
+            }
+            atomic_store_explicit(&slot->sequence, tail + i + PLOG_RING_SLOTS, memory_order_release);
+        }
+        notify_space();
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Logs a printf-style status message to stdout.
+ * Receives:
+ *   format, ...: printf-style format string and arguments.
+ * Returns:
+ *   None (void).
+ */
+void plog_out(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    pthread_mutex_lock(&g_plog_lock);
+    if (g_plog_async) {
+        ring_push_vformat(STDOUT_FILENO, format, args);
+    } else {
+        buffer_vappend(STDOUT_FILENO, format, args);
+    }
+    pthread_mutex_unlock(&g_plog_lock);
+    va_end(args);
+}
+
+/*
+ * Purpose:
+ *   Logs a printf-style error message to stderr.
+ * Receives:
+ *   format, ...: printf-style format string and arguments.
+ * Returns:
+ *   None (void).
+ */
+void plog_err(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    pthread_mutex_lock(&g_plog_lock);
+    if (g_plog_async) {
+        ring_push_vformat(STDERR_FILENO, format, args);
+    } else {
+        buffer_vappend(STDERR_FILENO, format, args);
+    }
+    pthread_mutex_unlock(&g_plog_lock);
+    va_end(args);
+}
+
+/*
+ * Purpose:
+ *   Replacement for perror(): logs "message: <strerror(errno)>" to stderr. In
+ *   asynchronous mode only the message and the errno value are queued; the
+ *   description is looked up on the logger thread. errno is preserved.
+ * Receives:
+ *   message: Prefix for the error description. May be NULL or empty, in which
+ *            case only the description is logged.
+ * Returns:
+ *   None (void).
+ */
+void plog_perror(const char *message) {
+    int saved_errno = errno;
+    if (message == NULL) {
+        message = "";
+    }
+    pthread_mutex_lock(&g_plog_lock);
+    if (g_plog_async && strlen(message) < PLOG_RECORD_TEXT_SIZE) {
+        plog_record_t record;
+        record.kind = PLOG_RECORD_ERRNO;
+        record.fd = STDERR_FILENO;
+        record.number = saved_errno;
+        memcpy(record.text, message, strlen(message) + 1);
+        ring_push(&record, false);
+    } else if (g_plog_async) {
+        char description[PLOG_ERROR_TEXT_SIZE];
+        if (strerror_r(saved_errno, description, sizeof(description)) != 0) {
+            snprintf(description, sizeof(description), "Unknown error %d", saved_errno);
+        }
+        // Queued as one message, so the overflow policy keeps or drops it whole.
+        size_t length = strlen(message) + strlen(description) + 3;
+        char *text = malloc(length + 1);
+        if (text != NULL) {
+            snprintf(text, length + 1, "%s: %s\n", message, description);
+            ring_push_text(STDERR_FILENO, text, length);
+            free(text);
+        }
+    } else {
+        buffer_append_error(message, saved_errno);
+    }
+    pthread_mutex_unlock(&g_plog_lock);
+    errno = saved_errno;
+}
+
+/*
+ * Purpose:
+ *   Logs a hot-path event to stdout whose formatting is deferred to the logger
+ *   thread in asynchronous mode: only the event kind, one string and one int
+ *   are copied into the ring. Each kind has a fixed format (see plog_event_t).
+ * Receives:
+ *   event:  The event.
+ *   text:   Its string argument.
+ *   number: Its int argument.
+ * Returns:
+ *   None (void).
+ */
+static void log_event(plog_event_t event, const char *text, int number) {
+    size_t text_length = strlen(text);
+    pthread_mutex_lock(&g_plog_lock);
+    if (g_plog_async && text_length < PLOG_RECORD_TEXT_SIZE) {
+        plog_record_t record;
+        record.kind = PLOG_RECORD_EVENT;
+        record.fd = STDOUT_FILENO;
+        record.number = number;
+        record.event = event;
+        memcpy(record.text, text, text_length + 1);
+        ring_push(&record, false);
+    } else if (g_plog_async) {
+        // Too long for one record: format here and queue the text.
+        char local[PLOG_EVENT_TEXT_SIZE];
+        size_t length = 0;
+        char *message = event_text(event, text, number, local, &length);
+        if (message != NULL) {
+            ring_push_text(STDOUT_FILENO, message, length);
+            if (message != local) {
+                free(message);
+            }
+        }
+    } else {
+        buffer_append_event(event, text, number);
+    }
+    pthread_mutex_unlock(&g_plog_lock);
+}
+
+/*
+ * Purpose:
+ *   Logs an event that takes only a string (PLOG_EVENT_EXEC_PATH).
+ * Receives:
+ *   event: The event.
+ *   text:  Its string argument.
+ * Returns:
+ *   None (void).
+ */
+void plog_event(plog_event_t event, const char *text) {
+    log_event(event, text, 0);
+}
+
+/*
+ * Purpose:
+ *   Logs an event that takes a string and an int.
+ * Receives:
+ *   event:  The event.
+ *   text:   Its string argument.
+ *   number: Its int argument.
+ * Returns:
+ *   None (void).
+ */
+void plog_event_number(plog_event_t event, const char *text, int number) {
+    log_event(event, text, number);
+}
+
+/*
+ * Purpose:
+ *   Writes out everything logged so far. In asynchronous mode this waits until
+ *   the logger thread has written every record queued before the call. Used once
+ *   per command-loop iteration and wherever output must precede a direct write.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success, -1 if a write failed (synchronous mode only).
+ */
+int plog_flush(void) {
+    pthread_mutex_lock(&g_plog_lock);
+    if (!g_plog_async) {
+        int rc = buffer_write_out();
+        pthread_mutex_unlock(&g_plog_lock);
+        return rc;
+    }
+    unsigned long ticket = ring_push_flush();
+    pthread_mutex_unlock(&g_plog_lock);
+    wait_for_flush(ticket);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Writes out the buffer in synchronous mode without waiting for anything
+ *   else, for threads that log outside the command loop (the output
+ *   reactors), whose messages would otherwise wait for the next prompt. In
+ *   asynchronous mode the logger thread writes on its own, so nothing is done.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void plog_write_pending(void) {
+    pthread_mutex_lock(&g_plog_lock);
+    if (!g_plog_async) {
+        buffer_write_out();
+    }
+    pthread_mutex_unlock(&g_plog_lock);
+}
+
+/*
+ * Purpose:
+ *   Makes sure no log output can be duplicated by a subsequent fork(). In
+ *   synchronous mode the buffer is written out. In asynchronous mode nothing is
+ *   needed: pending records live only in the ring, which a forked child never
+ *   writes (it execs or calls _exit()), so the launch path does not wait.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success, -1 if a write failed.
+ */
+int plog_prepare_fork(void) {
+    if (g_plog_async) {
+        return 0;
+    }
+    pthread_mutex_lock(&g_plog_lock);
+    int rc = buffer_write_out();
+    pthread_mutex_unlock(&g_plog_lock);
+    return rc;
+}
+
+/*
+ * Purpose:
+ *   pthread_atfork() prepare handler: takes the log lock, so no other thread
+ *   is halfway through a message while fork() copies the process.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void plog_atfork_prepare(void) {
+    pthread_mutex_lock(&g_plog_lock);
+}
+
+/*
+ * Purpose:
+ *   pthread_atfork() parent handler: releases the lock taken by
+ *   plog_atfork_prepare().
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void plog_atfork_parent(void) {
+    pthread_mutex_unlock(&g_plog_lock);
+}
+
+/*
+ * Purpose:
+ *   pthread_atfork() child handler. The forked child gets an empty buffer
+ *   (whatever it held belongs to the parent and is written by the parent) and
+ *   synchronous mode, since the logger thread does not exist in the child,
+ *   then releases the lock taken by plog_atfork_prepare() in the forking
+ *   thread, which is the child's only thread.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void plog_atfork_child(void) {
+    g_plog_async = false;
+    g_plog_used = 0;
+    g_plog_segment_count = 0;
+    pthread_mutex_unlock(&g_plog_lock);
+}
+
+/*
+ * Purpose:
+ *   Switches the log to asynchronous mode: writes out the current buffer and
+ *   starts the logger thread. Must be called before other threads start logging.
+ * Receives:
+ *   policy: What to do when the ring is full.
+ * Returns:
+ *   0 on success.
+ *   -1 if the semaphores or the thread could not be created; the log stays
+ *      synchronous and an error message is logged.
+ */
+int plog_start_async(plog_overflow_policy_t policy) {
+    if (g_plog_async) {
+        return 0;
+    }
+    buffer_write_out();
+
+    if (sem_init(&g_plog_items, 0, 0) != 0) {
+        plog_perror("Parent: Failed to create logger semaphore");
+        return -1;
+    }
+    if (sem_init(&g_plog_space, 0, 0) != 0) {
+        plog_perror("Parent: Failed to create logger semaphore");
+        sem_destroy(&g_plog_items);
+        return -1;
+    }
+
+    g_plog_ring.head = 0;
+    atomic_store(&g_plog_ring.tail, 0);
+    for (size_t i = 0; i < PLOG_RING_SLOTS; ++i) {
+        atomic_store(&g_plog_ring.slots[i].sequence, i);
+    }
+    atomic_store(&g_plog_producer_waiting, false);
+    atomic_store(&g_plog_dropped, 0);
+    g_plog_policy = policy;
+
+    int error_number = pthread_create(&g_plog_thread, NULL, logger_thread_main, NULL);
+    if (error_number != 0) {
+        errno = error_number;
+        plog_perror("Parent: Failed to start logger thread");
+        sem_destroy(&g_plog_items);
+        sem_destroy(&g_plog_space);
+        return -1;
+    }
+    g_plog_async = true;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Writes out everything still pending and, in asynchronous mode, stops the
+ *   logger thread and reports how many messages the overflow policy dropped.
+ *   The log is synchronous again afterwards.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void plog_shutdown(void) {
+    if (g_plog_async) {
+        plog_record_t record;
+        memset(&record, 0, sizeof(record));
+        record.kind = PLOG_RECORD_STOP;
+        pthread_mutex_lock(&g_plog_lock);
+        ring_push(&record, true);
+        pthread_mutex_unlock(&g_plog_lock);
+        pthread_join(g_plog_thread, NULL);
+        sem_destroy(&g_plog_items);
+        sem_destroy(&g_plog_space);
+        g_plog_async = false;
+
+        unsigned long dropped = plog_dropped();
+        if (dropped > 0) {
+            buffer_printf(STDERR_FILENO, "Parent: Logger dropped %lu message(s) on overflow.\n", dropped);
+        }
+    }
+    buffer_write_out();
+}
+
+/*
+ * Purpose:
+ *   Returns the number of messages discarded by the drop/drop-oldest policies.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The drop counter.
+ */
+unsigned long plog_dropped(void) {
+    return atomic_load(&g_plog_dropped);
+}
@@ -0,0 +1,67 @@
+/*
+ * parent_log.h
+ *
+ * Description:
+ * Buffered status/error output for the parent program. Messages for stdout and
+ * stderr are formatted into one in-memory buffer (keeping their relative order)
+ * and written with write() when plog_flush() is called: once per command-loop
+ * iteration, before every fork(), at exit, or when the buffer passes a size
+ * threshold. Nothing is ever left buffered across fork(), so children cannot
+ * duplicate parent output.
+ *
+ * In asynchronous mode (plog_start_async()) the calling thread only copies each
+ * message into a bounded ring with one sequence number per slot; callers are
+ * serialized by a producer lock, and the logger thread takes messages off the
+ * ring without it. The logger thread formats the records and performs all
+ * writes, so the launch path no longer waits for a slow terminal or disk. A
+ * full ring is handled by the selected overflow policy, which keeps or drops
+ * every message whole.
+ */
+#ifndef PARENT_LOG_H
+#define PARENT_LOG_H
+
+#include <stdarg.h>
+
+#define PLOG_BUFFER_SIZE 16384
+#define PLOG_FLUSH_THRESHOLD 8192
+#define PLOG_RING_SLOTS 1024          /* Must be a power of two. */
+#define PLOG_RECORD_TEXT_SIZE 256
+
+#if defined(__GNUC__)
+#define PLOG_PRINTF_FORMAT(fmt_index, args_index) __attribute__((format(printf, fmt_index, args_index)))
+#else
+#define PLOG_PRINTF_FORMAT(fmt_index, args_index)
+#endif
+
+typedef enum plog_overflow_policy_e {
+    PLOG_OVERFLOW_BLOCK,        /* Wait until the logger thread frees a slot. */
+    PLOG_OVERFLOW_DROP_OLDEST,  /* Discard the oldest unwritten message (counted). */
+    PLOG_OVERFLOW_DROP          /* Discard the new message (counted). */
+} plog_overflow_policy_t;
+
+/* Hot-path events with fixed formats (plog_event(), plog_event_number()). */
+typedef enum plog_event_e {
+    PLOG_EVENT_LAUNCHING,       /* Child name; number: launch method character */
+    PLOG_EVENT_EXEC_PATH,       /* Child executable path */
+    PLOG_EVENT_FORKED,          /* Child name; number: PID */
+    PLOG_EVENT_REPLAYED_EXIT,   /* Child name; number: exit status of the cached result */
+    PLOG_EVENT_REPLAYED_SIGNAL  /* Child name; number: signal that ended the cached result */
+} plog_event_t;
+
+void plog_out(const char *format, ...) PLOG_PRINTF_FORMAT(1, 2);
+void plog_err(const char *format, ...) PLOG_PRINTF_FORMAT(1, 2);
+void plog_perror(const char *message);
+void plog_event(plog_event_t event, const char *text);
+void plog_event_number(plog_event_t event, const char *text, int number);
+int plog_flush(void);
+void plog_write_pending(void);
+int plog_prepare_fork(void);
+void plog_atfork_prepare(void);
+void plog_atfork_parent(void);
+void plog_atfork_child(void);
+
+int plog_start_async(plog_overflow_policy_t policy);
+void plog_shutdown(void);
+unsigned long plog_dropped(void);
+
+#endif /* PARENT_LOG_H */
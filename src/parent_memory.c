@@ -0,0 +1,331 @@
+/*
+ * parent_memory.c
+ *
+ * Description:
+ * Implements the parent-only allocations (see parent_memory.h). Each large
+ * allocation is its own anonymous mapping, rounded up to whole pages, so
+ * MADV_DONTFORK covers exactly that block and a cached result can be made
+ * read-only without affecting its neighbours. Growing a mapped block uses
+ * mremap(), which keeps its advice. Counters are atomics: launcher threads,
+ * reactor shards and the command loop allocate concurrently.
+ */
+#define _GNU_SOURCE     // MADV_DONTFORK, mremap()
+
+#include "parent_memory.h"
+#include "parent_log.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static atomic_size_t g_pmem_bytes[PMEM_CLASS_COUNT];      // Mapped, page-rounded
+static atomic_size_t g_pmem_peak[PMEM_CLASS_COUNT];
+static atomic_ulong g_pmem_mappings[PMEM_CLASS_COUNT];
+static atomic_size_t g_pmem_other_bytes;                 // Mappings marked by pmem_dontfork()
+static atomic_ulong g_pmem_advice_failures;
+static atomic_ulong g_pmem_forks;
+static atomic_ullong g_pmem_fork_ns;
+static atomic_ullong g_pmem_fork_min_ns = ULLONG_MAX;
+static atomic_ullong g_pmem_fork_max_ns;
+
+static const char *const g_pmem_class_names[PMEM_CLASS_COUNT] = { "buffers", "cache" };
+
+/*
+ * Purpose:
+ *   Rounds a size up to whole pages.
+ * Receives:
+ *   size: Size in bytes.
+ * Returns:
+ *   The rounded size.
+ */
+static size_t page_round(size_t size) {
+    long value = sysconf(_SC_PAGESIZE);
+    size_t page_size = value > 0 ? (size_t)value : 4096;
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/*
+ * Purpose:
+ *   Reads the current time.
+ * Receives:
+ *   None.
+ * Returns:
+ *   CLOCK_MONOTONIC in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Adds a mapped block to a class's counters.
+ * Receives:
+ *   class:  The allocation class.
+ *   mapped: The block's page-rounded size.
+ * Returns:
+ *   None (void).
+ */
+static void count_mapped(pmem_class_t class, size_t mapped) {
+    size_t bytes = atomic_fetch_add_explicit(&g_pmem_bytes[class], mapped, memory_order_relaxed) + mapped;
+    size_t peak = atomic_load_explicit(&g_pmem_peak[class], memory_order_relaxed);
+    while (bytes > peak &&
+           !atomic_compare_exchange_weak_explicit(&g_pmem_peak[class], &peak, bytes,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/*
+ * Purpose:
+ *   Allocates a zero-filled block that fork() does not copy (from PMEM_MIN_SIZE
+ *   bytes; smaller blocks come from the heap). Any thread.
+ * Receives:
+ *   class: The allocation class.
+ *   size:  Size in bytes (at least 1).
+ * Returns:
+ *   The block, or NULL with errno set.
+ */
+void *pmem_alloc(pmem_class_t class, size_t size) {
+    if (size < PMEM_MIN_SIZE) {
+        return calloc(1, size);
+    }
+    size_t mapped = page_round(size);
+    void *block = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        return NULL;
+    }
+    if (madvise(block, mapped, MADV_DONTFORK) != 0) {
+        atomic_fetch_add_explicit(&g_pmem_advice_failures, 1, memory_order_relaxed);   // Still usable
+    }
+    atomic_fetch_add_explicit(&g_pmem_mappings[class], 1, memory_order_relaxed);
+    count_mapped(class, mapped);
+    return block;
+}
+
+/*
+ * Purpose:
+ *   Resizes a block from pmem_alloc(), keeping its contents up to the smaller
+ *   size. Any thread.
+ * Receives:
+ *   class:    The block's allocation class.
+ *   ptr:      The block, or NULL (then this allocates).
+ *   old_size: The size it was allocated or last resized with.
+ *   new_size: The new size (at least 1).
+ * Returns:
+ *   The resized block, or NULL with errno set (the old block is unchanged).
+ */
+void *pmem_realloc(pmem_class_t class, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return pmem_alloc(class, new_size);
+    }
+    if (old_size < PMEM_MIN_SIZE && new_size < PMEM_MIN_SIZE) {
+        return realloc(ptr, new_size);
+    }
+    if (old_size >= PMEM_MIN_SIZE && new_size >= PMEM_MIN_SIZE) {
+        size_t old_mapped = page_round(old_size);
+        size_t new_mapped = page_round(new_size);
+        void *block = mremap(ptr, old_mapped, new_mapped, MREMAP_MAYMOVE);
+        if (block == MAP_FAILED) {
+            return NULL;
+        }
+        if (new_mapped >= old_mapped) {
+            count_mapped(class, new_mapped - old_mapped);
+        } else {
+            atomic_fetch_sub_explicit(&g_pmem_bytes[class], old_mapped - new_mapped, memory_order_relaxed);
+        }
+        return block;
+    }
+    void *block = pmem_alloc(class, new_size);      // Crosses PMEM_MIN_SIZE
+    if (block == NULL) {
+        return NULL;
+    }
+    memcpy(block, ptr, old_size < new_size ? old_size : new_size);
+    pmem_free(class, ptr, old_size);
+    return block;
+}
+
+/*
+ * Purpose:
+ *   Frees a block from pmem_alloc() or pmem_realloc(). Any thread.
+ * Receives:
+ *   class: The block's allocation class.
+ *   ptr:   The block, or NULL.
+ *   size:  The size it was allocated or last resized with.
+ * Returns:
+ *   None (void).
+ */
+void pmem_free(pmem_class_t class, void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (size < PMEM_MIN_SIZE) {
+        free(ptr);
+        return;
+    }
+    size_t mapped = page_round(size);
+    munmap(ptr, mapped);
+    atomic_fetch_sub_explicit(&g_pmem_bytes[class], mapped, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&g_pmem_mappings[class], 1, memory_order_relaxed);
+}
+
+/*
+ * Purpose:
+ *   Makes a filled block read-only, so stray writes fault instead of
+ *   corrupting cached data. Heap blocks (below PMEM_MIN_SIZE) stay writable.
+ * Receives:
+ *   ptr:  The block.
+ *   size: Its size.
+ * Returns:
+ *   None (void).
+ */
+void pmem_seal(void *ptr, size_t size) {
+    if (ptr != NULL && size >= PMEM_MIN_SIZE) {
+        mprotect(ptr, page_round(size), PROT_READ);
+    }
+}
+
+/*
+ * Purpose:
+ *   Marks an existing parent-only mapping that stays until shutdown (e.g. the
+ *   launch journal) so that fork() skips it.
+ * Receives:
+ *   addr:   Page-aligned start of the mapping.
+ *   length: Its length.
+ * Returns:
+ *   0 on success, -1 on failure (errno set; the mapping is still copied).
+ */
+int pmem_dontfork(void *addr, size_t length) {
+    if (madvise(addr, length, MADV_DONTFORK) != 0) {
+        atomic_fetch_add_explicit(&g_pmem_advice_failures, 1, memory_order_relaxed);
+        return -1;
+    }
+    atomic_fetch_add_explicit(&g_pmem_other_bytes, page_round(length), memory_order_relaxed);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Takes the time just before fork().
+ * Receives:
+ *   None.
+ * Returns:
+ *   The start time, for pmem_fork_end().
+ */
+uint64_t pmem_fork_begin(void) {
+    return now_ns();
+}
+
+/*
+ * Purpose:
+ *   Records the duration of a successful fork(), in the parent right after it
+ *   returned. Any thread.
+ * Receives:
+ *   begin_ns: pmem_fork_begin() taken before fork().
+ * Returns:
+ *   None (void).
+ */
+void pmem_fork_end(uint64_t begin_ns) {
+    unsigned long long elapsed_ns = now_ns() - begin_ns;
+    atomic_fetch_add_explicit(&g_pmem_forks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_pmem_fork_ns, elapsed_ns, memory_order_relaxed);
+    unsigned long long min_ns = atomic_load_explicit(&g_pmem_fork_min_ns, memory_order_relaxed);
+    while (elapsed_ns < min_ns &&
+           !atomic_compare_exchange_weak_explicit(&g_pmem_fork_min_ns, &min_ns, elapsed_ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    unsigned long long max_ns = atomic_load_explicit(&g_pmem_fork_max_ns, memory_order_relaxed);
+    while (elapsed_ns > max_ns &&
+           !atomic_compare_exchange_weak_explicit(&g_pmem_fork_max_ns, &max_ns, elapsed_ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/*
+ * Purpose:
+ *   Reads the parent's mapped and resident size and its number of mappings.
+ * Receives:
+ *   mapped, resident: Receive the sizes in bytes.
+ *   mappings:         Receives the number of mappings.
+ * Returns:
+ *   0 on success, -1 if /proc could not be read.
+ */
+static int read_address_space(size_t *mapped, size_t *resident, unsigned long *mappings) {
+    FILE *statm = fopen("/proc/self/statm", "re");
+    if (statm == NULL) {
+        return -1;
+    }
+    unsigned long size_pages = 0;
+    unsigned long resident_pages = 0;
+    int fields = fscanf(statm, "%lu %lu", &size_pages, &resident_pages);
+    fclose(statm);
+    if (fields != 2) {
+        return -1;
+    }
+    *mapped = size_pages * page_round(1);
+    *resident = resident_pages * page_round(1);
+
+    *mappings = 0;
+    FILE *maps = fopen("/proc/self/maps", "re");
+    if (maps != NULL) {
+        char chunk[4096];
+        size_t length;
+        while ((length = fread(chunk, 1, sizeof(chunk), maps)) > 0) {
+            for (size_t i = 0; i < length; ++i) {
+                *mappings += chunk[i] == '\n';
+            }
+        }
+        fclose(maps);
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Prints the parent's mapped size, the part fork() skips and the measured
+ *   fork() time.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void pmem_print_stats(void) {
+    size_t mapped = 0;
+    size_t resident = 0;
+    unsigned long mappings = 0;
+    if (read_address_space(&mapped, &resident, &mappings) != 0) {
+        plog_perror("Parent: Failed to read the parent's address space size");
+    }
+    size_t other = atomic_load(&g_pmem_other_bytes);
+    size_t skipped = other;
+    char classes[160];
+    size_t used = 0;
+    for (int i = 0; i < PMEM_CLASS_COUNT; ++i) {
+        size_t bytes = atomic_load(&g_pmem_bytes[i]);
+        skipped += bytes;
+        int written = snprintf(classes + used, sizeof(classes) - used, "%s %lu block(s), %.1f KiB (peak %.1f KiB); ",
+                               g_pmem_class_names[i], atomic_load(&g_pmem_mappings[i]), (double)bytes / 1024.0,
+                               (double)atomic_load(&g_pmem_peak[i]) / 1024.0);
+        if (written > 0 && (size_t)written < sizeof(classes) - used) {
+            used += (size_t)written;
+        }
+    }
+    plog_out("Parent: Memory: %.1f MiB mapped in %lu mapping(s), %.1f MiB resident; fork() skips %.1f MiB: "
+             "%sother %.1f KiB%s.\n",
+             (double)mapped / (1024.0 * 1024.0), mappings, (double)resident / (1024.0 * 1024.0),
+             (double)skipped / (1024.0 * 1024.0), classes, (double)other / 1024.0,
+             atomic_load(&g_pmem_advice_failures) > 0 ? " (some mappings could not be marked)" : "");
+    unsigned long forks = atomic_load(&g_pmem_forks);
+    if (forks > 0) {
+        plog_out("Parent: fork(): %lu call(s), %.1f us average (min %.1f us, max %.1f us).\n", forks,
+                 (double)atomic_load(&g_pmem_fork_ns) / (double)forks / 1000.0,
+                 (double)atomic_load(&g_pmem_fork_min_ns) / 1000.0,
+                 (double)atomic_load(&g_pmem_fork_max_ns) / 1000.0);
+    }
+}
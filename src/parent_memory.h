@@ -0,0 +1,44 @@
+/*
+ * parent_memory.h
+ *
+ * Description:
+ * Keeps the parent's address space cheap to fork. fork() copies the page
+ * tables of every private mapping, so its cost grows with the parent's
+ * mapped size, and everything it copies is thrown away by the child's
+ * execve() moments later. Large buffers that only the parent uses (output
+ * reactor buffers, held and recorded output, archive blocks, cached
+ * results) are therefore placed in their own anonymous mappings marked
+ * MADV_DONTFORK, which fork() skips. A child must not touch them between
+ * fork() and execve(); nothing it needs there (arguments, environment,
+ * executable path, pipes) lives in them.
+ *
+ * Allocations are made per class, so hot mutable buffers never share pages
+ * with cached results; cached results are made read-only once filled.
+ * Requests smaller than PMEM_MIN_SIZE come from malloc(), as a mapping per
+ * small block would cost more than it saves. 's' prints the parent's mapped
+ * size, how much of it fork() skips and the measured fork() time.
+ */
+#ifndef PARENT_MEMORY_H
+#define PARENT_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PMEM_MIN_SIZE (32u * 1024u)
+
+typedef enum pmem_class_e {
+    PMEM_BUFFER,        /* Hot, mutable: reactor, archive and recording buffers */
+    PMEM_CACHE,         /* Written once, then read-only: cached results */
+    PMEM_CLASS_COUNT
+} pmem_class_t;
+
+void *pmem_alloc(pmem_class_t class, size_t size);
+void *pmem_realloc(pmem_class_t class, void *ptr, size_t old_size, size_t new_size);
+void pmem_free(pmem_class_t class, void *ptr, size_t size);
+void pmem_seal(void *ptr, size_t size);
+int pmem_dontfork(void *addr, size_t length);
+uint64_t pmem_fork_begin(void);
+void pmem_fork_end(uint64_t begin_ns);
+void pmem_print_stats(void);
+
+#endif /* PARENT_MEMORY_H */
@@ -0,0 +1,489 @@
+/*
+ * result_cache.c
+ *
+ * Description:
+ * Implements the child result cache (see result_cache.h): a chained hash table
+ * over the keys plus a doubly linked list in recency order. A lookup that hits
+ * moves the entry to the front; inserting into a full cache evicts the entry at
+ * the back. Recorded outputs are copied in and out under the mutex, so the
+ * replay itself runs unlocked.
+ *
+ * A miss does not make later launches of the same key wait: every launch until
+ * the first result is recorded forks, and results recorded for a key that is
+ * already cached only refresh its recency.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "result_cache.h"
+#include "parent_log.h"
+#include "parent_memory.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FNV64_OFFSET_BASIS 14695981039346656037u
+#define FNV64_PRIME 1099511628211u
+
+typedef struct result_entry_s {
+    result_key_t key;
+    uint64_t hash;
+    char *output;
+    size_t length;
+    int exit_code;
+    int exit_status;
+    char source_name[RESULT_SOURCE_NAME_SIZE];  // The child whose output was recorded
+    pid_t source_pid;
+    struct result_entry_s *chain;           // Next entry in the same bucket
+    struct result_entry_s *newer;           // Recency list
+    struct result_entry_s *older;
+} result_entry_t;
+
+/* A launch whose result is being recorded (see result_cache_fill_begin()). */
+typedef struct result_fill_s {
+    result_key_t key;
+    char child_name[RESULT_SOURCE_NAME_SIZE];
+    pid_t pid;
+} result_fill_t;
+
+static pthread_mutex_t g_result_lock = PTHREAD_MUTEX_INITIALIZER;
+static result_entry_t **g_result_buckets;
+static size_t g_result_bucket_mask;
+static size_t g_result_capacity;            // 0: cache disabled
+static size_t g_result_count;
+static size_t g_result_bytes;
+static result_entry_t *g_result_newest;
+static result_entry_t *g_result_oldest;
+static unsigned long g_result_hits;
+static unsigned long g_result_misses;
+static unsigned long g_result_stored;
+static unsigned long g_result_evicted;
+static unsigned long g_result_uncacheable;  // Too large, or the child was not reaped
+
+/*
+ * Purpose:
+ *   Continues a 64-bit FNV-1a hash over a byte range.
+ * Receives:
+ *   hash: The hash so far.
+ *   data, length: The bytes.
+ * Returns:
+ *   The updated hash.
+ */
+static uint64_t fnv64(uint64_t hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV64_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * Purpose:
+ *   Hashes a NULL-terminated string array, including each terminating NUL so
+ *   that ("ab", "c") and ("a", "bc") differ.
+ * Receives:
+ *   strings: The array (may be NULL).
+ * Returns:
+ *   The hash.
+ */
+static uint64_t hash_strings(char *const strings[]) {
+    uint64_t hash = FNV64_OFFSET_BASIS;
+    for (size_t i = 0; strings != NULL && strings[i] != NULL; ++i) {
+        hash = fnv64(hash, strings[i], strlen(strings[i]) + 1);
+    }
+    return hash;
+}
+
+/*
+ * Purpose:
+ *   Hashes a key field by field (the struct may contain padding).
+ * Receives:
+ *   key: The key.
+ * Returns:
+ *   The hash.
+ */
+static uint64_t hash_key(const result_key_t *key) {
+    uint64_t hash = FNV64_OFFSET_BASIS;
+    hash = fnv64(hash, &key->dev, sizeof(key->dev));
+    hash = fnv64(hash, &key->ino, sizeof(key->ino));
+    hash = fnv64(hash, &key->size, sizeof(key->size));
+    hash = fnv64(hash, &key->mtime.tv_sec, sizeof(key->mtime.tv_sec));
+    hash = fnv64(hash, &key->mtime.tv_nsec, sizeof(key->mtime.tv_nsec));
+    hash = fnv64(hash, &key->env_hash, sizeof(key->env_hash));
+    return fnv64(hash, &key->argv_hash, sizeof(key->argv_hash));
+}
+
+/*
+ * Purpose:
+ *   Compares two keys field by field.
+ * Receives:
+ *   a, b: The keys.
+ * Returns:
+ *   true if they are equal.
+ */
+static bool same_key(const result_key_t *a, const result_key_t *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec &&
+           a->env_hash == b->env_hash && a->argv_hash == b->argv_hash;
+}
+
+/*
+ * Purpose:
+ *   Finds an entry. Caller holds the lock.
+ * Receives:
+ *   key:  The key.
+ *   hash: hash_key() of the key.
+ * Returns:
+ *   The entry, or NULL.
+ */
+static result_entry_t *find_entry(const result_key_t *key, uint64_t hash) {
+    result_entry_t *entry = g_result_buckets[hash & g_result_bucket_mask];
+    while (entry != NULL && (entry->hash != hash || !same_key(&entry->key, key))) {
+        entry = entry->chain;
+    }
+    return entry;
+}
+
+/*
+ * Purpose:
+ *   Removes an entry from the recency list. Caller holds the lock.
+ * Receives:
+ *   entry: The entry.
+ * Returns:
+ *   None (void).
+ */
+static void unlink_recency(result_entry_t *entry) {
+    if (entry->newer != NULL) entry->newer->older = entry->older; else g_result_newest = entry->older;
+    if (entry->older != NULL) entry->older->newer = entry->newer; else g_result_oldest = entry->newer;
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+/*
+ * Purpose:
+ *   Puts an entry at the front of the recency list. Caller holds the lock.
+ * Receives:
+ *   entry: The entry (not in the list).
+ * Returns:
+ *   None (void).
+ */
+static void push_newest(result_entry_t *entry) {
+    entry->older = g_result_newest;
+    entry->newer = NULL;
+    if (g_result_newest != NULL) g_result_newest->newer = entry; else g_result_oldest = entry;
+    g_result_newest = entry;
+}
+
+/*
+ * Purpose:
+ *   Removes and frees the least recently used entry. Caller holds the lock.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void evict_oldest(void) {
+    result_entry_t *entry = g_result_oldest;
+    if (entry == NULL) {
+        return;
+    }
+    unlink_recency(entry);
+    result_entry_t **link = &g_result_buckets[entry->hash & g_result_bucket_mask];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    g_result_count--;
+    g_result_bytes -= entry->length;
+    g_result_evicted++;
+    pmem_free(PMEM_CACHE, entry->output, entry->length > 0 ? entry->length : 1);
+    free(entry);
+}
+
+/*
+ * Purpose:
+ *   Inserts a result as the most recently used entry, evicting the least
+ *   recently used one if the cache is full. Caller holds the lock.
+ * Receives:
+ *   key, hash:   The key (not cached yet) and its hash.
+ *   result:      The recorded output (copied), exit status and source child.
+ * Returns:
+ *   true on success, false on allocation failure (nothing is changed).
+ */
+static bool insert_entry(const result_key_t *key, uint64_t hash, const result_cache_hit_t *result) {
+    const char *output = result->output;
+    size_t length = result->length;
+    result_entry_t *entry = malloc(sizeof(*entry));
+    if (entry == NULL || (entry->output = pmem_alloc(PMEM_CACHE, length > 0 ? length : 1)) == NULL) {
+        free(entry);
+        return false;
+    }
+    if (g_result_count == g_result_capacity) {
+        evict_oldest();
+    }
+    entry->key = *key;
+    entry->hash = hash;
+    memcpy(entry->output, output, length);
+    pmem_seal(entry->output, length);                   // Read-only from here on
+    entry->length = length;
+    entry->exit_code = result->exit_code;
+    entry->exit_status = result->exit_status;
+    memcpy(entry->source_name, result->source_name, sizeof(entry->source_name));
+    entry->source_pid = result->source_pid;
+    size_t bucket = hash & g_result_bucket_mask;
+    entry->chain = g_result_buckets[bucket];
+    g_result_buckets[bucket] = entry;
+    push_newest(entry);
+    g_result_count++;
+    g_result_bytes += length;
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Enables the cache.
+ * Receives:
+ *   capacity: Maximum number of results (1..RESULT_CACHE_MAX_ENTRIES).
+ * Returns:
+ *   0 on success, -1 on allocation failure (the cache stays disabled; an error
+ *   message is logged).
+ */
+int result_cache_init(size_t capacity) {
+    size_t buckets = 16;
+    while (buckets < capacity * 2) {
+        buckets *= 2;
+    }
+    g_result_buckets = pmem_alloc(PMEM_BUFFER, buckets * sizeof(*g_result_buckets));
+    if (g_result_buckets == NULL) {
+        plog_perror("Parent: Failed to allocate result cache");
+        return -1;
+    }
+    g_result_bucket_mask = buckets - 1;
+    g_result_capacity = capacity;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Tells whether the cache is enabled.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true after a successful result_cache_init().
+ */
+bool result_cache_enabled(void) {
+    return g_result_capacity > 0;
+}
+
+/*
+ * Purpose:
+ *   Builds the key of a launch.
+ * Receives:
+ *   key:       Receives the key.
+ *   exec_path: The child executable (stat'ed for its identity).
+ *   argv:      The child's NULL-terminated arguments; argv[0] is not hashed.
+ *   envp:      The child's NULL-terminated environment, in the order passed to
+ *              execve().
+ * Returns:
+ *   0 on success, -1 if the executable cannot be stat'ed (the launch is then
+ *   neither looked up nor recorded; no message is logged, execve() reports it).
+ */
+int result_key_make(result_key_t *key, const char *exec_path, char *const argv[], char *const envp[]) {
+    struct stat st;
+    if (stat(exec_path, &st) != 0) {
+        return -1;
+    }
+    memset(key, 0, sizeof(*key));
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime = st.st_mtim;
+    key->env_hash = hash_strings(envp);
+    key->argv_hash = hash_strings(argv != NULL && argv[0] != NULL ? argv + 1 : argv);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Looks up a recorded result and counts a hit or a miss.
+ * Receives:
+ *   key: The launch key.
+ *   hit: Receives a copy of the result on a hit.
+ * Returns:
+ *   true on a hit, false on a miss (or if the copy could not be allocated,
+ *   which is counted as a miss).
+ */
+bool result_cache_lookup(const result_key_t *key, result_cache_hit_t *hit) {
+    uint64_t hash = hash_key(key);
+    pthread_mutex_lock(&g_result_lock);
+    result_entry_t *entry = find_entry(key, hash);
+    char *output = entry != NULL ? malloc(entry->length > 0 ? entry->length : 1) : NULL;
+    if (output == NULL) {
+        g_result_misses++;
+        pthread_mutex_unlock(&g_result_lock);
+        return false;
+    }
+    memcpy(output, entry->output, entry->length);
+    hit->output = output;
+    hit->length = entry->length;
+    hit->exit_code = entry->exit_code;
+    hit->exit_status = entry->exit_status;
+    memcpy(hit->source_name, entry->source_name, sizeof(hit->source_name));
+    hit->source_pid = entry->source_pid;
+    unlink_recency(entry);
+    push_newest(entry);
+    g_result_hits++;
+    pthread_mutex_unlock(&g_result_lock);
+    return true;
+}
+
+/*
+ * Purpose:
+ *   Starts recording the result of a launch that missed.
+ * Receives:
+ *   key:        The launch key.
+ *   child_name: The launched child's name, shown when its result is replayed.
+ *   pid:        Its PID.
+ * Returns:
+ *   A context for result_cache_fill(), or NULL on allocation failure (the
+ *   result is then not recorded).
+ */
+void *result_cache_fill_begin(const result_key_t *key, const char *child_name, pid_t pid) {
+    result_fill_t *fill = malloc(sizeof(*fill));
+    if (fill != NULL) {
+        fill->key = *key;
+        snprintf(fill->child_name, sizeof(fill->child_name), "%s", child_name);
+        fill->pid = pid;
+    }
+    return fill;
+}
+
+/*
+ * Purpose:
+ *   Completes a recording: stores the result unless it is incomplete, and
+ *   frees the context. Called once per context, from an output reactor.
+ * Receives:
+ *   context:     The context from result_cache_fill_begin().
+ *   output:      Everything the child wrote (stdout and stderr, as forwarded).
+ *   length:      Its length.
+ *   complete:    false if the output was too large or the exit status is unknown.
+ *   exit_code:   CLD_EXITED, CLD_KILLED or CLD_DUMPED.
+ *   exit_status: Exit status or signal number.
+ * Returns:
+ *   None (void).
+ */
+void result_cache_fill(void *context, const char *output, size_t length, bool complete,
+                       int exit_code, int exit_status) {
+    result_fill_t *fill = context;
+    uint64_t hash = hash_key(&fill->key);
+
+    pthread_mutex_lock(&g_result_lock);
+    if (!complete) {
+        g_result_uncacheable++;
+    } else {
+        result_entry_t *entry = find_entry(&fill->key, hash);
+        if (entry != NULL) {
+            unlink_recency(entry);      // Recorded by an earlier launch of the same key
+            push_newest(entry);
+        } else {
+            result_cache_hit_t result = { (char *)output, length, exit_code, exit_status, { 0 }, fill->pid };
+            memcpy(result.source_name, fill->child_name, sizeof(result.source_name));
+            if (insert_entry(&fill->key, hash, &result)) {
+                g_result_stored++;
+            } else {
+                g_result_uncacheable++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_result_lock);
+    free(fill);
+}
+
+/*
+ * Purpose:
+ *   Hands every cached result to a callback, least recently used first, so
+ *   that importing them in the same order restores the recency (hot restart).
+ * Receives:
+ *   save:    Called once per result, with the lock held; the result is only
+ *            valid during the call.
+ *   context: Passed to save.
+ * Returns:
+ *   0 on success, -1 as soon as 'save' fails.
+ */
+int result_cache_export(result_cache_save_fn save, void *context) {
+    int result = 0;
+    pthread_mutex_lock(&g_result_lock);
+    for (result_entry_t *entry = g_result_oldest; entry != NULL && result == 0; entry = entry->newer) {
+        result_cache_hit_t view = { entry->output, entry->length, entry->exit_code, entry->exit_status,
+                                    { 0 }, entry->source_pid };
+        memcpy(view.source_name, entry->source_name, sizeof(view.source_name));
+        result = save(context, &entry->key, &view);
+    }
+    pthread_mutex_unlock(&g_result_lock);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Adds a result exported by a previous instance of the parent as the most
+ *   recently used entry. Results already cached are left as they are.
+ * Receives:
+ *   key:    The launch key.
+ *   result: The result (output copied).
+ * Returns:
+ *   0 on success, -1 if the cache is disabled or on allocation failure (no
+ *   message is logged).
+ */
+int result_cache_import(const result_key_t *key, const result_cache_hit_t *result) {
+    if (!result_cache_enabled()) {
+        return -1;
+    }
+    uint64_t hash = hash_key(key);
+    pthread_mutex_lock(&g_result_lock);
+    bool ok = find_entry(key, hash) != NULL ||
+              insert_entry(key, hash, result);
+    pthread_mutex_unlock(&g_result_lock);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Purpose:
+ *   Prints the hit and miss counts and the cache occupancy.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Prints nothing when the cache is disabled.
+ */
+void result_cache_print_stats(void) {
+    if (!result_cache_enabled()) {
+        return;
+    }
+    pthread_mutex_lock(&g_result_lock);
+    unsigned long lookups = g_result_hits + g_result_misses;
+    plog_out("Parent: Result cache: %lu hit(s), %lu miss(es) (%.1f%% hits); %zu of %zu entries, "
+             "%zu bytes; %lu stored, %lu evicted, %lu not cacheable.\n",
+             g_result_hits, g_result_misses, lookups > 0 ? 100.0 * (double)g_result_hits / (double)lookups : 0.0,
+             g_result_count, g_result_capacity, g_result_bytes, g_result_stored, g_result_evicted,
+             g_result_uncacheable);
+    pthread_mutex_unlock(&g_result_lock);
+}
+
+/*
+ * Purpose:
+ *   Frees all cached results. Called after the output reactors have stopped.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void result_cache_shutdown(void) {
+    while (g_result_oldest != NULL) {
+        evict_oldest();
+    }
+    pmem_free(PMEM_BUFFER, g_result_buckets, (g_result_bucket_mask + 1) * sizeof(*g_result_buckets));
+    g_result_buckets = NULL;
+    g_result_capacity = 0;
+}
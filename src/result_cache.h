@@ -0,0 +1,65 @@
+/*
+ * result_cache.h
+ *
+ * Description:
+ * Optional cache of child results (output and exit status) for children whose
+ * output depends only on their binary, arguments and environment. A result is
+ * keyed by the executable's identity (device, inode, size, modification time),
+ * a hash of the child's environment block and a hash of its arguments; argv[0]
+ * is left out, since it carries the per-child name ("child_NN"). On a hit the
+ * parent replays the recorded output instead of forking. The replayed text is
+ * that of the child that was recorded (its name, PID and timings included),
+ * so the entry keeps that child's name and PID and the replay is announced
+ * with a marker line naming them.
+ *
+ * The cache holds at most 'capacity' results and evicts the least recently
+ * used one; outputs above OUTPUT_RESULT_MAX_SIZE are not cached. Results are
+ * filled in by the output reactors (child_output.h) and looked up by the
+ * launching threads, so all operations take one mutex.
+ */
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define RESULT_CACHE_MAX_ENTRIES 65536
+#define RESULT_SOURCE_NAME_SIZE 40      /* Fits a child name (OUTPUT_NAME_SIZE) */
+
+typedef struct result_key_s {
+    dev_t dev;                  /* Executable identity */
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    uint64_t env_hash;          /* FNV-1a over the environment block */
+    uint64_t argv_hash;         /* FNV-1a over argv[1..] */
+} result_key_t;
+
+typedef struct result_cache_hit_s {
+    char *output;               /* Copy of the recorded output (free() it) */
+    size_t length;
+    int exit_code;              /* CLD_EXITED, CLD_KILLED or CLD_DUMPED */
+    int exit_status;            /* Exit status or signal number */
+    char source_name[RESULT_SOURCE_NAME_SIZE];  /* The child that was recorded */
+    pid_t source_pid;
+} result_cache_hit_t;
+
+/* Receives one cached result during result_cache_export(); returns 0 to go on. */
+typedef int (*result_cache_save_fn)(void *context, const result_key_t *key, const result_cache_hit_t *result);
+
+int result_cache_init(size_t capacity);
+bool result_cache_enabled(void);
+int result_key_make(result_key_t *key, const char *exec_path, char *const argv[], char *const envp[]);
+bool result_cache_lookup(const result_key_t *key, result_cache_hit_t *hit);
+void *result_cache_fill_begin(const result_key_t *key, const char *child_name, pid_t pid);
+void result_cache_fill(void *context, const char *output, size_t length, bool complete,
+                       int exit_code, int exit_status);
+int result_cache_export(result_cache_save_fn save, void *context);
+int result_cache_import(const result_key_t *key, const result_cache_hit_t *result);
+void result_cache_print_stats(void);
+void result_cache_shutdown(void);
+
+#endif /* RESULT_CACHE_H */
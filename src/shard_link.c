@@ -0,0 +1,184 @@
+/*
+ * shard_link.c
+ *
+ * Description:
+ * Implements the parent's connection to a shard router (see shard_link.h
+ * and shard_protocol.h).
+ */
+#define _GNU_SOURCE     // MSG_NOSIGNAL, SOCK_CLOEXEC
+
+#include "shard_link.h"
+#include "shard_protocol.h"
+#include "child_output.h"
+#include "launcher.h"
+#include "parent_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool g_shard_link_enabled;
+static int g_shard_link_null_fd = -1;   // /dev/null, standard input of children
+
+/*
+ * Purpose:
+ *   Sends a whole line to the router. A router that went away is noticed by
+ *   the command loop, which then reads end of file.
+ * Receives:
+ *   line:   The line.
+ *   length: Its length.
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+static int send_line(const char *line, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(STDIN_FILENO, line, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        line += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Connects to the shard router and makes the connection the parent's
+ *   standard input. After a hot restart the connection is already there and
+ *   the 'h' that caused the restart is acknowledged instead.
+ * Receives:
+ *   socket_path: The router's socket.
+ *   restarting:  true if this instance was started by a hot restart.
+ * Returns:
+ *   0 on success, -1 on failure (error logged).
+ */
+int shard_link_open(const char *socket_path, bool restarting) {
+    g_shard_link_null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (g_shard_link_null_fd < 0) {
+        plog_perror("Parent: Failed to open /dev/null");
+        return -1;
+    }
+    struct stat input;
+    if (restarting && fstat(STDIN_FILENO, &input) == 0 && S_ISSOCK(input.st_mode)) {
+        g_shard_link_enabled = true;
+        shard_link_ack();
+        return 0;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        plog_err("Parent: Shard router socket path '%s' is too long.\n", socket_path);
+        shard_link_close();
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        plog_perror("Parent: Failed to create shard router socket");
+        shard_link_close();
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *)&address, sizeof(address)) != 0) {
+        plog_perror("Parent: Failed to connect to shard router");
+        close(fd);
+        shard_link_close();
+        return -1;
+    }
+    // Standard input stays open across a hot restart's execve().
+    if (dup2(fd, STDIN_FILENO) < 0) {
+        plog_perror("Parent: Failed to read commands from shard router");
+        close(fd);
+        shard_link_close();
+        return -1;
+    }
+    close(fd);
+
+    char hello[64];
+    int length = snprintf(hello, sizeof(hello), SHARD_HELLO " %d\n", (int)getpid());
+    if (send_line(hello, (size_t)length) != 0) {
+        plog_perror("Parent: Failed to announce to shard router");
+        shard_link_close();
+        return -1;
+    }
+    g_shard_link_enabled = true;
+    plog_out("Parent: Reading commands from shard router '%s'.\n", socket_path);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Tells whether commands come from a shard router.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true after a successful shard_link_open().
+ */
+bool shard_link_enabled(void) {
+    return g_shard_link_enabled;
+}
+
+/*
+ * Purpose:
+ *   Returns the descriptor a forked child should use as standard input.
+ * Receives:
+ *   None.
+ * Returns:
+ *   /dev/null when commands come from a shard router, -1 otherwise (the
+ *   child keeps the parent's standard input).
+ */
+int shard_link_child_stdin(void) {
+    return g_shard_link_enabled ? g_shard_link_null_fd : -1;
+}
+
+/*
+ * Purpose:
+ *   Acknowledges the command just carried out, with the parent's load and
+ *   the child ids it has left.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Does nothing without a shard router.
+ */
+void shard_link_ack(void) {
+    if (!g_shard_link_enabled) {
+        return;
+    }
+    unsigned long launched;
+    unsigned long failed;
+    launcher_counts(&launched, &failed);
+    int next_id = launcher_next_child_id();
+    char ack[96];
+    int length = snprintf(ack, sizeof(ack), "%c %lu %lu %zu %d\n", SHARD_ACK, launched, failed,
+                          output_running_children(), next_id < SHARD_MAX_CHILDREN ? SHARD_MAX_CHILDREN - next_id : 0);
+    if (send_line(ack, (size_t)length) != 0) {
+        plog_perror("Parent: Failed to acknowledge command to shard router");
+    }
+}
+
+/*
+ * Purpose:
+ *   Releases the link's /dev/null descriptor. Standard input itself is left
+ *   to the process exit.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void shard_link_close(void) {
+    if (g_shard_link_null_fd >= 0) {
+        close(g_shard_link_null_fd);
+        g_shard_link_null_fd = -1;
+    }
+    g_shard_link_enabled = false;
+}
@@ -0,0 +1,25 @@
+/*
+ * shard_link.h
+ *
+ * Description:
+ * Parent side of a sharded deployment (-S, see shard_protocol.h). The parent
+ * connects to the shard router's Unix socket, announces its PID and moves
+ * the connection onto standard input, so the command loop reads the
+ * router's commands like typed ones. After each command the parent sends an
+ * acknowledgement with its load. Children get /dev/null as standard input
+ * rather than the connection, so a shard that exits closes it even while
+ * its children run. After a hot restart the new instance finds the
+ * connection still on standard input and keeps using it.
+ */
+#ifndef SHARD_LINK_H
+#define SHARD_LINK_H
+
+#include <stdbool.h>
+
+int shard_link_open(const char *socket_path, bool restarting);
+bool shard_link_enabled(void);
+int shard_link_child_stdin(void);
+void shard_link_ack(void);
+void shard_link_close(void);
+
+#endif /* SHARD_LINK_H */
@@ -0,0 +1,38 @@
+/*
+ * shard_protocol.h
+ *
+ * Description:
+ * Line protocol between a shard router (shard_router.c) and the parent
+ * instances behind it, over a Unix stream socket. A parent started with
+ * '-S <socket>' connects to the router, announces itself and then reads its
+ * commands from the connection instead of the terminal:
+ *
+ *   parent -> router:  "hello <pid>\n"                  once, on connect
+ *   router -> parent:  any parent command line ("+ 4\n", "v NAME=VALUE\n", ...),
+ *                      or "?\n", which only asks for an acknowledgement
+ *   parent -> router:  "= <launched> <failed> <running> <ids_left>\n"
+ *                      after every command line, in order
+ *
+ * The acknowledgement tells the router that the command was carried out and
+ * how loaded the parent is: children launched and failed since it started,
+ * captured children still running, and how many of its SHARD_MAX_CHILDREN
+ * child ids are left. A launch line never asks for more children than that.
+ *
+ * A command that is not acknowledged when the connection closes may have
+ * been carried out in part: a parent that dies in the middle of a launch has
+ * already forked some of its children. The router sends unacknowledged
+ * launches to another parent in full, so re-routed launches run at least
+ * once, not exactly once. A hot restart ('h') keeps the connection; the new
+ * instance acknowledges the 'h'.
+ */
+#ifndef SHARD_PROTOCOL_H
+#define SHARD_PROTOCOL_H
+
+#define SHARD_HELLO "hello"
+#define SHARD_PROBE '?'
+#define SHARD_ACK '='
+#define SHARD_MAX_CHILDREN 10000    /* Child ids a parent hands out (its MAX_CHILDREN) */
+#define SHARD_LINE_SIZE 4352    /* Longest line either side reads: a parent command line
+                                   (up to 4096 bytes) plus a launch key */
+
+#endif /* SHARD_PROTOCOL_H */
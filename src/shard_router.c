@@ -0,0 +1,1057 @@
+/*
+ * shard_router.c
+ *
+ * Description:
+ * Local front end for several parent instances (shards). Parents started
+ * with '-S <socket>' connect to the router's Unix socket (shard_protocol.h);
+ * the router reads the parent command protocol on its standard input and
+ * passes every command on:
+ *
+ * - Launches ('+', '*', '&' [count] [key]) go to one shard. With consistent
+ *   hashing (-b hash, default) the key picks the shard on a ring of virtual
+ *   nodes, so a key keeps its shard while shards join and leave, except for
+ *   keys of a shard that left. Without a key the request number is used.
+ *   With -b least the shard with the fewest running and requested children
+ *   gets the launch.
+ * - 'v' and 'u' go to every shard, and are replayed to shards that join
+ *   later, so all shards launch with the same environment. 'e' and 'h' go to
+ *   every shard.
+ * - 's' probes every shard and prints their loads and the totals once all
+ *   have answered.
+ * - 'd <pid>' drains a shard: it gets no new launches, and once it has
+ *   acknowledged everything sent to it, it is told to quit.
+ * - 'q' (or end of file) drains every shard and exits.
+ *
+ * Shard connections are non-blocking: what is sent to a shard goes through
+ * its output queue, written out as the socket accepts it, so a shard that
+ * reads slowly never stalls the router or the other shards. A shard whose
+ * queue holds more than ROUTER_OUTPUT_LIMIT bytes gets no new launches until
+ * it catches up, and neither does one without enough child ids left (its
+ * acknowledgements report them; see SHARD_MAX_CHILDREN).
+ *
+ * Every command sent to a shard stays queued until the shard acknowledges
+ * it. When a shard's connection closes, its unacknowledged commands are sent
+ * to the remaining shards (launches), or dropped (broadcasts, which the
+ * other shards got themselves). Launches wait in a backlog while no shard is
+ * available, so shards can join and leave without losing requests. A shard
+ * that died in the middle of a launch may have forked part of it; the
+ * launch is re-sent in full, so re-routing is at least once, not exactly
+ * once.
+ *
+ * Usage: shard_router [-b hash|least] <socket_path>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "shard_protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define ROUTER_MAX_SHARDS 64
+#define ROUTER_VIRTUAL_NODES 64     // Ring points per shard
+#define ROUTER_KEY_SIZE 128
+#define ROUTER_ENV_SIZE 256         // Remembered 'v'/'u' commands (one per variable)
+#define ROUTER_OUTPUT_LIMIT (64u * SHARD_LINE_SIZE)     // Queued bytes above which a shard gets no launches
+
+typedef enum router_request_kind_e {
+    ROUTER_LAUNCH,                  // Goes to one shard; re-routed if unacknowledged
+    ROUTER_BROADCAST,               // Sent to every shard
+    ROUTER_PROBE,                   // Status probe for 's'
+    ROUTER_QUIT                     // Ends a drained shard
+} router_request_kind_t;
+
+typedef struct router_request_s {
+    router_request_kind_t kind;
+    unsigned long count;            // Children requested (launches)
+    char key[ROUTER_KEY_SIZE];      // Routing key (launches)
+    char line[SHARD_LINE_SIZE];     // Line sent, newline included
+} router_request_t;
+
+/* FIFO of requests (ring buffer, grows as needed). */
+typedef struct request_queue_s {
+    router_request_t **items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} request_queue_t;
+
+/* Bytes read from a descriptor, up to the end of the last complete line. */
+typedef struct line_buffer_s {
+    char data[SHARD_LINE_SIZE];
+    size_t used;
+    bool overflow;                  // Current line is too long and is skipped
+} line_buffer_t;
+
+typedef struct router_shard_s {
+    int fd;
+    pid_t pid;                      // From the hello; 0 until it arrives
+    bool draining;                  // No new launches; quit once idle
+    bool quit_sent;
+    bool broken;                    // Sending failed; closed by the main loop
+    line_buffer_t input;
+    char *output;                   // Bytes not yet accepted by the socket
+    size_t output_used;
+    size_t output_capacity;
+    request_queue_t sent;           // Unacknowledged requests, oldest first
+    unsigned long launched;         // From the last acknowledgement
+    unsigned long failed;
+    unsigned long running;
+    unsigned long ids_left;         // Child ids left, from the last acknowledgement
+    unsigned long requested;        // Children in unacknowledged launches
+} router_shard_t;
+
+typedef struct ring_point_s {
+    uint64_t hash;
+    router_shard_t *shard;
+} ring_point_t;
+
+static bool g_router_least_loaded;
+static router_shard_t *g_router_shards[ROUTER_MAX_SHARDS];
+static size_t g_router_shard_count;
+static ring_point_t g_router_ring[ROUTER_MAX_SHARDS * ROUTER_VIRTUAL_NODES];
+static size_t g_router_ring_size;
+static request_queue_t g_router_backlog;        // Launches waiting for a shard
+static char *g_router_env[ROUTER_ENV_SIZE];     // 'v'/'u' lines, replayed on join
+static size_t g_router_env_count;
+static unsigned long g_router_requests;         // Launch requests received
+static size_t g_router_probes_waiting;          // Probes of the current 's'
+static bool g_router_quitting;
+static volatile sig_atomic_t g_router_signal;
+
+/*
+ * Purpose:
+ *   64-bit FNV-1a hash.
+ * Receives:
+ *   text: NUL-terminated string.
+ * Returns:
+ *   The hash.
+ */
+static uint64_t hash_text(const char *text) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *text != '\0'; ++text) {
+        hash ^= (unsigned char)*text;
+        hash *= 1099511628211ULL;
+    }
+    // FNV-1a spreads short, similar keys poorly in the high bits; finish with a mix.
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/*
+ * Purpose:
+ *   Appends a request to a queue, or puts it first.
+ * Receives:
+ *   queue:   The queue.
+ *   request: The request (owned by the queue afterwards).
+ *   front:   true to put it first.
+ * Returns:
+ *   0 on success, -1 if the queue could not grow (error printed).
+ */
+static int queue_push(request_queue_t *queue, router_request_t *request, bool front) {
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity > 0 ? queue->capacity * 2 : 16;
+        router_request_t **items = malloc(capacity * sizeof(*items));
+        if (items == NULL) {
+            perror("Router: Failed to grow request queue");
+            return -1;
+        }
+        for (size_t i = 0; i < queue->count; ++i) {
+            items[i] = queue->items[(queue->head + i) % queue->capacity];
+        }
+        free(queue->items);
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    if (front) {
+        queue->head = (queue->head + queue->capacity - 1) % queue->capacity;
+        queue->items[queue->head] = request;
+    } else {
+        queue->items[(queue->head + queue->count) % queue->capacity] = request;
+    }
+    queue->count++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Removes the oldest request of a queue.
+ * Receives:
+ *   queue: The queue.
+ * Returns:
+ *   The request (caller owns it), or NULL if the queue is empty.
+ */
+static router_request_t *queue_pop(request_queue_t *queue) {
+    if (queue->count == 0) {
+        return NULL;
+    }
+    router_request_t *request = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return request;
+}
+
+/*
+ * Purpose:
+ *   Removes the newest request of a queue.
+ * Receives:
+ *   queue: The queue.
+ * Returns:
+ *   The request (caller owns it), or NULL if the queue is empty.
+ */
+static router_request_t *queue_pop_back(request_queue_t *queue) {
+    if (queue->count == 0) {
+        return NULL;
+    }
+    queue->count--;
+    return queue->items[(queue->head + queue->count) % queue->capacity];
+}
+
+/*
+ * Purpose:
+ *   Creates a request.
+ * Receives:
+ *   kind:  The request kind.
+ *   line:  Line to send, without its newline.
+ *   count: Children requested (launches).
+ *   key:   Routing key, or NULL.
+ * Returns:
+ *   The request, or NULL if allocation failed (error printed).
+ */
+static router_request_t *new_request(router_request_kind_t kind, const char *line, unsigned long count,
+                                     const char *key) {
+    router_request_t *request = calloc(1, sizeof(*request));
+    if (request == NULL) {
+        perror("Router: Failed to allocate request");
+        return NULL;
+    }
+    request->kind = kind;
+    request->count = count;
+    snprintf(request->key, sizeof(request->key), "%s", key != NULL ? key : "");
+    snprintf(request->line, sizeof(request->line), "%s\n", line);
+    return request;
+}
+
+/*
+ * Purpose:
+ *   Tells whether a shard takes new launches.
+ * Receives:
+ *   shard: The shard.
+ * Returns:
+ *   true if it has announced itself and is neither draining nor broken.
+ */
+static bool shard_active(const router_shard_t *shard) {
+    return shard->pid > 0 && !shard->draining && !shard->broken;
+}
+
+/*
+ * Purpose:
+ *   qsort() comparison for ring points.
+ * Receives:
+ *   a, b: Pointers to ring_point_t.
+ * Returns:
+ *   <0, 0 or >0.
+ */
+static int compare_points(const void *a, const void *b) {
+    const ring_point_t *x = a;
+    const ring_point_t *y = b;
+    return x->hash < y->hash ? -1 : x->hash > y->hash ? 1 : 0;
+}
+
+/*
+ * Purpose:
+ *   Rebuilds the hash ring from the active shards. A shard's points depend
+ *   only on its PID, so the other shards keep their keys when one joins or
+ *   leaves.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void rebuild_ring(void) {
+    g_router_ring_size = 0;
+    for (size_t i = 0; i < g_router_shard_count; ++i) {
+        router_shard_t *shard = g_router_shards[i];
+        if (!shard_active(shard)) {
+            continue;
+        }
+        for (int node = 0; node < ROUTER_VIRTUAL_NODES; ++node) {
+            char name[32];
+            snprintf(name, sizeof(name), "%d#%d", (int)shard->pid, node);
+            g_router_ring[g_router_ring_size].hash = hash_text(name);
+            g_router_ring[g_router_ring_size].shard = shard;
+            g_router_ring_size++;
+        }
+    }
+    qsort(g_router_ring, g_router_ring_size, sizeof(g_router_ring[0]), compare_points);
+}
+
+/*
+ * Purpose:
+ *   Tells whether a shard has child ids left for a launch, counting the
+ *   launches it has not acknowledged yet.
+ * Receives:
+ *   shard:   The shard.
+ *   request: The launch.
+ * Returns:
+ *   true if the shard can carry it out.
+ */
+static bool shard_has_ids(const router_shard_t *shard, const router_request_t *request) {
+    return shard->requested <= shard->ids_left && request->count <= shard->ids_left - shard->requested;
+}
+
+/*
+ * Purpose:
+ *   Picks the shard for a launch. Shards without enough child ids left are
+ *   passed over; with hashing, the next shard on the ring gets the key.
+ * Receives:
+ *   request: The launch.
+ * Returns:
+ *   The shard, or NULL if no shard can take it now: none is active with
+ *   enough ids, or the chosen one has a full output queue (the launch then
+ *   waits, so launches keep their order).
+ */
+static router_shard_t *pick_shard(const router_request_t *request) {
+    if (g_router_least_loaded) {
+        router_shard_t *best = NULL;
+        for (size_t i = 0; i < g_router_shard_count; ++i) {
+            router_shard_t *shard = g_router_shards[i];
+            if (shard_active(shard) && shard_has_ids(shard, request) && shard->output_used < ROUTER_OUTPUT_LIMIT &&
+                (best == NULL || shard->running + shard->requested < best->running + best->requested)) {
+                best = shard;
+            }
+        }
+        return best;
+    }
+    if (g_router_ring_size == 0) {
+        return NULL;
+    }
+    // First point at or after the key's hash, wrapping around.
+    uint64_t hash = hash_text(request->key);
+    size_t low = 0;
+    size_t high = g_router_ring_size;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (g_router_ring[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (size_t step = 0; step < g_router_ring_size; ++step) {
+        router_shard_t *shard = g_router_ring[(low + step) % g_router_ring_size].shard;
+        if (shard_has_ids(shard, request)) {
+            return shard->output_used < ROUTER_OUTPUT_LIMIT ? shard : NULL;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Writes as much of a shard's output queue as its socket accepts without
+ *   blocking. A shard whose connection fails is marked broken.
+ * Receives:
+ *   shard: The shard.
+ * Returns:
+ *   None (void).
+ */
+static void flush_output(router_shard_t *shard) {
+    size_t written = 0;
+    while (written < shard->output_used && !shard->broken) {
+        ssize_t sent = send(shard->fd, shard->output + written, shard->output_used - written, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;      // Rest goes out on POLLOUT
+        }
+        if (sent <= 0) {
+            shard->broken = true;
+            break;
+        }
+        written += (size_t)sent;
+    }
+    shard->output_used -= written;
+    memmove(shard->output, shard->output + written, shard->output_used);
+}
+
+/*
+ * Purpose:
+ *   Appends a line to a shard's output queue and sends what the socket takes.
+ * Receives:
+ *   shard:  The shard.
+ *   line:   The line, newline included.
+ * Returns:
+ *   None (void). If the queue cannot grow the shard is marked broken, so its
+ *   unacknowledged launches are re-routed.
+ */
+static void queue_output(router_shard_t *shard, const char *line) {
+    size_t length = strlen(line);
+    if (shard->output_used + length > shard->output_capacity) {
+        size_t capacity = shard->output_capacity > 0 ? shard->output_capacity : SHARD_LINE_SIZE;
+        while (capacity < shard->output_used + length) {
+            capacity *= 2;
+        }
+        char *output = realloc(shard->output, capacity);
+        if (output == NULL) {
+            perror("Router: Failed to grow shard output queue");
+            shard->broken = true;
+            return;
+        }
+        shard->output = output;
+        shard->output_capacity = capacity;
+    }
+    memcpy(shard->output + shard->output_used, line, length);
+    shard->output_used += length;
+    flush_output(shard);
+}
+
+/*
+ * Purpose:
+ *   Sends a request to a shard (through its output queue) and keeps it until
+ *   acknowledged. A shard whose connection fails is marked broken; the main
+ *   loop then closes it and re-routes what it had not acknowledged, this
+ *   request included.
+ * Receives:
+ *   shard:   The shard.
+ *   request: The request (owned by the shard afterwards).
+ * Returns:
+ *   None (void).
+ */
+static void send_request(router_shard_t *shard, router_request_t *request) {
+    if (queue_push(&shard->sent, request, false) != 0) {
+        free(request);
+        return;
+    }
+    if (request->kind == ROUTER_LAUNCH) {
+        shard->requested += request->count;
+    }
+    if (!shard->broken) {
+        queue_output(shard, request->line);
+    }
+}
+
+/*
+ * Purpose:
+ *   Sends waiting launches to shards, and tells drained shards to quit.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void dispatch(void) {
+    while (g_router_backlog.count > 0) {
+        router_shard_t *shard = pick_shard(g_router_backlog.items[g_router_backlog.head]);
+        if (shard == NULL) {
+            break;
+        }
+        send_request(shard, queue_pop(&g_router_backlog));
+    }
+    for (size_t i = 0; i < g_router_shard_count; ++i) {
+        router_shard_t *shard = g_router_shards[i];
+        if (shard->draining && !shard->quit_sent && shard->sent.count == 0 && shard->pid > 0) {
+            router_request_t *quit = new_request(ROUTER_QUIT, "q", 0, NULL);
+            if (quit != NULL) {
+                shard->quit_sent = true;
+                printf("Router: Shard PID %d drained; asking it to quit.\n", (int)shard->pid);
+                send_request(shard, quit);
+            }
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Sends a copy of a line to every shard that has announced itself.
+ * Receives:
+ *   kind: ROUTER_BROADCAST or ROUTER_PROBE.
+ *   line: The line, without its newline.
+ * Returns:
+ *   The number of shards it was sent to.
+ */
+static size_t broadcast(router_request_kind_t kind, const char *line) {
+    size_t sent = 0;
+    for (size_t i = 0; i < g_router_shard_count; ++i) {
+        router_shard_t *shard = g_router_shards[i];
+        if (shard->pid <= 0 || shard->broken || shard->quit_sent) {
+            continue;
+        }
+        router_request_t *request = new_request(kind, line, 0, NULL);
+        if (request != NULL) {
+            send_request(shard, request);
+            sent++;
+        }
+    }
+    return sent;
+}
+
+/*
+ * Purpose:
+ *   Prints every shard's load and the totals ('s').
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void print_stats(void) {
+    unsigned long launched = 0;
+    unsigned long failed = 0;
+    unsigned long running = 0;
+    for (size_t i = 0; i < g_router_shard_count; ++i) {
+        const router_shard_t *shard = g_router_shards[i];
+        if (shard->pid <= 0) {
+            continue;
+        }
+        printf("Router:   shard PID %d: %lu launched, %lu failed, %lu running, %zu unacknowledged, "
+               "%lu child id(s) left%s.\n", (int)shard->pid, shard->launched, shard->failed, shard->running,
+               shard->sent.count, shard->ids_left, shard->draining ? " (draining)" : "");
+        launched += shard->launched;
+        failed += shard->failed;
+        running += shard->running;
+    }
+    printf("Router: %zu shard(s) (%s): %lu launched, %lu failed, %lu running; "
+           "%lu launch request(s) received, %zu waiting for a shard.\n",
+           g_router_shard_count, g_router_least_loaded ? "least loaded" : "consistent hashing",
+           launched, failed, running, g_router_requests, g_router_backlog.count);
+    fflush(stdout);
+}
+
+/*
+ * Purpose:
+ *   Handles a line from a shard: its hello or an acknowledgement.
+ * Receives:
+ *   shard: The shard.
+ *   line:  The line, without its newline.
+ * Returns:
+ *   None (void).
+ */
+static void handle_shard_line(router_shard_t *shard, const char *line) {
+    int pid;
+    unsigned long launched;
+    unsigned long failed;
+    unsigned long running;
+    unsigned long ids_left;
+    int fields;
+    if (shard->pid == 0 && sscanf(line, SHARD_HELLO " %d", &pid) == 1 && pid > 0) {
+        shard->pid = pid;
+        // The shard gets the environment changes it missed before any launch.
+        for (size_t i = 0; i < g_router_env_count; ++i) {
+            router_request_t *request = new_request(ROUTER_BROADCAST, g_router_env[i], 0, NULL);
+            if (request != NULL) {
+                send_request(shard, request);
+            }
+        }
+        rebuild_ring();
+        printf("Router: Shard PID %d joined (%zu shard(s)).\n", pid, g_router_shard_count);
+        fflush(stdout);
+    } else if (line[0] == SHARD_ACK &&
+               (fields = sscanf(line + 1, "%lu %lu %lu %lu", &launched, &failed, &running, &ids_left)) >= 3) {
+        shard->launched = launched;
+        shard->failed = failed;
+        shard->running = running;
+        if (fields == 4) {
+            shard->ids_left = ids_left;
+        }
+        router_request_t *request = queue_pop(&shard->sent);
+        if (request == NULL) {
+            fprintf(stderr, "Router: Unexpected acknowledgement from shard PID %d.\n", (int)shard->pid);
+            return;
+        }
+        if (request->kind == ROUTER_LAUNCH) {
+            shard->requested -= request->count;
+        } else if (request->kind == ROUTER_PROBE && g_router_probes_waiting > 0 &&
+                   --g_router_probes_waiting == 0) {
+            print_stats();
+        }
+        free(request);
+    } else {
+        fprintf(stderr, "Router: Ignoring line from shard PID %d: '%s'.\n", (int)shard->pid, line);
+    }
+}
+
+/*
+ * Purpose:
+ *   Closes a shard's connection and removes it. Launches it had not
+ *   acknowledged go back to the front of the backlog, in order and in full,
+ *   even if the shard forked part of one before it died; other requests are
+ *   dropped.
+ * Receives:
+ *   index: The shard's index in g_router_shards.
+ * Returns:
+ *   None (void).
+ */
+static void remove_shard(size_t index) {
+    router_shard_t *shard = g_router_shards[index];
+    size_t rerouted = 0;
+    router_request_t *request;
+    while ((request = queue_pop_back(&shard->sent)) != NULL) {
+        if (request->kind == ROUTER_LAUNCH && queue_push(&g_router_backlog, request, true) == 0) {
+            rerouted++;
+            continue;
+        }
+        if (request->kind == ROUTER_PROBE && g_router_probes_waiting > 0 && --g_router_probes_waiting == 0) {
+            print_stats();
+        }
+        free(request);
+    }
+    close(shard->fd);
+    free(shard->output);
+    free(shard->sent.items);
+    g_router_shards[index] = g_router_shards[--g_router_shard_count];
+    if (shard->pid > 0) {
+        printf("Router: Shard PID %d left (%zu shard(s)); %zu launch request(s) re-routed.\n",
+               (int)shard->pid, g_router_shard_count, rerouted);
+        fflush(stdout);
+    }
+    free(shard);
+    rebuild_ring();
+    if (g_router_probes_waiting > 0 && g_router_shard_count == 0) {
+        g_router_probes_waiting = 0;
+        print_stats();
+    }
+}
+
+/*
+ * Purpose:
+ *   Reads what a descriptor has and passes each complete line on. Lines
+ *   longer than the buffer are skipped with a message.
+ * Receives:
+ *   fd:      The descriptor.
+ *   buffer:  Its line buffer.
+ *   handle:  Called with each line (without newline) and context.
+ *   context: Passed to handle.
+ * Returns:
+ *   1 if data was read, 0 at end of file, -1 on error.
+ */
+static int read_lines(int fd, line_buffer_t *buffer, void (*handle)(void *, char *), void *context) {
+    ssize_t got = read(fd, buffer->data + buffer->used, sizeof(buffer->data) - 1 - buffer->used);
+    if (got < 0) {
+        return errno == EINTR || errno == EAGAIN ? 1 : -1;
+    }
+    if (got == 0) {
+        return 0;
+    }
+    buffer->used += (size_t)got;
+    char *start = buffer->data;
+    char *newline;
+    while ((newline = memchr(start, '\n', buffer->used - (size_t)(start - buffer->data))) != NULL) {
+        *newline = '\0';
+        if (buffer->overflow) {
+            buffer->overflow = false;
+        } else {
+            handle(context, start);
+        }
+        start = newline + 1;
+    }
+    buffer->used -= (size_t)(start - buffer->data);
+    memmove(buffer->data, start, buffer->used);
+    if (buffer->used == sizeof(buffer->data) - 1) {
+        if (!buffer->overflow) {
+            fprintf(stderr, "Router: Line too long (at most %d characters); skipped.\n", SHARD_LINE_SIZE - 2);
+        }
+        buffer->overflow = true;
+        buffer->used = 0;
+    }
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   read_lines() callback for a shard connection.
+ * Receives:
+ *   context: The router_shard_t.
+ *   line:    The line.
+ * Returns:
+ *   None (void).
+ */
+static void shard_line(void *context, char *line) {
+    handle_shard_line(context, line);
+}
+
+/*
+ * Purpose:
+ *   Remembers a 'v' or 'u' line for shards that join later, replacing an
+ *   earlier one for the same variable.
+ * Receives:
+ *   line: The command line.
+ * Returns:
+ *   None (void).
+ */
+static void remember_env(const char *line) {
+    const char *name = line + 1;
+    while (*name == ' ' || *name == '\t') {
+        name++;
+    }
+    size_t name_length = strcspn(name, "= \t");
+    size_t slot = g_router_env_count;
+    for (size_t i = 0; i < g_router_env_count; ++i) {
+        const char *other = g_router_env[i] + 1;
+        while (*other == ' ' || *other == '\t') {
+            other++;
+        }
+        if (strcspn(other, "= \t") == name_length && strncmp(other, name, name_length) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == ROUTER_ENV_SIZE) {
+        fprintf(stderr, "Router: Too many environment changes to replay to joining shards.\n");
+        return;
+    }
+    char *copy = strdup(line);
+    if (copy == NULL) {
+        perror("Router: Failed to remember environment change");
+        return;
+    }
+    if (slot == g_router_env_count) {
+        g_router_env_count++;
+    } else {
+        free(g_router_env[slot]);
+    }
+    g_router_env[slot] = copy;
+}
+
+/*
+ * Purpose:
+ *   Starts draining every shard; the router exits once all have left.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void start_quitting(void) {
+    g_router_quitting = true;
+    for (size_t i = 0; i < g_router_shard_count; ++i) {
+        g_router_shards[i]->draining = true;
+    }
+    rebuild_ring();
+    if (g_router_backlog.count > 0) {
+        fprintf(stderr, "Router: %zu launch request(s) never reached a shard.\n", g_router_backlog.count);
+    }
+    printf("Router: Quitting once every shard has finished its requests.\n");
+    fflush(stdout);
+}
+
+/*
+ * Purpose:
+ *   Handles a command line from standard input (see the file comment).
+ * Receives:
+ *   context: Unused.
+ *   line:    The line.
+ * Returns:
+ *   None (void).
+ */
+static void command_line(void *context, char *line) {
+    (void)context;
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (*line == '\0') {
+        return;
+    }
+    char command = *line;
+    switch (command) {
+        case '+':
+        case '*':
+        case '&': {
+            char *end = NULL;
+            long count = strtol(line + 1, &end, 10);
+            if (end == line + 1) {
+                count = 1;
+            } else if (count < 1 || count > SHARD_MAX_CHILDREN) {
+                fprintf(stderr, "Router: Invalid launch count in '%s' (1..%d).\n", line, SHARD_MAX_CHILDREN);
+                return;
+            }
+            while (*end == ' ' || *end == '\t') {
+                end++;
+            }
+            char key[ROUTER_KEY_SIZE];
+            g_router_requests++;
+            if (*end != '\0') {
+                snprintf(key, sizeof(key), "%s", end);
+            } else {
+                snprintf(key, sizeof(key), "#%lu", g_router_requests);
+            }
+            char forwarded[32];
+            snprintf(forwarded, sizeof(forwarded), "%c %ld", command, count);
+            router_request_t *request = new_request(ROUTER_LAUNCH, forwarded, (unsigned long)count, key);
+            if (request != NULL && queue_push(&g_router_backlog, request, false) != 0) {
+                free(request);
+            }
+            if (g_router_ring_size == 0 && !g_router_least_loaded) {
+                printf("Router: No shard available; the launch waits for one.\n");
+            }
+            break;
+        }
+        case 'v':
+        case 'u':
+            remember_env(line);
+            broadcast(ROUTER_BROADCAST, line);
+            break;
+        case 'e':
+        case 'h':
+            broadcast(ROUTER_BROADCAST, line);
+            break;
+        case 's': {
+            char probe[2] = { SHARD_PROBE, '\0' };
+            g_router_probes_waiting = broadcast(ROUTER_PROBE, probe);
+            if (g_router_probes_waiting == 0) {
+                print_stats();
+            }
+            break;
+        }
+        case 'd': {
+            char *end = NULL;
+            long pid = strtol(line + 1, &end, 10);
+            size_t i = 0;
+            while (i < g_router_shard_count && (g_router_shards[i]->pid != pid || pid <= 0)) {
+                i++;
+            }
+            if (i == g_router_shard_count) {
+                fprintf(stderr, "Router: No shard with PID '%s'.\n", line + 1);
+                return;
+            }
+            g_router_shards[i]->draining = true;
+            rebuild_ring();
+            printf("Router: Draining shard PID %ld.\n", pid);
+            break;
+        }
+        case 'q':
+        case 'Q':
+            start_quitting();
+            break;
+        default:
+            fprintf(stderr, "Router: Unknown command '%c'. Use +, *, & [count] [key], v, u, e, h, s, d <pid> or q.\n",
+                    command);
+            break;
+    }
+    fflush(stdout);
+}
+
+/*
+ * Purpose:
+ *   Records SIGINT/SIGTERM for the main loop.
+ * Receives:
+ *   signum: The signal.
+ * Returns:
+ *   None (void).
+ */
+static void handle_signal(int signum) {
+    g_router_signal = signum;
+}
+
+/*
+ * Purpose:
+ *   Creates the listening socket, replacing a stale socket file.
+ * Receives:
+ *   path: The socket path.
+ * Returns:
+ *   The listening descriptor, or -1 on failure (error printed).
+ */
+static int listen_on(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Router: Socket path '%s' is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Router: Failed to create socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (const struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        perror("Router: Failed to listen on socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Purpose:
+ *   Accepts a shard connection. It takes launches once it has said hello.
+ * Receives:
+ *   listen_fd: The listening socket.
+ * Returns:
+ *   None (void).
+ */
+static void accept_shard(int listen_fd) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        if (errno != EINTR) perror("Router: Failed to accept shard");
+        return;
+    }
+    router_shard_t *shard = calloc(1, sizeof(*shard));
+    if (g_router_shard_count == ROUTER_MAX_SHARDS || shard == NULL) {
+        fprintf(stderr, "Router: Refusing shard (at most %d).\n", ROUTER_MAX_SHARDS);
+        free(shard);
+        close(fd);
+        return;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        perror("Router: Failed to make shard connection non-blocking");
+        free(shard);
+        close(fd);
+        return;
+    }
+    shard->fd = fd;
+    shard->ids_left = SHARD_MAX_CHILDREN;       // Until its first acknowledgement says otherwise
+    g_router_shards[g_router_shard_count++] = shard;
+}
+
+/*
+ * Purpose:
+ *   Prints usage instructions to the standard error stream.
+ * Receives:
+ *   prog_name: The name of the executable.
+ * Returns:
+ *   None (void).
+ */
+static void print_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s [-b hash|least] <socket_path>\n", prog_name ? prog_name : "shard_router");
+    fprintf(stderr, "  -b hash|least: Route launches by consistent hashing on their key (default)\n");
+    fprintf(stderr, "                 or to the least loaded shard.\n");
+    fprintf(stderr, "  Start shards with: parent -S <socket_path> ... <environment_filter_file>\n");
+    fprintf(stderr, "  Commands: + * & [count] [key], v NAME=VALUE, u NAME, e, h [binary], s, d <pid>, q\n");
+}
+
+/*
+ * Purpose:
+ *   Runs the router until 'q' (or end of file, or a signal) and every shard
+ *   has left.
+ * Receives:
+ *   argc, argv: Command line (see print_usage()).
+ * Returns:
+ *   EXIT_SUCCESS, or EXIT_FAILURE on a usage or socket error.
+ */
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "b:")) != -1) {
+        if (option == 'b' && strcmp(optarg, "hash") == 0) {
+            g_router_least_loaded = false;
+        } else if (option == 'b' && strcmp(optarg, "least") == 0) {
+            g_router_least_loaded = true;
+        } else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *socket_path = argv[optind];
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int listen_fd = listen_on(socket_path);
+    if (listen_fd < 0) {
+        return EXIT_FAILURE;
+    }
+    printf("Router PID: %d, listening on '%s'.\n", getpid(), socket_path);
+    fflush(stdout);
+
+    line_buffer_t input = { .used = 0, .overflow = false };
+    bool input_open = true;
+    struct pollfd fds[ROUTER_MAX_SHARDS + 2];
+    while (!g_router_quitting || g_router_shard_count > 0) {
+        if (g_router_signal != 0 && !g_router_quitting) {
+            printf("Router: Signal %d received.\n", (int)g_router_signal);
+            start_quitting();
+        }
+        dispatch();
+        for (size_t i = 0; i < g_router_shard_count;) {
+            if (g_router_shards[i]->broken) {
+                remove_shard(i);    // The last shard moves into slot i
+            } else {
+                ++i;
+            }
+        }
+        if (g_router_quitting && g_router_shard_count == 0) {
+            break;
+        }
+
+        nfds_t count = 0;
+        fds[count++] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+        fds[count++] = (struct pollfd){ .fd = input_open && !g_router_quitting ? STDIN_FILENO : -1,
+                                        .events = POLLIN };
+        for (size_t i = 0; i < g_router_shard_count; ++i) {
+            short events = POLLIN;
+            if (g_router_shards[i]->output_used > 0) {
+                events |= POLLOUT;
+            }
+            fds[count++] = (struct pollfd){ .fd = g_router_shards[i]->fd, .events = events };
+        }
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Router: poll() failed");
+            break;
+        }
+
+        // Shards first: their slots shift when one is removed, so walk backwards.
+        for (size_t i = g_router_shard_count; i-- > 0;) {
+            if (fds[2 + i].revents == 0) {
+                continue;
+            }
+            router_shard_t *shard = g_router_shards[i];
+            if (fds[2 + i].revents & POLLOUT) {
+                flush_output(shard);    // A failure marks it broken; removed on the next pass
+            }
+            if ((fds[2 + i].revents & ~POLLOUT) != 0 && read_lines(shard->fd, &shard->input, shard_line, shard) <= 0) {
+                remove_shard(i);
+            }
+        }
+        if (fds[1].revents != 0) {
+            int rc = read_lines(STDIN_FILENO, &input, command_line, NULL);
+            if (rc <= 0) {
+                input_open = false;
+                if (!g_router_quitting) {
+                    printf("Router: End of commands.\n");
+                    start_quitting();
+                }
+            }
+        }
+        if (fds[0].revents != 0) {
+            accept_shard(listen_fd);
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+    router_request_t *request;
+    while ((request = queue_pop(&g_router_backlog)) != NULL) {
+        free(request);
+    }
+    free(g_router_backlog.items);
+    for (size_t i = 0; i < g_router_env_count; ++i) {
+        free(g_router_env[i]);
+    }
+    printf("Router: Exiting.\n");
+    return EXIT_SUCCESS;
+}
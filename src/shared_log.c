@@ -0,0 +1,373 @@
+/*
+ * shared_log.c
+ *
+ * Description:
+ * Implements the shared append log described in shared_log.h. Writers never
+ * take a lock: a record is reserved by a compare-and-swap of its length field
+ * at the cursor from 0, so the length is visible the moment the space is
+ * taken, and the cursor is then moved past it. A writer that finds the slot
+ * already claimed moves the cursor on for the owner and tries again, so a
+ * writer that dies anywhere after its claim neither blocks other writers nor
+ * hides later records from readers; its record just stays WRITING. The state
+ * becomes COMMITTED only after the payload is in place. The writer whose
+ * reservation would run past the end of the file claims the remaining tail
+ * as PADDING instead, so readers stop cleanly at the end of the log.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "shared_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHARED_LOG_DATA_OFFSET 64u
+
+_Static_assert(sizeof(shared_log_header_t) <= SHARED_LOG_DATA_OFFSET,
+               "shared log header must fit before the first record");
+_Static_assert(sizeof(shared_log_record_t) % SHARED_LOG_ALIGN == 0,
+               "shared log record header must keep payloads aligned");
+
+/*
+ * Purpose:
+ *   Rounds a size up to the record alignment.
+ * Receives:
+ *   size: Size in bytes.
+ * Returns:
+ *   'size' rounded up to a multiple of SHARED_LOG_ALIGN.
+ */
+static uint64_t align_record(uint64_t size) {
+    return (size + SHARED_LOG_ALIGN - 1) & ~(uint64_t)(SHARED_LOG_ALIGN - 1);
+}
+
+/*
+ * Purpose:
+ *   Returns the current wall-clock time in nanoseconds.
+ * Receives:
+ *   None.
+ * Returns:
+ *   Nanoseconds since the epoch, or 0 if the clock cannot be read.
+ */
+static uint64_t realtime_ns(void) {
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) != 0) {
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Creates a new, empty log file with all of its blocks allocated up front, so
+ *   writers never fault on a hole in the file.
+ * Receives:
+ *   path:       Path of the file to create; an existing file is replaced.
+ *   capacity:   Total file size in bytes.
+ *   generation: Generation number stored in the header.
+ * Returns:
+ *   0 on success, -1 on failure (an error message is printed).
+ */
+int shared_log_create(const char *path, uint64_t capacity, uint64_t generation) {
+    if (capacity < SHARED_LOG_DATA_OFFSET + sizeof(shared_log_record_t) || capacity > (uint64_t)SIZE_MAX) {
+        fprintf(stderr, "Parent: Invalid shared log capacity %llu\n", (unsigned long long)capacity);
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Parent: Failed to create shared log");
+        return -1;
+    }
+    int rc = posix_fallocate(fd, 0, (off_t)capacity);
+    if (rc != 0 && ftruncate(fd, (off_t)capacity) != 0) {
+        perror("Parent: Failed to size shared log");
+        close(fd);
+        return -1;
+    }
+
+    shared_log_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SHARED_LOG_MAGIC;
+    header.version = SHARED_LOG_VERSION;
+    header.capacity = capacity;
+    header.data_offset = SHARED_LOG_DATA_OFFSET;
+    header.generation = generation;
+    atomic_init(&header.cursor, SHARED_LOG_DATA_OFFSET);
+
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        perror("Parent: Failed to write shared log header");
+        close(fd);
+        return -1;
+    }
+    if (close(fd) != 0) {
+        perror("Parent: Failed to close shared log");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Opens and maps an existing log and validates its header.
+ * Receives:
+ *   log:      Handle to fill in.
+ *   path:     Path of the log file.
+ *   writable: true to map the file for appending, false for read-only access.
+ * Returns:
+ *   0 on success, -1 on failure (errno is set; EINVAL for a malformed file).
+ *   Nothing is printed so callers can choose how to report the failure.
+ */
+int shared_log_open(shared_log_t *log, const char *path, bool writable) {
+    log->fd = -1;
+    log->header = NULL;
+    log->mapped_size = 0;
+
+    int fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    if ((uint64_t)st.st_size < SHARED_LOG_DATA_OFFSET || (uint64_t)st.st_size > (uint64_t)SIZE_MAX) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    shared_log_header_t *header = map;
+    if (header->magic != SHARED_LOG_MAGIC || header->version != SHARED_LOG_VERSION ||
+        header->capacity != (uint64_t)size || header->data_offset != SHARED_LOG_DATA_OFFSET) {
+        munmap(map, size);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    log->fd = fd;
+    log->header = header;
+    log->mapped_size = size;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Unmaps and closes a log handle. Safe to call on a handle that failed to
+ *   open or was already closed.
+ * Receives:
+ *   log: Handle to close.
+ * Returns:
+ *   None.
+ */
+void shared_log_close(shared_log_t *log) {
+    if (log->header != NULL) {
+        munmap(log->header, log->mapped_size);
+        log->header = NULL;
+    }
+    if (log->fd != -1) {
+        close(log->fd);
+        log->fd = -1;
+    }
+    log->mapped_size = 0;
+}
+
+/*
+ * Purpose:
+ *   Appends one record. Safe to call concurrently from any number of processes
+ *   mapping the same file.
+ * Receives:
+ *   log:         Handle opened with writable == true.
+ *   pid:         PID stored in the record.
+ *   payload:     Bytes to store.
+ *   payload_len: Number of bytes in 'payload'.
+ * Returns:
+ *   0 on success, -1 if the record does not fit (errno = ENOSPC) or is too
+ *   large to be represented (errno = EMSGSIZE).
+ */
+int shared_log_append(shared_log_t *log, int32_t pid, const void *payload, size_t payload_len) {
+    shared_log_header_t *header = log->header;
+    uint64_t length = align_record(sizeof(shared_log_record_t) + (uint64_t)payload_len);
+    if (payload_len > UINT32_MAX || length > UINT32_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    uint64_t capacity = header->capacity;
+    uint64_t offset = atomic_load_explicit(&header->cursor, memory_order_acquire);
+    shared_log_record_t *record;
+    for (;;) {
+        if (offset >= capacity) {
+            errno = ENOSPC;
+            return -1;
+        }
+        uint64_t claim = offset + length <= capacity ? length : capacity - offset;
+        if (offset + sizeof(shared_log_record_t) > capacity) {
+            /* A tail too short for a record header: readers stop before it. */
+            atomic_compare_exchange_strong_explicit(&header->cursor, &offset, capacity,
+                                                    memory_order_acq_rel, memory_order_acquire);
+            continue;
+        }
+        record = (shared_log_record_t *)((char *)header + offset);
+        uint32_t seen = 0;
+        if (atomic_compare_exchange_strong_explicit(&record->length, &seen, (uint32_t)claim,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            /* Claimed. Move the cursor past it unless another writer already did. */
+            uint64_t expected = offset;
+            atomic_compare_exchange_strong_explicit(&header->cursor, &expected, offset + claim,
+                                                    memory_order_acq_rel, memory_order_acquire);
+            if (claim == length) {
+                break;
+            }
+            atomic_store_explicit(&record->state, SHARED_LOG_STATE_PADDING, memory_order_release);
+            errno = ENOSPC;
+            return -1;
+        }
+        /* Another writer claimed this offset: help it move the cursor, then retry. */
+        uint64_t expected = offset;
+        if (atomic_compare_exchange_strong_explicit(&header->cursor, &expected, offset + seen,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            offset += seen;
+        } else {
+            offset = expected;
+        }
+    }
+
+    record->pid = pid;
+    record->payload_len = (uint32_t)payload_len;
+    record->timestamp_ns = realtime_ns();
+    memcpy(record + 1, payload, payload_len);
+    atomic_store_explicit(&record->state, SHARED_LOG_STATE_COMMITTED, memory_order_release);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reports how many bytes of the log have been reserved so far.
+ * Receives:
+ *   log: Open handle.
+ * Returns:
+ *   Reserved bytes including the header, capped at the capacity.
+ */
+uint64_t shared_log_used(const shared_log_t *log) {
+    uint64_t cursor = atomic_load_explicit(&log->header->cursor, memory_order_relaxed);
+    return cursor < log->header->capacity ? cursor : log->header->capacity;
+}
+
+/*
+ * Purpose:
+ *   Steps to the next record of the log. A record's length is published by
+ *   the reservation itself, so the walk follows the lengths rather than the
+ *   cursor: records that are still being written (or whose writer died) are
+ *   skipped and reported, and an unclaimed slot (length 0) ends the walk so
+ *   the caller can retry later from the same offset.
+ * Receives:
+ *   log:    Open handle.
+ *   offset: In/out walk position; start at 0 for the beginning of the log.
+ *   entry:  Filled in when SHARED_LOG_WALK_RECORD is returned.
+ * Returns:
+ *   SHARED_LOG_WALK_RECORD, SHARED_LOG_WALK_PENDING or SHARED_LOG_WALK_END.
+ */
+shared_log_walk_t shared_log_next(const shared_log_t *log, uint64_t *offset, shared_log_entry_t *entry) {
+    const shared_log_header_t *header = log->header;
+    uint64_t capacity = header->capacity;
+    uint64_t pos = *offset < header->data_offset ? header->data_offset : *offset;
+
+    while (pos + sizeof(shared_log_record_t) <= capacity) {
+        shared_log_record_t *record = (shared_log_record_t *)((char *)header + pos);
+        uint32_t length = atomic_load_explicit(&record->length, memory_order_acquire);
+        if (length == 0 || length % SHARED_LOG_ALIGN != 0 || pos + length > capacity) {
+            break;
+        }
+        uint32_t state = atomic_load_explicit(&record->state, memory_order_acquire);
+        *offset = pos + length;
+        if (state == SHARED_LOG_STATE_COMMITTED) {
+            entry->pid = record->pid;
+            entry->timestamp_ns = record->timestamp_ns;
+            entry->payload = (const char *)(record + 1);
+            entry->payload_len = record->payload_len;
+            return SHARED_LOG_WALK_RECORD;
+        }
+        if (state == SHARED_LOG_STATE_WRITING) {
+            return SHARED_LOG_WALK_PENDING;
+        }
+        pos += length;    /* Padding */
+    }
+    *offset = pos;
+    return SHARED_LOG_WALK_END;
+}
+
+/*
+ * Purpose:
+ *   Replaces the log at 'path' with a fresh one without ever leaving the path
+ *   missing: the new file is prepared under a temporary name, older generations
+ *   are shifted (<path>.1 -> <path>.2 ...), the current file is hard-linked to
+ *   <path>.1 and the new file is renamed over 'path' atomically. Writers that
+ *   already mapped the old file keep appending to it; new writers open the new
+ *   one.
+ * Receives:
+ *   path:     Path of the active log.
+ *   capacity: Capacity of the new log.
+ * Returns:
+ *   0 on success, -1 on failure (an error message is printed; the active log
+ *   is left in place).
+ */
+int shared_log_rotate(const char *path, uint64_t capacity) {
+    size_t path_len = strlen(path);
+    if (path_len + 16 > PATH_MAX) {
+        fprintf(stderr, "Parent: Shared log path too long\n");
+        return -1;
+    }
+    char tmp_path[PATH_MAX];
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    uint64_t generation = 0;
+    shared_log_t current;
+    if (shared_log_open(&current, path, false) == 0) {
+        generation = current.header->generation + 1;
+        shared_log_close(&current);
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (shared_log_create(tmp_path, capacity, generation) != 0) {
+        return -1;
+    }
+
+    for (int keep = SHARED_LOG_KEEP - 1; keep >= 1; --keep) {
+        snprintf(from, sizeof(from), "%s.%d", path, keep);
+        snprintf(to, sizeof(to), "%s.%d", path, keep + 1);
+        if (rename(from, to) != 0 && errno != ENOENT) {
+            perror("Parent: Failed to shift rotated shared log");
+        }
+    }
+    snprintf(to, sizeof(to), "%s.1", path);
+    if (unlink(to) != 0 && errno != ENOENT) {
+        perror("Parent: Failed to remove rotated shared log");
+    }
+    if (link(path, to) != 0 && errno != ENOENT) {
+        perror("Parent: Failed to keep rotated shared log");
+    }
+    if (rename(tmp_path, path) != 0) {
+        perror("Parent: Failed to install new shared log");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * shared_log.h
+ *
+ * Description:
+ * Shared append log that children write their reports into directly, without
+ * routing the bytes through the parent. The log is a preallocated file mapped
+ * with MAP_SHARED by every participant. Its header holds an atomic write cursor:
+ * a writer reserves space for a record by swapping the record's length in at
+ * the cursor (compare-and-swap from 0) and advancing the cursor, fills it in
+ * and then publishes it by storing the record's state with release semantics.
+ * Readers can therefore walk the log while writers are still active, and a
+ * writer that dies mid-record leaves a skippable record, not a gap. The parent only
+ * creates the file and rotates it when it fills up.
+ *
+ * File layout: [shared_log_header_t][record][record]... where every record is
+ * a shared_log_record_t followed by its payload, padded to 8 bytes.
+ */
+#ifndef SHARED_LOG_H
+#define SHARED_LOG_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHARED_LOG_MAGIC 0x474C4853u    /* "SHLG" */
+#define SHARED_LOG_VERSION 1u
+#define SHARED_LOG_ALIGN 8u
+#define SHARED_LOG_DEFAULT_CAPACITY (16u * 1024u * 1024u)
+#define SHARED_LOG_KEEP 3               /* Rotated generations kept as <path>.1 .. <path>.N */
+
+/* Name of the environment variable that tells a child where the log is. */
+#define ENV_VAR_SHARED_LOG_NAME "CHILD_SHARED_LOG"
+
+enum {
+    SHARED_LOG_STATE_WRITING = 0,       /* Reserved, payload not complete yet. */
+    SHARED_LOG_STATE_COMMITTED = 1,     /* Payload complete and readable. */
+    SHARED_LOG_STATE_PADDING = 2        /* Unused tail left by a writer that did not fit. */
+};
+
+typedef struct shared_log_header_s {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;          /* Size of the whole file in bytes. */
+    uint64_t data_offset;       /* Offset of the first record. */
+    uint64_t generation;        /* Incremented by every rotation. */
+    _Atomic uint64_t cursor;    /* Offset of the next free byte, at most capacity; may lag one claimed record. */
+} shared_log_header_t;
+
+typedef struct shared_log_record_s {
+    _Atomic uint32_t length;    /* Total record size incl. header and padding; 0 until claimed. */
+    _Atomic uint32_t state;     /* SHARED_LOG_STATE_* */
+    int32_t pid;                /* Writer's PID. */
+    uint32_t payload_len;
+    uint64_t timestamp_ns;      /* CLOCK_REALTIME at reservation. */
+} shared_log_record_t;
+
+typedef struct shared_log_s {
+    int fd;
+    shared_log_header_t *header;
+    size_t mapped_size;
+} shared_log_t;
+
+typedef struct shared_log_entry_s {
+    int32_t pid;
+    uint64_t timestamp_ns;
+    const char *payload;
+    uint32_t payload_len;
+} shared_log_entry_t;
+
+typedef enum shared_log_walk_e {
+    SHARED_LOG_WALK_END = 0,        /* No further records (yet). */
+    SHARED_LOG_WALK_RECORD = 1,     /* 'entry' holds a committed record. */
+    SHARED_LOG_WALK_PENDING = 2     /* Skipped a record that is still being written. */
+} shared_log_walk_t;
+
+int shared_log_create(const char *path, uint64_t capacity, uint64_t generation);
+int shared_log_open(shared_log_t *log, const char *path, bool writable);
+void shared_log_close(shared_log_t *log);
+int shared_log_append(shared_log_t *log, int32_t pid, const void *payload, size_t payload_len);
+uint64_t shared_log_used(const shared_log_t *log);
+shared_log_walk_t shared_log_next(const shared_log_t *log, uint64_t *offset, shared_log_entry_t *entry);
+int shared_log_rotate(const char *path, uint64_t capacity);
+
+#endif /* SHARED_LOG_H */
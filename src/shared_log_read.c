@@ -0,0 +1,180 @@
+/*
+ * shared_log_read.c
+ *
+ * Description:
+ * Reader for the shared append log written by the children (see shared_log.h).
+ * Prints every committed record with its writer's PID and timestamp. The log
+ * is only mapped read-only, so the reader can run while the parent and its
+ * children are still writing. With -f it keeps following the log, waits for
+ * records that are still being written, and switches to the new file after
+ * the parent rotated the log. Binary child reports (child_report.h) are
+ * decoded and printed as text.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "shared_log.h"
+#include "child_report.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define POLL_INTERVAL_NS 100000000L    /* 100 ms between polls in follow mode */
+#define PENDING_GIVE_UP_POLLS 20       /* Skip a record still unfinished after ~2 s (writer died) */
+
+/*
+ * Purpose:
+ *   Prints one record: a header line with PID and timestamp, then the payload
+ *   (rendered as text if it is a binary child report), terminated by a newline
+ *   if the payload does not end with one.
+ * Receives:
+ *   entry: Committed record.
+ * Returns:
+ *   0 on success, -1 on a write error.
+ */
+static int print_entry(const shared_log_entry_t *entry) {
+    if (printf("--- pid %d @ %llu.%09llu (%u bytes)\n", (int)entry->pid,
+               (unsigned long long)(entry->timestamp_ns / 1000000000u),
+               (unsigned long long)(entry->timestamp_ns % 1000000000u),
+               (unsigned)entry->payload_len) < 0) {
+        return -1;
+    }
+    child_report_t report;
+    if (child_report_frame_length(entry->payload, entry->payload_len) == (long)entry->payload_len &&
+        child_report_decode(entry->payload, entry->payload_len, &report) == 0) {
+        return child_report_render(stdout, &report);
+    }
+    if (fwrite(entry->payload, 1, entry->payload_len, stdout) != entry->payload_len) {
+        return -1;
+    }
+    if (entry->payload_len > 0 && entry->payload[entry->payload_len - 1] != '\n') {
+        if (putchar('\n') == EOF) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Checks whether 'path' now names a different file than the open log, which
+ *   means the parent rotated it.
+ * Receives:
+ *   log:  Open handle.
+ *   path: Path of the active log.
+ * Returns:
+ *   true if the path refers to another file, false otherwise.
+ */
+static bool log_was_rotated(const shared_log_t *log, const char *path) {
+    struct stat open_st;
+    struct stat path_st;
+    if (fstat(log->fd, &open_st) != 0 || stat(path, &path_st) != 0) {
+        return false;
+    }
+    return open_st.st_ino != path_st.st_ino || open_st.st_dev != path_st.st_dev;
+}
+
+/*
+ * Purpose:
+ *   Entry point: shared_log_read [-f] <log file>.
+ * Receives:
+ *   argc, argv: Command-line arguments.
+ * Returns:
+ *   EXIT_SUCCESS, or EXIT_FAILURE if the log cannot be opened or printed.
+ */
+int main(int argc, char *argv[]) {
+    bool follow = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        if (opt == 'f') {
+            follow = true;
+        } else {
+            fprintf(stderr, "Usage: %s [-f] <shared log file>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-f] <shared log file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *path = argv[optind];
+
+    shared_log_t log;
+    if (shared_log_open(&log, path, false) != 0) {
+        fprintf(stderr, "Reader: Failed to open shared log '%s': %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    uint64_t offset = log.header->data_offset;
+    int pending_polls = 0;
+    const struct timespec interval = {0, POLL_INTERVAL_NS};
+
+    for (;;) {
+        shared_log_entry_t entry;
+        uint64_t record_start = offset;
+        shared_log_walk_t step = shared_log_next(&log, &offset, &entry);
+
+        if (step == SHARED_LOG_WALK_RECORD) {
+            pending_polls = 0;
+            if (print_entry(&entry) != 0) {
+                perror("Reader: Failed to print record");
+                shared_log_close(&log);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (step == SHARED_LOG_WALK_PENDING) {
+            if (!follow) {
+                printf("--- record at offset %llu still being written, skipped\n",
+                       (unsigned long long)record_start);
+                continue;
+            }
+            if (++pending_polls < PENDING_GIVE_UP_POLLS) {
+                offset = record_start;    /* Retry the same record after the next poll. */
+            } else {
+                printf("--- record at offset %llu never completed, skipped\n",
+                       (unsigned long long)record_start);
+                pending_polls = 0;
+                continue;
+            }
+        }
+        if (!follow) {
+            break;
+        }
+
+        fflush(stdout);
+        if (step == SHARED_LOG_WALK_END && log_was_rotated(&log, path)) {
+            /* Children that opened the old file before the rotation may still
+             * be finishing a record; give them one more poll before leaving. */
+            nanosleep(&interval, NULL);
+            while (shared_log_next(&log, &offset, &entry) == SHARED_LOG_WALK_RECORD) {
+                if (print_entry(&entry) != 0) {
+                    perror("Reader: Failed to print record");
+                    shared_log_close(&log);
+                    return EXIT_FAILURE;
+                }
+            }
+            shared_log_close(&log);
+            if (shared_log_open(&log, path, false) != 0) {
+                fprintf(stderr, "Reader: Failed to reopen shared log '%s': %s\n", path, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            printf("--- log rotated (generation %llu)\n", (unsigned long long)log.header->generation);
+            offset = log.header->data_offset;
+            pending_polls = 0;
+            continue;
+        }
+        nanosleep(&interval, NULL);
+    }
+
+    shared_log_close(&log);
+    if (fflush(stdout) != 0) {
+        perror("Reader: Failed to flush output");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
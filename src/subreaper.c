@@ -0,0 +1,429 @@
+/*
+ * subreaper.c
+ *
+ * Description:
+ * Implements subreaper mode (see subreaper.h). Launches are kept in a small
+ * hash table keyed by PID, which is also the process group of their
+ * descendants. A zombie is found with waitid(WNOWAIT) before it is reaped, so
+ * its process group can still be read and a child that the reactor watches
+ * through its pidfd is left alone. The resource usage of a reaped process
+ * comes from the raw waitid() system call, which fills in a struct rusage.
+ */
+#define _GNU_SOURCE     // syscall(), signalfd()
+
+#include "subreaper.h"
+#include "child_output.h"
+#include "parent_log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SUBREAPER_BUCKETS 1024
+
+/* A launched child whose process group may still have members. */
+typedef struct subreaper_launch_s {
+    pid_t pid;                          // Also the process group of its descendants
+    int child_id;
+    char name[OUTPUT_NAME_SIZE];
+    bool exited;                        // The child itself was reaped
+    bool unwatched;                     // Its exit could not be watched: reaped here
+    unsigned descendants;               // Descendants reaped so far
+    struct rusage self;                 // The child's own usage
+    struct rusage others;               // Sum over its descendants
+    struct subreaper_launch_s *next;    // Bucket chain
+} subreaper_launch_t;
+
+static bool g_subreaper_enabled;
+static int g_subreaper_fd = -1;
+static pthread_mutex_t g_subreaper_lock = PTHREAD_MUTEX_INITIALIZER;   // Guards everything below
+static subreaper_launch_t *g_subreaper_buckets[SUBREAPER_BUCKETS];
+static size_t g_subreaper_tracked;
+static unsigned g_subreaper_forking;    // fork() calls not followed by subreaper_launched() yet
+static unsigned long g_subreaper_attributed;
+static unsigned long g_subreaper_unattributed;
+static unsigned long g_subreaper_reported;
+
+/*
+ * Purpose:
+ *   Makes the parent a child subreaper and routes SIGCHLD to a signalfd.
+ *   Must be called before any other thread is started, so that every thread
+ *   inherits the blocked SIGCHLD.
+ * Receives:
+ *   None.
+ * Returns:
+ *   0 on success, -1 on failure (error logged; the mode stays off).
+ */
+int subreaper_enable(void) {
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1L, 0L, 0L, 0L) != 0) {
+        plog_perror("Parent: Failed to become a child subreaper");
+        return -1;
+    }
+    sigset_t child_signal;
+    sigemptyset(&child_signal);
+    sigaddset(&child_signal, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &child_signal, NULL) != 0 ||
+        (g_subreaper_fd = signalfd(-1, &child_signal, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        plog_perror("Parent: Failed to create SIGCHLD signalfd");
+        sigprocmask(SIG_UNBLOCK, &child_signal, NULL);
+        prctl(PR_SET_CHILD_SUBREAPER, 0L, 0L, 0L, 0L);
+        return -1;
+    }
+    g_subreaper_enabled = true;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Tells whether subreaper mode is on.
+ * Receives:
+ *   None.
+ * Returns:
+ *   true after a successful subreaper_enable().
+ */
+bool subreaper_enabled(void) {
+    return g_subreaper_enabled;
+}
+
+/*
+ * Purpose:
+ *   Returns the SIGCHLD signalfd, for the reactor to wait on.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The descriptor, or -1 when the mode is off.
+ */
+int subreaper_signal_fd(void) {
+    return g_subreaper_fd;
+}
+
+/*
+ * Purpose:
+ *   Finds the launch of a process group. Caller holds the lock.
+ * Receives:
+ *   pid: The launched child's PID (process group), or -1.
+ * Returns:
+ *   The launch, or NULL if it is not tracked.
+ */
+static subreaper_launch_t *find_launch(pid_t pid) {
+    if (pid <= 0) {
+        return NULL;
+    }
+    subreaper_launch_t *launch = g_subreaper_buckets[(unsigned)pid % SUBREAPER_BUCKETS];
+    while (launch != NULL && launch->pid != pid) {
+        launch = launch->next;
+    }
+    return launch;
+}
+
+/*
+ * Purpose:
+ *   Adds one process's usage to a sum: times and counters add up, the
+ *   maximum resident set size is the largest one.
+ * Receives:
+ *   sum:   The sum.
+ *   usage: The process's usage.
+ * Returns:
+ *   None (void).
+ */
+static void add_usage(struct rusage *sum, const struct rusage *usage) {
+    sum->ru_utime.tv_sec += usage->ru_utime.tv_sec;
+    sum->ru_utime.tv_usec += usage->ru_utime.tv_usec;
+    sum->ru_stime.tv_sec += usage->ru_stime.tv_sec;
+    sum->ru_stime.tv_usec += usage->ru_stime.tv_usec;
+    sum->ru_utime.tv_sec += sum->ru_utime.tv_usec / 1000000;
+    sum->ru_utime.tv_usec %= 1000000;
+    sum->ru_stime.tv_sec += sum->ru_stime.tv_usec / 1000000;
+    sum->ru_stime.tv_usec %= 1000000;
+    if (usage->ru_maxrss > sum->ru_maxrss) {
+        sum->ru_maxrss = usage->ru_maxrss;
+    }
+    sum->ru_minflt += usage->ru_minflt;
+    sum->ru_majflt += usage->ru_majflt;
+    sum->ru_nvcsw += usage->ru_nvcsw;
+    sum->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/*
+ * Purpose:
+ *   Converts a timeval to seconds.
+ * Receives:
+ *   time: The timeval.
+ * Returns:
+ *   Seconds.
+ */
+static double seconds(const struct timeval *time) {
+    return (double)time->tv_sec + (double)time->tv_usec / 1e6;
+}
+
+/*
+ * Purpose:
+ *   Reports and forgets a launch once the child has been reaped and no
+ *   process is left in its process group. Caller holds the lock.
+ * Receives:
+ *   launch: The launch.
+ * Returns:
+ *   None (void).
+ */
+static void finish_if_done(subreaper_launch_t *launch) {
+    if (!launch->exited || kill(-launch->pid, 0) == 0 || errno != ESRCH) {
+        return;
+    }
+    if (launch->descendants > 0) {
+        g_subreaper_reported++;
+        plog_out("Parent: Child '%s' and %u descendant(s) finished: %.3f s user, %.3f s system "
+                 "(descendants %.3f s user, %.3f s system), max RSS %ld KiB.\n",
+                 launch->name, launch->descendants,
+                 seconds(&launch->self.ru_utime) + seconds(&launch->others.ru_utime),
+                 seconds(&launch->self.ru_stime) + seconds(&launch->others.ru_stime),
+                 seconds(&launch->others.ru_utime), seconds(&launch->others.ru_stime),
+                 launch->self.ru_maxrss > launch->others.ru_maxrss ? launch->self.ru_maxrss
+                                                                    : launch->others.ru_maxrss);
+        plog_write_pending();       // Called on the reactor thread
+    }
+    subreaper_launch_t **link = &g_subreaper_buckets[(unsigned)launch->pid % SUBREAPER_BUCKETS];
+    while (*link != launch) {
+        link = &(*link)->next;
+    }
+    *link = launch->next;
+    g_subreaper_tracked--;
+    free(launch);
+}
+
+/*
+ * Purpose:
+ *   Announces a fork(). Until the matching subreaper_launched(), a zombie
+ *   leading its own process group may be the new child, so it is not reaped
+ *   as a descendant. Any thread.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Does nothing when the mode is off.
+ */
+void subreaper_forking(void) {
+    if (!g_subreaper_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&g_subreaper_lock);
+    g_subreaper_forking++;
+    pthread_mutex_unlock(&g_subreaper_lock);
+}
+
+/*
+ * Purpose:
+ *   Starts tracking a launched child, right after fork() and before its exit
+ *   can be watched. Any thread.
+ * Receives:
+ *   pid:      The child's PID (and process group), or -1 if fork() failed.
+ *   child_id: The child's number.
+ *   name:     The child's name ("child_NN").
+ * Returns:
+ *   None (void). Does nothing when the mode is off; on allocation failure
+ *   the child's descendants are reaped but not attributed (error logged).
+ */
+void subreaper_launched(pid_t pid, int child_id, const char *name) {
+    if (!g_subreaper_enabled) {
+        return;
+    }
+    subreaper_launch_t *launch = pid > 0 ? calloc(1, sizeof(*launch)) : NULL;
+    if (pid > 0 && launch == NULL) {
+        plog_perror("Parent: Failed to allocate descendant accounting");
+    }
+    if (launch != NULL) {
+        launch->pid = pid;
+        launch->child_id = child_id;
+        snprintf(launch->name, sizeof(launch->name), "%s", name);
+    }
+    pthread_mutex_lock(&g_subreaper_lock);
+    if (launch != NULL) {
+        subreaper_launch_t **bucket = &g_subreaper_buckets[(unsigned)pid % SUBREAPER_BUCKETS];
+        launch->next = *bucket;
+        *bucket = launch;
+        g_subreaper_tracked++;
+    }
+    g_subreaper_forking--;
+    pthread_mutex_unlock(&g_subreaper_lock);
+}
+
+/*
+ * Purpose:
+ *   Notes that a launched child's exit could not be watched through its
+ *   pidfd, so the subreaper reaps it like a descendant.
+ * Receives:
+ *   pid: The child's PID.
+ * Returns:
+ *   None (void).
+ */
+void subreaper_unwatched(pid_t pid) {
+    pthread_mutex_lock(&g_subreaper_lock);
+    subreaper_launch_t *launch = find_launch(pid);
+    if (launch != NULL) {
+        launch->unwatched = true;
+    }
+    pthread_mutex_unlock(&g_subreaper_lock);
+}
+
+/*
+ * Purpose:
+ *   Records the usage of a launched child reaped by the reactor.
+ * Receives:
+ *   pid:   The child's PID.
+ *   usage: Its resource usage.
+ * Returns:
+ *   None (void).
+ */
+void subreaper_child_exited(pid_t pid, const struct rusage *usage) {
+    pthread_mutex_lock(&g_subreaper_lock);
+    subreaper_launch_t *launch = find_launch(pid);
+    if (launch != NULL) {
+        launch->self = *usage;
+        launch->exited = true;
+        finish_if_done(launch);
+    }
+    pthread_mutex_unlock(&g_subreaper_lock);
+}
+
+/*
+ * Purpose:
+ *   Reaps every exited descendant and adds its usage to its launch. Stops at
+ *   the first zombie that is a launched child: it is reaped through its pidfd
+ *   (possibly once its watch is registered), and the reactor then collects
+ *   again. Called by the reactor when SIGCHLD arrives and after each child it
+ *   reaps.
+ * Receives:
+ *   watched: Tells whether a PID is watched by the reactor.
+ *   context: Passed to watched.
+ * Returns:
+ *   None (void).
+ */
+void subreaper_collect(subreaper_watched_fn watched, void *context) {
+    struct signalfd_siginfo signals[8];
+    while (read(g_subreaper_fd, signals, sizeof(signals)) > 0) {
+    }
+    for (;;) {
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid == 0) {
+            return;
+        }
+        pid_t pid = info.si_pid;
+        if (watched(context, pid)) {
+            return;
+        }
+        pid_t group = getpgid(pid);     // Still readable: the zombie has not been reaped
+        pthread_mutex_lock(&g_subreaper_lock);
+        subreaper_launch_t *own = find_launch(pid);
+        bool pending = own != NULL ? !own->unwatched && !own->exited
+                                   : group == pid && g_subreaper_forking > 0;
+        pthread_mutex_unlock(&g_subreaper_lock);
+        if (pending) {
+            return;     // A child whose exit watch is not registered yet
+        }
+        struct rusage usage;
+        memset(&usage, 0, sizeof(usage));
+        memset(&info, 0, sizeof(info));
+        if (syscall(SYS_waitid, P_PID, pid, &info, WEXITED | WNOHANG, &usage) != 0) {
+            return;
+        }
+
+        pthread_mutex_lock(&g_subreaper_lock);
+        subreaper_launch_t *launch = find_launch(group);
+        if (launch != NULL && group == pid) {
+            launch->self = usage;       // A child whose exit could not be watched
+            launch->exited = true;
+        } else if (launch != NULL) {
+            add_usage(&launch->others, &usage);
+            launch->descendants++;
+            g_subreaper_attributed++;
+        } else {
+            g_subreaper_unattributed++;
+        }
+        if (launch != NULL) {
+            finish_if_done(launch);
+        }
+        pthread_mutex_unlock(&g_subreaper_lock);
+    }
+}
+
+/*
+ * Purpose:
+ *   Sends a signal to the process group of every launch that is still
+ *   tracked. Children run in their own process groups, so a terminal's
+ *   Ctrl-C (SIGINT) or a SIGTERM only reaches the parent; the command loop
+ *   passes it on with this before exiting.
+ * Receives:
+ *   signum: The signal to send.
+ * Returns:
+ *   The number of process groups signalled. Nothing is sent when the mode is
+ *   off.
+ */
+size_t subreaper_forward_signal(int signum) {
+    size_t signalled = 0;
+    if (!g_subreaper_enabled) {
+        return 0;
+    }
+    pthread_mutex_lock(&g_subreaper_lock);
+    for (size_t i = 0; i < SUBREAPER_BUCKETS; ++i) {
+        for (subreaper_launch_t *launch = g_subreaper_buckets[i]; launch != NULL; launch = launch->next) {
+            if (kill(-launch->pid, signum) == 0) {
+                signalled++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_subreaper_lock);
+    return signalled;
+}
+
+/*
+ * Purpose:
+ *   Prints how many descendants were reaped and attributed.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void). Prints nothing when the mode is off.
+ */
+void subreaper_print_stats(void) {
+    if (!g_subreaper_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&g_subreaper_lock);
+    plog_out("Parent: Subreaper: %lu descendant(s) reaped (%lu attributed to their launch, %lu not); "
+             "%zu launch(es) tracked, %lu reported with descendants.\n",
+             g_subreaper_attributed + g_subreaper_unattributed, g_subreaper_attributed,
+             g_subreaper_unattributed, g_subreaper_tracked, g_subreaper_reported);
+    pthread_mutex_unlock(&g_subreaper_lock);
+}
+
+/*
+ * Purpose:
+ *   Frees the launch table and closes the signalfd. Called after the output
+ *   reactors have stopped; descendants still running are reaped by init
+ *   once the parent exits.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+void subreaper_shutdown(void) {
+    for (size_t i = 0; i < SUBREAPER_BUCKETS; ++i) {
+        while (g_subreaper_buckets[i] != NULL) {
+            subreaper_launch_t *launch = g_subreaper_buckets[i];
+            g_subreaper_buckets[i] = launch->next;
+            free(launch);
+        }
+    }
+    g_subreaper_tracked = 0;
+    if (g_subreaper_fd >= 0) {
+        close(g_subreaper_fd);
+        g_subreaper_fd = -1;
+    }
+    g_subreaper_enabled = false;
+}
@@ -0,0 +1,44 @@
+/*
+ * subreaper.h
+ *
+ * Description:
+ * Optional subreaper mode (-D). The parent marks itself as a child subreaper
+ * (PR_SET_CHILD_SUBREAPER), so helpers that children leave behind are
+ * re-parented to it instead of to init. Every child leads its own process
+ * group, which its descendants inherit; when a descendant exits, the output
+ * reactor (child_output.h) reaps it on SIGCHLD (signalfd) and its resource
+ * usage is added to the launch whose process group it belongs to. Once a
+ * child and all of its descendants are gone, the launch's totals are
+ * reported. Descendants that left their process group (e.g. daemons calling
+ * setsid()) are reaped but not attributed. Since the children are not in the
+ * terminal's foreground process group, a SIGINT or SIGTERM that stops the
+ * parent is forwarded to the groups of the launches still tracked.
+ *
+ * Children reaped through their pidfd are the reactor's own; the subreaper
+ * only reaps processes that are not watched. To keep that decision race-free
+ * the mode runs a single reactor.
+ */
+#ifndef SUBREAPER_H
+#define SUBREAPER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* Tells whether a PID is a child the reactor reaps through its pidfd. */
+typedef bool (*subreaper_watched_fn)(void *context, pid_t pid);
+
+int subreaper_enable(void);
+bool subreaper_enabled(void);
+int subreaper_signal_fd(void);
+void subreaper_forking(void);
+void subreaper_launched(pid_t pid, int child_id, const char *name);
+void subreaper_unwatched(pid_t pid);
+void subreaper_child_exited(pid_t pid, const struct rusage *usage);
+void subreaper_collect(subreaper_watched_fn watched, void *context);
+size_t subreaper_forward_signal(int signum);
+void subreaper_print_stats(void);
+void subreaper_shutdown(void);
+
+#endif /* SUBREAPER_H */
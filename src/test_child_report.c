@@ -0,0 +1,346 @@
+/*
+ * test_child_report.c
+ *
+ * Description:
+ * Tests for the binary child report (child_report.h). A report built with the
+ * encoder must decode to the same fields and variables. Malformed input (bad
+ * header, truncated reports, field lengths that run past the end, fields of
+ * the wrong size, random corruption) must be rejected by
+ * child_report_decode(), and whatever it accepts must be safe to walk with
+ * child_report_next_var().
+ *
+ * Usage: test_child_report
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "child_report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static unsigned g_checks;
+static unsigned g_failures;
+static unsigned long long g_rng_state = 0x9E3779B97F4A7C15ull;
+
+/*
+ * Purpose:
+ *   Records the outcome of one check and reports a failure.
+ * Receives:
+ *   passed:    The outcome.
+ *   condition: Text of the checked expression.
+ *   line:      Source line of the check.
+ * Returns:
+ *   None (void).
+ */
+static void check(int passed, const char *condition, int line) {
+    g_checks++;
+    if (!passed) {
+        g_failures++;
+        fprintf(stderr, "test_child_report.c:%d: check failed: %s\n", line, condition);
+    }
+}
+
+/*
+ * Purpose:
+ *   Deterministic xorshift64 pseudo-random generator, so every run tests the same inputs.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The next pseudo-random value.
+ */
+static unsigned long long next_random(void) {
+    g_rng_state ^= g_rng_state << 13;
+    g_rng_state ^= g_rng_state >> 7;
+    g_rng_state ^= g_rng_state << 17;
+    return g_rng_state;
+}
+
+/*
+ * Purpose:
+ *   Builds the report used by the tests: every fixed field, two variables
+ *   that were found (one with an empty value) and one that was missing.
+ * Receives:
+ *   builder: Receives the finished report.
+ * Returns:
+ *   0 on success, -1 if the encoder failed.
+ */
+static int build_report(child_report_builder_t *builder) {
+    int32_t pid = 4242;
+    int32_t ppid = 17;
+    uint64_t timing[2] = { 1700000000123456789ull, 98765 };
+    if (child_report_begin(builder) != 0) {
+        return -1;
+    }
+    child_report_add(builder, CHILD_REPORT_TAG_NAME, 0, "child_07", 8);
+    child_report_add(builder, CHILD_REPORT_TAG_PID, 0, &pid, sizeof(pid));
+    child_report_add(builder, CHILD_REPORT_TAG_PPID, 0, &ppid, sizeof(ppid));
+    child_report_add(builder, CHILD_REPORT_TAG_FILTER_FILE, 0, "/tmp/env", 8);
+    child_report_add_var(builder, "HOME", "/home/user");
+    child_report_add_var(builder, "LC_COLLATE", NULL);
+    child_report_add(builder, 99, 0, "future field", 12);     // Unknown tags are skipped
+    child_report_add_var(builder, "EMPTY", "");
+    child_report_add(builder, CHILD_REPORT_TAG_TIMING, 0, timing, sizeof(timing));
+    return child_report_finish(builder);
+}
+
+/*
+ * Purpose:
+ *   Walks every variable of a decoded report and checks that each one lies
+ *   inside the encoded buffer.
+ * Receives:
+ *   report:       A report accepted by child_report_decode().
+ *   data, length: The encoded buffer.
+ * Returns:
+ *   The number of variables walked.
+ */
+static size_t walk_vars(const child_report_t *report, const char *data, size_t length) {
+    size_t cursor = 0;
+    size_t count = 0;
+    child_report_var_t var;
+    while (child_report_next_var(report, &cursor, &var)) {
+        const char *end = data + length;
+        CHECK(var.name >= data && var.name_len <= (size_t)(end - var.name));
+        CHECK(var.value == NULL || (var.value >= data && var.value_len <= (size_t)(end - var.value)));
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Purpose:
+ *   Checks that an encoded report decodes to the fields it was built from.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_round_trip(void) {
+    child_report_builder_t builder;
+    CHECK(build_report(&builder) == 0);
+    CHECK(child_report_frame_length(builder.data, builder.length) == (long)builder.length);
+
+    child_report_t report;
+    CHECK(child_report_decode(builder.data, builder.length, &report) == 0);
+    CHECK(report.name_len == 8 && memcmp(report.name, "child_07", 8) == 0);
+    CHECK(report.pid == 4242 && report.ppid == 17);
+    CHECK(report.filter_file_len == 8 && memcmp(report.filter_file, "/tmp/env", 8) == 0);
+    CHECK(report.start_ns == 1700000000123456789ull && report.elapsed_ns == 98765);
+    CHECK(report.var_count == 3 && report.missing_count == 1);
+
+    size_t cursor = 0;
+    child_report_var_t var;
+    CHECK(child_report_next_var(&report, &cursor, &var));
+    CHECK(var.name_len == 4 && memcmp(var.name, "HOME", 4) == 0);
+    CHECK(var.value != NULL && var.value_len == 10 && memcmp(var.value, "/home/user", 10) == 0);
+    CHECK(child_report_next_var(&report, &cursor, &var));
+    CHECK(var.name_len == 10 && memcmp(var.name, "LC_COLLATE", 10) == 0 && var.value == NULL);
+    CHECK(child_report_next_var(&report, &cursor, &var));
+    CHECK(var.name_len == 5 && memcmp(var.name, "EMPTY", 5) == 0 && var.value != NULL && var.value_len == 0);
+    CHECK(!child_report_next_var(&report, &cursor, &var));
+    child_report_free(&builder);
+}
+
+/*
+ * Purpose:
+ *   Checks header validation in child_report_frame_length() and
+ *   child_report_decode().
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_bad_header(void) {
+    child_report_builder_t builder;
+    CHECK(build_report(&builder) == 0);
+    char *copy = malloc(builder.length);
+    child_report_t report;
+    CHECK(copy != NULL);
+    if (copy == NULL) {
+        child_report_free(&builder);
+        return;
+    }
+
+    // A partial header is "need more" while its magic prefix matches.
+    for (size_t available = 0; available < CHILD_REPORT_HEADER_SIZE; ++available) {
+        CHECK(child_report_frame_length(builder.data, available) == 0);
+        CHECK(child_report_decode(builder.data, available, &report) != 0);
+    }
+
+    memcpy(copy, builder.data, builder.length);
+    copy[0] ^= 0x20;
+    CHECK(child_report_frame_length(copy, 1) == -1);
+    CHECK(child_report_decode(copy, builder.length, &report) != 0);
+
+    memcpy(copy, builder.data, builder.length);
+    uint16_t version = CHILD_REPORT_VERSION + 1;
+    memcpy(copy + 4, &version, sizeof(version));
+    CHECK(child_report_frame_length(copy, builder.length) == -1);
+    CHECK(child_report_decode(copy, builder.length, &report) != 0);
+
+    uint32_t lengths[] = { 0, CHILD_REPORT_HEADER_SIZE - 1, (uint32_t)builder.length - 1,
+                           (uint32_t)builder.length + 1, CHILD_REPORT_MAX_SIZE + 1, UINT32_MAX };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        memcpy(copy, builder.data, builder.length);
+        memcpy(copy + 8, &lengths[i], sizeof(lengths[i]));
+        CHECK(child_report_decode(copy, builder.length, &report) != 0);
+    }
+    free(copy);
+    child_report_free(&builder);
+}
+
+/*
+ * Purpose:
+ *   Checks that a report cut short anywhere is rejected, even when its
+ *   header claims the shorter length.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_truncated(void) {
+    child_report_builder_t builder;
+    CHECK(build_report(&builder) == 0);
+    char *copy = malloc(builder.length);
+    CHECK(copy != NULL);
+    if (copy == NULL) {
+        child_report_free(&builder);
+        return;
+    }
+    size_t accepted = 0;
+    for (size_t length = CHILD_REPORT_HEADER_SIZE; length < builder.length; ++length) {
+        child_report_t report;
+        memcpy(copy, builder.data, length);
+        CHECK(child_report_decode(copy, length, &report) != 0);    // Header still says the full length
+
+        uint32_t claimed = (uint32_t)length;
+        memcpy(copy + 8, &claimed, sizeof(claimed));
+        if (child_report_decode(copy, length, &report) == 0) {
+            // Only a cut at a field boundary leaves a well-formed (shorter) report.
+            accepted++;
+            walk_vars(&report, copy, length);
+        }
+    }
+    CHECK(accepted == 9);       // The empty field area plus the first 8 of the 9 fields
+    free(copy);
+    child_report_free(&builder);
+}
+
+/*
+ * Purpose:
+ *   Checks fields whose lengths do not fit: value lengths past the end of the
+ *   report, fixed-size fields of the wrong size and variables whose name is
+ *   longer than their value.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_bad_fields(void) {
+    static const struct {
+        uint16_t tag;
+        uint16_t flags;
+        uint32_t claimed_len;       // Length stored in the field header
+        uint32_t actual_len;        // Value bytes that follow
+        uint32_t name_len;          // VAR only: stored name length
+    } cases[] = {
+        { CHILD_REPORT_TAG_NAME, 0, 9, 8, 0 },
+        { CHILD_REPORT_TAG_NAME, 0, UINT32_MAX, 8, 0 },
+        { CHILD_REPORT_TAG_PID, 0, 2, 2, 0 },
+        { CHILD_REPORT_TAG_PPID, 0, 8, 8, 0 },
+        { CHILD_REPORT_TAG_TIMING, 0, 8, 8, 0 },
+        { CHILD_REPORT_TAG_VAR, CHILD_REPORT_VAR_FOUND, 3, 3, 0 },
+        { CHILD_REPORT_TAG_VAR, CHILD_REPORT_VAR_FOUND, 8, 8, 5 },
+        { CHILD_REPORT_TAG_VAR, 0, 8, 8, UINT32_MAX },
+        { 99, 0, 17, 16, 0 }
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        char data[CHILD_REPORT_HEADER_SIZE + CHILD_REPORT_FIELD_HEADER_SIZE + 16];
+        memset(data, 'x', sizeof(data));
+        uint32_t magic = CHILD_REPORT_MAGIC;
+        uint16_t version = CHILD_REPORT_VERSION;
+        uint32_t length = CHILD_REPORT_HEADER_SIZE + CHILD_REPORT_FIELD_HEADER_SIZE + cases[i].actual_len;
+        memcpy(data, &magic, 4);
+        memcpy(data + 4, &version, 2);
+        memcpy(data + 8, &length, 4);
+        char *field = data + CHILD_REPORT_HEADER_SIZE;
+        memcpy(field, &cases[i].tag, 2);
+        memcpy(field + 2, &cases[i].flags, 2);
+        memcpy(field + 4, &cases[i].claimed_len, 4);
+        if (cases[i].tag == CHILD_REPORT_TAG_VAR && cases[i].actual_len >= 4) {
+            memcpy(field + 8, &cases[i].name_len, 4);
+        }
+        child_report_t report;
+        CHECK(child_report_decode(data, length, &report) != 0);
+    }
+
+    // A field header cut short after a complete field.
+    child_report_builder_t builder;
+    CHECK(child_report_begin(&builder) == 0);
+    child_report_add(&builder, CHILD_REPORT_TAG_NAME, 0, "child_01", 8);
+    CHECK(child_report_finish(&builder) == 0);
+    char data[64];
+    memcpy(data, builder.data, builder.length);
+    memset(data + builder.length, 0, CHILD_REPORT_FIELD_HEADER_SIZE - 1);
+    uint32_t length = (uint32_t)builder.length + CHILD_REPORT_FIELD_HEADER_SIZE - 1;
+    memcpy(data + 8, &length, 4);
+    child_report_t report;
+    CHECK(child_report_decode(data, length, &report) != 0);
+    child_report_free(&builder);
+}
+
+/*
+ * Purpose:
+ *   Flips random bytes of a valid report. Decoding must never read outside
+ *   the buffer, and every report it accepts must be safe to walk.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_random_corruption(void) {
+    child_report_builder_t builder;
+    CHECK(build_report(&builder) == 0);
+    size_t accepted = 0;
+    for (int round = 0; round < 20000; ++round) {
+        // An exact-size copy, so a read past the end shows up under a memory checker.
+        char *copy = malloc(builder.length);
+        CHECK(copy != NULL);
+        if (copy == NULL) {
+            break;
+        }
+        memcpy(copy, builder.data, builder.length);
+        int flips = 1 + (int)(next_random() % 4);
+        for (int i = 0; i < flips; ++i) {
+            size_t fields_size = builder.length - CHILD_REPORT_HEADER_SIZE;
+            size_t at = CHILD_REPORT_HEADER_SIZE + (size_t)(next_random() % fields_size);
+            copy[at] = (char)next_random();
+        }
+        child_report_t report;
+        if (child_report_decode(copy, builder.length, &report) == 0) {
+            accepted++;
+            size_t vars = walk_vars(&report, copy, builder.length);
+            CHECK(vars == report.var_count);
+            CHECK(report.missing_count <= report.var_count);
+        }
+        free(copy);
+    }
+    CHECK(accepted > 0);        // Flips inside values leave the report well-formed
+    child_report_free(&builder);
+}
+
+int main(void) {
+    test_round_trip();
+    test_bad_header();
+    test_truncated();
+    test_bad_fields();
+    test_random_corruption();
+    if (g_failures > 0) {
+        fprintf(stderr, "test_child_report: %u of %u checks failed.\n", g_failures, g_checks);
+        return EXIT_FAILURE;
+    }
+    printf("test_child_report: all %u checks passed.\n", g_checks);
+    return EXIT_SUCCESS;
+}
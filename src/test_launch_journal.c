@@ -0,0 +1,400 @@
+/*
+ * test_launch_journal.c
+ *
+ * Description:
+ * Recovery tests for the launch journal (launch_journal.h). A journal is
+ * written with launches and exits of real children and then damaged the way
+ * a crashed parent leaves it: records whose slot was reserved but whose kind
+ * was never stored (torn), a file cut short, a header that is not a journal,
+ * a cursor past the end. Reopening must keep exactly the launches of
+ * children that still run (not those that exited, and not a PID now used by
+ * another process), resume child numbering after every journaled id, and
+ * start a new journal when the file cannot be one. Compaction must keep the
+ * launches without an exit, in order.
+ *
+ * Usage: test_launch_journal
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "launch_journal.h"
+#include "launcher.h"
+#include "parent_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define TEST_DEAD_CHILDREN 3
+#define TEST_JOURNAL_SIZE (sizeof(journal_header_t) + (size_t)JOURNAL_RECORDS * sizeof(journal_record_t))
+
+static unsigned g_checks;
+static unsigned g_failures;
+
+/*
+ * Purpose:
+ *   Records the outcome of one check and reports a failure.
+ * Receives:
+ *   passed:    The outcome.
+ *   condition: Text of the checked expression.
+ *   line:      Source line of the check.
+ * Returns:
+ *   None (void).
+ */
+static void check(int passed, const char *condition, int line) {
+    g_checks++;
+    if (!passed) {
+        g_failures++;
+        fprintf(stderr, "test_launch_journal.c:%d: check failed: %s\n", line, condition);
+    }
+}
+
+/*
+ * Purpose:
+ *   Reads the journal header from the file.
+ * Receives:
+ *   path:   Journal file.
+ *   header: Receives the header.
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+static int read_header(const char *path, journal_header_t *header) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t got = pread(fd, header, sizeof(*header), 0);
+    close(fd);
+    return got == (ssize_t)sizeof(*header) ? 0 : -1;
+}
+
+/*
+ * Purpose:
+ *   Reads or writes one record slot or the header of the journal file.
+ * Receives:
+ *   path:   Journal file.
+ *   offset: File offset.
+ *   data:   Buffer.
+ *   size:   Bytes to transfer.
+ *   store:  Write (1) or read (0).
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+static int transfer(const char *path, off_t offset, void *data, size_t size, int store) {
+    int fd = open(path, (store ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t done = store ? pwrite(fd, data, size, offset) : pread(fd, data, size, offset);
+    close(fd);
+    return done == (ssize_t)size ? 0 : -1;
+}
+
+/*
+ * Purpose:
+ *   Reads record slot 'index' from the journal file.
+ * Receives:
+ *   path:   Journal file.
+ *   index:  Slot.
+ *   record: Receives the record.
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+static int read_record(const char *path, size_t index, journal_record_t *record) {
+    return transfer(path, (off_t)(sizeof(journal_header_t) + index * sizeof(journal_record_t)), record,
+                    sizeof(*record), 0);
+}
+
+/*
+ * Purpose:
+ *   Overwrites record slot 'index' of the journal file.
+ * Receives:
+ *   path:   Journal file.
+ *   index:  Slot.
+ *   record: The record.
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+static int write_record(const char *path, size_t index, journal_record_t *record) {
+    return transfer(path, (off_t)(sizeof(journal_header_t) + index * sizeof(journal_record_t)), record,
+                    sizeof(*record), 1);
+}
+
+/*
+ * Purpose:
+ *   Returns the size of a file.
+ * Receives:
+ *   path: The file.
+ * Returns:
+ *   The size, or -1 if it cannot be read.
+ */
+static off_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+/*
+ * Purpose:
+ *   Starts a child that runs until it is killed.
+ * Receives:
+ *   None.
+ * Returns:
+ *   Its PID, or -1 if fork() failed.
+ */
+static pid_t start_sleeper(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (;;) {
+            pause();
+        }
+    }
+    return pid;
+}
+
+/*
+ * Purpose:
+ *   Starts a child that exits at once and reaps it, leaving a PID that no
+ *   longer runs.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The child's former PID, or -1 if fork() failed.
+ */
+static pid_t dead_pid(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(0);
+    }
+    if (pid > 0) {
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+    }
+    return pid;
+}
+
+/*
+ * Purpose:
+ *   Checks that an empty file becomes an empty journal.
+ * Receives:
+ *   path: Journal file (empty).
+ * Returns:
+ *   None (void).
+ */
+static void test_new_journal(const char *path) {
+    CHECK(journal_open(path, true) == 0);
+    CHECK(journal_enabled());
+    journal_close();
+    CHECK(!journal_enabled());
+    journal_header_t header;
+    CHECK(read_header(path, &header) == 0);
+    CHECK(header.magic == JOURNAL_MAGIC && header.version == JOURNAL_VERSION);
+    CHECK(header.record_size == sizeof(journal_record_t) && header.capacity == JOURNAL_RECORDS);
+    CHECK(atomic_load(&header.next) == 0);
+    CHECK(file_size(path) == (off_t)TEST_JOURNAL_SIZE);
+}
+
+/*
+ * Purpose:
+ *   Journals exited, still running and recycled children, tears two records
+ *   as a crash between reserving and publishing them would, and checks what
+ *   the replay keeps.
+ * Receives:
+ *   path: Journal file (an empty journal).
+ * Returns:
+ *   None (void).
+ */
+static void test_recovery(const char *path) {
+    pid_t dead[TEST_DEAD_CHILDREN];
+    for (int i = 0; i < TEST_DEAD_CHILDREN; ++i) {
+        dead[i] = dead_pid();
+        CHECK(dead[i] > 0);
+    }
+    CHECK(journal_open(path, true) == 0);
+    uint64_t launch_ns = journal_now();
+    pid_t live = start_sleeper();
+    CHECK(live > 0);
+    if (live <= 0) {
+        journal_close();
+        return;
+    }
+
+    char name[24];
+    for (int i = 0; i < TEST_DEAD_CHILDREN; ++i) {
+        snprintf(name, sizeof(name), "child_%.2d", i);
+        journal_launch(i, dead[i], name, '+', "/bin/child", 1, launch_ns);
+    }
+    journal_launch(3, live, "child_03", '*', "/bin/child", 2, launch_ns);
+    // Our own PID, journaled as if launched later: a PID that now belongs to another process.
+    journal_launch(4, getpid(), "child_04", '+', "/bin/child", 2, journal_now() + 5000000000ull);
+    journal_exit(0, dead[0], CLD_EXITED, 0);
+    journal_exit(1, dead[1], CLD_KILLED, SIGTERM);
+    journal_close();
+
+    // Torn records: child 2's exit and the launch of child 9 were reserved but never published.
+    journal_header_t header;
+    CHECK(read_header(path, &header) == 0 && atomic_load(&header.next) == 7);
+    journal_record_t torn;
+    memset(&torn, 0, sizeof(torn));
+    torn.child_id = 2;
+    torn.pid = dead[2];
+    CHECK(write_record(path, 7, &torn) == 0);
+    torn.child_id = 9;
+    torn.pid = dead[0];
+    snprintf(torn.name, sizeof(torn.name), "child_09");
+    CHECK(write_record(path, 8, &torn) == 0);
+    atomic_store(&header.next, 9);
+    CHECK(transfer(path, 0, &header, sizeof(header), 1) == 0);
+
+    CHECK(journal_open(path, true) == 0);
+    journal_resume();
+    CHECK(launcher_next_child_id() == 10);      // After every journaled id, torn ones included
+    journal_close();
+
+    CHECK(read_header(path, &header) == 0 && atomic_load(&header.next) == 1);
+    journal_record_t record;
+    CHECK(read_record(path, 0, &record) == 0);
+    CHECK(atomic_load(&record.kind) == JOURNAL_LAUNCH && record.child_id == 3 && record.pid == live);
+    CHECK(record.method == '*' && record.env_generation == 2 && record.boot_ns == launch_ns);
+    CHECK(strcmp(record.name, "child_03") == 0 && strcmp(record.exec_path, "/bin/child") == 0);
+    for (size_t i = 1; i < 9; ++i) {
+        CHECK(read_record(path, i, &record) == 0 && atomic_load(&record.kind) == JOURNAL_EMPTY &&
+              record.child_id == 0);
+    }
+
+    // Without recovery (hot restart) the journal is only compacted: the same launch stays.
+    CHECK(journal_open(path, false) == 0);
+    journal_close();
+    CHECK(read_header(path, &header) == 0 && atomic_load(&header.next) == 1);
+
+    kill(live, SIGKILL);
+    while (waitpid(live, NULL, 0) < 0 && errno == EINTR) {
+    }
+    // Now gone: the replay drops it.
+    CHECK(journal_open(path, true) == 0);
+    journal_resume();
+    journal_close();
+    CHECK(read_header(path, &header) == 0 && atomic_load(&header.next) == 0);
+}
+
+/*
+ * Purpose:
+ *   Checks files a journal cannot be replayed from: cut short, with a foreign
+ *   header and with a cursor far past the end.
+ * Receives:
+ *   path: Journal file (a valid journal).
+ * Returns:
+ *   None (void).
+ */
+static void test_damaged_files(const char *path) {
+    journal_header_t header;
+    journal_record_t record;
+
+    // Cut short: a new journal replaces it.
+    CHECK(truncate(path, (off_t)TEST_JOURNAL_SIZE / 2) == 0);
+    CHECK(journal_open(path, true) == 0);
+    journal_launch(5, dead_pid(), "child_05", '+', "/bin/child", 1, journal_now());
+    journal_close();
+    CHECK(file_size(path) == (off_t)TEST_JOURNAL_SIZE);
+    CHECK(read_header(path, &header) == 0 && header.magic == JOURNAL_MAGIC && atomic_load(&header.next) == 1);
+
+    // Cut short inside the header.
+    CHECK(truncate(path, 10) == 0);
+    CHECK(journal_open(path, true) == 0);
+    journal_close();
+    CHECK(read_header(path, &header) == 0 && header.magic == JOURNAL_MAGIC && atomic_load(&header.next) == 0);
+
+    // Right size, foreign header (another version, other record size).
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION + 1;
+    header.record_size = sizeof(journal_record_t);
+    header.capacity = JOURNAL_RECORDS;
+    atomic_store(&header.next, 3);
+    CHECK(transfer(path, 0, &header, sizeof(header), 1) == 0);
+    CHECK(journal_open(path, true) == 0);
+    journal_close();
+    CHECK(read_header(path, &header) == 0 && header.version == JOURNAL_VERSION && atomic_load(&header.next) == 0);
+    header.record_size = sizeof(journal_record_t) / 2;
+    CHECK(transfer(path, 0, &header, sizeof(header), 1) == 0);
+    CHECK(journal_open(path, true) == 0);
+    journal_close();
+    CHECK(read_header(path, &header) == 0 && header.record_size == sizeof(journal_record_t));
+
+    // A cursor past the end (appends kept reserving once it was full): every slot is replayed.
+    memset(&record, 0, sizeof(record));
+    atomic_store(&record.kind, JOURNAL_LAUNCH);
+    record.child_id = 12;
+    record.pid = 1000000 + 12;
+    CHECK(write_record(path, JOURNAL_RECORDS - 1, &record) == 0);
+    atomic_store(&header.next, (uint64_t)JOURNAL_RECORDS * 3);
+    CHECK(transfer(path, 0, &header, sizeof(header), 1) == 0);
+    CHECK(journal_open(path, false) == 0);
+    journal_close();
+    CHECK(read_header(path, &header) == 0 && atomic_load(&header.next) == 1);
+    CHECK(read_record(path, 0, &record) == 0 && atomic_load(&record.kind) == JOURNAL_LAUNCH && record.child_id == 12);
+    CHECK(read_record(path, JOURNAL_RECORDS - 1, &record) == 0 && atomic_load(&record.kind) == JOURNAL_EMPTY);
+}
+
+/*
+ * Purpose:
+ *   Fills the journal past three quarters with launches and exits and checks
+ *   that compaction keeps only the launches without an exit, in order.
+ * Receives:
+ *   path: Journal file.
+ * Returns:
+ *   None (void).
+ */
+static void test_compaction(const char *path) {
+    CHECK(truncate(path, 0) == 0);
+    CHECK(journal_open(path, true) == 0);
+    int launches = JOURNAL_RECORDS / 8 * 3 + 25;
+    for (int id = 0; id < launches; ++id) {
+        journal_launch(id, 1000000 + id, "child", '+', "/bin/child", 1, 0);
+        if (id % 1000 != 0) {
+            journal_exit(id, 1000000 + id, CLD_EXITED, 0);
+        }
+    }
+    journal_maintain(0);
+    journal_close();
+
+    int kept = (launches + 999) / 1000;
+    journal_header_t header;
+    CHECK(read_header(path, &header) == 0 && atomic_load(&header.next) == (uint64_t)kept);
+    for (int i = 0; i < kept; ++i) {
+        journal_record_t record;
+        CHECK(read_record(path, (size_t)i, &record) == 0 && atomic_load(&record.kind) == JOURNAL_LAUNCH &&
+              record.child_id == i * 1000);
+    }
+}
+
+int main(void) {
+    const char *tmpdir = getenv("TMPDIR");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/test_launch_journal.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("test_launch_journal: mkstemp() failed");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    test_new_journal(path);
+    test_recovery(path);
+    test_damaged_files(path);
+    test_compaction(path);
+    plog_flush();
+    unlink(path);
+    if (g_failures > 0) {
+        fprintf(stderr, "test_launch_journal: %u of %u checks failed.\n", g_failures, g_checks);
+        return EXIT_FAILURE;
+    }
+    printf("test_launch_journal: all %u checks passed.\n", g_checks);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+/*
+ * test_lz_codec.c
+ *
+ * Description:
+ * Tests for the archive's block codec (lz_codec.h). Inputs of many sizes and
+ * shapes (empty, runs, text, random, repeats at long offsets) must survive a
+ * compress/decompress round trip, and neither side may write past its output
+ * buffer. Corrupt blocks (truncated, hand-crafted bad offsets and lengths,
+ * random corruption) and wrong decompressed sizes must be rejected without
+ * writing outside the output buffer.
+ *
+ * Usage: test_lz_codec
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "lz_codec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define TEST_GUARD_SIZE 64
+#define TEST_GUARD_BYTE 0xA5
+#define TEST_MAX_INPUT (64u * 1024u)
+
+static unsigned g_checks;
+static unsigned g_failures;
+static unsigned long long g_rng_state = 0x9E3779B97F4A7C15ull;
+
+/*
+ * Purpose:
+ *   Records the outcome of one check and reports a failure.
+ * Receives:
+ *   passed:    The outcome.
+ *   condition: Text of the checked expression.
+ *   line:      Source line of the check.
+ * Returns:
+ *   None (void).
+ */
+static void check(int passed, const char *condition, int line) {
+    g_checks++;
+    if (!passed) {
+        g_failures++;
+        fprintf(stderr, "test_lz_codec.c:%d: check failed: %s\n", line, condition);
+    }
+}
+
+/*
+ * Purpose:
+ *   Deterministic xorshift64 pseudo-random generator, so every run tests the same inputs.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The next pseudo-random value.
+ */
+static unsigned long long next_random(void) {
+    g_rng_state ^= g_rng_state << 13;
+    g_rng_state ^= g_rng_state >> 7;
+    g_rng_state ^= g_rng_state << 17;
+    return g_rng_state;
+}
+
+/*
+ * Purpose:
+ *   Tells whether the guard bytes after a buffer are untouched.
+ * Receives:
+ *   guard: First byte after the buffer.
+ * Returns:
+ *   true if all TEST_GUARD_SIZE bytes still hold TEST_GUARD_BYTE.
+ */
+static int guard_intact(const char *guard) {
+    for (size_t i = 0; i < TEST_GUARD_SIZE; ++i) {
+        if ((unsigned char)guard[i] != TEST_GUARD_BYTE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Compresses and decompresses one input and checks the result, the
+ *   compression bound and both output buffers' guards. Also checks that a
+ *   block is rejected when the expected size is off by one and when the
+ *   compressed form does not fit.
+ * Receives:
+ *   src, src_len: The input.
+ * Returns:
+ *   None (void).
+ */
+static void round_trip(const char *src, size_t src_len) {
+    size_t bound = LZ_COMPRESS_BOUND(src_len);
+    char *compressed = malloc(bound + TEST_GUARD_SIZE);
+    char *output = malloc(src_len + 1 + TEST_GUARD_SIZE);
+    CHECK(compressed != NULL && output != NULL);
+    if (compressed == NULL || output == NULL) {
+        free(compressed);
+        free(output);
+        return;
+    }
+    memset(compressed, TEST_GUARD_BYTE, bound + TEST_GUARD_SIZE);
+    size_t compressed_len = lz_compress(src, src_len, compressed, bound);
+    CHECK(compressed_len > 0 && compressed_len <= bound);
+    CHECK(guard_intact(compressed + bound));
+
+    memset(output, TEST_GUARD_BYTE, src_len + 1 + TEST_GUARD_SIZE);
+    CHECK(lz_decompress(compressed, compressed_len, output, src_len) == 0);
+    CHECK(memcmp(output, src, src_len) == 0);
+    CHECK(guard_intact(output + src_len));
+
+    if (src_len > 0) {
+        memset(output, TEST_GUARD_BYTE, src_len + 1 + TEST_GUARD_SIZE);
+        CHECK(lz_decompress(compressed, compressed_len, output, src_len - 1) != 0);
+        CHECK(guard_intact(output + src_len - 1));
+    }
+    CHECK(lz_decompress(compressed, compressed_len, output, src_len + 1) != 0);
+
+    // One byte short of the compressed size: must report "does not fit", not overrun.
+    memset(compressed, TEST_GUARD_BYTE, bound + TEST_GUARD_SIZE);
+    CHECK(lz_compress(src, src_len, compressed, compressed_len - 1) == 0);
+    CHECK(guard_intact(compressed + compressed_len - 1));
+    free(compressed);
+    free(output);
+}
+
+/*
+ * Purpose:
+ *   Round-trips inputs of many sizes and shapes.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_round_trips(void) {
+    static const size_t sizes[] = { 0, 1, 4, 5, 8, 9, 10, 12, 13, 15, 16, 19, 20, 100, 255, 256, 270, 271,
+                                    1000, 4096, 65535, TEST_MAX_INPUT };
+    char *src = malloc(TEST_MAX_INPUT);
+    CHECK(src != NULL);
+    if (src == NULL) {
+        return;
+    }
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t size = sizes[s];
+        memset(src, 0, size);                                   // One long run
+        round_trip(src, size);
+        for (size_t i = 0; i < size; ++i) {                     // Short period
+            src[i] = "abc"[i % 3];
+        }
+        round_trip(src, size);
+        for (size_t i = 0; i < size; ++i) {                     // Incompressible
+            src[i] = (char)next_random();
+        }
+        round_trip(src, size);
+        for (size_t i = 0; i < size; ++i) {                     // Log-like lines
+            src[i] = (char)(i % 64 == 63 ? '\n' : 'a' + (int)((i / 64 + i % 7) % 26));
+        }
+        round_trip(src, size);
+    }
+
+    // Literal runs and matches whose lengths need several extension bytes,
+    // and a long match at a long offset.
+    for (size_t i = 0; i < TEST_MAX_INPUT; ++i) {
+        src[i] = (char)next_random();
+    }
+    memset(src + 600, 'z', 3000);
+    memcpy(src + 40000, src + 1000, 20000);
+    round_trip(src, TEST_MAX_INPUT);
+    free(src);
+}
+
+/*
+ * Purpose:
+ *   Decodes a hand-built block whose match uses the longest offset the
+ *   format can express (65535), and the same block one literal short, where
+ *   that offset points before the output.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_longest_offset(void) {
+    size_t literals = 65535;
+    size_t output_len = literals + 4;
+    char *block = malloc(1 + 258 + literals + 2);
+    char *output = malloc(output_len + TEST_GUARD_SIZE);
+    CHECK(block != NULL && output != NULL);
+    if (block == NULL || output == NULL) {
+        free(block);
+        free(output);
+        return;
+    }
+    for (int short_block = 0; short_block < 2; ++short_block) {
+        size_t count = literals - (size_t)short_block;
+        size_t length = 0;
+        block[length++] = (char)0xF0;                   // 15+ literals, match length 4
+        size_t extension = count - 15;
+        for (; extension >= 255; extension -= 255) {
+            block[length++] = (char)0xFF;
+        }
+        block[length++] = (char)extension;
+        for (size_t i = 0; i < count; ++i) {
+            block[length++] = (char)next_random();
+        }
+        block[length++] = (char)0xFF;                   // Offset 65535, little-endian
+        block[length++] = (char)0xFF;
+        memset(output, TEST_GUARD_BYTE, output_len + TEST_GUARD_SIZE);
+        int result = lz_decompress(block, length, output, count + 4);
+        if (short_block) {
+            CHECK(result != 0);
+        } else {
+            CHECK(result == 0 && memcmp(output + count, output, 4) == 0);
+        }
+        CHECK(guard_intact(output + output_len));
+    }
+    free(block);
+    free(output);
+}
+
+/*
+ * Purpose:
+ *   Checks hand-crafted blocks whose offsets or lengths are invalid.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_bad_blocks(void) {
+    char output[64 + TEST_GUARD_SIZE];
+    static const struct {
+        const char *block;
+        size_t block_len;
+        size_t output_len;
+    } cases[] = {
+        { "", 0, 1 },                                   // Nothing for a nonempty block
+        { "\x10", 1, 1 },                               // Literal missing
+        { "\xF0", 1, 30 },                              // Literal length extension missing
+        { "\xF0\xFF", 2, 300 },                         // Extension cut after a 255
+        { "\x10" "a", 2, 2 },                           // Too few bytes overall
+        { "\x10" "a" "\x00", 3, 5 },                    // Offset cut short
+        { "\x10" "a" "\x00\x00", 4, 5 },                // Offset 0
+        { "\x10" "a" "\x02\x00", 4, 5 },                // Offset before the start of the output
+        { "\x1F" "a" "\x01\x00", 4, 64 },               // Match length extension missing
+        { "\x10" "a" "\x01\x00", 4, 4 },                // Match runs past the output
+        { "\x20" "ab", 3, 1 }                           // Literals run past the output
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        memset(output, TEST_GUARD_BYTE, sizeof(output));
+        CHECK(lz_decompress(cases[i].block, cases[i].block_len, output, cases[i].output_len) != 0);
+        CHECK(guard_intact(output + 64));
+    }
+    // The same shapes, well-formed: an overlapping match repeats the literal.
+    CHECK(lz_decompress("\x10" "a" "\x01\x00", 4, output, 5) == 0 && memcmp(output, "aaaaa", 5) == 0);
+    CHECK(lz_decompress("", 0, output, 0) == 0);
+}
+
+/*
+ * Purpose:
+ *   Checks that every truncation of a valid block is rejected and that random
+ *   corruption never makes the decoder write past its output buffer.
+ * Receives:
+ *   None.
+ * Returns:
+ *   None (void).
+ */
+static void test_corrupt_blocks(void) {
+    size_t src_len = 20000;
+    char *src = malloc(src_len);
+    char *compressed = malloc(LZ_COMPRESS_BOUND(src_len));
+    char *corrupt = malloc(LZ_COMPRESS_BOUND(src_len));
+    char *output = malloc(src_len + TEST_GUARD_SIZE);
+    CHECK(src != NULL && compressed != NULL && corrupt != NULL && output != NULL);
+    if (src == NULL || compressed == NULL || corrupt == NULL || output == NULL) {
+        free(src);
+        free(compressed);
+        free(corrupt);
+        free(output);
+        return;
+    }
+    for (size_t i = 0; i < src_len; ++i) {     // Text with both literals and matches
+        src[i] = (char)(next_random() % 4 == 0 ? 'a' + (int)(next_random() % 26) : "lorem ipsum "[i % 12]);
+    }
+    size_t compressed_len = lz_compress(src, src_len, compressed, LZ_COMPRESS_BOUND(src_len));
+    CHECK(compressed_len > 0 && compressed_len < src_len);
+
+    for (size_t length = 0; length < compressed_len; ++length) {
+        memset(output, TEST_GUARD_BYTE, src_len + TEST_GUARD_SIZE);
+        CHECK(lz_decompress(compressed, length, output, src_len) != 0);
+        CHECK(guard_intact(output + src_len));
+    }
+
+    size_t rejected = 0;
+    for (int round = 0; round < 5000; ++round) {
+        memcpy(corrupt, compressed, compressed_len);
+        int flips = 1 + (int)(next_random() % 8);
+        for (int i = 0; i < flips; ++i) {
+            corrupt[next_random() % compressed_len] = (char)next_random();
+        }
+        memset(output, TEST_GUARD_BYTE, src_len + TEST_GUARD_SIZE);
+        rejected += lz_decompress(corrupt, compressed_len, output, src_len) != 0;
+        CHECK(guard_intact(output + src_len));
+    }
+    CHECK(rejected > 0);
+    free(src);
+    free(compressed);
+    free(corrupt);
+    free(output);
+}
+
+int main(void) {
+    test_round_trips();
+    test_longest_offset();
+    test_bad_blocks();
+    test_corrupt_blocks();
+    if (g_failures > 0) {
+        fprintf(stderr, "test_lz_codec: %u of %u checks failed.\n", g_failures, g_checks);
+        return EXIT_FAILURE;
+    }
+    printf("test_lz_codec: all %u checks passed.\n", g_checks);
+    return EXIT_SUCCESS;
+}
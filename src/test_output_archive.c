@@ -0,0 +1,358 @@
+/*
+ * test_output_archive.c
+ *
+ * Description:
+ * Round-trip test of the output archive (output_archive.h) and archive_query.
+ * Output of several children is appended in interleaved pieces of random
+ * size (compressible text spanning several blocks, incompressible bytes that
+ * are stored as is, a child without output), the archive is closed, and
+ * archive_query must return exactly each child's output, list the children,
+ * honour -s and reject a malformed -s. The archive is then cut back to what
+ * a killed parent leaves behind (no index, then a torn last block);
+ * archive_query must find the blocks by scanning and return the complete
+ * ones.
+ *
+ * Usage: test_output_archive <archive_query program>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "output_archive.h"
+#include "parent_log.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define TEST_CHILDREN 4
+#define TEST_QUERY_OUTPUT_MAX (1024u * 1024u)
+
+typedef struct test_child_s {
+    uint32_t child_id;
+    size_t length;
+    char *data;                 /* Expected output */
+    size_t written;
+    bool closed;
+    archive_stream_t stream;
+} test_child_t;
+
+static unsigned g_checks;
+static unsigned g_failures;
+static unsigned long long g_rng_state = 0x9E3779B97F4A7C15ull;
+
+/*
+ * Purpose:
+ *   Records the outcome of one check and reports a failure.
+ * Receives:
+ *   passed:    The outcome.
+ *   condition: Text of the checked expression.
+ *   line:      Source line of the check.
+ * Returns:
+ *   None (void).
+ */
+static void check(int passed, const char *condition, int line) {
+    g_checks++;
+    if (!passed) {
+        g_failures++;
+        fprintf(stderr, "test_output_archive.c:%d: check failed: %s\n", line, condition);
+    }
+}
+
+/*
+ * Purpose:
+ *   Deterministic xorshift64 pseudo-random generator, so every run tests the same inputs.
+ * Receives:
+ *   None.
+ * Returns:
+ *   The next pseudo-random value.
+ */
+static unsigned long long next_random(void) {
+    g_rng_state ^= g_rng_state << 13;
+    g_rng_state ^= g_rng_state >> 7;
+    g_rng_state ^= g_rng_state << 17;
+    return g_rng_state;
+}
+
+/*
+ * Purpose:
+ *   Runs archive_query and collects its standard output.
+ * Receives:
+ *   argv:   Program and arguments, NULL-terminated.
+ *   output: Buffer of TEST_QUERY_OUTPUT_MAX bytes.
+ *   length: Receives the number of bytes read.
+ * Returns:
+ *   The program's exit status, or -1 if it could not be run or did not exit.
+ */
+static int run_query(char *const argv[], char *output, size_t *length) {
+    int pipe_fds[2];
+    *length = 0;
+    if (pipe(pipe_fds) != 0) {
+        perror("test_output_archive: pipe() failed");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("test_output_archive: fork() failed");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    for (;;) {
+        ssize_t got = read(pipe_fds[0], output + *length, TEST_QUERY_OUTPUT_MAX - *length);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        *length += (size_t)got;
+    }
+    close(pipe_fds[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+ * Purpose:
+ *   Queries one child's output and compares it with the expected bytes.
+ * Receives:
+ *   query:          archive_query program.
+ *   path:           Archive.
+ *   since:          -s argument, or NULL.
+ *   child:          The child.
+ *   expected_start: Offset into the child's output where the result must start.
+ *   expected_end:   Offset where the result must end.
+ *   output:         Scratch buffer of TEST_QUERY_OUTPUT_MAX bytes.
+ * Returns:
+ *   None (void).
+ */
+static void check_query(const char *query, const char *path, const char *since, const test_child_t *child,
+                        size_t expected_start, size_t expected_end, char *output) {
+    char id[16];
+    snprintf(id, sizeof(id), "child_%.2u", (unsigned)child->child_id);
+    char *argv[] = { (char *)query, (char *)path, id, NULL, NULL, NULL };
+    if (since != NULL) {
+        argv[1] = "-s";
+        argv[2] = (char *)since;
+        argv[3] = (char *)path;
+        argv[4] = id;
+    }
+    size_t length;
+    CHECK(run_query(argv, output, &length) == 0);
+    CHECK(length == expected_end - expected_start);
+    CHECK(length == expected_end - expected_start &&
+          memcmp(output, child->data + expected_start, length) == 0);
+}
+
+/*
+ * Purpose:
+ *   Fills in the children's expected output.
+ * Receives:
+ *   children: TEST_CHILDREN children.
+ * Returns:
+ *   0 on success, -1 on allocation failure.
+ */
+static int make_outputs(test_child_t *children) {
+    static const size_t lengths[TEST_CHILDREN] = { 3 * OUTPUT_ARCHIVE_BLOCK_SIZE + 1234, 70000, 0, 17 };
+    static const uint32_t ids[TEST_CHILDREN] = { 1, 2, 3, 10 };
+    for (int c = 0; c < TEST_CHILDREN; ++c) {
+        test_child_t *child = &children[c];
+        child->child_id = ids[c];
+        child->length = lengths[c];
+        child->written = 0;
+        child->closed = false;
+        child->data = malloc(child->length + 1);
+        if (child->data == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < child->length; ++i) {
+            if (c == 1) {
+                child->data[i] = (char)next_random();       // Stored uncompressed
+            } else {
+                child->data[i] = (char)(i % 40 == 39 ? '\n' : 'a' + (int)((i / 40 + i % 5 + (size_t)c) % 26));
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Writes the archive, appending the children's output interleaved in
+ *   pieces of random size and closing each child's stream once its output
+ *   ends, as the output reactor does.
+ * Receives:
+ *   path:     Archive to create.
+ *   children: TEST_CHILDREN children.
+ * Returns:
+ *   0 on success, -1 if the archive could not be written.
+ */
+static int write_archive(const char *path, test_child_t *children) {
+    if (archive_open(path) != 0) {
+        return -1;
+    }
+    CHECK(archive_enabled());
+    for (int c = 0; c < TEST_CHILDREN; ++c) {
+        archive_stream_init(&children[c].stream, children[c].child_id);
+    }
+    int rc = 0;
+    for (int open_streams = TEST_CHILDREN; open_streams > 0;) {
+        open_streams = 0;
+        for (int c = 0; c < TEST_CHILDREN; ++c) {
+            test_child_t *child = &children[c];
+            if (child->closed) {
+                continue;
+            }
+            size_t piece = 1 + (size_t)(next_random() % 9000);
+            if (piece > child->length - child->written) {
+                piece = child->length - child->written;
+            }
+            if (archive_append(&child->stream, child->data + child->written, piece) != 0) {
+                rc = -1;
+            }
+            child->written += piece;
+            if (child->written == child->length) {
+                child->closed = true;
+                if (archive_stream_close(&child->stream) != 0) {
+                    rc = -1;
+                }
+            } else {
+                open_streams++;
+            }
+        }
+    }
+    if (archive_close() != 0) {
+        rc = -1;
+    }
+    CHECK(!archive_enabled());
+    return rc;
+}
+
+/*
+ * Purpose:
+ *   Cuts the archive back to 'length' bytes.
+ * Receives:
+ *   path:   Archive.
+ *   length: New size.
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+static int cut_archive(const char *path, off_t length) {
+    if (truncate(path, length) != 0) {
+        perror("test_output_archive: truncate() failed");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <archive_query program>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *query = argv[1];
+    const char *tmpdir = getenv("TMPDIR");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/test_output_archive.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("test_output_archive: mkstemp() failed");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    test_child_t children[TEST_CHILDREN];
+    memset(children, 0, sizeof(children));
+    char *output = malloc(TEST_QUERY_OUTPUT_MAX);
+    CHECK(output != NULL && make_outputs(children) == 0);
+    CHECK(output != NULL && write_archive(path, children) == 0);
+    plog_flush();
+    if (g_failures > 0) {
+        goto done;
+    }
+
+    // Complete archive: the index is used.
+    for (int c = 0; c < TEST_CHILDREN; ++c) {
+        check_query(query, path, NULL, &children[c], 0, children[c].length, output);
+    }
+    const test_child_t unknown = { .child_id = 99, .length = 0, .data = "" };
+    check_query(query, path, NULL, &unknown, 0, 0, output);
+    // -s after everything was written still returns the child's last block.
+    size_t last_block = (children[0].length - 1) / OUTPUT_ARCHIVE_BLOCK_SIZE * OUTPUT_ARCHIVE_BLOCK_SIZE;
+    check_query(query, path, "4000000000", &children[0], last_block, children[0].length, output);
+
+    size_t length;
+    // A start time that is not a number of seconds is a usage error, not 0 or a huge time.
+    static const char *const bad_since[] = { "abc", "-1", "5x", "", "99999999999999999999" };
+    for (size_t i = 0; i < sizeof(bad_since) / sizeof(bad_since[0]); ++i) {
+        char *bad_argv[] = { (char *)query, "-s", (char *)bad_since[i], path, "child_01", NULL };
+        CHECK(run_query(bad_argv, output, &length) == EXIT_FAILURE && length == 0);
+    }
+
+    char *list_argv[] = { (char *)query, "-l", path, NULL };
+    CHECK(run_query(list_argv, output, &length) == 0);
+    char expected_list[512];
+    int expected_length = snprintf(expected_list, sizeof(expected_list),
+                                   "child_01: 4 blocks, %zu bytes (",
+                                   children[0].length);
+    CHECK(length > (size_t)expected_length && memcmp(output, expected_list, (size_t)expected_length) == 0);
+    output[length < TEST_QUERY_OUTPUT_MAX ? length : TEST_QUERY_OUTPUT_MAX - 1] = '\0';
+    CHECK(strstr(output, "child_02: 2 blocks, 70000 bytes (70000 stored)\n") != NULL);
+    CHECK(strstr(output, "child_03:") == NULL);
+    CHECK(strstr(output, "child_10: 1 blocks, 17 bytes (") != NULL);
+
+    // No index or trailer: a parent that was killed. The blocks are found by scanning.
+    archive_trailer_t trailer;
+    FILE *file = fopen(path, "rb");
+    CHECK(file != NULL && fseek(file, -(long)sizeof(trailer), SEEK_END) == 0 &&
+          fread(&trailer, sizeof(trailer), 1, file) == 1);
+    if (file != NULL) {
+        fclose(file);
+    }
+    CHECK(trailer.magic == OUTPUT_ARCHIVE_INDEX_MAGIC && trailer.entry_count == 7);
+    if (g_failures == 0 && cut_archive(path, (off_t)trailer.index_offset) == 0) {
+        for (int c = 0; c < TEST_CHILDREN; ++c) {
+            check_query(query, path, NULL, &children[c], 0, children[c].length, output);
+        }
+    }
+
+    // A torn last block: every complete block is still returned. child_01's
+    // output ends last, so its final partial block is the last in the file;
+    // cutting 9 bytes removes at least 2 of its bytes after the index padding.
+    if (g_failures == 0 && cut_archive(path, (off_t)trailer.index_offset - 9) == 0) {
+        check_query(query, path, NULL, &children[0], 0, last_block, output);
+        check_query(query, path, NULL, &children[1], 0, children[1].length, output);
+        check_query(query, path, NULL, &children[3], 0, children[3].length, output);
+    }
+
+done:
+    unlink(path);
+    for (int c = 0; c < TEST_CHILDREN; ++c) {
+        free(children[c].data);
+    }
+    free(output);
+    if (g_failures > 0) {
+        fprintf(stderr, "test_output_archive: %u of %u checks failed.\n", g_failures, g_checks);
+        return EXIT_FAILURE;
+    }
+    printf("test_output_archive: all %u checks passed.\n", g_checks);
+    return EXIT_SUCCESS;
+}
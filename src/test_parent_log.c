@@ -0,0 +1,257 @@
+/*
+ * test_parent_log.c
+ *
+ * Description:
+ * Tests for the parent log's asynchronous mode (parent_log.h). For each
+ * overflow policy, a child process sends its stdout and stderr to a file,
+ * starts the logger thread and lets several threads log at once: messages
+ * that span several ring records, events, flushes, and messages too long
+ * for the ring. The file must then hold every message whole and each
+ * thread's messages in order. With the blocking policy nothing may be
+ * missing; with the dropping policies the missing messages must match the
+ * drop counter. A flush must never wait forever, whatever was dropped.
+ *
+ * Usage: test_parent_log
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "parent_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define TEST_THREADS 4
+#define TEST_MESSAGES 3000
+#define TEST_EVENT_EVERY 50
+#define TEST_FLUSH_EVERY 250
+#define TEST_LONG_AT 1000
+#define TEST_LONG_LENGTH 40000          /* More than the ring holds in one message */
+#define TEST_TIMEOUT_SECONDS 60
+
+static unsigned g_checks;
+static unsigned g_failures;
+
+/*
+ * Purpose:
+ *   Records the outcome of one check and reports a failure.
+ * Receives:
+ *   passed:    The outcome.
+ *   condition: Text of the checked expression.
+ *   line:      Source line of the check.
+ * Returns:
+ *   None (void).
+ */
+static void check(int passed, const char *condition, int line) {
+    g_checks++;
+    if (!passed) {
+        g_failures++;
+        fprintf(stderr, "test_parent_log.c:%d: check failed: %s\n", line, condition);
+    }
+}
+
+/*
+ * Purpose:
+ *   Length of the body of one thread's message.
+ * Receives:
+ *   seq: Message number.
+ * Returns:
+ *   The body length; some messages need several ring records.
+ */
+static size_t body_length(int seq) {
+    return seq == TEST_LONG_AT ? TEST_LONG_LENGTH : (size_t)(seq % 7) * 150 + 10;
+}
+
+/*
+ * Purpose:
+ *   Logs one thread's messages, events and flushes. Runs in the child.
+ * Receives:
+ *   arg: The thread number.
+ * Returns:
+ *   NULL.
+ */
+static void *log_messages(void *arg) {
+    int id = (int)(long)arg;
+    static char bodies[TEST_THREADS][TEST_LONG_LENGTH + 1];
+    char *body = bodies[id];
+    char name[16];
+    snprintf(name, sizeof(name), "child_%d", id);
+    for (int seq = 0; seq < TEST_MESSAGES; ++seq) {
+        size_t length = body_length(seq);
+        memset(body, 'a' + id, length);
+        body[length] = '\0';
+        plog_out("<%d:%d:%zu:%s>\n", id, seq, length, body);
+        if (seq % TEST_EVENT_EVERY == 0) {
+            plog_event_number(PLOG_EVENT_FORKED, name, seq);
+        }
+        if (seq % TEST_FLUSH_EVERY == 0) {
+            plog_flush();
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Runs the logging threads with one policy, in a child process whose
+ *   output goes to 'path'. The last line written is the drop counter.
+ * Receives:
+ *   policy: Overflow policy.
+ *   path:   Output file.
+ * Returns:
+ *   Does not return; exits 0, or 1 if the logger could not be started.
+ */
+static void run_child(plog_overflow_policy_t policy, const char *path) {
+    int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0 || dup2(fd, STDERR_FILENO) < 0) {
+        _exit(1);
+    }
+    alarm(TEST_TIMEOUT_SECONDS);        // A flush that never returns fails the test
+    if (plog_start_async(policy) != 0) {
+        _exit(1);
+    }
+    pthread_t threads[TEST_THREADS];
+    for (long i = 0; i < TEST_THREADS; ++i) {
+        if (pthread_create(&threads[i], NULL, log_messages, (void *)i) != 0) {
+            _exit(1);
+        }
+    }
+    for (int i = 0; i < TEST_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    plog_shutdown();
+    char line[64];
+    int length = snprintf(line, sizeof(line), "dropped %lu\n", plog_dropped());
+    _exit(write(STDOUT_FILENO, line, (size_t)length) == length ? 0 : 1);
+}
+
+/*
+ * Purpose:
+ *   Checks one line of output: a message or event of one thread, in order.
+ * Receives:
+ *   line:       The line, without its newline.
+ *   next_seq:   Per thread, the lowest message number still allowed.
+ *   next_event: Per thread, the lowest event number still allowed.
+ *   messages:   Counts whole messages and events.
+ * Returns:
+ *   true if the line is whole and in order.
+ */
+static bool check_line(const char *line, int *next_seq, int *next_event, size_t *messages) {
+    int id;
+    int seq;
+    size_t length;
+    int consumed = 0;
+    if (sscanf(line, "<%d:%d:%zu:%n", &id, &seq, &length, &consumed) == 3 && consumed > 0) {
+        const char *body = line + consumed;
+        if (id < 0 || id >= TEST_THREADS || seq < next_seq[id] || seq >= TEST_MESSAGES ||
+            length != body_length(seq) || strlen(body) != length + 1 || body[length] != '>') {
+            return false;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (body[i] != 'a' + id) {
+                return false;
+            }
+        }
+        next_seq[id] = seq + 1;
+        (*messages)++;
+        return true;
+    }
+    if (sscanf(line, "Parent: Forked child process 'child_%d' with PID %d.%n", &id, &seq, &consumed) == 2 &&
+        consumed > 0 && line[consumed] == '\0') {
+        if (id < 0 || id >= TEST_THREADS || seq < next_event[id] || seq % TEST_EVENT_EVERY != 0) {
+            return false;
+        }
+        next_event[id] = seq + 1;
+        (*messages)++;
+        return true;
+    }
+    return strncmp(line, "Parent: Logger dropped ", 23) == 0;
+}
+
+/*
+ * Purpose:
+ *   Runs one policy and checks its output.
+ * Receives:
+ *   policy: Overflow policy.
+ *   path:   Scratch output file.
+ * Returns:
+ *   None (void).
+ */
+static void test_policy(plog_overflow_policy_t policy, const char *path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_child(policy, path);
+    }
+    CHECK(pid > 0);
+    if (pid < 0) {
+        return;
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);      // Not stuck in a flush (SIGALRM)
+
+    FILE *file = fopen(path, "r");
+    CHECK(file != NULL);
+    if (file == NULL) {
+        return;
+    }
+    static char line[TEST_LONG_LENGTH + 64];
+    int next_seq[TEST_THREADS] = { 0 };
+    int next_event[TEST_THREADS] = { 0 };
+    size_t messages = 0;
+    size_t broken = 0;
+    unsigned long dropped = 0;
+    bool have_dropped = false;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "dropped %lu", &dropped) == 1) {
+            have_dropped = true;
+        } else if (!check_line(line, next_seq, next_event, &messages)) {
+            broken++;
+        }
+    }
+    fclose(file);
+
+    size_t total = (size_t)TEST_THREADS * (TEST_MESSAGES + (TEST_MESSAGES + TEST_EVENT_EVERY - 1) / TEST_EVENT_EVERY);
+    CHECK(broken == 0);
+    CHECK(have_dropped);
+    CHECK(messages + dropped == total);
+    if (policy == PLOG_OVERFLOW_BLOCK) {
+        CHECK(dropped == 0);
+    }
+    for (int id = 0; id < TEST_THREADS; ++id) {
+        CHECK(next_seq[id] == TEST_MESSAGES || policy != PLOG_OVERFLOW_BLOCK);
+    }
+}
+
+int main(void) {
+    const char *tmpdir = getenv("TMPDIR");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/test_parent_log.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("test_parent_log: mkstemp() failed");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    test_policy(PLOG_OVERFLOW_BLOCK, path);
+    test_policy(PLOG_OVERFLOW_DROP, path);
+    test_policy(PLOG_OVERFLOW_DROP_OLDEST, path);
+    unlink(path);
+    if (g_failures > 0) {
+        fprintf(stderr, "test_parent_log: %u of %u checks failed.\n", g_failures, g_checks);
+        return EXIT_FAILURE;
+    }
+    printf("test_parent_log: all %u checks passed.\n", g_checks);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/*
+ * test_shared_log.c
+ *
+ * Description:
+ * Tests for the shared append log (shared_log.h). Several processes append
+ * records of varying size concurrently, once into a log large enough for all
+ * of them and once until it is full; the walk must return every record
+ * intact, each writer's records in order, and nothing still pending. A
+ * writer that dies after claiming a record (before or after moving the
+ * cursor) must not stop later writers, and readers must skip its record.
+ *
+ * Usage: test_shared_log
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "shared_log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define TEST_WRITERS 4
+#define TEST_RECORDS_PER_WRITER 2000
+#define TEST_PAYLOAD_MAX 96
+
+static unsigned g_checks;
+static unsigned g_failures;
+
+/*
+ * Purpose:
+ *   Records the outcome of one check and reports a failure.
+ * Receives:
+ *   passed:    The outcome.
+ *   condition: Text of the checked expression.
+ *   line:      Source line of the check.
+ * Returns:
+ *   None (void).
+ */
+static void check(int passed, const char *condition, int line) {
+    g_checks++;
+    if (!passed) {
+        g_failures++;
+        fprintf(stderr, "test_shared_log.c:%d: check failed: %s\n", line, condition);
+    }
+}
+
+/*
+ * Purpose:
+ *   Builds the payload of one record: "<writer> <seq> " followed by filler
+ *   whose length and bytes depend on both, so a torn or misplaced record is
+ *   detected.
+ * Receives:
+ *   writer, seq: The record.
+ *   payload:     Buffer of TEST_PAYLOAD_MAX bytes.
+ * Returns:
+ *   The payload length.
+ */
+static size_t make_payload(int writer, int seq, char *payload) {
+    int length = snprintf(payload, TEST_PAYLOAD_MAX, "%d %d ", writer, seq);
+    size_t filler = (size_t)(seq * 7 + writer) % (TEST_PAYLOAD_MAX - 24);
+    for (size_t i = 0; i < filler; ++i) {
+        payload[(size_t)length + i] = (char)('a' + (int)((i + (size_t)seq) % 26));
+    }
+    return (size_t)length + filler;
+}
+
+/*
+ * Purpose:
+ *   Appends one writer's records, stopping at the first that does not fit.
+ *   Runs in a child process.
+ * Receives:
+ *   path:   The log.
+ *   writer: Writer number.
+ * Returns:
+ *   Does not return; exits 0, or 1 on an unexpected error.
+ */
+static void run_writer(const char *path, int writer) {
+    shared_log_t log;
+    if (shared_log_open(&log, path, true) != 0) {
+        _exit(1);
+    }
+    char payload[TEST_PAYLOAD_MAX];
+    for (int seq = 0; seq < TEST_RECORDS_PER_WRITER; ++seq) {
+        size_t length = make_payload(writer, seq, payload);
+        if (shared_log_append(&log, (int32_t)getpid(), payload, length) != 0) {
+            _exit(errno == ENOSPC ? 0 : 1);
+        }
+    }
+    _exit(0);
+}
+
+/*
+ * Purpose:
+ *   Creates a log, lets TEST_WRITERS processes append to it at once and
+ *   checks every record the walk returns.
+ * Receives:
+ *   path:     Log file to create.
+ *   capacity: Log capacity.
+ *   full:     true if the log is too small for all records.
+ * Returns:
+ *   None (void).
+ */
+static void test_concurrent_writers(const char *path, uint64_t capacity, bool full) {
+    CHECK(shared_log_create(path, capacity, 0) == 0);
+    pid_t writers[TEST_WRITERS];
+    for (int w = 0; w < TEST_WRITERS; ++w) {
+        writers[w] = fork();
+        if (writers[w] == 0) {
+            run_writer(path, w);
+        }
+        CHECK(writers[w] > 0);
+    }
+    for (int w = 0; w < TEST_WRITERS; ++w) {
+        int status = 0;
+        while (writers[w] > 0 && waitpid(writers[w], &status, 0) < 0 && errno == EINTR) {
+        }
+        CHECK(writers[w] > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    shared_log_t log;
+    CHECK(shared_log_open(&log, path, false) == 0);
+    if (log.header == NULL) {
+        return;
+    }
+    int next_seq[TEST_WRITERS] = { 0 };
+    size_t records = 0;
+    size_t pending = 0;
+    size_t bad = 0;
+    uint64_t offset = 0;
+    shared_log_entry_t entry;
+    shared_log_walk_t walk;
+    while ((walk = shared_log_next(&log, &offset, &entry)) != SHARED_LOG_WALK_END) {
+        if (walk == SHARED_LOG_WALK_PENDING) {
+            pending++;
+            continue;
+        }
+        records++;
+        int writer = -1;
+        int seq = -1;
+        char text[TEST_PAYLOAD_MAX];
+        char expected[TEST_PAYLOAD_MAX];
+        if (entry.payload_len < TEST_PAYLOAD_MAX) {
+            memcpy(text, entry.payload, entry.payload_len);
+            text[entry.payload_len] = '\0';
+        }
+        if (entry.payload_len >= TEST_PAYLOAD_MAX || sscanf(text, "%d %d", &writer, &seq) != 2 ||
+            writer < 0 || writer >= TEST_WRITERS || seq != next_seq[writer] ||
+            make_payload(writer, seq, expected) != entry.payload_len ||
+            memcmp(expected, entry.payload, entry.payload_len) != 0 || entry.pid != writers[writer]) {
+            bad++;
+            continue;
+        }
+        next_seq[writer]++;
+    }
+    CHECK(bad == 0 && pending == 0);
+    if (full) {
+        CHECK(shared_log_used(&log) == capacity);
+        CHECK(records > 0 && records < (size_t)TEST_WRITERS * TEST_RECORDS_PER_WRITER);
+    } else {
+        CHECK(records == (size_t)TEST_WRITERS * TEST_RECORDS_PER_WRITER);
+        for (int w = 0; w < TEST_WRITERS; ++w) {
+            CHECK(next_seq[w] == TEST_RECORDS_PER_WRITER);
+        }
+    }
+    shared_log_close(&log);
+}
+
+/*
+ * Purpose:
+ *   Simulates writers that died mid-append: one after publishing its
+ *   record's length but before moving the cursor, one after moving the
+ *   cursor but before committing. Later appends must go through, and
+ *   readers must skip both records.
+ * Receives:
+ *   path: Log file to create.
+ * Returns:
+ *   None (void).
+ */
+static void test_dead_writers(const char *path) {
+    CHECK(shared_log_create(path, 4096, 0) == 0);
+    shared_log_t log;
+    CHECK(shared_log_open(&log, path, true) == 0);
+    if (log.header == NULL) {
+        return;
+    }
+    CHECK(shared_log_append(&log, 1, "first", 5) == 0);
+
+    // Died after the length CAS: the cursor still points at its record.
+    uint64_t cursor = atomic_load(&log.header->cursor);
+    shared_log_record_t *claimed = (shared_log_record_t *)((char *)log.header + cursor);
+    atomic_store(&claimed->length, 64);
+    CHECK(shared_log_append(&log, 2, "second", 6) == 0);
+    CHECK(atomic_load(&log.header->cursor) > cursor + 64);
+
+    // Died after moving the cursor: its record stays in the writing state.
+    cursor = atomic_load(&log.header->cursor);
+    claimed = (shared_log_record_t *)((char *)log.header + cursor);
+    atomic_store(&claimed->length, 32);
+    atomic_store(&log.header->cursor, cursor + 32);
+    CHECK(shared_log_append(&log, 3, "third", 5) == 0);
+
+    size_t filled = 0;
+    while (shared_log_append(&log, 4, "filler", 6) == 0) {
+        filled++;
+    }
+    CHECK(errno == ENOSPC);
+    CHECK(shared_log_used(&log) == log.header->capacity);
+
+    size_t records = 0;
+    size_t pending = 0;
+    uint64_t offset = 0;
+    shared_log_entry_t entry;
+    shared_log_walk_t walk;
+    int32_t order[3] = { 0 };
+    while ((walk = shared_log_next(&log, &offset, &entry)) != SHARED_LOG_WALK_END) {
+        if (walk == SHARED_LOG_WALK_PENDING) {
+            pending++;
+        } else {
+            if (records < 3) {
+                order[records] = entry.pid;
+            }
+            records++;
+        }
+    }
+    CHECK(pending == 2);
+    CHECK(records == 3 + filled);
+    CHECK(order[0] == 1 && order[1] == 2 && order[2] == 3);
+    shared_log_close(&log);
+}
+
+int main(void) {
+    const char *tmpdir = getenv("TMPDIR");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/test_shared_log.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("test_shared_log: mkstemp() failed");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    test_concurrent_writers(path, 4u * 1024u * 1024u, false);
+    test_concurrent_writers(path, 64u * 1024u + 12, true);
+    test_dead_writers(path);
+    unlink(path);
+    if (g_failures > 0) {
+        fprintf(stderr, "test_shared_log: %u of %u checks failed.\n", g_failures, g_checks);
+        return EXIT_FAILURE;
+    }
+    printf("test_shared_log: all %u checks passed.\n", g_checks);
+    return EXIT_SUCCESS;
+}